@@ -0,0 +1,1379 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include "benchmark.h"
+#include "domain.h"
+#include "ensemble.h"
+#include "ephemeris.h"
+#include "kernels.h"
+#include "kepler.h"
+#include "orbits.h"
+#include "prediction.h"
+#include "simthread.h"
+#include "snapshots.h"
+
+// Direct summation is skipped once a single evaluation is expected to take longer than this (seconds)
+const double DIRECT_LIMIT = 20.0;
+
+/*
+ * Wall-clock seconds spent in a callable, best of the given number of repetitions
+ */
+template <typename F>
+static double timeBest(int repetitions, F f) {
+
+	double best = 1.0e300;
+	for (int r = 0; r < repetitions; r++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (elapsed.count() < best)
+			best = elapsed.count();
+	}
+	return best;
+}
+
+/*
+ * Bodies uniformly distributed inside the unit sphere with a total mass of 1 and small random velocities
+ */
+void createCluster(Simulation &simulation, size_t count, unsigned int seed) {
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+	simulation.Bodies.clear();
+	for (size_t i = 0; i < count; i++) {
+		double x, y, z;
+		do {
+			x = uniform(rng);
+			y = uniform(rng);
+			z = uniform(rng);
+		} while (x * x + y * y + z * z > 1.0);
+		simulation.addBody(1.0 / count, x, y, z, 0.1 * uniform(rng), 0.1 * uniform(rng), 0.1 * uniform(rng));
+	}
+}
+
+/*
+ * Orbital speed from the mass of body 0 alone, the pull of the other bodies is a small perturbation
+ */
+void createBelt(Simulation &simulation, size_t count, double inner, double outer, unsigned int seed) {
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	const BodyStore &b = simulation.Bodies;
+	double gm = simulation.G * b.m[0];
+
+	for (size_t i = 0; i < count; i++) {
+		double r = inner + (outer - inner) * uniform(rng);
+		double phase = 2.0 * PI * uniform(rng);
+		double tilt = 0.05 * (uniform(rng) - 0.5);
+		double speed = sqrt(gm / r);
+		double c = cos(phase), s = sin(phase);
+		simulation.addParticle(b.x[0] + r * c, b.y[0] + r * tilt * s, b.z[0] - r * s,
+			b.vx[0] - speed * s, b.vy[0] + speed * tilt * c, b.vz[0] - speed * c);
+	}
+}
+
+/*
+ * Root mean square of the relative acceleration error against the reference
+ */
+static double accelerationError(const BodyArray &rx, const BodyArray &ry, const BodyArray &rz, const BodyStore &bodies) {
+
+	double sum = 0.0;
+	size_t n = bodies.size();
+	for (size_t i = 0; i < n; i++) {
+		double dx = bodies.ax[i] - rx[i], dy = bodies.ay[i] - ry[i], dz = bodies.az[i] - rz[i];
+		double ref = rx[i] * rx[i] + ry[i] * ry[i] + rz[i] * rz[i];
+		if (ref > 0.0)
+			sum += (dx * dx + dy * dy + dz * dz) / ref;
+	}
+	return n > 0 ? sqrt(sum / n) : 0.0;
+}
+
+/*
+ * Largest relative acceleration error against the reference
+ */
+static double maxAccelerationError(const BodyArray &rx, const BodyArray &ry, const BodyArray &rz, const BodyStore &bodies) {
+
+	double worst = 0.0;
+	for (size_t i = 0; i < bodies.size(); i++) {
+		double dx = bodies.ax[i] - rx[i], dy = bodies.ay[i] - ry[i], dz = bodies.az[i] - rz[i];
+		double ref = rx[i] * rx[i] + ry[i] * ry[i] + rz[i] * rz[i];
+		if (ref > 0.0)
+			worst = fmax(worst, sqrt((dx * dx + dy * dy + dz * dz) / ref));
+	}
+	return worst;
+}
+
+void benchmarkSolvers(size_t maxBodies) {
+
+	Simulation simulation(GRAVITY, 1.0e-3);
+	size_t crossover = 0;
+	double directSeconds = 0.0;
+
+	printf("Force evaluation, theta = %g, leaf size = %d\n", simulation.Theta, LEAF_SIZE);
+	printf("%10s %14s %14s %10s %12s\n", "N", "direct [ms]", "tree [ms]", "speedup", "rms error");
+
+	for (size_t n = 256; n <= maxBodies; n *= 2) {
+		createCluster(simulation, n, 1234);
+
+		// Direct summation, skipped when the quadratic cost gets too large
+		bool direct = directSeconds * 4.0 < DIRECT_LIMIT;
+		BodyArray rx, ry, rz;
+		if (direct) {
+			simulation.Solver = DIRECT_SUM;
+			directSeconds = timeBest(3, [&]() { simulation.computeAccelerations(); });
+			rx = simulation.Bodies.ax;
+			ry = simulation.Bodies.ay;
+			rz = simulation.Bodies.az;
+		}
+
+		// Barnes-Hut, including the tree build
+		simulation.Solver = BARNES_HUT;
+		double treeSeconds = timeBest(3, [&]() { simulation.computeAccelerations(); });
+
+		if (direct) {
+			printf("%10zu %14.3f %14.3f %10.2f %12.3e\n", n, directSeconds * 1000.0, treeSeconds * 1000.0,
+				directSeconds / treeSeconds, accelerationError(rx, ry, rz, simulation.Bodies));
+			if (crossover == 0 && treeSeconds < directSeconds)
+				crossover = n;
+		}
+		else
+			printf("%10zu %14s %14.3f %10s %12s\n", n, "-", treeSeconds * 1000.0, "-", "-");
+	}
+
+	if (crossover)
+		printf("Barnes-Hut is faster from N = %zu\n", crossover);
+	else
+		printf("Barnes-Hut was not faster for any N up to %zu\n", maxBodies);
+}
+
+void benchmarkFmm(size_t bodies, double errorBudget) {
+
+	Simulation simulation(GRAVITY, 1.0e-3);
+	ThreadPool pool;
+	simulation.Pool = &pool;
+	createCluster(simulation, bodies, 1234);
+
+	// Reference accelerations
+	simulation.Solver = DIRECT_SUM;
+	double directSeconds = timeBest(1, [&]() { simulation.computeAccelerations(); });
+	BodyArray rx = simulation.Bodies.ax, ry = simulation.Bodies.ay, rz = simulation.Bodies.az;
+
+	printf("Fast multipole, N = %zu, theta = %g, leaf size = %d, %u threads, direct sum %.3f ms\n", bodies, FMM_THETA, FMM_LEAF_SIZE, pool.size(),
+		directSeconds * 1000.0);
+	printf("%6s %8s %12s %12s %12s\n", "order", "terms", "time [ms]", "rms error", "max error");
+
+	simulation.Solver = FAST_MULTIPOLE;
+	int cheapest = 0;
+	double cheapestSeconds = 0.0;
+	for (int order = 1; order <= FMM_MAX_ORDER; order++) {
+		simulation.Order = order;
+		double seconds = timeBest(1, [&]() { simulation.computeAccelerations(); });
+		double rms = accelerationError(rx, ry, rz, simulation.Bodies);
+		double worst = maxAccelerationError(rx, ry, rz, simulation.Bodies);
+		printf("%6d %8d %12.3f %12.3e %12.3e\n", order, (order + 1) * (order + 2) * (order + 3) / 6, seconds * 1000.0, rms, worst);
+		if (rms <= errorBudget && (cheapest == 0 || seconds < cheapestSeconds)) {
+			cheapest = order;
+			cheapestSeconds = seconds;
+		}
+	}
+
+	if (cheapest)
+		printf("Cheapest order within an rms error of %g: %d (%.3f ms)\n", errorBudget, cheapest, cheapestSeconds * 1000.0);
+	else
+		printf("No order reached an rms error of %g\n", errorBudget);
+
+	// Smallest N at which that order beats direct summation on the same threads, searched by doubling
+	simulation.Order = cheapest ? cheapest : FMM_ORDER;
+	size_t crossover = 0;
+	directSeconds = 0.0;
+	printf("Order %d against direct summation\n", simulation.Order);
+	printf("%10s %14s %14s %10s\n", "N", "direct [ms]", "fmm [ms]", "speedup");
+	for (size_t n = 256; crossover == 0 && directSeconds * 4.0 < DIRECT_LIMIT; n *= 2) {
+		createCluster(simulation, n, 1234);
+		simulation.Solver = DIRECT_SUM;
+		directSeconds = timeBest(3, [&]() { simulation.computeAccelerations(); });
+		simulation.Solver = FAST_MULTIPOLE;
+		double fmmSeconds = timeBest(3, [&]() { simulation.computeAccelerations(); });
+		printf("%10zu %14.3f %14.3f %10.2f\n", n, directSeconds * 1000.0, fmmSeconds * 1000.0, directSeconds / fmmSeconds);
+		if (fmmSeconds < directSeconds)
+			crossover = n;
+	}
+
+	if (crossover)
+		printf("Order %d is faster than direct summation from N = %zu\n", simulation.Order, crossover);
+	else
+		printf("Order %d was not faster than direct summation within the time limit\n", simulation.Order);
+}
+
+void benchmarkKernels(size_t maxBodies) {
+
+	Simulation simulation(GRAVITY, 1.0e-3);
+	double eps2 = simulation.Softening * simulation.Softening;
+
+	printf("Pairwise kernel, %s with %d lanes against scalar\n", kernelName(), KERNEL_WIDTH);
+	printf("%10s %16s %16s %10s %12s\n", "N", "scalar [Gp/s]", "vector [Gp/s]", "speedup", "max error");
+
+	for (size_t n = 64; n <= maxBodies; n *= 2) {
+		createCluster(simulation, n, 1234);
+		const BodyStore &b = simulation.Bodies;
+		BodyArray sx(n), sy(n), sz(n), vx(n), vy(n), vz(n);
+		int repetitions = (int)(1 + (1 << 24) / (n * n));
+
+		double scalarSeconds = timeBest(3, [&]() {
+			for (int r = 0; r < repetitions; r++) {
+				sx.assign(n, 0.0); sy.assign(n, 0.0); sz.assign(n, 0.0);
+				pairwiseAccelerationsScalar(&b.x[0], &b.y[0], &b.z[0], n, &b.x[0], &b.y[0], &b.z[0], &b.m[0], n, eps2, &sx[0], &sy[0], &sz[0]);
+			}
+		});
+		double vectorSeconds = timeBest(3, [&]() {
+			for (int r = 0; r < repetitions; r++) {
+				vx.assign(n, 0.0); vy.assign(n, 0.0); vz.assign(n, 0.0);
+				pairwiseAccelerations(&b.x[0], &b.y[0], &b.z[0], n, &b.x[0], &b.y[0], &b.z[0], &b.m[0], n, eps2, &vx[0], &vy[0], &vz[0]);
+			}
+		});
+
+		// Vector accelerations against the scalar ones
+		double worst = 0.0;
+		for (size_t i = 0; i < n; i++) {
+			double dx = vx[i] - sx[i], dy = vy[i] - sy[i], dz = vz[i] - sz[i];
+			double ref = sx[i] * sx[i] + sy[i] * sy[i] + sz[i] * sz[i];
+			if (ref > 0.0)
+				worst = fmax(worst, sqrt((dx * dx + dy * dy + dz * dz) / ref));
+		}
+
+		double pairs = (double)n * n * repetitions;
+		printf("%10zu %16.3f %16.3f %10.2f %12.3e\n", n, pairs / scalarSeconds * 1.0e-9, pairs / vectorSeconds * 1.0e-9, scalarSeconds / vectorSeconds, worst);
+	}
+}
+
+void benchmarkScaling(size_t bodies, unsigned maxThreads) {
+
+	if (maxThreads == 0)
+		maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+
+	Simulation simulation(GRAVITY, 1.0e-3);
+	ThreadPool pool(1);
+	simulation.Pool = &pool;
+	createCluster(simulation, bodies, 1234);
+
+	printf("Strong scaling, N = %zu, tile size = %zu, %s kernel\n", bodies, TILE_SIZE, kernelName());
+	printf("%8s %12s %9s %11s %12s %9s %11s\n", "threads", "direct [ms]", "speedup", "efficiency", "tree [ms]", "speedup", "efficiency");
+
+	double directBase = 0.0, treeBase = 0.0;
+	for (unsigned threads = 1; threads <= maxThreads; threads = threads * 2 > maxThreads && threads < maxThreads ? maxThreads : threads * 2) {
+		pool.resize(threads);
+
+		simulation.Solver = DIRECT_SUM;
+		double direct = timeBest(3, [&]() { simulation.computeAccelerations(); });
+		simulation.Solver = BARNES_HUT;
+		double tree = timeBest(3, [&]() { simulation.computeAccelerations(); });
+		if (threads == 1) {
+			directBase = direct;
+			treeBase = tree;
+		}
+
+		printf("%8u %12.3f %9.2f %10.0f%% %12.3f %9.2f %10.0f%%\n", threads,
+			direct * 1000.0, directBase / direct, 100.0 * directBase / direct / threads,
+			tree * 1000.0, treeBase / tree, 100.0 * treeBase / tree / threads);
+	}
+}
+
+void benchmarkIntegrators(const Simulation &initial, double duration, double errorBudget) {
+
+	const char *names[] = { "leapfrog", "yoshida4", "wisdom-holman" };
+	const Integrator_Type integrators[] = { LEAPFROG, YOSHIDA4, WISDOM_HOLMAN };
+	double energy = initial.totalEnergy();
+
+	printf("Integrators, %zu bodies over a duration of %g\n", initial.Bodies.size(), duration);
+	printf("%14s %10s %10s %12s %12s\n", "integrator", "step", "steps", "time [ms]", "max error");
+
+	for (int k = 0; k < 3; k++) {
+		double best = 0.0, bestSeconds = 0.0;
+		for (double dt = 1.0 / 256.0; dt <= 4.0; dt *= 2.0) {
+			Simulation simulation = initial;
+			simulation.Integrator = integrators[k];
+			unsigned long long steps = (unsigned long long)ceil(duration / dt);
+			unsigned long long sample = steps / 256 + 1;
+
+			// Energy is sampled outside the timed part
+			double worst = 0.0, seconds = 0.0;
+			for (unsigned long long done = 0; done < steps; done += sample) {
+				unsigned long long count = done + sample < steps ? sample : steps - done;
+				seconds += timeBest(1, [&]() {
+					for (unsigned long long i = 0; i < count; i++)
+						simulation.step(dt);
+				});
+				worst = fmax(worst, fabs((simulation.totalEnergy() - energy) / energy));
+			}
+
+			printf("%14s %10g %10llu %12.3f %12.3e\n", names[k], dt, steps, seconds * 1000.0, worst);
+			if (worst <= errorBudget && dt > best) {
+				best = dt;
+				bestSeconds = seconds;
+			}
+		}
+		if (best > 0.0)
+			printf("%14s largest step within %g: %g (%.3f ms)\n", names[k], errorBudget, best, bestSeconds * 1000.0);
+		else
+			printf("%14s no step within %g\n", names[k], errorBudget);
+	}
+}
+
+/*
+ * The shared step that matches the block steps is that of the deepest level in use at the end, which the fastest body needs
+ */
+void benchmarkBlocks(const Simulation &initial, double duration, double step) {
+
+	double energy = initial.totalEnergy();
+	unsigned long long steps = (unsigned long long)ceil(duration / step);
+	unsigned long long sample = steps / 256 + 1;
+
+	Simulation blocked = initial;
+	blocked.Integrator = BLOCK_LEAPFROG;
+	blocked.Blocks.resetStatistics();
+	double worst = 0.0, seconds = 0.0;
+	for (unsigned long long done = 0; done < steps; done += sample) {
+		unsigned long long count = done + sample < steps ? sample : steps - done;
+		seconds += timeBest(1, [&]() {
+			for (unsigned long long i = 0; i < count; i++)
+				blocked.step(step);
+		});
+		worst = fmax(worst, fabs((blocked.totalEnergy() - energy) / energy));
+	}
+
+	const BlockTimesteps &blocks = blocked.Blocks;
+	std::vector<size_t> population = blocks.population();
+	int deepest = 0;
+	printf("Block time steps, %zu bodies over a duration of %g with a base step of %g\n", initial.Bodies.size(), duration, step);
+	printf("%6s %12s %8s %14s\n", "level", "step", "bodies", "body steps");
+	for (int level = 0; level <= blocks.MaxLevel; level++) {
+		// Levels that the bodies only passed on their way up from the deepest level
+		if (population[level] == 0 && blocks.LevelSteps[level] <= 2 * initial.Bodies.size())
+			continue;
+		if (population[level] > 0)
+			deepest = level;
+		printf("%6d %12g %8zu %14llu\n", level, step / (double)(1ULL << level), population[level], blocks.LevelSteps[level]);
+	}
+
+	double shared = step / (double)(1ULL << deepest);
+	unsigned long long sharedSteps = (unsigned long long)ceil(duration / shared);
+	Simulation single = initial;
+	single.Integrator = LEAPFROG;
+	double sharedWorst = 0.0, sharedSeconds = 0.0;
+	sample = sharedSteps / 256 + 1;
+	for (unsigned long long done = 0; done < sharedSteps; done += sample) {
+		unsigned long long count = done + sample < sharedSteps ? sample : sharedSteps - done;
+		sharedSeconds += timeBest(1, [&]() {
+			for (unsigned long long i = 0; i < count; i++)
+				single.step(shared);
+		});
+		sharedWorst = fmax(sharedWorst, fabs((single.totalEnergy() - energy) / energy));
+	}
+
+	printf("%14s %12s %14s %12s %12s\n", "integrator", "substeps", "evaluations", "time [ms]", "max error");
+	printf("%14s %12llu %14llu %12.3f %12.3e\n", "block", blocks.Substeps, blocks.ForceEvaluations, seconds * 1000.0, worst);
+	printf("%14s %12llu %14llu %12.3f %12.3e\n", "shared", sharedSteps, sharedSteps * (unsigned long long)initial.Bodies.size(),
+		sharedSeconds * 1000.0, sharedWorst);
+}
+
+void benchmarkParticles(const Simulation &initial, size_t maxParticles, int steps) {
+
+	size_t bodies = initial.Bodies.size();
+	printf("Test particles around %zu bodies, %d steps, %u threads\n", bodies, steps, initial.Pool ? initial.Pool->size() : 1);
+	printf("%10s %12s %16s %14s %14s\n", "particles", "time [ms]", "particle steps/s", "pairs/step", "full pairs");
+
+	for (size_t count = 1024; count <= maxParticles; count *= 2) {
+		Simulation simulation = initial;
+		createBelt(simulation, count, 22.0, 28.0, 1234);
+		simulation.prepareAccelerations();
+
+		double seconds = timeBest(1, [&]() {
+			for (int i = 0; i < steps; i++)
+				simulation.step(simulation.MaxStep);
+		});
+
+		double total = (double)(count + bodies);
+		printf("%10zu %12.3f %16.3e %14.3e %14.3e\n", count, seconds * 1000.0, count * (double)steps / seconds,
+			(double)count * bodies + (double)bodies * bodies, total * total);
+	}
+}
+
+/*
+ * One orbit in ten is hyperbolic, the others have eccentricities up to 0.95
+ */
+void benchmarkKepler(size_t orbits, unsigned threads) {
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	OrbitCatalog catalog;
+	for (size_t i = 0; i < orbits; i++) {
+		double e = i % 10 == 9 ? 1.1 + 2.0 * uniform(rng) : 0.95 * uniform(rng);
+		catalog.addElements(40.0, 5.0 + 50.0 * uniform(rng), e, PI * uniform(rng), 2.0 * PI * uniform(rng),
+			2.0 * PI * uniform(rng), 1000.0 * (uniform(rng) - 0.5));
+	}
+
+	ThreadPool pool(threads);
+	std::vector<double> x(orbits), y(orbits), z(orbits);
+	const double times[] = { 0.0, 12.5, -3.0e3, 1.0e5 };
+
+	printf("Kepler propagation of %zu orbits, %s, %u threads\n", orbits, kernelName(), pool.size());
+	printf("%12s %12s %16s %14s\n", "time", "time [ms]", "positions/ms", "max error");
+	for (int k = 0; k < 4; k++) {
+		double t = times[k];
+		double seconds = timeBest(3, [&]() { catalog.positionsAt(t, &x[0], &y[0], &z[0], &pool); });
+
+		// Relative position difference from the scalar solver on a sample of the orbits
+		double worst = 0.0;
+		for (size_t i = 0; i < orbits; i += orbits / 1000 + 1) {
+			double sx, sy, sz, svx, svy, svz;
+			catalog.stateAt(i, t, sx, sy, sz, svx, svy, svz);
+			double d = sqrt((x[i] - sx) * (x[i] - sx) + (y[i] - sy) * (y[i] - sy) + (z[i] - sz) * (z[i] - sz));
+			worst = fmax(worst, d / sqrt(sx * sx + sy * sy + sz * sz));
+		}
+		printf("%12g %12.3f %16.3e %14.3e\n", t, seconds * 1000.0, orbits / (seconds * 1000.0), worst);
+	}
+}
+
+/*
+ * The radius is a fifth of the mean spacing of the disk, so about a quarter of the bodies touch another one
+ */
+void benchmarkCollisions(size_t maxBodies) {
+
+	ThreadPool pool;
+	printf("Collision search on debris disks, %u threads\n", pool.size());
+	printf("%10s %10s %16s %16s %12s %14s\n", "bodies", "contacts", "hash [ns/body]", "sweep [ns/body]", "agree", "merge [ms]");
+
+	for (size_t n = 1024; n <= maxBodies; n *= 2) {
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		double volume = PI * (30.0 * 30.0 - 20.0 * 20.0) * 0.5;
+		double radius = 0.2 * cbrt(volume / n);
+		BodyStore disk;
+		for (size_t i = 0; i < n; i++) {
+			double r = sqrt(20.0 * 20.0 + (30.0 * 30.0 - 20.0 * 20.0) * uniform(rng));
+			double phase = 2.0 * PI * uniform(rng);
+			disk.add(1.0e-9, r * cos(phase), 0.5 * (uniform(rng) - 0.5), -r * sin(phase), 0.0, 0.0, 0.0, radius);
+		}
+
+		CollisionDetector detector;
+		std::vector<Contact> hashed, swept;
+		double hashSeconds = timeBest(3, [&]() { detector.findContacts(disk, SPATIAL_HASH, hashed, &pool); });
+		double sweepSeconds = timeBest(3, [&]() { detector.findContacts(disk, SWEEP_AND_PRUNE, swept, &pool); });
+		bool agree = hashed.size() == swept.size();
+		for (size_t k = 0; agree && k < hashed.size(); k++)
+			agree = hashed[k].a == swept[k].a && hashed[k].b == swept[k].b;
+
+		std::vector<size_t> kept;
+		double mergeSeconds = timeBest(1, [&]() { mergeContacts(disk, hashed, kept); });
+
+		printf("%10zu %10zu %16.1f %16.1f %12s %14.3f\n", n, hashed.size(), hashSeconds * 1.0e9 / n, sweepSeconds * 1.0e9 / n,
+			agree ? "yes" : "NO", mergeSeconds * 1000.0);
+	}
+}
+
+/*
+ * The exact kernel is also compared with the scalar kernel on the same tile, which is what makes the hashes agree across
+ * machines with different vector instructions
+ */
+void benchmarkDeterminism(size_t bodies, int steps, unsigned maxThreads) {
+
+	if (maxThreads == 0)
+		maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+
+	Simulation initial(GRAVITY, 1.0e-3);
+	createCluster(initial, bodies, 1234);
+	ThreadPool pool(1);
+
+	size_t tile = bodies < TILE_SIZE ? bodies : TILE_SIZE;
+	const BodyStore &b = initial.Bodies;
+	std::vector<double> exact(3 * tile, 0.0), scalar(3 * tile, 0.0);
+	pairwiseAccelerationsExact(&b.x[0], &b.y[0], &b.z[0], tile, &b.x[0], &b.y[0], &b.z[0], &b.m[0], tile, 1.0e-6,
+		&exact[0], &exact[tile], &exact[2 * tile]);
+	pairwiseAccelerationsScalar(&b.x[0], &b.y[0], &b.z[0], tile, &b.x[0], &b.y[0], &b.z[0], &b.m[0], tile, 1.0e-6,
+		&scalar[0], &scalar[tile], &scalar[2 * tile]);
+	bool identical = memcmp(&exact[0], &scalar[0], exact.size() * sizeof(double)) == 0;
+
+	printf("Deterministic mode, N = %zu, %d leapfrog steps, %s kernel\n", bodies, steps, kernelName());
+	printf("Exact kernel identical to the scalar kernel: %s\n", identical ? "yes" : "NO");
+	printf("%8s %12s %18s %12s %18s %9s\n", "threads", "fast [ms]", "fast hash", "exact [ms]", "exact hash", "penalty");
+
+	unsigned long long reference = 0;
+	bool reproducible = true;
+	for (unsigned threads = 1; threads <= maxThreads; threads = threads * 2 > maxThreads && threads < maxThreads ? maxThreads : threads * 2) {
+		pool.resize(threads);
+
+		double seconds[2];
+		unsigned long long hashes[2];
+		for (int mode = 0; mode < 2; mode++) {
+			Simulation simulation = initial;
+			simulation.Pool = &pool;
+			simulation.Deterministic = mode == 1;
+			simulation.prepareAccelerations();
+			seconds[mode] = timeBest(1, [&]() {
+				for (int i = 0; i < steps; i++)
+					simulation.step(simulation.MaxStep);
+			});
+			hashes[mode] = mode == 1 ? simulation.StateHash : simulation.stateHash();
+		}
+
+		if (threads == 1)
+			reference = hashes[1];
+		reproducible = reproducible && hashes[1] == reference;
+		printf("%8u %12.3f %18llx %12.3f %18llx %8.2fx\n", threads, seconds[0] * 1000.0 / steps, hashes[0],
+			seconds[1] * 1000.0 / steps, hashes[1], seconds[1] / seconds[0]);
+	}
+	printf("Deterministic hashes agree across thread counts: %s\n", reproducible ? "yes" : "NO");
+}
+
+/*
+ * Each mode prints one series of (wall time, energy error) pairs, so the drift of the modes can be plotted against
+ * their cost. Energy is sampled outside the timed part. The largest error also contains the bounded oscillation of the
+ * integrator, the final error is mostly the accumulated round-off
+ */
+void benchmarkSummation(const Simulation &initial, double duration, double step, double errorBudget) {
+
+	const char *names[] = { "plain", "state", "all" };
+	const Summation_Mode modes[] = { PLAIN_SUMMATION, COMPENSATED_STATE, COMPENSATED_ALL };
+	const int samples = 32;
+	double energy = initial.totalEnergy();
+	unsigned long long steps = (unsigned long long)ceil(duration / step);
+
+	printf("Summation modes, %zu bodies, %llu Yoshida4 steps of %g\n", initial.Bodies.size(), steps, step);
+	printf("%8s %14s %12s %14s\n", "mode", "sim time", "wall [s]", "energy error");
+
+	double seconds[3], worst[3], drift[3];
+	for (int k = 0; k < 3; k++) {
+		Simulation simulation = initial;
+		simulation.Integrator = YOSHIDA4;
+		simulation.Summation = modes[k];
+		seconds[k] = 0.0;
+		worst[k] = 0.0;
+		for (int s = 0; s < samples; s++) {
+			unsigned long long count = steps * (s + 1) / samples - steps * s / samples;
+			seconds[k] += timeBest(1, [&]() {
+				for (unsigned long long i = 0; i < count; i++)
+					simulation.step(step);
+			});
+			double error = fabs((simulation.totalEnergy() - energy) / energy);
+			worst[k] = fmax(worst[k], error);
+			drift[k] = error;
+			printf("%8s %14g %12.3f %14.3e\n", names[k], simulation.Time, seconds[k], error);
+		}
+	}
+
+	printf("%8s %12s %9s %14s %14s\n", "mode", "wall [s]", "cost", "max error", "final error");
+	int cheapest = -1;
+	for (int k = 0; k < 3; k++) {
+		printf("%8s %12.3f %8.2fx %14.3e %14.3e\n", names[k], seconds[k], seconds[k] / seconds[0], worst[k], drift[k]);
+		if (drift[k] <= errorBudget && (cheapest < 0 || seconds[k] < seconds[cheapest]))
+			cheapest = k;
+	}
+	if (cheapest >= 0)
+		printf("Cheapest mode within %g: %s\n", errorBudget, names[cheapest]);
+	else
+		printf("No mode within %g\n", errorBudget);
+}
+
+/*
+ * The comet passes the planet at the pericenter with one unit of speed to spare at infinity. Its start is found by
+ * running the encounter backwards from the pericenter with fine regularized steps. Softening is off, so the encounter is
+ * as close as asked for
+ */
+void benchmarkRegularization(const Simulation &initial, double pericenter, double duration) {
+
+	size_t planet = initial.Bodies.size() > 3 ? 3 : initial.Bodies.size() - 1;
+	const BodyStore &b = initial.Bodies;
+	double mu = initial.G * b.m[planet];
+	double speed = sqrt(2.0 * mu / pericenter + 1.0);
+	double radius = 0.01;
+
+	Simulation start = initial;
+	start.Softening = 0.0;
+	start.addBody(1.0e-12, b.x[planet] + pericenter, b.y[planet], b.z[planet], b.vx[planet], b.vy[planet] + speed, b.vz[planet]);
+	start.RegularizationRadius = radius;
+	start.Integrator = YOSHIDA4;
+	double fine = initial.MaxStep / 16.0;
+	unsigned long long backward = (unsigned long long)ceil(0.5 * duration / fine);
+	for (unsigned long long i = 0; i < backward; i++)
+		start.step(-0.5 * duration / backward);
+	start.Time = 0.0;
+	start.Steps = 0;
+	start.RegularizedSteps = 0;
+	start.invalidateAccelerations();
+
+	Simulation reference = start;
+	reference.MaxStep = fine;
+	reference.advance(duration);
+	size_t comet = start.Bodies.size() - 1;
+	double energy = start.totalEnergy();
+
+	const char *names[] = { "leapfrog", "block", "leapfrog+ks", "yoshida4+ks" };
+	const Integrator_Type integrators[] = { LEAPFROG, BLOCK_LEAPFROG, LEAPFROG, YOSHIDA4 };
+	const double radii[] = { 0.0, 0.0, radius, radius };
+
+	printf("Comet passing body %zu at %g, duration %g, step %g\n", planet, pericenter, duration, initial.MaxStep);
+	printf("%14s %12s %12s %12s %14s %14s\n", "integrator", "time [ms]", "substeps", "ks steps", "energy error", "comet error");
+	for (int k = 0; k < 4; k++) {
+		Simulation simulation = start;
+		simulation.Integrator = integrators[k];
+		simulation.RegularizationRadius = radii[k];
+		simulation.Blocks.resetStatistics();
+		double seconds = timeBest(1, [&]() { simulation.advance(duration); });
+
+		const BodyStore &s = simulation.Bodies, &r = reference.Bodies;
+		double dx = s.x[comet] - r.x[comet], dy = s.y[comet] - r.y[comet], dz = s.z[comet] - r.z[comet];
+		unsigned long long substeps = integrators[k] == BLOCK_LEAPFROG ? simulation.Blocks.Substeps : simulation.Steps;
+		printf("%14s %12.3f %12llu %12llu %14.3e %14.3e\n", names[k], seconds * 1000.0, substeps, simulation.RegularizedSteps,
+			fabs((simulation.totalEnergy() - energy) / energy), sqrt(dx * dx + dy * dy + dz * dz));
+	}
+}
+
+/*
+ * The comet starts at aphelion around body 0 and carries little enough mass to leave the planets alone. Its position is
+ * compared with a Gauss-Radau reference run at a tenth of the tolerance, which is as tight as the round-off in the
+ * error estimate allows. Most of the error is made at the pericenter passages, where a fixed step is least accurate
+ */
+void benchmarkGaussRadau(const Simulation &initial, double eccentricity, int orbits) {
+
+	const BodyStore &b = initial.Bodies;
+	double mu = initial.G * b.m[0];
+	double axis = 25.0;
+	double aphelion = axis * (1.0 + eccentricity);
+	double speed = sqrt(mu * (1.0 - eccentricity) / aphelion);
+	double period = 2.0 * PI * sqrt(axis * axis * axis / mu);
+	double duration = orbits * period;
+
+	Simulation start = initial;
+	start.addBody(1.0e-9, b.x[0] - aphelion, b.y[0], b.z[0], b.vx[0], b.vy[0], b.vz[0] + speed);
+	size_t comet = start.Bodies.size() - 1;
+	double energy = start.totalEnergy();
+
+	Simulation reference = start;
+	reference.Integrator = GAUSS_RADAU;
+	reference.Radau.Epsilon = RADAU_EPSILON / 10.0;
+	reference.step(duration);
+
+	printf("Comet with eccentricity %g around body 0, %d orbits of %g\n", eccentricity, orbits, period);
+	printf("%14s %12s %12s %10s %14s %10s %12s %14s %14s\n", "integrator", "step", "steps", "rejected", "evaluations",
+		"per step", "time [ms]", "energy error", "comet error");
+
+	Simulation radau = start;
+	radau.Integrator = GAUSS_RADAU;
+	radau.Radau.resetStatistics();
+	double seconds = timeBest(1, [&]() { radau.step(duration); });
+	const GaussRadauState &state = radau.Radau;
+	const BodyStore &r = reference.Bodies;
+	double dx = radau.Bodies.x[comet] - r.x[comet], dy = radau.Bodies.y[comet] - r.y[comet], dz = radau.Bodies.z[comet] - r.z[comet];
+	double radauError = sqrt(dx * dx + dy * dy + dz * dz);
+	printf("%14s %12g %12llu %10llu %14llu %10.1f %12.3f %14.3e %14.3e\n", "gauss-radau", duration / state.Accepted,
+		state.Accepted, state.Rejected, state.ForceEvaluations, (double)state.ForceEvaluations / state.Accepted,
+		seconds * 1000.0, fabs((radau.totalEnergy() - energy) / energy), radauError);
+
+	// Leapfrog steps halve until the comet is as accurate as with Gauss-Radau, or the cost is a thousand times higher
+	unsigned long long matched = 0;
+	for (unsigned long long steps = 256ULL * orbits; steps <= 1000ULL * state.ForceEvaluations; steps *= 2) {
+		Simulation leapfrog = start;
+		leapfrog.Integrator = LEAPFROG;
+		double dt = duration / steps;
+		seconds = timeBest(1, [&]() {
+			for (unsigned long long i = 0; i < steps; i++)
+				leapfrog.step(dt);
+		});
+		const BodyStore &l = leapfrog.Bodies;
+		dx = l.x[comet] - r.x[comet]; dy = l.y[comet] - r.y[comet]; dz = l.z[comet] - r.z[comet];
+		double error = sqrt(dx * dx + dy * dy + dz * dz);
+		printf("%14s %12g %12llu %10d %14llu %10.1f %12.3f %14.3e %14.3e\n", "leapfrog", dt, steps, 0, steps, 1.0,
+			seconds * 1000.0, fabs((leapfrog.totalEnergy() - energy) / energy), error);
+		if (error <= radauError) {
+			matched = steps;
+			break;
+		}
+	}
+	if (matched > 0)
+		printf("leapfrog matches the comet error with %.1f times the force evaluations\n", (double)matched / state.ForceEvaluations);
+	else
+		printf("leapfrog does not match the comet error of %.3e within a thousand times the force evaluations\n", radauError);
+}
+
+/*
+ * The moons of body 5 and 6 (Jupiter and Saturn) start on circular orbits. The first four are placed and weighed like
+ * the Galilean moons, the others are light and spread from 0.12 to 0.48, inside the Hill sphere. The flat run steps
+ * everything at the substep the subsystems use, MOON_ORBIT_STEPS per orbit of the fastest moon, the fine run at an
+ * eighth of that, and the reference at a thirtieth. The moon error is the largest difference of a moon's position
+ * relative to its planet from the reference
+ */
+void benchmarkMoons(const Simulation &initial, size_t moons, double duration, double step) {
+
+	const size_t planets[] = { 5, 6 };
+	const double heavy[] = { 1.8e-6, 1.0e-6, 3.0e-6, 2.2e-6 };
+	const double inner[] = { 0.02, 0.032, 0.051, 0.09 };
+	std::vector<double> distances(moons), masses(moons);
+	for (size_t i = 0; i < moons; i++) {
+		distances[i] = i < 4 ? inner[i] : 0.12 * pow(4.0, (i - 4.0) / (moons > 5 ? moons - 5.0 : 1.0));
+		masses[i] = i < 4 ? heavy[i] : 1.0e-9;
+	}
+	const BodyStore &b = initial.Bodies;
+	size_t systems = b.size() > 6 ? 2 : 0;
+
+	// Unsoftened, like the Kepler drift of the Wisdom-Holman map inside the subsystems
+	Simulation base = initial;
+	base.Softening = 0.0;
+
+	// Moons as ordinary bodies, in the order of the planets
+	Simulation flat = base;
+	double shortest = HUGE_VAL;
+	for (size_t s = 0; s < systems; s++)
+		for (size_t i = 0; i < moons; i++) {
+			flat.addOrbitingBody(planets[s], masses[i], distances[i]);
+			shortest = fmin(shortest, 2.0 * PI * sqrt(distances[i] * distances[i] * distances[i] / (initial.G * (b.m[planets[s]] + masses[i]))));
+		}
+	flat.Integrator = LEAPFROG;
+	flat.MaxStep = shortest / MOON_ORBIT_STEPS;
+
+	Simulation fine = flat;
+	fine.MaxStep = flat.MaxStep / 8.0;
+
+	Simulation reference = flat;
+	reference.MaxStep = flat.MaxStep / 30.0;
+	reference.advance(duration);
+
+	Simulation hierarchy = base;
+	for (size_t s = 0; s < systems; s++) {
+		size_t subsystem = hierarchy.addSubsystem(planets[s]);
+		for (size_t i = 0; i < moons; i++)
+			hierarchy.addMoon(subsystem, masses[i], distances[i]);
+	}
+	hierarchy.Integrator = LEAPFROG;
+	hierarchy.MaxStep = step;
+	Simulation hierarchyLeapfrog = hierarchy;
+	for (size_t s = 0; s < hierarchyLeapfrog.Subsystems.size(); s++)
+		hierarchyLeapfrog.Subsystems[s].Members.Integrator = LEAPFROG;
+
+	Simulation alone = base;
+	alone.Integrator = LEAPFROG;
+	alone.MaxStep = step;
+
+	const char *names[] = { "planets", "flat", "flat fine", "subsystems", "subsystems lf" };
+	Simulation *runs[] = { &alone, &flat, &fine, &hierarchy, &hierarchyLeapfrog };
+	printf("%zu moons around each of %zu planets over a duration of %g, shortest moon orbit %g\n", moons, systems, duration, shortest);
+	printf("%14s %8s %12s %12s %10s %14s %14s\n", "frames", "bodies", "step", "time [ms]", "vs planets", "energy error", "moon error");
+
+	double planetsSeconds = 0.0;
+	for (int k = 0; k < 5; k++) {
+		Simulation &simulation = *runs[k];
+		double energy = simulation.totalEnergy();
+		double seconds = timeBest(1, [&]() { simulation.advance(duration); });
+		if (k == 0)
+			planetsSeconds = seconds;
+
+		// Moon positions relative to their planet
+		double worst = 0.0;
+		for (size_t s = 0; k > 0 && s < systems; s++)
+			for (size_t i = 0; i < moons; i++) {
+				const BodyStore &r = reference.Bodies;
+				size_t moon = b.size() + s * moons + i;
+				double rx = r.x[moon] - r.x[planets[s]], ry = r.y[moon] - r.y[planets[s]], rz = r.z[moon] - r.z[planets[s]];
+				double mx, my, mz;
+				if (k <= 2) {
+					const BodyStore &f = simulation.Bodies;
+					mx = f.x[moon] - f.x[planets[s]]; my = f.y[moon] - f.y[planets[s]]; mz = f.z[moon] - f.z[planets[s]];
+				}
+				else {
+					const BodyStore &m = simulation.Subsystems[s].Members.Bodies;
+					mx = m.x[i + 1] - m.x[0]; my = m.y[i + 1] - m.y[0]; mz = m.z[i + 1] - m.z[0];
+				}
+				worst = fmax(worst, sqrt((mx - rx) * (mx - rx) + (my - ry) * (my - ry) + (mz - rz) * (mz - rz)));
+			}
+
+		printf("%14s %8zu %12g %12.3f %10.2f %14.3e %14.3e\n", names[k], k == 0 ? b.size() : b.size() + systems * moons,
+			simulation.MaxStep, seconds * 1000.0, seconds / planetsSeconds, fabs((simulation.totalEnergy() - energy) / energy), worst);
+	}
+}
+
+/*
+ * The separate simulations stand in for one process per member: each one is a full simulation stepped on its own, with
+ * the copies spread over the same threads. Only a sample of them is run, the rate is per member step either way
+ */
+void benchmarkEnsemble(const Simulation &initial, size_t members, int steps, double dt) {
+
+	if (members == 0 || steps <= 0)
+		return;
+
+	ThreadPool pool;
+	Ensemble ensemble(initial, members, 1.0e-6, 1234);
+	ensemble.Pool = &pool;
+	std::vector<double> start(members);
+	for (size_t e = 0; e < members; e++)
+		start[e] = ensemble.energy(e);
+
+	size_t sample = std::min(members, (size_t)256);
+	std::vector<Simulation> separate(sample, initial);
+	for (size_t e = 0; e < sample; e++) {
+		separate[e].Integrator = LEAPFROG;
+		separate[e].MaxStep = dt;
+	}
+
+	double batchedSeconds = timeBest(1, [&]() { ensemble.advance(steps, dt); });
+	double separateSeconds = timeBest(1, [&]() {
+		pool.run(sample, [&](size_t e) {
+			for (int s = 0; s < steps; s++)
+				separate[e].step(dt);
+		});
+	});
+
+	// The unperturbed member against a plain run, which sums the forces in another order
+	const BodyStore &b = separate[0].Bodies;
+	double distance = 0.0;
+	for (size_t i = 0; i < ensemble.Bodies; i++) {
+		size_t k = i * ensemble.Stride;
+		double dx = ensemble.x[k] - b.x[i], dy = ensemble.y[k] - b.y[i], dz = ensemble.z[k] - b.z[i];
+		distance = fmax(distance, sqrt(dx * dx + dy * dy + dz * dz));
+	}
+
+	std::vector<double> errors(members);
+	for (size_t e = 0; e < members; e++)
+		errors[e] = fabs((ensemble.energy(e) - start[e]) / start[e]);
+	std::sort(errors.begin(), errors.end());
+
+	double batchedRate = members * (double)steps / batchedSeconds;
+	double separateRate = sample * (double)steps / separateSeconds;
+	printf("Ensemble of %zu members of %zu bodies, %d leapfrog steps of %g, %u threads\n", members, ensemble.Bodies, steps, dt,
+		pool.size());
+	printf("%12s %12s %18s\n", "mode", "time [ms]", "member steps/s");
+	printf("%12s %12.3f %18.4g\n", "batched", batchedSeconds * 1000.0, batchedRate);
+	printf("%12s %12.3f %18.4g\n", "separate", separateSeconds * 1000.0 * members / sample, separateRate);
+	printf("Speedup %.2f, unperturbed member %.3e from the plain run\n", batchedRate / separateRate, distance);
+	printf("Energy error over the members: min %.3e, median %.3e, max %.3e\n", errors[0], errors[members / 2], errors[members - 1]);
+}
+
+/*
+ * The single process runs on one thread, so the speedup is that of the processes alone. The positions differ from it by
+ * round-off only, in the summation order of the domains. The spline rows repeat both solvers with spline softening and
+ * the screened law
+ */
+void benchmarkDomains(size_t bodies, unsigned maxRanks, int steps) {
+
+	if (maxRanks == 0)
+		maxRanks = std::thread::hardware_concurrency();
+	maxRanks = std::max(1u, std::min(maxRanks, DOMAIN_MAX_RANKS));
+
+	Simulation initial(GRAVITY, 1.0e-2, 1.0e-3);
+	createCluster(initial, bodies, 1234);
+	const char *names[] = { "direct", "tree", "direct/s", "tree/s" };
+	const Force_Solver solvers[] = { DIRECT_SUM, BARNES_HUT, DIRECT_SUM, BARNES_HUT };
+
+	printf("Domain decomposition of %zu bodies over %d leapfrog steps\n", bodies, steps);
+	printf("%8s %8s %14s %10s %16s\n", "solver", "ranks", "step [ms]", "speedup", "max difference");
+	for (int k = 0; k < 4; k++) {
+		Simulation single = initial;
+		single.Solver = solvers[k];
+		if (k >= 2) {
+			single.SofteningModel = SPLINE_SOFTENING;
+			single.ForceLaw = SCREENED_LAW;
+			single.ScreeningLength = 0.5;
+		}
+		double singleSeconds = timeBest(1, [&]() {
+			for (int i = 0; i < steps; i++)
+				single.step(single.MaxStep);
+		});
+		printf("%8s %8s %14.3f %10s %16s\n", names[k], "single", singleSeconds * 1000.0 / steps, "1.00", "-");
+
+		for (unsigned ranks = 1; ranks <= maxRanks; ranks *= 2) {
+			Simulation split = initial;
+			split.Solver = solvers[k];
+			split.SofteningModel = single.SofteningModel;
+			split.ForceLaw = single.ForceLaw;
+			split.ScreeningLength = single.ScreeningLength;
+			bool success = true;
+			double seconds = timeBest(1, [&]() { success = launchRanks(split, ranks, steps, split.MaxStep); });
+			if (!success) {
+				printf("%8s %8u %14s\n", names[k], ranks, "failed");
+				break;
+			}
+
+			double difference = 0.0;
+			const BodyStore &a = single.Bodies, &b = split.Bodies;
+			for (size_t i = 0; i < bodies; i++)
+				difference = fmax(difference, fabs(a.x[i] - b.x[i]) + fabs(a.y[i] - b.y[i]) + fabs(a.z[i] - b.z[i]));
+			printf("%8s %8u %14.3f %10.2f %16.3e\n", names[k], ranks, seconds * 1000.0 / steps, singleSeconds / seconds, difference);
+		}
+	}
+}
+
+/*
+ * A restore lands on the last snapshot before the time, and is checked against the recorded positions there. The
+ * interpolation is checked halfway between snapshots against a restore followed by a half step. The rewind row restores,
+ * records a longer step and restores that time again, which must give the live state
+ */
+void benchmarkSnapshots(const Simulation &initial, double duration, int seeks) {
+
+	Simulation plain = initial;
+	unsigned long long steps = (unsigned long long)ceil(duration / plain.MaxStep);
+	double dt = duration / steps;
+	double stepSeconds = timeBest(1, [&]() {
+		for (unsigned long long i = 0; i < steps; i++)
+			plain.step(dt);
+	});
+
+	Simulation simulation = initial;
+	SnapshotRing ring(SNAPSHOT_KEYFRAME, (size_t)-1);
+	double recordSeconds = timeBest(1, [&]() {
+		ring.record(simulation, 0.0);
+		for (unsigned long long i = 0; i < steps; i++) {
+			simulation.step(dt);
+			ring.record(simulation, dt);
+		}
+	});
+
+	size_t n = initial.Bodies.size() + initial.Particles.size();
+	double raw = 6.0 * sizeof(double) * n;
+	printf("Snapshots of %zu bodies over %llu steps, keyframe every %d\n", n, steps, SNAPSHOT_KEYFRAME);
+	printf("Memory %.2f MB, %.1f bytes per snapshot against %.0f raw\n", ring.bytes() / 1048576.0, (double)ring.bytes() / ring.size(), raw);
+	printf("Step %.3f us, recording adds %.3f us\n", stepSeconds * 1.0e6 / steps, (recordSeconds - stepSeconds) * 1.0e6 / steps);
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<double> uniform(ring.earliest(), ring.latest() - dt);
+	std::vector<double> times(seeks);
+	for (int k = 0; k < seeks; k++)
+		times[k] = uniform(rng);
+
+	Simulation restored = initial;
+	std::vector<double> x, y, z;
+	double restoreError = 0.0, interpolateError = 0.0, replayed = 0.0;
+	double restoreSeconds = 0.0, interpolateSeconds = 0.0;
+	for (int k = 0; k < seeks; k++) {
+		restoreSeconds += timeBest(1, [&]() { ring.restore(times[k], restored); });
+		replayed += restored.Time / dt;
+		ring.interpolate(restored.Time, x, y, z);
+		for (size_t i = 0; i < x.size(); i++)
+			restoreError = fmax(restoreError, fabs(x[i] - restored.Bodies.x[i]) + fabs(y[i] - restored.Bodies.y[i]) + fabs(z[i] - restored.Bodies.z[i]));
+
+		double half = restored.Time + 0.5 * dt;
+		interpolateSeconds += timeBest(1, [&]() { ring.interpolate(half, x, y, z); });
+		restored.step(0.5 * dt);
+		for (size_t i = 0; i < x.size(); i++)
+			interpolateError = fmax(interpolateError, fabs(x[i] - restored.Bodies.x[i]) + fabs(y[i] - restored.Bodies.y[i]) + fabs(z[i] - restored.Bodies.z[i]));
+	}
+
+	// Rewind, go on with a step three times the recorded one and restore again, against the state of the live run
+	Simulation live = initial;
+	ring.restore(0.5 * (ring.earliest() + ring.latest()), live);
+	ring.discardAfter(live.Time);
+	live.step(3.0 * dt);
+	ring.record(live, 3.0 * dt);
+	ring.restore(live.Time, restored);
+	double rewindError = fabs(restored.Time - live.Time);
+	for (size_t i = 0; i < live.Bodies.size(); i++)
+		rewindError = fmax(rewindError, fabs(live.Bodies.x[i] - restored.Bodies.x[i]) + fabs(live.Bodies.y[i] - restored.Bodies.y[i]) +
+			fabs(live.Bodies.z[i] - restored.Bodies.z[i]));
+
+	printf("%14s %14s %18s %16s\n", "seek", "time [us]", "replay from 0 [us]", "max difference");
+	printf("%14s %14.3f %18.3f %16.3e\n", "restore", restoreSeconds * 1.0e6 / seeks, replayed * stepSeconds * 1.0e6 / steps / seeks, restoreError);
+	printf("%14s %14.3f %18s %16.3e\n", "interpolate", interpolateSeconds * 1.0e6 / seeks, "-", interpolateError);
+	printf("%14s %14s %18s %16.3e\n", "rewind", "-", "-", rewindError);
+}
+
+/*
+ * One row of benchmarkInteractions. The targets run in tiles of TILE_SIZE, like in the direct sum, and the result is
+ * returned in double precision for the comparison
+ */
+template <typename Real, typename Softening, typename Law>
+static double timeInteractions(const BodyStore &b, double softening, double range, std::vector<double> &result) {
+
+	size_t n = b.size();
+	std::vector<Real> x(b.x.begin(), b.x.end()), y(b.y.begin(), b.y.end()), z(b.z.begin(), b.z.end()), m(b.m.begin(), b.m.end());
+	std::vector<Real> ax(n), ay(n), az(n);
+	ForceParameters<Real> p(softening, range);
+
+	double seconds = timeBest(3, [&]() {
+		std::fill(ax.begin(), ax.end(), Real(0));
+		std::fill(ay.begin(), ay.end(), Real(0));
+		std::fill(az.begin(), az.end(), Real(0));
+		for (size_t begin = 0; begin < n; begin += TILE_SIZE)
+			pairInteractions<Real, Softening, Law>(&x[begin], &y[begin], &z[begin], std::min(TILE_SIZE, n - begin),
+				&x[0], &y[0], &z[0], &m[0], n, p, &ax[begin], &ay[begin], &az[begin]);
+	});
+
+	result.resize(3 * n);
+	for (size_t i = 0; i < n; i++) {
+		result[i] = ax[i];
+		result[n + i] = ay[i];
+		result[2 * n + i] = az[i];
+	}
+	return seconds;
+}
+
+/*
+ * Largest deviation of a float result from the double one, relative to the largest acceleration
+ */
+static double largestDeviation(const std::vector<double> &a, const std::vector<double> &reference) {
+
+	double scale = 0.0, deviation = 0.0;
+	for (size_t i = 0; i < a.size(); i++) {
+		scale = fmax(scale, fabs(reference[i]));
+		deviation = fmax(deviation, fabs(a[i] - reference[i]));
+	}
+	return scale > 0.0 ? deviation / scale : 0.0;
+}
+
+/*
+ * The screening length is the radius of the cluster, so the screened law differs clearly from Newton's
+ */
+void benchmarkInteractions(size_t bodies) {
+
+	Simulation cluster(GRAVITY, 1.0e-2);
+	createCluster(cluster, bodies, 1234);
+	const BodyStore &b = cluster.Bodies;
+	double softening = 0.05, range = 1.0;
+	double pairs = (double)bodies * bodies;
+
+	printf("Pair interaction policies on %zu bodies, softening %g, screening length %g\n", bodies, softening, range);
+	printf("%10s %10s %10s %12s %16s\n", "softening", "law", "precision", "ns/pair", "float deviation");
+
+	std::vector<double> doubles, floats;
+	const char *softenings[] = { "plummer", "none", "spline" };
+	const char *laws[] = { "newton", "screened" };
+	for (int s = 0; s < 3; s++)
+		for (int l = 0; l < 2; l++) {
+			double seconds[2];
+			int k = 2 * s + l;
+			switch (k) {
+			case 0:
+				seconds[0] = timeInteractions<double, PlummerSoftening, NewtonLaw>(b, softening, range, doubles);
+				seconds[1] = timeInteractions<float, PlummerSoftening, NewtonLaw>(b, softening, range, floats);
+				break;
+			case 1:
+				seconds[0] = timeInteractions<double, PlummerSoftening, ScreenedLaw>(b, softening, range, doubles);
+				seconds[1] = timeInteractions<float, PlummerSoftening, ScreenedLaw>(b, softening, range, floats);
+				break;
+			case 2:
+				seconds[0] = timeInteractions<double, NoSoftening, NewtonLaw>(b, softening, range, doubles);
+				seconds[1] = timeInteractions<float, NoSoftening, NewtonLaw>(b, softening, range, floats);
+				break;
+			case 3:
+				seconds[0] = timeInteractions<double, NoSoftening, ScreenedLaw>(b, softening, range, doubles);
+				seconds[1] = timeInteractions<float, NoSoftening, ScreenedLaw>(b, softening, range, floats);
+				break;
+			case 4:
+				seconds[0] = timeInteractions<double, SplineSoftening, NewtonLaw>(b, softening, range, doubles);
+				seconds[1] = timeInteractions<float, SplineSoftening, NewtonLaw>(b, softening, range, floats);
+				break;
+			default:
+				seconds[0] = timeInteractions<double, SplineSoftening, ScreenedLaw>(b, softening, range, doubles);
+				seconds[1] = timeInteractions<float, SplineSoftening, ScreenedLaw>(b, softening, range, floats);
+				break;
+			}
+			printf("%10s %10s %10s %12.3f %16s\n", softenings[s], laws[l], "double", seconds[0] * 1.0e9 / pairs, "-");
+			printf("%10s %10s %10s %12.3f %16.3e\n", softenings[s], laws[l], "float", seconds[1] * 1.0e9 / pairs, largestDeviation(floats, doubles));
+		}
+
+	std::vector<double> ax(bodies), ay(bodies), az(bodies);
+	double handSeconds = timeBest(3, [&]() {
+		std::fill(ax.begin(), ax.end(), 0.0);
+		std::fill(ay.begin(), ay.end(), 0.0);
+		std::fill(az.begin(), az.end(), 0.0);
+		for (size_t begin = 0; begin < bodies; begin += TILE_SIZE)
+			pairwiseAccelerations(&b.x[begin], &b.y[begin], &b.z[begin], std::min(TILE_SIZE, bodies - begin),
+				&b.x[0], &b.y[0], &b.z[0], &b.m[0], bodies, softening * softening, &ax[begin], &ay[begin], &az[begin]);
+	});
+	printf("Hand-vectorized Plummer kernel (%s): %.3f ns/pair\n", kernelName(), handSeconds * 1.0e9 / pairs);
+}
+
+/*
+ * The warp reached over the whole run includes the first ticks, in which the controller still measures the step cost
+ */
+void benchmarkTimeWarp(const Simulation &initial, double seconds) {
+
+	printf("Time warp on %zu bodies, %g s of wall time per warp, step budget %.0f%% of every tick\n", initial.Bodies.size(),
+		seconds, WARP_BUDGET * 100.0);
+	printf("%12s %12s %12s %12s %12s\n", "warp", "reached", "over run", "step", "lag");
+	for (double warp = WARP_MIN; warp <= WARP_MAX; warp *= 10.0) {
+		Simulation simulation = initial;
+		SimulationThread thread(simulation);
+		thread.setWarp(warp);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		thread.start();
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		thread.stop();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		printf("%12g %12.4g %12.4g %12.4g %12.4g\n", warp, (double)thread.Achieved, simulation.Time / elapsed.count(),
+			(double)thread.Step, (double)thread.Lag);
+	}
+}
+
+/*
+ * The first step of every run is taken outside the timed part, so all runs start with valid accelerations
+ */
+void benchmarkDiagnostics(size_t bodies, int steps, unsigned threads) {
+
+	Simulation initial(GRAVITY, 1.0e-2);
+	createCluster(initial, bodies, 4321);
+	ThreadPool pool(threads);
+	initial.Pool = &pool;
+
+	const Force_Solver solvers[] = { DIRECT_SUM, BARNES_HUT };
+	const char *names[] = { "direct", "tree" };
+	const unsigned long long intervals[] = { 0, 1, 10 };
+
+	printf("Conserved quantity samples, N = %zu, %d leapfrog steps, %u threads, %s kernel\n", bodies, steps, pool.size(), kernelName());
+	printf("%8s %12s %12s %12s %10s %12s %14s %10s %12s\n", "solver", "step [ms]", "every [ms]", "every 10", "overhead",
+		"pass [ms]", "energy [ms]", "same", "energy diff");
+	for (int s = 0; s < 2; s++) {
+		double seconds[3];
+		unsigned long long hashes[3];
+		Simulation sampled;
+		for (int k = 0; k < 3; k++) {
+			Simulation simulation = initial;
+			simulation.Solver = solvers[s];
+			simulation.DiagnosticInterval = intervals[k];
+			simulation.step(simulation.MaxStep);
+			seconds[k] = timeBest(1, [&]() {
+				for (int i = 0; i < steps; i++)
+					simulation.step(simulation.MaxStep);
+			});
+			hashes[k] = simulation.stateHash();
+			if (k == 1)
+				sampled = simulation;
+		}
+
+		// A sample right after the positions changed cannot reuse a force evaluation and takes the potential pass
+		Diagnostics fused = sampled.LastDiagnostics;
+		double pass = timeBest(3, [&]() {
+			sampled.invalidateAccelerations();
+			sampled.diagnostics();
+		});
+		double energy = 0.0;
+		double total = timeBest(1, [&]() { energy = sampled.totalEnergy(); });
+
+		printf("%8s %12.3f %12.3f %12.3f %9.1f%% %12.3f %14.3f %10s %12.3e\n", names[s], seconds[0] * 1000.0 / steps,
+			seconds[1] * 1000.0 / steps, seconds[2] * 1000.0 / steps, (seconds[1] / seconds[0] - 1.0) * 100.0, pass * 1000.0,
+			total * 1000.0, hashes[1] == hashes[0] && hashes[2] == hashes[0] ? "yes" : "NO",
+			fabs(fused.Energy - energy) / fabs(energy));
+	}
+}
+
+/*
+ * Wait for the predictor to publish the prediction of the given snapshot
+ */
+static void awaitPrediction(OrbitPredictor &predictor, unsigned long long generation) {
+
+	while (predictor.latest().Generation < generation)
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+/*
+ * The reference follows the simulation at its own step to the time of every vertex, so the error is that of the
+ * prediction's longer step
+ */
+void benchmarkPrediction(const Simulation &initial, double orbits) {
+
+	std::vector<size_t> bodies;
+	for (size_t i = 1; i < initial.Bodies.size(); i++)
+		bodies.push_back(i);
+
+	OrbitPredictor predictor;
+	predictor.Orbits = orbits;
+	predictor.select(bodies);
+	predictor.start();
+
+	Simulation simulation = initial;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	predictor.offer(simulation);
+	awaitPrediction(predictor, 1);
+	std::chrono::duration<double> latency = std::chrono::steady_clock::now() - start;
+	Prediction prediction = predictor.latest();
+
+	simulation.step(simulation.MaxStep);
+	const int offers = 100000;
+	double offer = timeBest(1, [&]() {
+		for (int i = 0; i < offers; i++)
+			predictor.offer(simulation);
+	});
+
+	// Vertices of all bodies in time order, checked against one reference run
+	std::vector<std::pair<double, size_t> > vertices;
+	for (size_t k = 0; k < prediction.Bodies.size(); k++)
+		for (int v = 0; v < prediction.Count[k]; v++)
+			vertices.push_back(std::make_pair(prediction.Time + v * prediction.Interval[k], k * 1000000 + v));
+	std::sort(vertices.begin(), vertices.end());
+	Simulation reference = initial;
+	double largest = 0.0;
+	for (size_t i = 0; i < vertices.size(); i++) {
+		reference.advance(vertices[i].first - reference.Time);
+		size_t k = vertices[i].second / 1000000, v = vertices[i].second % 1000000;
+		size_t body = prediction.Bodies[k];
+		const float *p = &prediction.Vertices[3 * (prediction.First[k] + v)];
+		double dx = prediction.OriginX[k] + p[0] - reference.Bodies.x[body];
+		double dy = prediction.OriginY[k] + p[1] - reference.Bodies.y[body];
+		double dz = prediction.OriginZ[k] + p[2] - reference.Bodies.z[body];
+		double rx = reference.Bodies.x[body] - reference.Bodies.x[0];
+		double ry = reference.Bodies.y[body] - reference.Bodies.y[0];
+		double rz = reference.Bodies.z[body] - reference.Bodies.z[0];
+		largest = std::max(largest, sqrt((dx * dx + dy * dy + dz * dz) / (rx * rx + ry * ry + rz * rz)));
+	}
+
+	// A burst of snapshots, every one makes the one before stale
+	unsigned long long completed = predictor.Completed, cancelled = predictor.Cancelled;
+	const int burst = 20;
+	for (int i = 0; i < burst; i++) {
+		predictor.select(bodies);
+		predictor.offer(simulation);
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+	awaitPrediction(predictor, 1 + burst);
+	predictor.stop();
+
+	size_t count = 0;
+	for (size_t k = 0; k < prediction.Count.size(); k++)
+		count += prediction.Count[k];
+	printf("Orbit prediction of %zu bodies over %g orbits, %zu vertices\n", bodies.size(), orbits, count);
+	printf("Snapshot to published paths: %.3f ms\n", latency.count() * 1000.0);
+	printf("Offer of a state that needs no snapshot: %.1f ns\n", offer / offers * 1.0e9);
+	printf("Largest distance from the simulation: %.3e of the orbit radius\n", largest);
+	printf("Burst of %d snapshots: %llu completed, %llu cancelled, %llu superseded before they started\n", burst,
+		(unsigned long long)predictor.Completed - completed, (unsigned long long)predictor.Cancelled - cancelled,
+		burst - ((unsigned long long)predictor.Completed - completed) - ((unsigned long long)predictor.Cancelled - cancelled));
+}
+
+/*
+ * Mean J2000 elements of the planets around the Sun and of the Moon around the Earth: semi-major axis (AU, km for the
+ * Moon), eccentricity, inclination, longitude of the ascending node, argument of periapsis and mean anomaly (degrees)
+ */
+static const double FIXTURE_ELEMENTS[EPHEMERIS_ITEMS - 1][6] = {
+	{ 0.38710, 0.20563, 7.005, 48.331, 29.124, 174.796 },
+	{ 0.72333, 0.00677, 3.395, 76.680, 54.884, 50.115 },
+	{ 1.00000, 0.01671, 0.000, 0.000, 102.937, 357.529 },
+	{ 1.52368, 0.09340, 1.850, 49.558, 286.502, 19.373 },
+	{ 5.20260, 0.04849, 1.303, 100.464, 273.867, 20.020 },
+	{ 9.55491, 0.05551, 2.489, 113.666, 339.392, 317.021 },
+	{ 19.21845, 0.04630, 0.773, 74.006, 96.999, 142.238 },
+	{ 30.11039, 0.00899, 1.770, 131.784, 273.187, 256.228 },
+	{ 39.48169, 0.24883, 17.142, 110.304, 113.763, 14.530 },
+	{ 384400.0, 0.05490, 5.145, 125.080, 318.150, 135.270 }
+};
+
+/*
+ * Without a file, a fixture over 40 years is written from Kepler orbits with the elements above, a fixed Sun and the DE440
+ * constants, so the fit error of the series can be measured against the orbits
+ */
+void benchmarkEphemeris(const char *path, size_t lookups, unsigned threads) {
+
+	const double J2000 = 2451545.0, DAY = 86400.0;
+	const double au = 149597870.7, ratio = 81.30056822149722;
+	const char *fixture = "ephemeris_fixture.bin";
+	OrbitCatalog orbits;
+	if (path == NULL) {
+		for (int i = 0; i < EPHEMERIS_ITEMS - 1; i++) {
+			const double *e = FIXTURE_ELEMENTS[i];
+			double mu = (i == EPHEMERIS_MOON ? 403503.2355 : 1.32712440018e11) * DAY * DAY;
+			double a = i == EPHEMERIS_MOON ? e[0] : e[0] * au;
+			double periapsisTime = J2000 - e[5] * PI / 180.0 / sqrt(mu / (a * a * a));
+			orbits.addElements(mu, a * (1.0 - e[1]), e[1], e[2] * PI / 180.0, e[3] * PI / 180.0, e[4] * PI / 180.0, periapsisTime);
+		}
+		double start = J2000 - 0.5 - 20.0 * 365.25;
+		bool written = writeEphemeris(fixture, 440, start, start + 40.0 * 365.25, EPHEMERIS_INTERVAL, au, ratio,
+			[&](int item, double jd, double &x, double &y, double &z) {
+				double vx, vy, vz;
+				if (item == EPHEMERIS_SUN)
+					x = y = z = 0.0;
+				else
+					orbits.stateAt(item, jd, x, y, z, vx, vy, vz);
+			});
+		if (!written) {
+			printf("Could not write %s\n", fixture);
+			return;
+		}
+		path = fixture;
+	}
+
+	Ephemeris ephemeris;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool opened = ephemeris.open(path);
+	std::chrono::duration<double> mapping = std::chrono::steady_clock::now() - start;
+	if (!opened) {
+		printf("%s is not a DE file of this byte order\n", path);
+		return;
+	}
+
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<double> uniform(ephemeris.Start, ephemeris.End);
+	std::vector<double> epochs(lookups / EPHEMERIS_BODIES + 1);
+	for (size_t e = 0; e < epochs.size(); e++)
+		epochs[e] = uniform(rng);
+	size_t n = epochs.size() * EPHEMERIS_BODIES;
+	std::vector<double> x(n), y(n), z(n);
+
+	double scalar = timeBest(3, [&]() {
+		for (size_t e = 0; e < epochs.size(); e++)
+			for (int b = 0; b < EPHEMERIS_BODIES; b++) {
+				size_t at = e * EPHEMERIS_BODIES + b;
+				double vx, vy, vz;
+				ephemeris.stateAt(b, epochs[e], 0.0, x[at], y[at], z[at], vx, vy, vz);
+			}
+	});
+	std::vector<double> sx = x, sy = y, sz = z;
+	double vector = timeBest(3, [&]() { ephemeris.positionsAt(&epochs[0], epochs.size(), &x[0], &y[0], &z[0]); });
+	ThreadPool pool(threads);
+	double pooled = timeBest(3, [&]() { ephemeris.positionsAt(&epochs[0], epochs.size(), &x[0], &y[0], &z[0], &pool); });
+
+	// Vector lanes against the scalar recurrence, relative to the distance from the barycenter
+	double lanes = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		double d = sqrt((x[i] - sx[i]) * (x[i] - sx[i]) + (y[i] - sy[i]) * (y[i] - sy[i]) + (z[i] - sz[i]) * (z[i] - sz[i]));
+		lanes = std::max(lanes, d / (sqrt(sx[i] * sx[i] + sy[i] * sy[i] + sz[i] * sz[i]) + 1.0));
+	}
+
+	printf("%s (DE%d), %.1f to %.1f in %g-day records, %s, %u threads\n", path, ephemeris.Number, ephemeris.Start,
+		ephemeris.End, ephemeris.Interval, kernelName(), pool.size());
+	printf("Mapping and header: %.3f ms, AU %.3f km, Earth-Moon mass ratio %.6f\n", mapping.count() * 1000.0,
+		ephemeris.AU, ephemeris.EarthMoonRatio);
+	printf("%-26s %16s\n", "lookup", "positions/s");
+	printf("%-26s %16.3e\n", "scalar, one body", n / scalar);
+	printf("%-26s %16.3e\n", "vector, bodies side by side", n / vector);
+	printf("%-26s %16.3e\n", "vector, thread pool", n / pooled);
+	printf("Largest difference of the vector lanes from the scalar series: %.3e\n", lanes);
+
+	double ex, ey, ez, evx, evy, evz, sunX, sunY, sunZ;
+	if (ephemeris.stateAt(EPHEMERIS_EARTH, J2000, 0.0, ex, ey, ez, evx, evy, evz) &&
+		ephemeris.stateAt(EPHEMERIS_SUN, J2000, 0.0, sunX, sunY, sunZ, evx, evy, evz))
+		printf("Earth to Sun at J2000: %.9f AU\n", sqrt((ex - sunX) * (ex - sunX) + (ey - sunY) * (ey - sunY) +
+			(ez - sunZ) * (ez - sunZ)) / ephemeris.AU);
+
+	if (path == fixture) {
+		// Fit error of the series against the orbits they were fitted to
+		double worst[EPHEMERIS_BODIES] = {};
+		for (size_t e = 0; e < epochs.size() && e < 10000; e++) {
+			double item[EPHEMERIS_ITEMS][3] = {}, v[3];
+			for (int i = 0; i < EPHEMERIS_ITEMS - 1; i++)
+				orbits.stateAt(i, epochs[e], item[i][0], item[i][1], item[i][2], v[0], v[1], v[2]);
+			for (int b = 0; b < EPHEMERIS_BODIES; b++) {
+				double r[3];
+				for (int k = 0; k < 3; k++) {
+					double earth = item[EPHEMERIS_EARTH_MOON][k] - item[EPHEMERIS_MOON][k] / (1.0 + ratio);
+					r[k] = b == EPHEMERIS_EARTH ? earth : b == EPHEMERIS_MOON ? earth + item[EPHEMERIS_MOON][k] : item[b][k];
+				}
+				size_t at = e * EPHEMERIS_BODIES + b;
+				worst[b] = std::max(worst[b], sqrt((x[at] - r[0]) * (x[at] - r[0]) + (y[at] - r[1]) * (y[at] - r[1]) +
+					(z[at] - r[2]) * (z[at] - r[2])));
+			}
+		}
+		const char *bodyNames[EPHEMERIS_BODIES] = { "Mercury", "Venus", "Earth-Moon", "Mars", "Jupiter", "Saturn", "Uranus",
+			"Neptune", "Pluto", "Moon", "Sun", "Earth" };
+		printf("Largest distance from the fitted orbits [km]:");
+		for (int b = 0; b < EPHEMERIS_BODIES; b++)
+			printf("%s %s %.2e", b ? "," : "", bodyNames[b], worst[b]);
+		printf("\n");
+		ephemeris.close();
+		remove(fixture);
+	}
+}
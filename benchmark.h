@@ -0,0 +1,114 @@
+#pragma once
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stddef.h>
+#include "simulation.h"
+
+// Fill the simulation with a random spherical cluster of equal-mass bodies
+void createCluster(Simulation &simulation, size_t count, unsigned int seed);
+
+// Add test particles on circular orbits around body 0 between the inner and outer distance, close to the xz-plane
+void createBelt(Simulation &simulation, size_t count, double inner, double outer, unsigned int seed);
+
+// Time direct summation against Barnes-Hut for doubling body counts and report where the tree becomes faster
+void benchmarkSolvers(size_t maxBodies);
+
+// Time the fast multipole solver at every expansion order against direct summation, report the cheapest order within the error budget
+// and the N from which that order is faster than direct summation
+void benchmarkFmm(size_t bodies, double errorBudget);
+
+// Time the scalar and vector pairwise kernels for doubling body counts and report pair interactions per second
+void benchmarkKernels(size_t maxBodies);
+
+// Strong scaling of the tiled direct sum and of Barnes-Hut from one thread to the given number of threads (0 for every hardware thread)
+void benchmarkScaling(size_t bodies, unsigned maxThreads);
+
+// Integrate copies of the given simulation over the duration with every integrator at a range of step sizes, and report the
+// energy error, cost and the largest step of each integrator within the error budget
+void benchmarkIntegrators(const Simulation &initial, double duration, double errorBudget);
+
+// Integrate a copy of the given simulation with block time steps of the given base step and report the bodies, steps and
+// force evaluations per level, against the shared leapfrog step of the deepest level
+void benchmarkBlocks(const Simulation &initial, double duration, double step);
+
+// Step copies of the given simulation with a belt of test particles of doubling size up to the given count, and report
+// particle steps per second against the pair interactions a full N-body step of the same bodies would need
+void benchmarkParticles(const Simulation &initial, size_t maxParticles, int steps);
+
+// Evaluate a random catalog of closed and open two-body orbits at far apart times with the batched Kepler solver, and
+// report positions per millisecond and the largest difference from the scalar solver
+void benchmarkKepler(size_t orbits, unsigned threads);
+
+// Time the spatial hash against sweep and prune on debris disks of doubling size, and the merging of the contacts found
+void benchmarkCollisions(size_t maxBodies);
+
+// Step a random cluster with the fast and the deterministic direct sum on one to the given number of threads (0 for every
+// hardware thread), and report the time per step, the state hash of every run and the throughput penalty of the
+// deterministic mode
+void benchmarkDeterminism(size_t bodies, int steps, unsigned maxThreads);
+
+// Integrate copies of the given simulation over the duration with the given step in every summation mode, print the
+// relative energy error against wall-clock time, and report the cheapest mode whose final error (the drift) stays within
+// the budget. Uses the fourth order Yoshida integrator, so the truncation error stays below the round-off
+void benchmarkSummation(const Simulation &initial, double duration, double step, double errorBudget);
+
+// Send a light comet past body 3 of the given simulation with the given closest approach, halfway through the duration,
+// and integrate it with plain leapfrog, block time steps and the regularized leapfrog and Yoshida integrators. Reports the
+// cost, the energy error and the comet's distance from a fine regularized reference
+void benchmarkRegularization(const Simulation &initial, double pericenter, double duration);
+
+// Add a comet of the given eccentricity around body 0 of the given simulation and follow it over the given number of
+// orbits with the adaptive Gauss-Radau integrator and with leapfrog at halving steps. Reports accepted and rejected
+// steps, force evaluations per accepted step, the energy error and the comet's distance from a tighter Gauss-Radau run
+void benchmarkGaussRadau(const Simulation &initial, double eccentricity, int orbits);
+
+// Give Jupiter and Saturn of the given simulation the given number of moons each, and integrate them as plain bodies at
+// the step of the fastest moon, and in subsystems with their own substeps below the given outer step. Reports the time
+// against the planets alone, the energy error and the largest moon position error against a fine flat reference
+void benchmarkMoons(const Simulation &initial, size_t moons, double duration, double step);
+
+// Integrate the given number of perturbed copies of the given simulation over the given number of leapfrog steps, once as
+// a batched ensemble and once as separate simulations side by side. Reports member steps per second of both, the distance
+// of the unperturbed member from a plain run and the spread of the energy errors over the members
+void benchmarkEnsemble(const Simulation &initial, size_t members, int steps, double dt);
+
+// Step a random cluster with the direct sum and the Barnes-Hut tree in one process, and split into spatial domains over one
+// to the given number of processes (0 for every hardware thread). Reports the time per step, the speedup and the largest
+// position difference from the single process
+void benchmarkDomains(size_t bodies, unsigned maxRanks, int steps);
+
+// Record every step of the given simulation over the duration into a snapshot ring, then jump to the given number of
+// random times. Reports the memory per snapshot against raw states, the cost of recording, restoring and interpolating,
+// and the distance of restored and interpolated states from the recorded ones
+void benchmarkSnapshots(const Simulation &initial, double duration, int seeks);
+
+// Run the given simulation on the simulation thread for the given wall seconds at every tenfold warp from WARP_MIN to
+// WARP_MAX. Reports the warp reached, the step the controller chose and the simulated time dropped as lag
+void benchmarkTimeWarp(const Simulation &initial, double seconds);
+
+// Time every instantiation of the pair interaction template, float and double precision times each softening model and
+// force law, on a random cluster of the given size. Reports nanoseconds per interaction and the largest relative
+// deviation of float from double, next to the hand-vectorized Plummer kernel
+void benchmarkInteractions(size_t bodies);
+
+// Step a random cluster with the direct sum and Barnes-Hut on the given number of threads (0 for every hardware thread),
+// without samples of the conserved quantities, with a sample every step and with one every 10 steps. Reports the time per
+// step, the cost of a sample against a step, of the sample's own potential pass and of totalEnergy(), whether the bodies
+// took the same steps as without samples and how far the sampled energy is from totalEnergy()
+void benchmarkDiagnostics(size_t bodies, int steps, unsigned threads);
+
+// Predict the given number of orbits of every body but body 0 of the given simulation on the prediction worker. Reports
+// the time from the snapshot to the published paths, the cost of offering a state that needs no snapshot, the largest
+// distance of the paths from the simulation at its own step relative to the orbit size, and how many of a burst of
+// stale snapshots were cancelled
+void benchmarkPrediction(const Simulation &initial, double orbits);
+
+// Look up the barycentric positions of every body in the given DE file at random epochs over its span, with the scalar
+// series per body, with the bodies side by side in the vector lanes and on the given number of threads (0 for every
+// hardware thread). Without a file, a fixture is fitted to Kepler orbits of the planets and the fit error is reported too.
+// Reports positions per second and the largest difference of the vector lanes from the scalar series
+void benchmarkEphemeris(const char *path, size_t lookups, unsigned threads);
+
+#endif
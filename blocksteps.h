@@ -0,0 +1,50 @@
+#pragma once
+
+#ifndef BLOCKSTEPS_H
+#define BLOCKSTEPS_H
+
+#include <vector>
+#include "bodies.h"
+
+// Default block time step values
+const int BLOCK_MAX_LEVEL = 16;
+const double BLOCK_ETA = 0.01;
+
+// State of the hierarchical block time steps. A body on level l takes steps of dt / 2^l, where dt is the step passed to
+// Simulation::step(), and only the bodies that finish a step in a substep have their accelerations evaluated
+struct BlockTimesteps {
+	// Accuracy parameter, a body's step is Eta times its acceleration over the rate of change of its acceleration
+	double Eta;
+	// Deepest level a body can be put on
+	int MaxLevel;
+	// Level of every body
+	std::vector<int> Level;
+	// Acceleration of every body at the end of its last step, for the rate of change
+	BodyArray LastAx, LastAy, LastAz;
+
+	// Statistics since the last reset. Body steps finished on every level
+	std::vector<unsigned long long> LevelSteps;
+	// Substeps and accelerations evaluated for single bodies
+	unsigned long long Substeps, ForceEvaluations;
+
+	BlockTimesteps() : Eta(BLOCK_ETA), MaxLevel(BLOCK_MAX_LEVEL), Substeps(0), ForceEvaluations(0) { }
+
+	// Clear the statistics
+	void resetStatistics()
+	{
+		LevelSteps.assign(MaxLevel + 1, 0);
+		Substeps = 0;
+		ForceEvaluations = 0;
+	}
+
+	// Number of bodies on every level
+	std::vector<size_t> population() const
+	{
+		std::vector<size_t> count(MaxLevel + 1, 0);
+		for (size_t i = 0; i < Level.size(); i++)
+			count[Level[i]]++;
+		return count;
+	}
+};
+
+#endif
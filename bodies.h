@@ -0,0 +1,112 @@
+#pragma once
+
+#ifndef BODIES_H
+#define BODIES_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+// Alignment of the body arrays, one AVX-512 register or cache line
+const size_t BODY_ALIGNMENT = 64;
+
+// Allocator that places the body arrays on BODY_ALIGNMENT boundaries, so vector kernels can use aligned loads
+template <typename T>
+class AlignedAllocator {
+public:
+	typedef T value_type;
+
+	AlignedAllocator() { }
+	template <typename U> AlignedAllocator(const AlignedAllocator<U> &) { }
+
+	T *allocate(size_t n)
+	{
+#ifdef _MSC_VER
+		void *p = _aligned_malloc(n * sizeof(T), BODY_ALIGNMENT);
+#else
+		void *p = NULL;
+		if (posix_memalign(&p, BODY_ALIGNMENT, n * sizeof(T)) != 0)
+			p = NULL;
+#endif
+		if (!p)
+			throw std::bad_alloc();
+		return (T *)p;
+	}
+
+	void deallocate(T *p, size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	template <typename U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+	template <typename U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+// Aligned array of one body property
+typedef std::vector<double, AlignedAllocator<double> > BodyArray;
+
+// Structure-of-arrays storage for the state of every simulated body
+class BodyStore {
+public:
+	// Mass
+	BodyArray m;
+	// Position
+	BodyArray x, y, z;
+	// Velocity
+	BodyArray vx, vy, vz;
+	// Acceleration from the last force evaluation
+	BodyArray ax, ay, az;
+	// Radius for collisions
+	BodyArray r;
+
+	// Number of bodies
+	size_t size() const { return m.size(); }
+
+	// Append a body and return its index
+	size_t add(double mass, double px, double py, double pz, double pvx, double pvy, double pvz, double radius = 0.0)
+	{
+		m.push_back(mass);
+		x.push_back(px); y.push_back(py); z.push_back(pz);
+		vx.push_back(pvx); vy.push_back(pvy); vz.push_back(pvz);
+		ax.push_back(0.0); ay.push_back(0.0); az.push_back(0.0);
+		r.push_back(radius);
+		return m.size() - 1;
+	}
+
+	// Copy body from over body to
+	void move(size_t to, size_t from)
+	{
+		m[to] = m[from];
+		x[to] = x[from]; y[to] = y[from]; z[to] = z[from];
+		vx[to] = vx[from]; vy[to] = vy[from]; vz[to] = vz[from];
+		ax[to] = ax[from]; ay[to] = ay[from]; az[to] = az[from];
+		r[to] = r[from];
+	}
+
+	// Keep the first count bodies
+	void resize(size_t count)
+	{
+		m.resize(count);
+		x.resize(count); y.resize(count); z.resize(count);
+		vx.resize(count); vy.resize(count); vz.resize(count);
+		ax.resize(count); ay.resize(count); az.resize(count);
+		r.resize(count);
+	}
+
+	// Remove all bodies
+	void clear()
+	{
+		m.clear();
+		x.clear(); y.clear(); z.clear();
+		vx.clear(); vy.clear(); vz.clear();
+		ax.clear(); ay.clear(); az.clear();
+		r.clear();
+	}
+};
+
+#endif
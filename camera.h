@@ -29,8 +29,9 @@ const float ZOOM = 45.0f;
 class Camera
 {
 public:
-	// Camera Attributes
-	glm::vec3 Position;
+	// Camera Attributes. The position is kept in double precision and serves as the origin of rendering, so scenes at
+	// astronomical scales keep their precision close to the camera
+	glm::dvec3 Position;
 	glm::vec3 Front;
 	glm::vec3 Up;
 	glm::vec3 Right;
@@ -46,7 +47,7 @@ public:
 	// Constructor with vectors
 	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
 	{
-		Position = position;
+		Position = glm::dvec3(position);
 		WorldUp = up;
 		Yaw = yaw;
 		Pitch = pitch;
@@ -55,7 +56,7 @@ public:
 	// Constructor with scalar values
 	Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
 	{
-		Position = glm::vec3(posX, posY, posZ);
+		Position = glm::dvec3(posX, posY, posZ);
 		WorldUp = glm::vec3(upX, upY, upZ);
 		Yaw = yaw;
 		Pitch = pitch;
@@ -65,21 +66,34 @@ public:
 	// Returns the view matrix calculated using Euler Angles and the LookAt Matrix
 	glm::mat4 GetViewMatrix()
 	{
-		return glm::lookAt(Position, Position + Front, Up);
+		return glm::lookAt(glm::vec3(Position), glm::vec3(Position) + Front, Up);
+	}
+
+	// Returns the view matrix with the camera at the origin, which only rotates. Use with positions from GetRelativePosition
+	glm::mat4 GetRelativeViewMatrix()
+	{
+		return glm::lookAt(glm::vec3(0.0f), Front, Up);
+	}
+
+	// Returns a world position relative to the camera. The subtraction is done in double precision, so only the
+	// remaining offset is rounded to float
+	glm::vec3 GetRelativePosition(double x, double y, double z)
+	{
+		return glm::vec3((float)(x - Position.x), (float)(y - Position.y), (float)(z - Position.z));
 	}
 
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
-		float velocity = MovementSpeed * deltaTime;
+		double velocity = MovementSpeed * deltaTime;
 		if (direction == FORWARD)
-			Position += Front * velocity;
+			Position += glm::dvec3(Front) * velocity;
 		if (direction == BACKWARD)
-			Position -= Front * velocity;
+			Position -= glm::dvec3(Front) * velocity;
 		if (direction == LEFT)
-			Position -= Right * velocity;
+			Position -= glm::dvec3(Right) * velocity;
 		if (direction == RIGHT)
-			Position += Right * velocity;
+			Position += glm::dvec3(Right) * velocity;
 	}
 
 	// Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -0,0 +1,287 @@
+#include <math.h>
+#include <algorithm>
+#include "collisions.h"
+
+/*
+ * Hash of an integer cell, from the large primes of Teschner et al. (2003)
+ */
+static inline uint32_t cellHash(int64_t x, int64_t y, int64_t z, uint32_t mask) {
+
+	return (uint32_t)(((uint64_t)x * 73856093ULL) ^ ((uint64_t)y * 19349663ULL) ^ ((uint64_t)z * 83492791ULL)) & mask;
+}
+
+// Own cell and the 13 neighbours in the forward half of the surrounding cells. Every pair of neighbouring cells is
+// visited from exactly one of its two cells
+static const int NEIGHBOURS[14][3] = {
+	{ 0, 0, 0 }, { 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+	{ -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 }, { -1, 0, 1 }, { 0, 0, 1 }, { 1, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+};
+
+static inline bool overlap(const BodyStore &b, size_t i, size_t j) {
+
+	double dx = b.x[j] - b.x[i];
+	double dy = b.y[j] - b.y[i];
+	double dz = b.z[j] - b.z[i];
+	double reach = b.r[i] + b.r[j];
+	return dx * dx + dy * dy + dz * dz < reach * reach;
+}
+
+static inline bool contactLess(const Contact &p, const Contact &q) {
+
+	return p.a < q.a || (p.a == q.a && p.b < q.b);
+}
+
+CollisionDetector::CollisionDetector() : CellSize(0.0) { }
+
+void CollisionDetector::runBlocks(size_t count, ThreadPool *pool, const std::function<void(size_t)> &task) {
+
+	size_t blocks = (count + COLLISION_BLOCK - 1) / COLLISION_BLOCK;
+	if (pool && blocks > 1)
+		pool->run(blocks, task);
+	else
+		for (size_t b = 0; b < blocks; b++)
+			task(b);
+}
+
+void CollisionDetector::findContacts(const BodyStore &bodies, Collision_Detector method, std::vector<Contact> &contacts, ThreadPool *pool) {
+
+	contacts.clear();
+	size_t n = bodies.size();
+	if (n < 2 || method == NO_COLLISIONS)
+		return;
+
+	found.resize((n + COLLISION_BLOCK - 1) / COLLISION_BLOCK);
+	for (size_t k = 0; k < found.size(); k++)
+		found[k].clear();
+
+	if (method == SWEEP_AND_PRUNE)
+		sweepAndPrune(bodies, pool);
+	else
+		spatialHash(bodies, pool);
+
+	for (size_t k = 0; k < found.size(); k++)
+		contacts.insert(contacts.end(), found[k].begin(), found[k].end());
+	std::sort(contacts.begin(), contacts.end(), contactLess);
+}
+
+/*
+ * Overlapping bodies no larger than half a cell lie in the same or in neighbouring cells. Cells are hashed into a table of
+ * at least twice as many buckets as bodies and the bodies are counting-sorted by bucket, so building the table and the
+ * search are linear in the number of bodies. A bucket may hold several cells, so the cell of every candidate is compared
+ * as well, which also keeps a pair from being found twice when two neighbouring cells share a bucket. Every body only
+ * looks at the forward half of its neighbours, so each pair of cells is searched once
+ */
+void CollisionDetector::spatialHash(const BodyStore &bodies, ThreadPool *pool) {
+
+	size_t n = bodies.size();
+	double cell = CellSize;
+	if (cell <= 0.0) {
+		double sum = 0.0;
+		for (size_t i = 0; i < n; i++)
+			sum += bodies.r[i];
+		cell = 4.0 * sum / n;
+	}
+	if (!(cell > 0.0))
+		return;
+	double invCell = 1.0 / cell;
+
+	uint32_t buckets = 1;
+	while (buckets < 2 * n && buckets < 0x80000000u)
+		buckets <<= 1;
+	uint32_t mask = buckets - 1;
+
+	cellX.resize(n); cellY.resize(n); cellZ.resize(n);
+	bucket.resize(n);
+	runBlocks(n, pool, [&](size_t block) {
+		size_t end = std::min(n, (block + 1) * COLLISION_BLOCK);
+		for (size_t i = block * COLLISION_BLOCK; i < end; i++) {
+			cellX[i] = (int64_t)floor(bodies.x[i] * invCell);
+			cellY[i] = (int64_t)floor(bodies.y[i] * invCell);
+			cellZ[i] = (int64_t)floor(bodies.z[i] * invCell);
+			bucket[i] = cellHash(cellX[i], cellY[i], cellZ[i], mask);
+		}
+	});
+
+	// Counting sort by bucket. Large bodies are left out of the table
+	large.clear();
+	bucketStart.assign((size_t)buckets + 1, 0);
+	for (size_t i = 0; i < n; i++) {
+		if (2.0 * bodies.r[i] > cell)
+			large.push_back(i);
+		else
+			bucketStart[bucket[i] + 1]++;
+	}
+	for (size_t k = 0; k < buckets; k++)
+		bucketStart[k + 1] += bucketStart[k];
+	size_t entries = bucketStart[buckets];
+	order.resize(entries);
+	{
+		std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+		for (size_t i = 0; i < n; i++)
+			if (!(2.0 * bodies.r[i] > cell))
+				order[fill[bucket[i]]++] = (uint32_t)i;
+	}
+
+	// Copies in bucket order, so the bodies of a bucket are contiguous in memory
+	sortedX.resize(entries); sortedY.resize(entries); sortedZ.resize(entries); sortedR.resize(entries);
+	sortedCellX.resize(entries); sortedCellY.resize(entries); sortedCellZ.resize(entries);
+	runBlocks(entries, pool, [&](size_t block) {
+		size_t end = std::min(entries, (block + 1) * COLLISION_BLOCK);
+		for (size_t e = block * COLLISION_BLOCK; e < end; e++) {
+			size_t i = order[e];
+			sortedX[e] = bodies.x[i]; sortedY[e] = bodies.y[i]; sortedZ[e] = bodies.z[i]; sortedR[e] = bodies.r[i];
+			sortedCellX[e] = cellX[i]; sortedCellY[e] = cellY[i]; sortedCellZ[e] = cellZ[i];
+		}
+	});
+
+	runBlocks(n, pool, [&](size_t block) {
+		std::vector<Contact> &out = found[block];
+		for (size_t e = block * COLLISION_BLOCK; e < std::min(entries, (block + 1) * COLLISION_BLOCK); e++) {
+			double x = sortedX[e], y = sortedY[e], z = sortedZ[e], r = sortedR[e];
+			for (int k = 0; k < 14; k++) {
+				int64_t cx = sortedCellX[e] + NEIGHBOURS[k][0], cy = sortedCellY[e] + NEIGHBOURS[k][1], cz = sortedCellZ[e] + NEIGHBOURS[k][2];
+				uint32_t b = cellHash(cx, cy, cz, mask);
+				for (size_t f = k == 0 ? e + 1 : bucketStart[b]; f < bucketStart[b + 1]; f++) {
+					if (sortedCellX[f] != cx || sortedCellY[f] != cy || sortedCellZ[f] != cz)
+						continue;
+					double dx = sortedX[f] - x, dy = sortedY[f] - y, dz = sortedZ[f] - z, reach = r + sortedR[f];
+					if (dx * dx + dy * dy + dz * dz < reach * reach) {
+						size_t i = order[e], j = order[f];
+						Contact c = { std::min(i, j), std::max(i, j) };
+						out.push_back(c);
+					}
+				}
+			}
+		}
+
+		size_t end = std::min(n, (block + 1) * COLLISION_BLOCK);
+		// Large bodies against this block
+		for (size_t l = 0; l < large.size(); l++) {
+			size_t big = large[l];
+			for (size_t j = block * COLLISION_BLOCK; j < end; j++) {
+				if (j == big || (j < big && 2.0 * bodies.r[j] > cell))
+					continue;
+				if (overlap(bodies, big, j)) {
+					Contact c = { std::min(big, j), std::max(big, j) };
+					out.push_back(c);
+				}
+			}
+		}
+	});
+}
+
+/*
+ * After sorting by the lowest x, the candidates of a body are the bodies that follow it until one starts beyond its
+ * highest x. Every body scans independently, so blocks of the sorted order run in parallel
+ */
+void CollisionDetector::sweepAndPrune(const BodyStore &bodies, ThreadPool *pool) {
+
+	size_t n = bodies.size();
+	sorted.resize(n);
+	for (size_t i = 0; i < n; i++)
+		sorted[i] = i;
+	std::sort(sorted.begin(), sorted.end(), [&bodies](size_t p, size_t q) {
+		return bodies.x[p] - bodies.r[p] < bodies.x[q] - bodies.r[q];
+	});
+	lower.resize(n);
+	for (size_t k = 0; k < n; k++)
+		lower[k] = bodies.x[sorted[k]] - bodies.r[sorted[k]];
+
+	runBlocks(n, pool, [&](size_t block) {
+		std::vector<Contact> &out = found[block];
+		size_t end = std::min(n, (block + 1) * COLLISION_BLOCK);
+		for (size_t k = block * COLLISION_BLOCK; k < end; k++) {
+			size_t i = sorted[k];
+			double upper = bodies.x[i] + bodies.r[i];
+			for (size_t l = k + 1; l < n && lower[l] < upper; l++) {
+				size_t j = sorted[l];
+				if (overlap(bodies, i, j)) {
+					Contact c = { std::min(i, j), std::max(i, j) };
+					out.push_back(c);
+				}
+			}
+		}
+	});
+}
+
+/*
+ * Groups are the connected components of the contacts, found with a union-find over the bodies that take part in a
+ * contact, whose root is the lowest index. Bodies outside the contacts are only moved down over the removed ones
+ */
+size_t mergeContacts(BodyStore &bodies, const std::vector<Contact> &contacts, std::vector<size_t> &kept) {
+
+	size_t n = bodies.size();
+	kept.clear();
+
+	// Bodies in contacts, sorted, and the union-find over their positions in that list
+	std::vector<size_t> members;
+	members.reserve(2 * contacts.size());
+	for (size_t k = 0; k < contacts.size(); k++) {
+		members.push_back(contacts[k].a);
+		members.push_back(contacts[k].b);
+	}
+	std::sort(members.begin(), members.end());
+	members.erase(std::unique(members.begin(), members.end()), members.end());
+	size_t count = members.size();
+	auto local = [&members](size_t i) { return (size_t)(std::lower_bound(members.begin(), members.end(), i) - members.begin()); };
+
+	std::vector<size_t> parent(count);
+	for (size_t k = 0; k < count; k++)
+		parent[k] = k;
+	auto find = [&parent](size_t k) {
+		while (parent[k] != k) {
+			parent[k] = parent[parent[k]];
+			k = parent[k];
+		}
+		return k;
+	};
+	for (size_t k = 0; k < contacts.size(); k++) {
+		size_t a = find(local(contacts[k].a)), b = find(local(contacts[k].b));
+		if (a < b)
+			parent[b] = a;
+		else if (b < a)
+			parent[a] = b;
+	}
+
+	// Mass, momentum, mass moment and volume of every group, summed in its root
+	std::vector<double> mass(count, 0.0), px(count, 0.0), py(count, 0.0), pz(count, 0.0), qx(count, 0.0), qy(count, 0.0), qz(count, 0.0), volume(count, 0.0);
+	for (size_t k = 0; k < count; k++) {
+		size_t root = find(k), i = members[k];
+		double m = bodies.m[i];
+		mass[root] += m;
+		px[root] += m * bodies.vx[i]; py[root] += m * bodies.vy[i]; pz[root] += m * bodies.vz[i];
+		qx[root] += m * bodies.x[i]; qy[root] += m * bodies.y[i]; qz[root] += m * bodies.z[i];
+		volume[root] += bodies.r[i] * bodies.r[i] * bodies.r[i];
+	}
+
+	std::vector<char> removed(count, 0);
+	for (size_t k = 0; k < count; k++) {
+		if (find(k) != k) {
+			removed[k] = 1;
+			continue;
+		}
+		size_t i = members[k];
+		if (mass[k] > 0.0) {
+			bodies.x[i] = qx[k] / mass[k]; bodies.y[i] = qy[k] / mass[k]; bodies.z[i] = qz[k] / mass[k];
+			bodies.vx[i] = px[k] / mass[k]; bodies.vy[i] = py[k] / mass[k]; bodies.vz[i] = pz[k] / mass[k];
+		}
+		bodies.m[i] = mass[k];
+		bodies.r[i] = cbrt(volume[k]);
+	}
+
+	kept.reserve(n);
+	size_t next = 0;
+	for (size_t k = 0, i = 0; i < n; i++) {
+		while (k < count && members[k] < i)
+			k++;
+		if (k < count && members[k] == i && removed[k])
+			continue;
+		if (next != i)
+			bodies.move(next, i);
+		kept.push_back(i);
+		next++;
+	}
+
+	bodies.resize(next);
+	return n - next;
+}
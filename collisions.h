@@ -0,0 +1,67 @@
+#pragma once
+
+#ifndef COLLISIONS_H
+#define COLLISIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "bodies.h"
+#include "threadpool.h"
+
+// Bodies per task of the collision search
+const size_t COLLISION_BLOCK = 4096;
+
+// Available broad phase searches
+enum Collision_Detector {
+	NO_COLLISIONS,
+	// Uniform grid of cells hashed into a table, every body is tested against the bodies in its own and neighbouring cells
+	SPATIAL_HASH,
+	// Bodies sorted by their lowest x, every body is tested against the following bodies whose x-range overlaps its own
+	SWEEP_AND_PRUNE
+};
+
+// Pair of bodies whose spheres overlap, a < b
+struct Contact {
+	size_t a, b;
+};
+
+// Broad and narrow phase search for overlapping bodies. Keeps its tables between calls, so a search every step does not allocate
+class CollisionDetector
+{
+public:
+	CollisionDetector();
+
+	// Edge length of the hash cells, 0 uses four times the mean radius. Bodies larger than half a cell are tested against every body
+	double CellSize;
+
+	// Find every pair of overlapping bodies, sorted by a and then b
+	void findContacts(const BodyStore &bodies, Collision_Detector method, std::vector<Contact> &contacts, ThreadPool *pool = NULL);
+
+private:
+	// Contacts found by every task
+	std::vector<std::vector<Contact> > found;
+	// Spatial hash: integer cell and bucket of every body, bodies sorted by bucket with the start of every bucket, and the bodies too large for the cells
+	std::vector<int64_t> cellX, cellY, cellZ;
+	std::vector<uint32_t> bucket, order, bucketStart;
+	std::vector<size_t> large;
+	// Positions, radii and cells in bucket order
+	std::vector<double> sortedX, sortedY, sortedZ, sortedR;
+	std::vector<int64_t> sortedCellX, sortedCellY, sortedCellZ;
+	// Sweep and prune: bodies sorted by their lowest x
+	std::vector<size_t> sorted;
+	std::vector<double> lower;
+
+	void spatialHash(const BodyStore &bodies, ThreadPool *pool);
+	void sweepAndPrune(const BodyStore &bodies, ThreadPool *pool);
+	// Call task(block) for every block of COLLISION_BLOCK items
+	void runBlocks(size_t count, ThreadPool *pool, const std::function<void(size_t)> &task);
+};
+
+// Merge every group of touching bodies into one body with their total mass and momentum at their center of mass, and
+// with their total volume. The body with the lowest index of a group takes its place, the others are removed. kept
+// receives the old index of every remaining body. Return the number of bodies removed
+size_t mergeContacts(BodyStore &bodies, const std::vector<Contact> &contacts, std::vector<size_t> &kept);
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stddef.h>
+
+// Bodies per task of the reductions over the bodies
+const size_t DIAGNOSTIC_BLOCK = 16384;
+
+// Conserved quantities of a simulation at one time. The potential energy comes out of the force evaluation that ended
+// the step where the solver can store it, see Simulation::DiagnosticInterval
+struct Diagnostics {
+	// Simulated time and steps taken when the sample was taken
+	double Time;
+	unsigned long long Steps;
+	// Kinetic and potential energy of the bodies, and the total energy with the members of the subsystems included
+	double Kinetic, Potential, Energy;
+	// Total momentum, and angular momentum about the origin
+	double Momentum[3], AngularMomentum[3];
+	// True when the potential was stored by the last force evaluation, false when it took a pass of its own
+	bool Fused;
+
+	Diagnostics() : Time(0.0), Steps(0), Kinetic(0.0), Potential(0.0), Energy(0.0), Fused(false)
+	{
+		for (int k = 0; k < 3; k++)
+			Momentum[k] = AngularMomentum[k] = 0.0;
+	}
+};
+
+#endif
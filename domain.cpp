@@ -0,0 +1,358 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <thread>
+#include <vector>
+#include "domain.h"
+#include "kernels.h"
+#include "octree.h"
+#include "simulation.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+// Number of shared body arrays of doubles
+static const int DOMAIN_ARRAYS = 11;
+
+/*
+ * Split the bodies order[lo, hi) into domains for count ranks from first on. Every cut is across the longest side of the
+ * bounding box, at the share of the bodies that goes to the ranks on its lower side
+ */
+static void bisect(const double *const *position, size_t *order, size_t lo, size_t hi, unsigned first, unsigned count,
+	size_t *begin) {
+
+	begin[first] = lo;
+	if (count <= 1)
+		return;
+
+	double extent[3];
+	for (int k = 0; k < 3; k++) {
+		double low = HUGE_VAL, high = -HUGE_VAL;
+		for (size_t i = lo; i < hi; i++) {
+			low = std::min(low, position[k][order[i]]);
+			high = std::max(high, position[k][order[i]]);
+		}
+		extent[k] = high - low;
+	}
+	const double *axis = position[extent[0] >= extent[1] && extent[0] >= extent[2] ? 0 : extent[1] >= extent[2] ? 1 : 2];
+
+	unsigned lower = count / 2;
+	size_t mid = lo + (hi - lo) * lower / count;
+	if (mid < hi)
+		std::nth_element(order + lo, order + mid, order + hi, [axis](size_t a, size_t b) { return axis[a] < axis[b]; });
+	bisect(position, order, lo, mid, first, lower, begin);
+	bisect(position, order, mid, hi, first + lower, count - lower, begin);
+}
+
+SharedDomain::SharedDomain() : header(NULL), bytes(0) { }
+
+SharedDomain::~SharedDomain() {
+
+	close();
+}
+
+/*
+ * One anonymous shared mapping holds the header and the arrays, each array starting on its own cache line. Forked ranks
+ * inherit it
+ */
+bool SharedDomain::create(const Simulation &simulation, unsigned ranks) {
+
+	close();
+	size_t n = simulation.Bodies.size();
+	if (ranks == 0 || ranks > DOMAIN_MAX_RANKS || n == 0)
+		return false;
+	if (simulation.Solver != DIRECT_SUM && simulation.Solver != BARNES_HUT)
+		return false;
+
+#ifdef _WIN32
+	return false;
+#else
+	size_t row = (n * sizeof(double) + BODY_ALIGNMENT - 1) / BODY_ALIGNMENT * BODY_ALIGNMENT;
+	size_t start = (sizeof(DomainHeader) + BODY_ALIGNMENT - 1) / BODY_ALIGNMENT * BODY_ALIGNMENT;
+	bytes = start + DOMAIN_ARRAYS * row + n * sizeof(size_t);
+	void *memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		bytes = 0;
+		return false;
+	}
+
+	header = new (memory) DomainHeader;
+	header->Bodies = n;
+	header->Ranks = ranks;
+	header->G = simulation.G;
+	header->Softening = simulation.Softening;
+	header->Theta = simulation.Theta;
+	header->Tree = simulation.Solver == BARNES_HUT;
+	header->SofteningModel = simulation.SofteningModel;
+	header->ForceLaw = simulation.ForceLaw;
+	header->ScreeningLength = simulation.ScreeningLength;
+	header->Time = simulation.Time;
+	header->Arrived.store(0);
+	header->Generation.store(0);
+	header->Launcher = (int)getpid();
+	header->Aborted.store(false);
+
+	double **arrays[DOMAIN_ARRAYS] = { &m, &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &r };
+	const BodyArray *sources[DOMAIN_ARRAYS] = { &simulation.Bodies.m, &simulation.Bodies.x, &simulation.Bodies.y,
+		&simulation.Bodies.z, &simulation.Bodies.vx, &simulation.Bodies.vy, &simulation.Bodies.vz, &simulation.Bodies.ax,
+		&simulation.Bodies.ay, &simulation.Bodies.az, &simulation.Bodies.r };
+	for (int k = 0; k < DOMAIN_ARRAYS; k++) {
+		*arrays[k] = (double *)((char *)memory + start + k * row);
+		memcpy(*arrays[k], &(*sources[k])[0], n * sizeof(double));
+	}
+	ids = (size_t *)((char *)memory + start + DOMAIN_ARRAYS * row);
+	for (size_t i = 0; i < n; i++)
+		ids[i] = i;
+	return true;
+#endif
+}
+
+void SharedDomain::close() {
+
+#ifndef _WIN32
+	if (header != NULL) {
+		header->~DomainHeader();
+		munmap(header, bytes);
+	}
+#endif
+	header = NULL;
+	bytes = 0;
+}
+
+/*
+ * Sense by generation: the last rank to arrive resets the count and starts the next generation, which releases the others.
+ * A rank that exits normally has passed the barrier first, so an exit only counts as a death while the generation is the
+ * one waited for
+ */
+bool SharedDomain::barrier() {
+
+	if (header->Aborted.load(std::memory_order_acquire))
+		return false;
+	unsigned generation = header->Generation.load(std::memory_order_acquire);
+	if (header->Arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == header->Ranks) {
+		header->Arrived.store(0, std::memory_order_relaxed);
+		header->Generation.fetch_add(1, std::memory_order_release);
+		return true;
+	}
+	for (unsigned spins = 1; header->Generation.load(std::memory_order_acquire) == generation; spins++) {
+		if (header->Aborted.load(std::memory_order_acquire))
+			return false;
+		if (spins % DOMAIN_POLL_SPINS == 0 && !alive() && header->Generation.load(std::memory_order_acquire) == generation) {
+			header->Aborted.store(true, std::memory_order_release);
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+/*
+ * Rank 0 looks for exited children without reaping them, so launchRanks still gets their status. A forked rank whose
+ * parent is no longer rank 0 has been orphaned
+ */
+bool SharedDomain::alive() const {
+
+#ifndef _WIN32
+	if ((int)getpid() != header->Launcher)
+		return (int)getppid() == header->Launcher;
+	for (size_t c = 0; c < children.size(); c++) {
+		siginfo_t info;
+		memset(&info, 0, sizeof(info));
+		if (waitid(P_PID, (id_t)children[c], &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0)
+			return false;
+	}
+#endif
+	return true;
+}
+
+/*
+ * The bodies are moved so that every domain is a contiguous range of the shared arrays
+ */
+void SharedDomain::balance() {
+
+	size_t n = header->Bodies;
+	std::vector<size_t> order(n);
+	for (size_t i = 0; i < n; i++)
+		order[i] = i;
+	const double *position[3] = { x, y, z };
+	bisect(position, &order[0], 0, n, 0, header->Ranks, header->Begin);
+	header->Begin[header->Ranks] = n;
+
+	std::vector<double> scratch(n);
+	double *arrays[DOMAIN_ARRAYS] = { m, x, y, z, vx, vy, vz, ax, ay, az, r };
+	for (int k = 0; k < DOMAIN_ARRAYS; k++) {
+		for (size_t i = 0; i < n; i++)
+			scratch[i] = arrays[k][order[i]];
+		memcpy(arrays[k], &scratch[0], n * sizeof(double));
+	}
+	std::vector<size_t> moved(n);
+	for (size_t i = 0; i < n; i++)
+		moved[i] = ids[order[i]];
+	memcpy(ids, &moved[0], n * sizeof(size_t));
+}
+
+/*
+ * Every rank builds the tree over all bodies from the shared positions on its own, which costs less than the forces on
+ * its domain, and walks it for its own bodies only. The direct sum runs over the sources in tiles that stay in the cache,
+ * with the same kernels as Simulation::interact
+ */
+void SharedDomain::computeAccelerations(unsigned rank) {
+
+	size_t n = header->Bodies;
+	size_t first = header->Begin[rank], last = header->Begin[rank + 1];
+	double eps2 = header->Softening * header->Softening;
+	double G = header->G;
+
+	if (header->Tree) {
+		BodyStore all;
+		all.resize(n);
+		memcpy(&all.m[0], m, n * sizeof(double));
+		memcpy(&all.x[0], x, n * sizeof(double));
+		memcpy(&all.y[0], y, n * sizeof(double));
+		memcpy(&all.z[0], z, n * sizeof(double));
+		Octree tree;
+		tree.build(all);
+		for (size_t i = first; i < last; i++)
+			tree.accelerationAt(all, x[i], y[i], z[i], (int)i, G, header->Theta, eps2, ax[i], ay[i], az[i],
+				header->SofteningModel, NULL, header->ForceLaw, header->ScreeningLength);
+		return;
+	}
+
+	bool plummer = header->SofteningModel == PLUMMER_SOFTENING && header->ForceLaw == NEWTON_LAW;
+	SoftenedKernel kernel = softenedKernel(header->SofteningModel, header->ForceLaw);
+	ForceParameters<double> parameters(header->Softening, header->ScreeningLength);
+	for (size_t i = first; i < last; i++)
+		ax[i] = ay[i] = az[i] = 0.0;
+	for (size_t s = 0; s < n; s += TILE_SIZE) {
+		size_t sources = std::min(TILE_SIZE, n - s);
+		if (plummer)
+			pairwiseAccelerations(x + first, y + first, z + first, last - first, x + s, y + s, z + s, m + s, sources, eps2,
+				ax + first, ay + first, az + first);
+		else
+			kernel(x + first, y + first, z + first, last - first, x + s, y + s, z + s, m + s, sources, parameters,
+				ax + first, ay + first, az + first, NULL);
+	}
+	for (size_t i = first; i < last; i++) {
+		ax[i] *= G;
+		ay[i] *= G;
+		az[i] *= G;
+	}
+}
+
+/*
+ * A rank writes only the velocities and positions of its own domain. The barrier after the drift publishes the new
+ * positions, the one after the kick keeps the next drift from moving bodies that another rank still reads
+ */
+bool SharedDomain::runRank(unsigned rank, int count, double dt) {
+
+	if (header == NULL || rank >= header->Ranks)
+		return false;
+
+	if (rank == 0)
+		balance();
+	if (!barrier())
+		return false;
+	computeAccelerations(rank);
+	if (!barrier())
+		return false;
+
+	for (int s = 0; s < count; s++) {
+		if (s > 0 && s % DOMAIN_BALANCE_STEPS == 0) {
+			if (rank == 0)
+				balance();
+			if (!barrier())
+				return false;
+		}
+
+		size_t first = header->Begin[rank], last = header->Begin[rank + 1];
+		for (size_t i = first; i < last; i++) {
+			vx[i] += 0.5 * dt * ax[i];
+			vy[i] += 0.5 * dt * ay[i];
+			vz[i] += 0.5 * dt * az[i];
+			x[i] += dt * vx[i];
+			y[i] += dt * vy[i];
+			z[i] += dt * vz[i];
+		}
+		if (!barrier())
+			return false;
+
+		computeAccelerations(rank);
+		for (size_t i = first; i < last; i++) {
+			vx[i] += 0.5 * dt * ax[i];
+			vy[i] += 0.5 * dt * ay[i];
+			vz[i] += 0.5 * dt * az[i];
+		}
+		if (!barrier())
+			return false;
+	}
+
+	if (rank == 0)
+		header->Time += count * dt;
+	return true;
+}
+
+void SharedDomain::read(Simulation &simulation) const {
+
+	if (header == NULL || simulation.Bodies.size() != header->Bodies)
+		return;
+
+	BodyStore &b = simulation.Bodies;
+	for (size_t i = 0; i < header->Bodies; i++) {
+		size_t k = ids[i];
+		b.x[k] = x[i]; b.y[k] = y[i]; b.z[k] = z[i];
+		b.vx[k] = vx[i]; b.vy[k] = vy[i]; b.vz[k] = vz[i];
+	}
+	simulation.Time = header->Time;
+	simulation.invalidateAccelerations();
+}
+
+/*
+ * A rank that cannot be started would leave the others waiting at the first barrier, so the ranks already forked are
+ * stopped before giving up. Once a rank dies, rank 0 leaves the barriers and kills the rest
+ */
+bool launchRanks(Simulation &simulation, unsigned ranks, int count, double dt) {
+
+#ifdef _WIN32
+	return false;
+#else
+	SharedDomain domain;
+	if (!domain.create(simulation, ranks))
+		return false;
+
+	std::vector<pid_t> children;
+	for (unsigned rank = 1; rank < ranks; rank++) {
+		pid_t pid = fork();
+		if (pid == 0)
+			_exit(domain.runRank(rank, count, dt) ? EXIT_SUCCESS : EXIT_FAILURE);
+		if (pid < 0) {
+			for (size_t c = 0; c < children.size(); c++) {
+				kill(children[c], SIGKILL);
+				waitpid(children[c], NULL, 0);
+			}
+			return false;
+		}
+		children.push_back(pid);
+	}
+
+	domain.watch(std::vector<int>(children.begin(), children.end()));
+	bool success = domain.runRank(0, count, dt);
+	for (size_t c = 0; c < children.size(); c++) {
+		if (!success)
+			kill(children[c], SIGKILL);
+		int status = 0;
+		if (waitpid(children[c], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+			success = false;
+	}
+	if (success) {
+		domain.read(simulation);
+		simulation.Steps += count;
+	}
+	return success;
+#endif
+}
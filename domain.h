@@ -0,0 +1,97 @@
+#pragma once
+
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "forcelaw.h"
+
+class Simulation;
+
+// Largest number of ranks in one decomposition
+const unsigned DOMAIN_MAX_RANKS = 256;
+// Steps between two rebalances of the domains, the bodies move little in between
+const int DOMAIN_BALANCE_STEPS = 16;
+// Spins at a barrier between two checks that the other ranks are still alive
+const unsigned DOMAIN_POLL_SPINS = 1024;
+
+// Start of the shared segment, followed by the body arrays
+struct DomainHeader {
+	// Number of bodies and of ranks
+	size_t Bodies;
+	unsigned Ranks;
+	// Force parameters of the simulation, and whether to use the Barnes-Hut tree instead of the direct sum
+	double G, Softening, Theta;
+	bool Tree;
+	// Softening model, force law and screening length of the simulation
+	Softening_Model SofteningModel;
+	Force_Law ForceLaw;
+	double ScreeningLength;
+	// Elapsed simulation time
+	double Time;
+	// Bodies of rank r are Begin[r] to Begin[r + 1] in the shared arrays
+	size_t Begin[DOMAIN_MAX_RANKS + 1];
+	// Barrier of the ranks: the number that have arrived and the number of barriers passed
+	std::atomic<unsigned> Arrived, Generation;
+	// Process id of rank 0, and whether a rank has died, which releases the others from the barriers
+	int Launcher;
+	std::atomic<bool> Aborted;
+};
+
+// Bodies of a simulation in memory shared by cooperating processes on one host. The bodies are split into spatial domains
+// by recursive coordinate bisection, one per rank, and every rank integrates its own domain with leapfrog. Positions are
+// exchanged through the shared arrays, and the ranks meet at a barrier in the shared segment around every force evaluation
+class SharedDomain
+{
+public:
+	SharedDomain();
+	~SharedDomain();
+
+	// Map a shared segment with the bodies of the simulation, to be split into the given number of domains. Test particles
+	// and subsystems are left out. Returns false where shared memory is not available, and for the multipole solver, which
+	// the ranks do not implement
+	bool create(const Simulation &simulation, unsigned ranks);
+	// Unmap the segment
+	void close();
+
+	// Advance the domain of one rank by count leapfrog steps of dt, in lockstep with the other ranks. Every rank of the
+	// decomposition has to call this with the same arguments. Returns false when the run was aborted because a rank died
+	bool runRank(unsigned rank, int count, double dt);
+
+	// Process ids of the forked ranks, which rank 0 checks while it waits at a barrier
+	void watch(const std::vector<int> &processes) { children = processes; }
+
+	// Copy the shared state back into the simulation it was created from
+	void read(Simulation &simulation) const;
+
+private:
+	DomainHeader *header;
+	// Body arrays in the segment, and the original index of every body
+	double *m, *x, *y, *z, *vx, *vy, *vz, *ax, *ay, *az, *r;
+	size_t *ids;
+	// Size of the mapping in bytes
+	size_t bytes;
+	// Forked ranks watched by rank 0
+	std::vector<int> children;
+
+	// Wait until every rank has arrived. Returns false when the run was aborted
+	bool barrier();
+	// False when a forked rank has exited (seen from rank 0) or rank 0 is gone (seen from the others)
+	bool alive() const;
+	// Sort the bodies into domains by the current positions. Only one rank may call this, between two barriers
+	void balance();
+	// Accelerations of the bodies of one rank from all bodies
+	void computeAccelerations(unsigned rank);
+
+	SharedDomain(const SharedDomain &);
+	SharedDomain &operator=(const SharedDomain &);
+};
+
+// Advance the simulation by count leapfrog steps of dt, split over the given number of processes on this host. The
+// calling process is rank 0 and forks the others. Returns false when the processes could not be started or one of them
+// died, in which case the others are stopped and the simulation is left as it was
+bool launchRanks(Simulation &simulation, unsigned ranks, int count, double dt);
+
+#endif
@@ -0,0 +1,129 @@
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include "ensemble.h"
+#include "kernels.h"
+#include "simulation.h"
+
+/*
+ * The rows are padded to whole BODY_ALIGNMENT blocks, so every row starts aligned and the padding members stay at zero
+ * mass and position, which the kernels skip as coincident pairs
+ */
+Ensemble::Ensemble(const Simulation &base, size_t members, double perturbation, unsigned seed) :
+	Bodies(base.Bodies.size()), Members(members), G(base.G), Softening(base.Softening), SofteningModel(base.SofteningModel),
+	ForceLaw(base.ForceLaw), ScreeningLength(base.ScreeningLength), Time(base.Time), Steps(0), Pool(NULL), ready(false) {
+
+	const size_t row = BODY_ALIGNMENT / sizeof(double);
+	Stride = (members + row - 1) / row * row;
+	BodyArray *arrays[] = { &m, &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az };
+	for (int k = 0; k < 10; k++)
+		arrays[k]->assign(Bodies * Stride, 0.0);
+
+	const BodyStore &b = base.Bodies;
+	std::mt19937_64 random(seed);
+	std::normal_distribution<double> normal(0.0, 1.0);
+	for (size_t i = 0; i < Bodies; i++) {
+		double r = sqrt(b.x[i] * b.x[i] + b.y[i] * b.y[i] + b.z[i] * b.z[i]);
+		double v = sqrt(b.vx[i] * b.vx[i] + b.vy[i] * b.vy[i] + b.vz[i] * b.vz[i]);
+		for (size_t e = 0; e < members; e++) {
+			size_t k = i * Stride + e;
+			double dr = e == 0 ? 0.0 : perturbation * r;
+			double dv = e == 0 ? 0.0 : perturbation * v;
+			m[k] = b.m[i];
+			x[k] = b.x[i] + dr * normal(random);
+			y[k] = b.y[i] + dr * normal(random);
+			z[k] = b.z[i] + dr * normal(random);
+			vx[k] = b.vx[i] + dv * normal(random);
+			vy[k] = b.vy[i] + dv * normal(random);
+			vz[k] = b.vz[i] + dv * normal(random);
+		}
+	}
+}
+
+/*
+ * The vector kernel covers Plummer softening with the Newtonian law, the other models and laws take the generic kernel
+ */
+void Ensemble::accelerations(size_t first, size_t count) {
+
+	if (SofteningModel == PLUMMER_SOFTENING && ForceLaw == NEWTON_LAW)
+		ensembleAccelerations(Bodies, Stride, count, &m[first], &x[first], &y[first], &z[first], Softening * Softening,
+			&ax[first], &ay[first], &az[first]);
+	else
+		ensembleKernel(SofteningModel, ForceLaw)(Bodies, Stride, count, &m[first], &x[first], &y[first], &z[first],
+			ForceParameters<double>(Softening, ScreeningLength), &ax[first], &ay[first], &az[first]);
+}
+
+/*
+ * Kick-drift-kick leapfrog over the columns of one chunk. The rows of a chunk are short, so the chunk stays in the cache
+ * of its thread over all the steps
+ */
+void Ensemble::advanceChunk(size_t first, size_t count, int steps, double dt) {
+
+	double kick = 0.5 * dt * G;
+
+	if (!ready)
+		accelerations(first, count);
+
+	for (int s = 0; s < steps; s++) {
+		for (size_t i = 0; i < Bodies; i++) {
+			size_t o = i * Stride + first;
+			for (size_t e = o; e < o + count; e++) {
+				vx[e] += kick * ax[e];
+				vy[e] += kick * ay[e];
+				vz[e] += kick * az[e];
+				x[e] += dt * vx[e];
+				y[e] += dt * vy[e];
+				z[e] += dt * vz[e];
+			}
+		}
+
+		accelerations(first, count);
+
+		for (size_t i = 0; i < Bodies; i++) {
+			size_t o = i * Stride + first;
+			for (size_t e = o; e < o + count; e++) {
+				vx[e] += kick * ax[e];
+				vy[e] += kick * ay[e];
+				vz[e] += kick * az[e];
+			}
+		}
+	}
+}
+
+void Ensemble::advance(int count, double dt) {
+
+	if (count <= 0 || Bodies == 0 || Members == 0)
+		return;
+
+	size_t chunks = (Members + ENSEMBLE_CHUNK - 1) / ENSEMBLE_CHUNK;
+	auto task = [&](size_t c) {
+		size_t first = c * ENSEMBLE_CHUNK;
+		advanceChunk(first, std::min(ENSEMBLE_CHUNK, Members - first), count, dt);
+	};
+	if (Pool != NULL && chunks > 1)
+		Pool->run(chunks, task);
+	else
+		for (size_t c = 0; c < chunks; c++)
+			task(c);
+
+	ready = true;
+	Time += count * dt;
+	Steps += count;
+}
+
+double Ensemble::energy(size_t member) const {
+
+	ForceParameters<double> p(Softening, ScreeningLength);
+	double kinetic = 0.0, potential = 0.0;
+
+	for (size_t i = 0; i < Bodies; i++) {
+		size_t a = i * Stride + member;
+		kinetic += 0.5 * m[a] * (vx[a] * vx[a] + vy[a] * vy[a] + vz[a] * vz[a]);
+		for (size_t j = i + 1; j < Bodies; j++) {
+			size_t b = j * Stride + member;
+			double dx = x[b] - x[a], dy = y[b] - y[a], dz = z[b] - z[a];
+			potential += G * m[a] * m[b] * softenedPotential(SofteningModel, dx * dx + dy * dy + dz * dz, p, ForceLaw);
+		}
+	}
+	return kinetic + potential;
+}
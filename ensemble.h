@@ -0,0 +1,59 @@
+#pragma once
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stddef.h>
+#include "bodies.h"
+#include "forcelaw.h"
+#include "threadpool.h"
+
+class Simulation;
+
+// Members per thread task. A multiple of every vector width, so only the last chunk has a scalar tail
+const size_t ENSEMBLE_CHUNK = 64;
+
+// Many independent copies of the same bodies, integrated together with leapfrog. The state is stored as [body][member],
+// so the values of one body in consecutive members are adjacent and one vector lane advances one member. Chunks of
+// members are spread over the threads and run every step of an advance on their own, without a barrier per step
+class Ensemble
+{
+public:
+	// Copy the bodies of base into every member. Member 0 stays exact, the positions and velocities of the others are
+	// perturbed by the given fraction of their length times a normal random number from the seed
+	Ensemble(const Simulation &base, size_t members, double perturbation, unsigned seed);
+
+	// Number of bodies in every member, and number of members
+	size_t Bodies, Members;
+	// Distance between the rows of two bodies, Members rounded up to whole aligned rows
+	size_t Stride;
+	// Mass, position, velocity and acceleration (without G) of body b in member e at b * Stride + e
+	BodyArray m, x, y, z, vx, vy, vz, ax, ay, az;
+	// Gravitational constant, softening and force law, taken from the base simulation
+	double G, Softening;
+	Softening_Model SofteningModel;
+	Force_Law ForceLaw;
+	double ScreeningLength;
+	// Elapsed simulation time and leapfrog steps
+	double Time;
+	unsigned long long Steps;
+	// Worker threads for the chunks of members, NULL to run them on the calling thread
+	ThreadPool *Pool;
+
+	// Advance every member by count leapfrog steps of dt
+	void advance(int count, double dt);
+
+	// Total energy of one member
+	double energy(size_t member) const;
+
+private:
+	// Whether the accelerations belong to the current positions
+	bool ready;
+
+	// Advance the members from first to first + count
+	void advanceChunk(size_t first, size_t count, int steps, double dt);
+	// Accelerations of the members from first to first + count
+	void accelerations(size_t first, size_t count);
+};
+
+#endif
@@ -0,0 +1,447 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "ephemeris.h"
+#include "kepler.h"
+#include "lanes.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Byte offsets in the header record of the DE files: three title lines, the names of the first 400 constants, the span,
+// the number of constants, the astronomical unit, the Earth-Moon mass ratio, the coefficient pointers, the DE number, the
+// pointer of the librations, and the names of any further constants
+static const size_t HEADER_TITLE = 0;
+static const size_t HEADER_NAMES = 252;
+static const size_t HEADER_SPAN = 2652;
+static const size_t HEADER_CONSTANTS = 2676;
+static const size_t HEADER_AU = 2680;
+static const size_t HEADER_RATIO = 2688;
+static const size_t HEADER_POINTERS = 2696;
+static const size_t HEADER_NUMBER = 2840;
+static const size_t HEADER_LIBRATIONS = 2844;
+static const size_t HEADER_MORE_NAMES = 2856;
+// Title lines and their length, names in the first block and the length of a name
+static const int TITLE_LINES = 3;
+static const size_t TITLE_LENGTH = 84;
+static const int HEADER_NAME_COUNT = 400;
+static const size_t NAME_LENGTH = 6;
+// Pointers in the header: the items, then the nutations with two series per subinterval
+static const int HEADER_ITEMS = 12;
+
+Ephemeris::Ephemeris() : Number(0), Start(0.0), End(0.0), Interval(0.0), AU(0.0), EarthMoonRatio(0.0), data(NULL), bytes(0),
+	file(NULL), mapping(NULL), recordSize(0), records(0) { }
+
+Ephemeris::~Ephemeris() {
+
+	close();
+}
+
+/*
+ * The mapping is read only and the file is opened for random access, so the system pages in records where lookups touch
+ * them instead of reading ahead through records nobody asked for
+ */
+bool Ephemeris::open(const char *path) {
+
+	close();
+#ifdef _WIN32
+	HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	HANDLE m = GetFileSizeEx(f, &size) && size.QuadPart > 0 ? CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	const void *view = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (view == NULL) {
+		if (m)
+			CloseHandle(m);
+		CloseHandle(f);
+		return false;
+	}
+	file = f;
+	mapping = m;
+	bytes = (size_t)size.QuadPart;
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat status;
+	void *view = fstat(fd, &status) == 0 && status.st_size > 0 ?
+		mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	// The mapping keeps the file open
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+	madvise(view, (size_t)status.st_size, MADV_RANDOM);
+	bytes = (size_t)status.st_size;
+#endif
+	data = (const unsigned char *)view;
+
+	if (!readHeader()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void Ephemeris::close() {
+
+	if (data) {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle((HANDLE)mapping);
+		CloseHandle((HANDLE)file);
+#else
+		munmap((void *)data, bytes);
+#endif
+	}
+	data = NULL;
+	bytes = 0;
+	file = mapping = NULL;
+	recordSize = records = 0;
+	names.clear();
+	values.clear();
+	Title.clear();
+	Number = 0;
+}
+
+/*
+ * The record length is not stored, it follows from the last coefficient any pointer reaches. Files of the other byte order
+ * fail the plausibility checks of the span and the DE number
+ */
+bool Ephemeris::readHeader() {
+
+	if (bytes < HEADER_MORE_NAMES)
+		return false;
+
+	double span[3];
+	int count, number, pointers[HEADER_ITEMS][3], librations[3];
+	memcpy(span, data + HEADER_SPAN, sizeof(span));
+	memcpy(&count, data + HEADER_CONSTANTS, sizeof(count));
+	memcpy(&AU, data + HEADER_AU, sizeof(AU));
+	memcpy(&EarthMoonRatio, data + HEADER_RATIO, sizeof(EarthMoonRatio));
+	memcpy(pointers, data + HEADER_POINTERS, sizeof(pointers));
+	memcpy(&number, data + HEADER_NUMBER, sizeof(number));
+	memcpy(librations, data + HEADER_LIBRATIONS, sizeof(librations));
+	if (number <= 0 || number > 100000 || count < 0 || count > 100000 || !(span[2] > 0.0) || !(span[1] > span[0]) ||
+		!(EarthMoonRatio > 0.0))
+		return false;
+
+	size_t size = 0;
+	for (int i = 0; i <= HEADER_ITEMS; i++) {
+		const int *p = i < HEADER_ITEMS ? pointers[i] : librations;
+		if (p[1] <= 0 || p[2] <= 0) {
+			if (i < EPHEMERIS_ITEMS)
+				return false;
+			continue;
+		}
+		if (p[0] < 3)
+			return false;
+		size = std::max(size, (size_t)(p[0] - 1) + (size_t)p[1] * p[2] * (i == EPHEMERIS_ITEMS ? 2 : 3));
+	}
+	for (int i = 0; i < EPHEMERIS_ITEMS; i++) {
+		offset[i] = pointers[i][0] - 1;
+		coefficients[i] = pointers[i][1];
+		subintervals[i] = pointers[i][2];
+	}
+
+	size_t recordBytes = size * sizeof(double);
+	size_t spanRecords = (size_t)((span[1] - span[0]) / span[2] + 0.5);
+	if (recordBytes < HEADER_MORE_NAMES || spanRecords == 0 || bytes / recordBytes < 2 + spanRecords)
+		return false;
+	const double *first = (const double *)(data + 2 * recordBytes);
+	if (first[0] != span[0])
+		return false;
+
+	recordSize = size;
+	records = spanRecords;
+	Number = number;
+	Start = span[0];
+	End = span[1];
+	Interval = span[2];
+
+	for (int line = 0; line < TITLE_LINES; line++) {
+		std::string text((const char *)data + HEADER_TITLE + line * TITLE_LENGTH, TITLE_LENGTH);
+		text.erase(text.find_last_not_of(' ') + 1);
+		Title += (line ? "\n" : "") + text;
+	}
+	// Names past the first block follow the header, values fill the second record
+	for (int k = 0; k < count; k++) {
+		size_t at = k < HEADER_NAME_COUNT ? HEADER_NAMES + k * NAME_LENGTH : HEADER_MORE_NAMES + (k - HEADER_NAME_COUNT) * NAME_LENGTH;
+		if (at + NAME_LENGTH > recordBytes || (k + 1) * sizeof(double) > recordBytes)
+			break;
+		std::string name((const char *)data + at, NAME_LENGTH);
+		name.erase(name.find_last_not_of(' ') + 1);
+		double value;
+		memcpy(&value, data + recordBytes + k * sizeof(double), sizeof(value));
+		names.push_back(name);
+		values.push_back(value);
+	}
+	return true;
+}
+
+double Ephemeris::constant(const char *name, double def) const {
+
+	for (size_t k = 0; k < names.size(); k++)
+		if (names[k] == name)
+			return values[k];
+	return def;
+}
+
+/*
+ * The time is taken relative to the start of the file before the fraction is added, which keeps its rounding error to
+ * that of the day number
+ */
+const double *Ephemeris::record(double jd, double fraction, double &s) const {
+
+	if (data == NULL)
+		return NULL;
+	double t = (jd - Start) + fraction;
+	if (!(t >= 0.0 && t <= End - Start))
+		return NULL;
+	size_t r = std::min((size_t)(t / Interval), records - 1);
+	s = (t - r * Interval) / Interval;
+	return (const double *)(data + (2 + r) * recordSize * sizeof(double));
+}
+
+/*
+ * Chebyshev polynomials and their derivatives by the three-term recurrences, T(k) = 2 t T(k-1) - T(k-2) and
+ * T'(k) = 2 T(k-1) + 2 t T'(k-1) - T'(k-2). The derivative is scaled from the subinterval [-1, 1] to days
+ */
+void Ephemeris::evaluate(const double *rec, int item, double s, double *position, double *velocity) const {
+
+	long long n = coefficients[item];
+	double sub = subintervals[item];
+	double u = s * sub;
+	double k = std::min(floor(u), sub - 1.0);
+	double t = 2.0 * (u - k) - 1.0;
+	const double *c = rec + offset[item] + (long long)k * 3 * n;
+	double scale = 2.0 * sub / Interval;
+
+	for (int axis = 0; axis < 3; axis++, c += n) {
+		double t0 = 1.0, t1 = t, d0 = 0.0, d1 = 1.0;
+		double p = c[0] + (n > 1 ? c[1] * t : 0.0);
+		double v = n > 1 ? c[1] : 0.0;
+		for (long long j = 2; j < n; j++) {
+			double t2 = 2.0 * t * t1 - t0;
+			double d2 = 2.0 * t1 + 2.0 * t * d1 - d0;
+			p += c[j] * t2;
+			v += c[j] * d2;
+			t0 = t1; t1 = t2;
+			d0 = d1; d1 = d2;
+		}
+		position[axis] = p;
+		if (velocity)
+			velocity[axis] = v * scale;
+	}
+}
+
+bool Ephemeris::stateAt(int body, double jd, double fraction, double &x, double &y, double &z, double &vx, double &vy, double &vz) const {
+
+	double s;
+	const double *rec = record(jd, fraction, s);
+	if (rec == NULL || body < 0 || body >= EPHEMERIS_BODIES)
+		return false;
+
+	double p[3], v[3];
+	if (body == EPHEMERIS_EARTH || body == EPHEMERIS_MOON) {
+		double mp[3], mv[3];
+		evaluate(rec, EPHEMERIS_EARTH_MOON, s, p, v);
+		evaluate(rec, EPHEMERIS_MOON, s, mp, mv);
+		double f = 1.0 / (1.0 + EarthMoonRatio);
+		for (int axis = 0; axis < 3; axis++) {
+			p[axis] -= f * mp[axis];
+			v[axis] -= f * mv[axis];
+			if (body == EPHEMERIS_MOON) {
+				p[axis] += mp[axis];
+				v[axis] += mv[axis];
+			}
+		}
+	}
+	else
+		evaluate(rec, body, s, p, v);
+
+	x = p[0]; y = p[1]; z = p[2];
+	vx = v[0]; vy = v[1]; vz = v[2];
+	return true;
+}
+
+/*
+ * Clenshaw's recurrence b(k) = 2 t b(k+1) - b(k+2) + c(k) for the items of a register at once, each with its own time in
+ * its subinterval and its own coefficients gathered from the record. Lanes with fewer coefficients read zeros above their
+ * count, which leaves their sums unchanged, so every lane runs to the largest count
+ */
+template <typename L>
+static void positionsLanes(const double *rec, const long long *index, const long long *count, const double *t, long long most,
+	double *x, double *y, double *z) {
+
+	typedef typename L::V V;
+	typedef typename L::I I;
+	I at = L::loadIndex(index);
+	I n = L::loadIndex(count);
+	V tc = L::load(t);
+	V t2 = L::add(tc, tc);
+	double *out[3] = { x, y, z };
+
+	for (int axis = 0; axis < 3; axis++) {
+		V b1 = L::set(0.0), b2 = L::set(0.0);
+		for (long long k = most - 1; k >= 1; k--) {
+			V b = L::add(L::sub(L::mul(t2, b1), b2), L::gather(rec, at, k, n));
+			b2 = b1;
+			b1 = b;
+		}
+		L::store(out[axis], L::add(L::sub(L::mul(tc, b1), b2), L::gather(rec, at, 0, n)));
+		at = L::addIndex(at, n);
+	}
+}
+
+/*
+ * The subinterval and its time are found per item, then the series of the items are summed side by side. The Moon is
+ * stored relative to the Earth, which follows from the Earth-Moon barycenter
+ */
+bool Ephemeris::positionsAt(double jd, double fraction, double *x, double *y, double *z) const {
+
+	double s;
+	const double *rec = record(jd, fraction, s);
+	if (rec == NULL)
+		return false;
+
+	long long index[EPHEMERIS_ITEMS];
+	double t[EPHEMERIS_ITEMS];
+	for (int i = 0; i < EPHEMERIS_ITEMS; i++) {
+		double u = s * subintervals[i];
+		double k = std::min(floor(u), subintervals[i] - 1.0);
+		t[i] = 2.0 * (u - k) - 1.0;
+		index[i] = offset[i] + (long long)k * 3 * coefficients[i];
+	}
+
+	size_t i = 0;
+#if defined(KERNEL_AVX512) || defined(KERNEL_AVX2)
+	for (; i + VectorLanes::WIDTH <= EPHEMERIS_ITEMS; i += VectorLanes::WIDTH)
+		positionsLanes<VectorLanes>(rec, index + i, coefficients + i, t + i,
+			*std::max_element(coefficients + i, coefficients + i + VectorLanes::WIDTH), x + i, y + i, z + i);
+#endif
+	for (; i < EPHEMERIS_ITEMS; i++)
+		positionsLanes<ScalarLanes>(rec, index + i, coefficients + i, t + i, coefficients[i], x + i, y + i, z + i);
+
+	double f = 1.0 / (1.0 + EarthMoonRatio);
+	x[EPHEMERIS_EARTH] = x[EPHEMERIS_EARTH_MOON] - f * x[EPHEMERIS_MOON];
+	y[EPHEMERIS_EARTH] = y[EPHEMERIS_EARTH_MOON] - f * y[EPHEMERIS_MOON];
+	z[EPHEMERIS_EARTH] = z[EPHEMERIS_EARTH_MOON] - f * z[EPHEMERIS_MOON];
+	x[EPHEMERIS_MOON] += x[EPHEMERIS_EARTH];
+	y[EPHEMERIS_MOON] += y[EPHEMERIS_EARTH];
+	z[EPHEMERIS_MOON] += z[EPHEMERIS_EARTH];
+	return true;
+}
+
+size_t Ephemeris::positionsAt(const double *jd, size_t count, double *x, double *y, double *z, ThreadPool *pool) const {
+
+	size_t blocks = (count + EPHEMERIS_BLOCK - 1) / EPHEMERIS_BLOCK;
+	std::vector<size_t> inside(blocks, 0);
+	auto task = [&](size_t b) {
+		size_t end = std::min((b + 1) * EPHEMERIS_BLOCK, count);
+		for (size_t e = b * EPHEMERIS_BLOCK; e < end; e++) {
+			size_t at = e * EPHEMERIS_BODIES;
+			if (positionsAt(jd[e], 0.0, x + at, y + at, z + at))
+				inside[b]++;
+			else
+				for (int k = 0; k < EPHEMERIS_BODIES; k++)
+					x[at + k] = y[at + k] = z[at + k] = NAN;
+		}
+	};
+
+	if (pool && blocks > 1)
+		pool->run(blocks, task);
+	else
+		for (size_t b = 0; b < blocks; b++)
+			task(b);
+
+	size_t total = 0;
+	for (size_t b = 0; b < blocks; b++)
+		total += inside[b];
+	return total;
+}
+
+/*
+ * Chebyshev interpolation at the N nodes t(j) = cos(pi (j + 1/2) / N) of every subinterval, where the coefficients follow
+ * exactly from c(k) = 2/N sum f(t(j)) T(k)(t(j)), with half that for c(0). The header record is padded with blanks and
+ * zeros like asc2eph does, and there are no nutations or librations
+ */
+bool writeEphemeris(const char *path, int number, double start, double end, double interval, double au, double earthMoonRatio,
+	const std::function<void(int item, double jd, double &x, double &y, double &z)> &positions) {
+
+	if (!(interval > 0.0) || !(end > start))
+		return false;
+
+	int pointers[HEADER_ITEMS][3] = {}, librations[3] = {};
+	int next = 3;
+	for (int i = 0; i < EPHEMERIS_ITEMS; i++) {
+		pointers[i][0] = next;
+		pointers[i][1] = EPHEMERIS_LAYOUT[i][0];
+		pointers[i][2] = EPHEMERIS_LAYOUT[i][1];
+		next += 3 * EPHEMERIS_LAYOUT[i][0] * EPHEMERIS_LAYOUT[i][1];
+	}
+	size_t size = std::max((size_t)(next - 1), (HEADER_MORE_NAMES + sizeof(double) - 1) / sizeof(double));
+	size_t records = (size_t)ceil((end - start) / interval - 1.0e-9);
+	double span[3] = { start, start + records * interval, interval };
+
+	std::vector<unsigned char> header(size * sizeof(double), 0);
+	memset(&header[0], ' ', HEADER_SPAN);
+	char line[TITLE_LENGTH + 1];
+	const char *titles[TITLE_LINES] = { "JPL Planetary Ephemeris DE%d fixture", "Start Epoch: JED= %.1f", "Final Epoch: JED= %.1f" };
+	for (int k = 0; k < TITLE_LINES; k++) {
+		int length = k == 0 ? snprintf(line, sizeof(line), titles[k], number) : snprintf(line, sizeof(line), titles[k], span[k == 1 ? 0 : 1]);
+		memcpy(&header[HEADER_TITLE + k * TITLE_LENGTH], line, std::min((size_t)length, TITLE_LENGTH));
+	}
+	const char *names[] = { "DENUM", "AU", "EMRAT" };
+	double values[] = { (double)number, au, earthMoonRatio };
+	int count = 3;
+	for (int k = 0; k < count; k++)
+		memcpy(&header[HEADER_NAMES + k * NAME_LENGTH], names[k], strlen(names[k]));
+	memcpy(&header[HEADER_SPAN], span, sizeof(span));
+	memcpy(&header[HEADER_CONSTANTS], &count, sizeof(count));
+	memcpy(&header[HEADER_AU], &au, sizeof(au));
+	memcpy(&header[HEADER_RATIO], &earthMoonRatio, sizeof(earthMoonRatio));
+	memcpy(&header[HEADER_POINTERS], pointers, sizeof(pointers));
+	memcpy(&header[HEADER_NUMBER], &number, sizeof(number));
+	memcpy(&header[HEADER_LIBRATIONS], librations, sizeof(librations));
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(&header[0], 1, header.size(), f) == header.size();
+	std::vector<double> rec(size, 0.0);
+	memcpy(&rec[0], values, sizeof(values));
+	ok = ok && fwrite(&rec[0], sizeof(double), size, f) == size;
+
+	for (size_t r = 0; r < records && ok; r++) {
+		std::fill(rec.begin(), rec.end(), 0.0);
+		rec[0] = start + r * interval;
+		rec[1] = rec[0] + interval;
+		for (int i = 0; i < EPHEMERIS_ITEMS; i++) {
+			int n = EPHEMERIS_LAYOUT[i][0], subs = EPHEMERIS_LAYOUT[i][1];
+			double length = interval / subs;
+			for (int sub = 0; sub < subs; sub++) {
+				double *c = &rec[pointers[i][0] - 1 + sub * 3 * n];
+				for (int j = 0; j < n; j++) {
+					double angle = PI * (j + 0.5) / n;
+					double p[3];
+					positions(i, rec[0] + sub * length + 0.5 * (cos(angle) + 1.0) * length, p[0], p[1], p[2]);
+					for (int axis = 0; axis < 3; axis++)
+						for (int k = 0; k < n; k++)
+							c[axis * n + k] += (k == 0 ? 1.0 : 2.0) / n * p[axis] * cos(k * angle);
+				}
+			}
+		}
+		ok = fwrite(&rec[0], sizeof(double), size, f) == size;
+	}
+	return fclose(f) == 0 && ok;
+}
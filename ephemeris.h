@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "threadpool.h"
+
+// Epochs per task when positions are evaluated on the thread pool
+const size_t EPHEMERIS_BLOCK = 1024;
+
+// Items with three Chebyshev series per subinterval in the binary JPL DE files, in file order. The Moon is relative to the
+// Earth and every other item relative to the solar system barycenter, in km
+enum Ephemeris_Body {
+	EPHEMERIS_MERCURY,
+	EPHEMERIS_VENUS,
+	EPHEMERIS_EARTH_MOON,
+	EPHEMERIS_MARS,
+	EPHEMERIS_JUPITER,
+	EPHEMERIS_SATURN,
+	EPHEMERIS_URANUS,
+	EPHEMERIS_NEPTUNE,
+	EPHEMERIS_PLUTO,
+	EPHEMERIS_MOON,
+	EPHEMERIS_SUN,
+	EPHEMERIS_ITEMS,
+	// Derived from the Earth-Moon barycenter, the Moon and the Earth-Moon mass ratio
+	EPHEMERIS_EARTH = EPHEMERIS_ITEMS,
+	EPHEMERIS_BODIES
+};
+
+// Coefficients per series and subintervals per record of every item in DE430/DE440, with 32-day records
+const int EPHEMERIS_LAYOUT[EPHEMERIS_ITEMS][2] = {
+	{ 14, 4 }, { 10, 2 }, { 13, 2 }, { 11, 1 }, { 8, 1 }, { 7, 1 }, { 6, 1 }, { 6, 1 }, { 6, 1 }, { 13, 8 }, { 11, 2 }
+};
+const double EPHEMERIS_INTERVAL = 32.0;
+
+// Reader of the binary JPL DE ephemeris files (as written by asc2eph, in the byte order of this machine). The file is
+// memory-mapped and records are only read where a lookup falls, so the operating system pages in just the records that
+// are used. Positions follow from the Chebyshev series of the record at any epoch, without integrating
+class Ephemeris
+{
+public:
+	Ephemeris();
+	~Ephemeris();
+
+	// Map a file and read its header. Return false when it cannot be mapped or is not a DE file of this byte order
+	bool open(const char *path);
+
+	// Unmap the file
+	void close();
+
+	// True while a file is mapped
+	bool isOpen() const { return data != NULL; }
+
+	// DE number and title lines of the file
+	int Number;
+	std::string Title;
+	// First and last Julian day (TDB) covered, and the days per record
+	double Start, End, Interval;
+	// Astronomical unit in km and Earth-Moon mass ratio
+	double AU, EarthMoonRatio;
+
+	// Value of a named constant of the file, or def when the file has none of that name
+	double constant(const char *name, double def = 0.0) const;
+
+	// Barycentric position (km) and velocity (km per day) of one body at the Julian day jd + fraction, which may be split
+	// to keep the full precision of the time. The Moon is barycentric here too. Return false outside the file
+	bool stateAt(int body, double jd, double fraction, double &x, double &y, double &z, double &vx, double &vy, double &vz) const;
+
+	// Barycentric positions (km) of every body (EPHEMERIS_BODIES entries) at the Julian day jd + fraction, with the items
+	// evaluated side by side in the vector lanes. Return false outside the file
+	bool positionsAt(double jd, double fraction, double *x, double *y, double *z) const;
+
+	// Barycentric positions of every body at count Julian days, stored by epoch with EPHEMERIS_BODIES entries each. Epochs
+	// outside the file give NaN. Return the number of epochs inside
+	size_t positionsAt(const double *jd, size_t count, double *x, double *y, double *z, ThreadPool *pool = NULL) const;
+
+private:
+	// Mapped file, its size and the handles that keep it mapped
+	const unsigned char *data;
+	size_t bytes;
+	void *file, *mapping;
+	// Doubles per record and number of data records
+	size_t recordSize, records;
+	// Offset of the first coefficient in a record, coefficients per series and subintervals of every item, with the
+	// offsets and counts as lane indices
+	long long offset[EPHEMERIS_ITEMS], coefficients[EPHEMERIS_ITEMS];
+	double subintervals[EPHEMERIS_ITEMS];
+	// Names and values of the constants
+	std::vector<std::string> names;
+	std::vector<double> values;
+
+	// Read the header and constants of the mapped file, false when it is not a DE file
+	bool readHeader();
+	// Data record of the time jd + fraction and the time within it as a fraction of the record, NULL outside the file
+	const double *record(double jd, double fraction, double &s) const;
+	// Raw position and velocity of one item, from its record
+	void evaluate(const double *coefficients, int item, double s, double *position, double *velocity) const;
+};
+
+// Write a DE file of the given number, span and interval (Julian days) in the layout of EPHEMERIS_LAYOUT, with the
+// coefficients fitted at the Chebyshev nodes of every subinterval to positions(item, jd, x, y, z), the raw position of an
+// item in km. Used to make fixtures; return false when the file cannot be written
+bool writeEphemeris(const char *path, int number, double start, double end, double interval, double au, double earthMoonRatio,
+	const std::function<void(int item, double jd, double &x, double &y, double &z)> &positions);
+
+#endif
@@ -0,0 +1,489 @@
+#include <math.h>
+#include <functional>
+#include "fmm.h"
+#include "kernels.h"
+#include "lanes.h"
+
+// Largest number of expansion terms
+static const int MAX_TERMS = (FMM_MAX_ORDER + 1) * (FMM_MAX_ORDER + 2) * (FMM_MAX_ORDER + 3) / 6;
+
+static void forEach(ThreadPool *pool, size_t count, const std::function<void(size_t)> &task) {
+
+	if (pool)
+		pool->run(count, task);
+	else
+		for (size_t i = 0; i < count; i++)
+			task(i);
+}
+
+Fmm::Fmm(int order, double theta, int leafSize)
+	: Tree(leafSize), Order(0), Theta(theta), Terms(0), CellInteractions(0), BodyInteractions(0) {
+
+	setOrder(order);
+}
+
+/*
+ * Enumerate the multi-indices up to the order and build the translation operators as flat lists of terms,
+ * so that every translation is a single loop over precomputed indices. The expansions are scaled by 1 / k!,
+ * which leaves no binomial coefficients in the terms
+ */
+void Fmm::setOrder(int order) {
+
+	if (order < 1)
+		order = 1;
+	if (order > FMM_MAX_ORDER)
+		order = FMM_MAX_ORDER;
+	if (order == Order)
+		return;
+	Order = order;
+
+	// Multi-indices sorted by total degree, and their position in a (p+1)^3 table
+	int side = Order + 1;
+	std::vector<int> table(side * side * side, -1);
+	ex.clear(); ey.clear(); ez.clear();
+	for (int degree = 0; degree <= Order; degree++)
+		for (int i = degree; i >= 0; i--)
+			for (int j = degree - i; j >= 0; j--) {
+				int k = degree - i - j;
+				table[(i * side + j) * side + k] = (int)ex.size();
+				ex.push_back(i); ey.push_back(j); ez.push_back(k);
+			}
+	Terms = (int)ex.size();
+
+	// Neighbouring multi-indices used by the recurrences
+	lower.assign(Terms, -1);
+	lowerAxis.assign(Terms, -1);
+	lowerScale.assign(Terms, 0.0);
+	for (int axis = 0; axis < 3; axis++) {
+		minus1[axis].assign(Terms, -1);
+		minus2[axis].assign(Terms, -1);
+	}
+	for (int t = 0; t < Terms; t++) {
+		int e[3] = { ex[t], ey[t], ez[t] };
+		for (int axis = 0; axis < 3; axis++) {
+			int f[3] = { e[0], e[1], e[2] };
+			if (f[axis] >= 1) {
+				f[axis] -= 1;
+				minus1[axis][t] = table[(f[0] * side + f[1]) * side + f[2]];
+				if (lower[t] < 0) {
+					lower[t] = minus1[axis][t];
+					lowerAxis[t] = axis;
+					lowerScale[t] = 1.0 / e[axis];
+				}
+			}
+			if (f[axis] >= 1) {
+				f[axis] -= 1;
+				minus2[axis][t] = table[(f[0] * side + f[1]) * side + f[2]];
+			}
+		}
+	}
+
+	// Neighbours and weights of the kernel recurrence, with weight 0 on term 0 in place of missing neighbours
+	recurrenceIndex.assign(Terms * 6, 0);
+	recurrenceWeight.assign(Terms * 6, 0.0);
+	for (int t = 1; t < Terms; t++) {
+		int e[3] = { ex[t], ey[t], ez[t] };
+		double degree = e[0] + e[1] + e[2];
+		for (int axis = 0; axis < 3; axis++) {
+			if (minus1[axis][t] >= 0) {
+				recurrenceIndex[t * 6 + axis] = minus1[axis][t];
+				recurrenceWeight[t * 6 + axis] = -(2.0 * degree - 1.0) * e[axis] / degree;
+			}
+			if (minus2[axis][t] >= 0) {
+				recurrenceIndex[t * 6 + 3 + axis] = minus2[axis][t];
+				recurrenceWeight[t * 6 + 3 + axis] = -(degree - 1.0) * e[axis] * (e[axis] - 1) / degree;
+			}
+		}
+	}
+
+	// M'_t += M_s w_(t - s) and L'_s += L_t w_(t - s) for s <= t, with the scaled monomials w of the shift
+	shiftMultipole.clear();
+	shiftLocal.clear();
+	multipoleToLocal.clear();
+	translationStart.assign(Terms + 1, 0);
+	for (int t = 0; t < Terms; t++) {
+		for (int s = 0; s < Terms; s++) {
+			int dx = ex[t] - ex[s], dy = ey[t] - ey[s], dz = ez[t] - ez[s];
+			if (dx >= 0 && dy >= 0 && dz >= 0) {
+				int shift = table[(dx * side + dy) * side + dz];
+				FmmTerm up = { t, s, shift };
+				FmmTerm down = { s, t, shift };
+				shiftMultipole.push_back(up);
+				shiftLocal.push_back(down);
+			}
+
+			// L_t += D_(s + t) M_s for |s| + |t| <= p
+			int sx = ex[t] + ex[s], sy = ey[t] + ey[s], sz = ez[t] + ez[s];
+			if (sx + sy + sz <= Order) {
+				FmmTerm term = { t, s, table[(sx * side + sy) * side + sz] };
+				multipoleToLocal.push_back(term);
+			}
+		}
+		translationStart[t + 1] = (int)multipoleToLocal.size();
+	}
+}
+
+/*
+ * Derivatives of the softened kernel with the recurrence of Lindsay and Krasny, multiplied through by k!:
+ * |k| R^2 D_k = -(2|k| - 1) sum_i k_i x_i D_(k - e_i) - (|k| - 1) sum_i k_i (k_i - 1) D_(k - 2e_i), where R^2 = r^2 + eps^2.
+ * The lanes hold the separations of different source cells
+ */
+template <typename L>
+void Fmm::derivatives(const double *x, const double *y, const double *z, double eps2, double *d) const {
+
+	const size_t W = L::WIDTH;
+	typename L::V c[3] = { L::load(x), L::load(y), L::load(z) };
+	for (size_t w = 0; w < W; w++)
+		d[w] = 1.0 / sqrt(x[w] * x[w] + y[w] * y[w] + z[w] * z[w] + eps2);
+	typename L::V invR2 = L::mul(L::load(d), L::load(d));
+
+	for (int t = 1; t < Terms; t++) {
+		const int *index = &recurrenceIndex[t * 6];
+		const double *weight = &recurrenceWeight[t * 6];
+		typename L::V sum1 = L::add(L::add(L::mul(L::mul(L::set(weight[0]), c[0]), L::load(d + index[0] * W)),
+			L::mul(L::mul(L::set(weight[1]), c[1]), L::load(d + index[1] * W))), L::mul(L::mul(L::set(weight[2]), c[2]), L::load(d + index[2] * W)));
+		typename L::V sum2 = L::add(L::add(L::mul(L::set(weight[3]), L::load(d + index[3] * W)),
+			L::mul(L::set(weight[4]), L::load(d + index[4] * W))), L::mul(L::set(weight[5]), L::load(d + index[5] * W)));
+		L::store(d + t * W, L::mul(L::add(sum1, sum2), invR2));
+	}
+}
+
+/*
+ * L_t += sum_s D_(s + t) M_s over |s| + |t| <= p, for up to L::WIDTH source cells at once, into one lane of sum per source.
+ * Unused lanes repeat the last source with zero moments
+ */
+template <typename L>
+void Fmm::translate(const int *sources, int count, const OctreeNode &target, double eps2, double *sum) const {
+
+	const size_t W = L::WIDTH;
+	double x[W], y[W], z[W];
+	double d[MAX_TERMS * W], m[MAX_TERMS * W];
+
+	for (size_t w = 0; w < W; w++) {
+		int cell = sources[(int)w < count ? w : count - 1];
+		const OctreeNode &source = Tree.Nodes[cell];
+		x[w] = target.mx - source.mx;
+		y[w] = target.my - source.my;
+		z[w] = target.mz - source.mz;
+		const double *moments = &Multipoles[cell * Terms];
+		for (int s = 0; s < Terms; s++)
+			m[s * W + w] = (int)w < count ? moments[s] : 0.0;
+	}
+	derivatives<L>(x, y, z, eps2, d);
+
+	// Four independent sums per target term hide the latency of the additions
+	const FmmTerm *term = &multipoleToLocal[0];
+	for (int t = 0; t < Terms; t++) {
+		const FmmTerm *end = &multipoleToLocal[0] + translationStart[t + 1];
+		typename L::V s0 = L::load(sum + t * W), s1 = L::set(0.0), s2 = s1, s3 = s1;
+		for (; term + 4 <= end; term += 4) {
+			s0 = L::add(s0, L::mul(L::load(d + term[0].kernel * W), L::load(m + term[0].source * W)));
+			s1 = L::add(s1, L::mul(L::load(d + term[1].kernel * W), L::load(m + term[1].source * W)));
+			s2 = L::add(s2, L::mul(L::load(d + term[2].kernel * W), L::load(m + term[2].source * W)));
+			s3 = L::add(s3, L::mul(L::load(d + term[3].kernel * W), L::load(m + term[3].source * W)));
+		}
+		for (; term < end; term++)
+			s0 = L::add(s0, L::mul(L::load(d + term->kernel * W), L::load(m + term->source * W)));
+		L::store(sum + t * W, L::add(L::add(s0, s1), L::add(s2, s3)));
+	}
+}
+
+/*
+ * Scaled monomials x^k / k!, each from the one below it along its first non-zero axis
+ */
+void Fmm::monomials(double x, double y, double z, double *p) const {
+
+	double c[3] = { x, y, z };
+	p[0] = 1.0;
+	for (int t = 1; t < Terms; t++)
+		p[t] = p[lower[t]] * c[lowerAxis[t]] * lowerScale[t];
+}
+
+/*
+ * The upward pass, the interaction lists and the downward pass each run on the thread pool. The passes go one depth at a
+ * time, and every task only writes to its own cell or to the bodies of its own leaf, so the result does not depend on the
+ * number of threads
+ */
+void Fmm::computeAccelerations(const BodyStore &bodies, double G, double softening, double *ax, double *ay, double *az, ThreadPool *pool) {
+
+	int n = (int)bodies.size();
+	for (int i = 0; i < n; i++)
+		ax[i] = ay[i] = az[i] = 0.0;
+	CellInteractions = 0;
+	BodyInteractions = 0;
+	if (n == 0)
+		return;
+
+	double eps2 = softening * softening;
+	Tree.build(bodies);
+	prepare(bodies);
+	int depths = (int)levelStart.size() - 1;
+
+	for (int level = depths - 1; level >= 0; level--)
+		forEach(pool, levelStart[level + 1] - levelStart[level], [&](size_t i) { gather(levels[levelStart[level] + i]); });
+
+	listInteractions();
+	forEach(pool, Tree.Nodes.size(), [&](size_t a) { interact((int)a, eps2); });
+
+	for (int level = 0; level < depths; level++)
+		forEach(pool, levelStart[level + 1] - levelStart[level], [&](size_t i) { scatter(levels[levelStart[level] + i]); });
+
+	for (int k = 0; k < n; k++) {
+		int i = Tree.Index[k];
+		ax[i] = G * accX[k];
+		ay[i] = G * accY[k];
+		az[i] = G * accZ[k];
+	}
+}
+
+/*
+ * Children always come after their parent in Octree::Nodes, so a forward sweep finds the depth of every cell
+ */
+void Fmm::prepare(const BodyStore &bodies) {
+
+	int n = (int)bodies.size();
+	x.resize(n); y.resize(n); z.resize(n); m.resize(n);
+	accX.assign(n, 0.0); accY.assign(n, 0.0); accZ.assign(n, 0.0);
+	for (int k = 0; k < n; k++) {
+		int i = Tree.Index[k];
+		x[k] = bodies.x[i];
+		y[k] = bodies.y[i];
+		z[k] = bodies.z[i];
+		m[k] = bodies.m[i];
+	}
+
+	int count = (int)Tree.Nodes.size();
+	Multipoles.assign(count * Terms, 0.0);
+	Locals.assign(count * Terms, 0.0);
+	radius.assign(count, 0.0);
+	parent.assign(count, -1);
+
+	std::vector<int> depth(count, 0);
+	int depths = 1;
+	for (int node = 0; node < count; node++) {
+		const OctreeNode &cell = Tree.Nodes[node];
+		for (int c = 0; c < cell.childCount; c++) {
+			parent[cell.firstChild + c] = node;
+			depth[cell.firstChild + c] = depth[node] + 1;
+		}
+		if (depth[node] + 1 > depths)
+			depths = depth[node] + 1;
+	}
+
+	levelStart.assign(depths + 1, 0);
+	for (int node = 0; node < count; node++)
+		levelStart[depth[node] + 1]++;
+	for (int level = 0; level < depths; level++)
+		levelStart[level + 1] += levelStart[level];
+	std::vector<int> fill(levelStart.begin(), levelStart.end() - 1);
+	levels.resize(count);
+	for (int node = 0; node < count; node++)
+		levels[fill[depth[node]]++] = node;
+}
+
+/*
+ * The traversal runs on one thread and only collects pairs. Sorting them by target gives every cell its own lists, so
+ * the translations and direct sums into different cells can run in parallel
+ */
+void Fmm::listInteractions() {
+
+	std::vector<int> cellPairs, leafPairs;
+	traverse(0, 0, cellPairs, leafPairs);
+
+	int count = (int)Tree.Nodes.size();
+	std::vector<int> *sources[2] = { &cellSources, &leafSources };
+	std::vector<int> *starts[2] = { &cellStart, &leafStart };
+	std::vector<int> *pairs[2] = { &cellPairs, &leafPairs };
+	for (int list = 0; list < 2; list++) {
+		std::vector<int> &start = *starts[list];
+		const std::vector<int> &pair = *pairs[list];
+		start.assign(count + 1, 0);
+		for (size_t k = 0; k < pair.size(); k += 2)
+			start[pair[k] + 1]++;
+		for (int a = 0; a < count; a++)
+			start[a + 1] += start[a];
+		std::vector<int> fill(start.begin(), start.end() - 1);
+		sources[list]->resize(pair.size() / 2);
+		for (size_t k = 0; k < pair.size(); k += 2)
+			(*sources[list])[fill[pair[k]]++] = pair[k + 1];
+	}
+
+	CellInteractions = cellSources.size();
+	for (size_t k = 0; k < leafPairs.size(); k += 2) {
+		const OctreeNode &target = Tree.Nodes[leafPairs[k]];
+		const OctreeNode &source = Tree.Nodes[leafPairs[k + 1]];
+		BodyInteractions += (unsigned long long)(target.end - target.begin) * (source.end - source.begin);
+	}
+}
+
+/*
+ * Well separated pairs exchange a multipole-to-local translation. Otherwise the larger cell is split,
+ * and pairs of leaves are summed directly
+ */
+void Fmm::traverse(int a, int b, std::vector<int> &cellPairs, std::vector<int> &leafPairs) const {
+
+	const OctreeNode &target = Tree.Nodes[a];
+	const OctreeNode &source = Tree.Nodes[b];
+
+	if (a == b) {
+		if (target.childCount == 0) {
+			leafPairs.push_back(a);
+			leafPairs.push_back(b);
+		}
+		else
+			for (int i = 0; i < target.childCount; i++)
+				for (int j = 0; j < target.childCount; j++)
+					traverse(target.firstChild + i, target.firstChild + j, cellPairs, leafPairs);
+		return;
+	}
+
+	double dx = target.mx - source.mx;
+	double dy = target.my - source.my;
+	double dz = target.mz - source.mz;
+	double distance = sqrt(dx * dx + dy * dy + dz * dz);
+
+	// Pairs of small leaves are cheaper to sum directly than to translate
+	bool leaves = target.childCount == 0 && source.childCount == 0;
+	bool small = (size_t)(target.end - target.begin) * (source.end - source.begin) < multipoleToLocal.size() / 4;
+
+	if (radius[a] + radius[b] < Theta * distance && !(leaves && small)) {
+		cellPairs.push_back(a);
+		cellPairs.push_back(b);
+	}
+	else if (leaves) {
+		leafPairs.push_back(a);
+		leafPairs.push_back(b);
+	}
+	else if (source.childCount == 0 || (target.childCount > 0 && radius[a] >= radius[b]))
+		for (int i = 0; i < target.childCount; i++)
+			traverse(target.firstChild + i, b, cellPairs, leafPairs);
+	else
+		for (int j = 0; j < source.childCount; j++)
+			traverse(a, source.firstChild + j, cellPairs, leafPairs);
+}
+
+/*
+ * Expansions are centered on the center of mass of each cell. The multipoles take the monomials of the negated offsets,
+ * which folds the (-1)^|s| of the translation into them
+ */
+void Fmm::gather(int node) {
+
+	const OctreeNode &cell = Tree.Nodes[node];
+	double *moments = &Multipoles[node * Terms];
+	double w[MAX_TERMS];
+
+	// Radius of the sphere around the center of mass that holds every body of the cell
+	double r = 0.0;
+
+	if (cell.childCount == 0) {
+		for (int i = cell.begin; i < cell.end; i++) {
+			double dx = x[i] - cell.mx, dy = y[i] - cell.my, dz = z[i] - cell.mz;
+			r = fmax(r, sqrt(dx * dx + dy * dy + dz * dz));
+			monomials(-dx, -dy, -dz, w);
+			for (int t = 0; t < Terms; t++)
+				moments[t] += m[i] * w[t];
+		}
+		radius[node] = r;
+		return;
+	}
+
+	for (int c = 0; c < cell.childCount; c++) {
+		int child = cell.firstChild + c;
+		const OctreeNode &sub = Tree.Nodes[child];
+		const double *source = &Multipoles[child * Terms];
+		double dx = sub.mx - cell.mx, dy = sub.my - cell.my, dz = sub.mz - cell.mz;
+		r = fmax(r, sqrt(dx * dx + dy * dy + dz * dz) + radius[child]);
+		monomials(-dx, -dy, -dz, w);
+		for (size_t i = 0; i < shiftMultipole.size(); i++) {
+			const FmmTerm &term = shiftMultipole[i];
+			moments[term.target] += source[term.source] * w[term.kernel];
+		}
+	}
+	radius[node] = fmin(r, cell.offset + sqrt(3.0) * cell.halfSize);
+}
+
+/*
+ * The translations go in groups of one source cell per vector lane. Direct sums use the pairwise kernel on the bodies in
+ * tree order, where every leaf is a contiguous range
+ */
+void Fmm::interact(int a, double eps2) {
+
+	const OctreeNode &target = Tree.Nodes[a];
+	double *l = &Locals[a * Terms];
+
+	// Lanes of the translated expansions, added up once all sources are done
+	double sum[MAX_TERMS * KERNEL_WIDTH] = { 0.0 };
+#if defined(KERNEL_AVX512) || defined(KERNEL_AVX2)
+	for (int k = cellStart[a]; k < cellStart[a + 1]; k += (int)VectorLanes::WIDTH)
+		translate<VectorLanes>(&cellSources[k], cellStart[a + 1] - k < (int)VectorLanes::WIDTH ? cellStart[a + 1] - k : (int)VectorLanes::WIDTH,
+			target, eps2, sum);
+#else
+	for (int k = cellStart[a]; k < cellStart[a + 1]; k++)
+		translate<ScalarLanes>(&cellSources[k], 1, target, eps2, sum);
+#endif
+	for (int t = 0; t < Terms; t++)
+		for (int w = 0; w < KERNEL_WIDTH; w++)
+			l[t] += sum[t * KERNEL_WIDTH + w];
+	if (leafStart[a] == leafStart[a + 1])
+		return;
+
+	// The targets are padded to whole registers with copies of the last body, whose sums are dropped
+	size_t count = target.end - target.begin;
+	size_t padded = (count + KERNEL_WIDTH - 1) / KERNEL_WIDTH * KERNEL_WIDTH;
+	BodyArray tx(padded), ty(padded), tz(padded), sumX(padded, 0.0), sumY(padded, 0.0), sumZ(padded, 0.0);
+	for (size_t i = 0; i < padded; i++) {
+		size_t b = target.begin + (i < count ? i : count - 1);
+		tx[i] = x[b];
+		ty[i] = y[b];
+		tz[i] = z[b];
+	}
+	for (int k = leafStart[a]; k < leafStart[a + 1]; k++) {
+		const OctreeNode &source = Tree.Nodes[leafSources[k]];
+		pairwiseAccelerations(&tx[0], &ty[0], &tz[0], padded, &x[source.begin], &y[source.begin], &z[source.begin], &m[source.begin],
+			source.end - source.begin, eps2, &sumX[0], &sumY[0], &sumZ[0]);
+	}
+	for (size_t i = 0; i < count; i++) {
+		accX[target.begin + i] += sumX[i];
+		accY[target.begin + i] += sumY[i];
+		accZ[target.begin + i] += sumZ[i];
+	}
+}
+
+/*
+ * The gradient of the local expansion sum_k L_k e^k / k! is sum_k L_k e^(k - e_i) / (k - e_i)! along axis i, the acceleration
+ * without G
+ */
+void Fmm::scatter(int node) {
+
+	const OctreeNode &cell = Tree.Nodes[node];
+	double *l = &Locals[node * Terms];
+	double w[MAX_TERMS];
+
+	if (parent[node] >= 0) {
+		const OctreeNode &up = Tree.Nodes[parent[node]];
+		const double *source = &Locals[parent[node] * Terms];
+		monomials(cell.mx - up.mx, cell.my - up.my, cell.mz - up.mz, w);
+		for (size_t i = 0; i < shiftLocal.size(); i++) {
+			const FmmTerm &term = shiftLocal[i];
+			l[term.target] += source[term.source] * w[term.kernel];
+		}
+	}
+	if (cell.childCount > 0)
+		return;
+
+	for (int i = cell.begin; i < cell.end; i++) {
+		monomials(x[i] - cell.mx, y[i] - cell.my, z[i] - cell.mz, w);
+		double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+		for (int t = 1; t < Terms; t++) {
+			if (minus1[0][t] >= 0)
+				sumX += l[t] * w[minus1[0][t]];
+			if (minus1[1][t] >= 0)
+				sumY += l[t] * w[minus1[1][t]];
+			if (minus1[2][t] >= 0)
+				sumZ += l[t] * w[minus1[2][t]];
+		}
+		accX[i] += sumX;
+		accY[i] += sumY;
+		accZ[i] += sumZ;
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef FMM_H
+#define FMM_H
+
+#include <stddef.h>
+#include <vector>
+#include "bodies.h"
+#include "octree.h"
+#include "threadpool.h"
+
+// Default fast multipole values
+const int FMM_ORDER = 4;
+const int FMM_MAX_ORDER = 10;
+const double FMM_THETA = 0.5;
+const int FMM_LEAF_SIZE = 64;
+
+// Term of a translation operator: Result[target] += Source[source] * Kernel[kernel]
+struct FmmTerm {
+	int target, source, kernel;
+};
+
+// Fast multipole gravity solver with Cartesian Taylor expansions of selectable order. Cells of an octree interact through a dual tree traversal,
+// which replaces the sums over well separated pairs of cells by translations of their expansions
+class Fmm
+{
+public:
+	// Tree over the bodies
+	Octree Tree;
+	// Expansion order and opening angle of the cell-cell interactions
+	int Order;
+	double Theta;
+	// Number of expansion terms per cell
+	int Terms;
+	// Multipole and local expansion of every cell, Terms values per cell, scaled by 1 / k! (multipoles also by (-1)^|k|)
+	std::vector<double> Multipoles, Locals;
+	// Interactions counted during the last evaluation
+	unsigned long long CellInteractions, BodyInteractions;
+
+	// Constructor
+	Fmm(int order = FMM_ORDER, double theta = FMM_THETA, int leafSize = FMM_LEAF_SIZE);
+
+	// Change the expansion order (1 to FMM_MAX_ORDER)
+	void setOrder(int order);
+
+	// Accelerations of every body
+	void computeAccelerations(const BodyStore &bodies, double G, double softening, double *ax, double *ay, double *az, ThreadPool *pool = NULL);
+
+private:
+	// Exponents of every multi-index with total degree up to Order, sorted by degree
+	std::vector<int> ex, ey, ez;
+	// Index of the multi-index one lower along its first non-zero axis, that axis and 1 / its exponent along it
+	std::vector<int> lower, lowerAxis;
+	std::vector<double> lowerScale;
+	// Indices of the multi-indices one and two lower along each axis (-1 when not present)
+	std::vector<int> minus1[3], minus2[3];
+	// Neighbours and weights of the kernel derivative recurrence, 6 per term
+	std::vector<int> recurrenceIndex;
+	std::vector<double> recurrenceWeight;
+	// Translation operators, with the terms of multipoleToLocal sorted by target (from translationStart[t] for target t)
+	std::vector<FmmTerm> shiftMultipole, shiftLocal, multipoleToLocal;
+	std::vector<int> translationStart;
+	// Expansion radius, parent and cells by depth (start of each depth in levelStart)
+	std::vector<double> radius;
+	std::vector<int> parent, levels, levelStart;
+	// Interaction lists of every target cell (cells from cellStart[a] to cellStart[a + 1] in cellSources, leaves likewise)
+	std::vector<int> cellStart, cellSources, leafStart, leafSources;
+	// Bodies and accelerations in tree order
+	BodyArray x, y, z, m, accX, accY, accZ;
+
+	// Scaled monomials x^k / k! of the given offset
+	void monomials(double x, double y, double z, double *p) const;
+	// Kernel derivatives D^k(1/sqrt(r^2 + eps2)) at L::WIDTH separations, L::WIDTH values per term
+	template <typename L>
+	void derivatives(const double *x, const double *y, const double *z, double eps2, double *d) const;
+	// Multipole-to-local translations from count (up to L::WIDTH) source cells into sum, L::WIDTH values per term
+	template <typename L>
+	void translate(const int *sources, int count, const OctreeNode &target, double eps2, double *sum) const;
+
+	// Copy the bodies in tree order, group the cells by depth and clear the expansions
+	void prepare(const BodyStore &bodies);
+	// Sort the pairs of a dual tree traversal into the interaction lists of every target cell
+	void listInteractions();
+	// Dual tree traversal from target cell a and source cell b, appending the pairs to the lists
+	void traverse(int a, int b, std::vector<int> &cellPairs, std::vector<int> &leafPairs) const;
+	// Moments of a cell, from its bodies or shifted up from its children
+	void gather(int node);
+	// Translations and direct sums of a target cell
+	void interact(int a, double eps2);
+	// Shift the local expansion of the parent into a cell, and evaluate it at the bodies of leaves
+	void scatter(int node);
+};
+
+#endif
@@ -0,0 +1,361 @@
+#pragma once
+
+#ifndef FORCELAW_H
+#define FORCELAW_H
+
+#include <stddef.h>
+#include <math.h>
+
+// Softening of the pair force at short distances
+enum Softening_Model {
+	// Plummer sphere, 1 / (r^2 + eps^2)^(3/2) at every distance
+	PLUMMER_SOFTENING,
+	// Plain 1 / r^2, for well separated bodies
+	NO_SOFTENING,
+	// Cubic spline kernel of support eps (Monaghan and Lattanzio 1985), exactly Newtonian beyond eps
+	SPLINE_SOFTENING
+};
+
+// Law of the pair force
+enum Force_Law {
+	// Newtonian inverse square law
+	NEWTON_LAW,
+	// Yukawa-screened gravity of the given screening length, see ScreenedLaw
+	SCREENED_LAW
+};
+
+// Parameters of the policies in the precision of the kernel, derived once per call from the softening length and range
+template <typename Real>
+struct ForceParameters {
+	// Plummer softening length squared
+	Real eps2;
+	// Reciprocal spline support and its cube, infinite without softening so every distance is outside the support
+	Real invH, invH3;
+	// Reciprocal screening length of the screened law, 0 for none
+	Real invRange;
+
+	ForceParameters(double softening, double range = 0.0)
+		: eps2((Real)(softening * softening)), invH((Real)(1.0 / softening)), invH3((Real)(1.0 / (softening * softening * softening))),
+		invRange((Real)(range > 0.0 ? 1.0 / range : 0.0)) { }
+};
+
+// Softening policies: inverseCube(r2) is the factor f of the acceleration m f d along the separation d, and potential(r2)
+// the potential of a unit mass pair. Each is a single expression, distance ranges are chosen with selects, not branches.
+// both(r2) gives the two from one square root, for the loops that sum the potential with the force. slope(r2) is the
+// derivative of inverseCube in r2, for the tidal tensor
+struct PlummerSoftening {
+	template <typename Real>
+	static inline Real inverseCube(Real r2, const ForceParameters<Real> &p)
+	{
+		Real invR = Real(1) / sqrt(r2 + p.eps2);
+		return invR * invR * invR;
+	}
+
+	template <typename Real>
+	static inline Real potential(Real r2, const ForceParameters<Real> &p)
+	{
+		return -Real(1) / sqrt(r2 + p.eps2);
+	}
+
+	template <typename Real>
+	static inline Real both(Real r2, const ForceParameters<Real> &p, Real &phi)
+	{
+		Real invR = Real(1) / sqrt(r2 + p.eps2);
+		phi = -invR;
+		return invR * invR * invR;
+	}
+
+	template <typename Real>
+	static inline Real slope(Real r2, const ForceParameters<Real> &p)
+	{
+		Real invR = Real(1) / sqrt(r2 + p.eps2);
+		Real invR2 = invR * invR;
+		return Real(-1.5) * invR2 * invR2 * invR;
+	}
+};
+
+struct NoSoftening {
+	template <typename Real>
+	static inline Real inverseCube(Real r2, const ForceParameters<Real> &)
+	{
+		Real invR = Real(1) / sqrt(r2);
+		return invR * invR * invR;
+	}
+
+	template <typename Real>
+	static inline Real potential(Real r2, const ForceParameters<Real> &)
+	{
+		return -Real(1) / sqrt(r2);
+	}
+
+	template <typename Real>
+	static inline Real both(Real r2, const ForceParameters<Real> &, Real &phi)
+	{
+		Real invR = Real(1) / sqrt(r2);
+		phi = -invR;
+		return invR * invR * invR;
+	}
+
+	template <typename Real>
+	static inline Real slope(Real r2, const ForceParameters<Real> &)
+	{
+		Real invR = Real(1) / sqrt(r2);
+		Real invR2 = invR * invR;
+		return Real(-1.5) * invR2 * invR2 * invR;
+	}
+};
+
+// The spline polynomials of the force and potential as used by GADGET (Springel 2005), in u = r / eps
+struct SplineSoftening {
+	template <typename Real>
+	static inline Real inverseCube(Real r2, const ForceParameters<Real> &p)
+	{
+		Real r = sqrt(r2);
+		Real u = r * p.invH;
+		Real inner = p.invH3 * (Real(32.0 / 3.0) + u * u * (Real(32.0) * u - Real(38.4)));
+		Real outer = p.invH3 * (Real(64.0 / 3.0) - Real(48.0) * u + Real(38.4) * u * u - Real(32.0 / 3.0) * u * u * u - Real(1.0 / 15.0) / (u * u * u));
+		Real newton = Real(1) / (r2 * r);
+		return u < Real(0.5) ? inner : u < Real(1) ? outer : newton;
+	}
+
+	template <typename Real>
+	static inline Real potential(Real r2, const ForceParameters<Real> &p)
+	{
+		Real r = sqrt(r2);
+		Real u = r * p.invH;
+		Real inner = p.invH * (Real(-2.8) + u * u * (Real(16.0 / 3.0) + u * u * (Real(6.4) * u - Real(9.6))));
+		Real outer = p.invH * (Real(-3.2) + Real(1.0 / 15.0) / u + u * u * (Real(32.0 / 3.0) + u * (Real(-16.0) + u * (Real(9.6) - Real(32.0 / 15.0) * u))));
+		Real newton = -Real(1) / r;
+		return u < Real(0.5) ? inner : u < Real(1) ? outer : newton;
+	}
+
+	template <typename Real>
+	static inline Real both(Real r2, const ForceParameters<Real> &p, Real &phi)
+	{
+		Real r = sqrt(r2);
+		Real u = r * p.invH;
+		Real invR = Real(1) / r;
+		Real forceInner = p.invH3 * (Real(32.0 / 3.0) + u * u * (Real(32.0) * u - Real(38.4)));
+		Real forceOuter = p.invH3 * (Real(64.0 / 3.0) - Real(48.0) * u + Real(38.4) * u * u - Real(32.0 / 3.0) * u * u * u - Real(1.0 / 15.0) / (u * u * u));
+		Real potentialInner = p.invH * (Real(-2.8) + u * u * (Real(16.0 / 3.0) + u * u * (Real(6.4) * u - Real(9.6))));
+		Real potentialOuter = p.invH * (Real(-3.2) + Real(1.0 / 15.0) / u + u * u * (Real(32.0 / 3.0) + u * (Real(-16.0) + u * (Real(9.6) - Real(32.0 / 15.0) * u))));
+		phi = u < Real(0.5) ? potentialInner : u < Real(1) ? potentialOuter : -invR;
+		return u < Real(0.5) ? forceInner : u < Real(1) ? forceOuter : Real(1) / (r2 * r);
+	}
+
+	// The derivative of the polynomial in u over 2 u, which stays finite at u = 0
+	template <typename Real>
+	static inline Real slope(Real r2, const ForceParameters<Real> &p)
+	{
+		Real r = sqrt(r2);
+		Real u = r * p.invH;
+		Real invH5 = p.invH3 * p.invH * p.invH;
+		Real inner = invH5 * (Real(-38.4) + Real(48.0) * u);
+		Real outer = invH5 * (Real(-48.0) + Real(76.8) * u - Real(32.0) * u * u + Real(0.2) / (u * u * u * u)) / (Real(2) * u);
+		Real newton = Real(-1.5) / (r2 * r2 * r);
+		return u < Real(0.5) ? inner : u < Real(1) ? outer : newton;
+	}
+};
+
+// Force laws: scale(r2) multiplies the softened inverse square force and potentialScale(r2) the softened potential.
+// scaleSlope(r2) is the derivative of scale in r2, for the tidal tensor
+struct NewtonLaw {
+	template <typename Real>
+	static inline Real scale(Real, const ForceParameters<Real> &) { return Real(1); }
+
+	template <typename Real>
+	static inline Real potentialScale(Real, const ForceParameters<Real> &) { return Real(1); }
+
+	template <typename Real>
+	static inline Real scaleSlope(Real, const ForceParameters<Real> &) { return Real(0); }
+};
+
+// Yukawa-screened gravity, the force of the potential -exp(-r / range) / r
+struct ScreenedLaw {
+	template <typename Real>
+	static inline Real scale(Real r2, const ForceParameters<Real> &p)
+	{
+		Real x = sqrt(r2) * p.invRange;
+		return (Real(1) + x) * exp(-x);
+	}
+
+	template <typename Real>
+	static inline Real potentialScale(Real r2, const ForceParameters<Real> &p)
+	{
+		return exp(-sqrt(r2) * p.invRange);
+	}
+
+	template <typename Real>
+	static inline Real scaleSlope(Real r2, const ForceParameters<Real> &p)
+	{
+		Real x = sqrt(r2) * p.invRange;
+		return Real(-0.5) * p.invRange * p.invRange * exp(-x);
+	}
+};
+
+// Add the acceleration (without G) of every source on every target, like pairwiseAccelerations, for any precision,
+// softening and force law. The inner loop runs over the targets, so it has no reduction and no branch, and the compiler
+// can vectorize it in the given precision. Coincident pairs are skipped with a select
+template <typename Real, typename Softening, typename Law>
+void pairInteractions(const Real *tx, const Real *ty, const Real *tz, size_t targets,
+	const Real *sx, const Real *sy, const Real *sz, const Real *sm, size_t sources,
+	const ForceParameters<Real> &parameters, Real *ax, Real *ay, Real *az)
+{
+	// Local copy, the compiler cannot tell that the accelerations do not overlap the parameters
+	const ForceParameters<Real> p = parameters;
+	for (size_t j = 0; j < sources; j++) {
+		const Real xj = sx[j], yj = sy[j], zj = sz[j], mj = sm[j];
+		for (size_t i = 0; i < targets; i++) {
+			Real dx = xj - tx[i];
+			Real dy = yj - ty[i];
+			Real dz = zj - tz[i];
+			Real r2 = dx * dx + dy * dy + dz * dz;
+			Real f = Law::scale(r2, p) * Softening::inverseCube(r2, p);
+			f = r2 > Real(0) ? mj * f : Real(0);
+			ax[i] += f * dx;
+			ay[i] += f * dy;
+			az[i] += f * dz;
+		}
+	}
+}
+
+// Double precision kernel of the solvers for a softening model and force law chosen at run time: adds the acceleration
+// (without G) of every source on every target, and the potential (without G) of the sources when potential is not NULL
+typedef void (*SoftenedKernel)(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	const ForceParameters<double> &parameters, double *ax, double *ay, double *az, double *potential);
+
+// Instantiation of the pair interaction in double precision with the signature of SoftenedKernel. The loop with potential
+// gives the accelerations the same bits as the one without
+template <typename Softening, typename Law>
+void pairwiseSoftened(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	const ForceParameters<double> &parameters, double *ax, double *ay, double *az, double *potential)
+{
+	if (potential == NULL) {
+		pairInteractions<double, Softening, Law>(tx, ty, tz, targets, sx, sy, sz, sm, sources, parameters, ax, ay, az);
+		return;
+	}
+
+	const ForceParameters<double> p = parameters;
+	for (size_t j = 0; j < sources; j++) {
+		const double xj = sx[j], yj = sy[j], zj = sz[j], mj = sm[j];
+		for (size_t i = 0; i < targets; i++) {
+			double dx = xj - tx[i];
+			double dy = yj - ty[i];
+			double dz = zj - tz[i];
+			double r2 = dx * dx + dy * dy + dz * dz;
+			double phi;
+			double f = Law::scale(r2, p) * Softening::both(r2, p, phi);
+			f = r2 > 0.0 ? mj * f : 0.0;
+			phi = r2 > 0.0 ? mj * Law::potentialScale(r2, p) * phi : 0.0;
+			ax[i] += f * dx;
+			ay[i] += f * dy;
+			az[i] += f * dz;
+			potential[i] += phi;
+		}
+	}
+}
+
+// Kernel of a softening model and force law
+template <typename Law>
+inline SoftenedKernel softenedKernel(Softening_Model model)
+{
+	switch (model) {
+	case NO_SOFTENING: return pairwiseSoftened<NoSoftening, Law>;
+	case SPLINE_SOFTENING: return pairwiseSoftened<SplineSoftening, Law>;
+	default: return pairwiseSoftened<PlummerSoftening, Law>;
+	}
+}
+
+inline SoftenedKernel softenedKernel(Softening_Model model, Force_Law law)
+{
+	return law == SCREENED_LAW ? softenedKernel<ScreenedLaw>(model) : softenedKernel<NewtonLaw>(model);
+}
+
+// Accelerations (without G) in a batch of independent systems stored as [body][member], like ensembleAccelerationsScalar,
+// for any softening and force law. Overwrites the accelerations of count members from the given pointers on
+typedef void (*EnsembleKernel)(size_t bodies, size_t stride, size_t count, const double *m, const double *x,
+	const double *y, const double *z, const ForceParameters<double> &parameters, double *ax, double *ay, double *az);
+
+// The inner loop runs over the members, so it vectorizes like pairInteractions. Coincident pairs, among them the padding
+// members, are skipped with a select
+template <typename Softening, typename Law>
+void ensembleSoftened(size_t bodies, size_t stride, size_t count, const double *m, const double *x, const double *y,
+	const double *z, const ForceParameters<double> &parameters, double *ax, double *ay, double *az)
+{
+	const ForceParameters<double> p = parameters;
+	for (size_t b = 0; b < bodies; b++)
+		for (size_t e = 0; e < count; e++)
+			ax[b * stride + e] = ay[b * stride + e] = az[b * stride + e] = 0.0;
+
+	for (size_t i = 0; i < bodies; i++)
+		for (size_t j = i + 1; j < bodies; j++) {
+			size_t oi = i * stride, oj = j * stride;
+			for (size_t e = 0; e < count; e++) {
+				double dx = x[oj + e] - x[oi + e];
+				double dy = y[oj + e] - y[oi + e];
+				double dz = z[oj + e] - z[oi + e];
+				double r2 = dx * dx + dy * dy + dz * dz;
+				double f = Law::scale(r2, p) * Softening::inverseCube(r2, p);
+				f = r2 > 0.0 ? f : 0.0;
+				double fi = m[oj + e] * f, fj = m[oi + e] * f;
+				ax[oi + e] += fi * dx; ay[oi + e] += fi * dy; az[oi + e] += fi * dz;
+				ax[oj + e] -= fj * dx; ay[oj + e] -= fj * dy; az[oj + e] -= fj * dz;
+			}
+		}
+}
+
+// Ensemble kernel of a softening model and force law
+template <typename Law>
+inline EnsembleKernel ensembleKernel(Softening_Model model)
+{
+	switch (model) {
+	case NO_SOFTENING: return ensembleSoftened<NoSoftening, Law>;
+	case SPLINE_SOFTENING: return ensembleSoftened<SplineSoftening, Law>;
+	default: return ensembleSoftened<PlummerSoftening, Law>;
+	}
+}
+
+inline EnsembleKernel ensembleKernel(Softening_Model model, Force_Law law)
+{
+	return law == SCREENED_LAW ? ensembleKernel<ScreenedLaw>(model) : ensembleKernel<NewtonLaw>(model);
+}
+
+// Factor f of the acceleration m f d under the given softening model and force law, for code outside the hot loops
+inline double softenedInverseCube(Softening_Model model, double r2, const ForceParameters<double> &p, Force_Law law = NEWTON_LAW)
+{
+	double scale = law == SCREENED_LAW ? ScreenedLaw::scale(r2, p) : 1.0;
+	switch (model) {
+	case NO_SOFTENING: return scale * NoSoftening::inverseCube(r2, p);
+	case SPLINE_SOFTENING: return scale * SplineSoftening::inverseCube(r2, p);
+	default: return scale * PlummerSoftening::inverseCube(r2, p);
+	}
+}
+
+// Derivative of softenedInverseCube in r2
+inline double softenedInverseCubeSlope(Softening_Model model, double r2, const ForceParameters<double> &p, Force_Law law = NEWTON_LAW)
+{
+	double slope, inverseCube;
+	switch (model) {
+	case NO_SOFTENING: slope = NoSoftening::slope(r2, p); inverseCube = NoSoftening::inverseCube(r2, p); break;
+	case SPLINE_SOFTENING: slope = SplineSoftening::slope(r2, p); inverseCube = SplineSoftening::inverseCube(r2, p); break;
+	default: slope = PlummerSoftening::slope(r2, p); inverseCube = PlummerSoftening::inverseCube(r2, p); break;
+	}
+	if (law == SCREENED_LAW)
+		return ScreenedLaw::scale(r2, p) * slope + ScreenedLaw::scaleSlope(r2, p) * inverseCube;
+	return slope;
+}
+
+// Pair potential of a unit mass pair under the given softening model and force law
+inline double softenedPotential(Softening_Model model, double r2, const ForceParameters<double> &p, Force_Law law = NEWTON_LAW)
+{
+	double scale = law == SCREENED_LAW ? ScreenedLaw::potentialScale(r2, p) : 1.0;
+	switch (model) {
+	case NO_SOFTENING: return scale * NoSoftening::potential(r2, p);
+	case SPLINE_SOFTENING: return scale * SplineSoftening::potential(r2, p);
+	default: return scale * PlummerSoftening::potential(r2, p);
+	}
+}
+
+#endif
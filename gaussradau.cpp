@@ -0,0 +1,374 @@
+#include <math.h>
+#include "integrators.h"
+#include "strictfp.h"
+
+// Spacings of the Gauss-Radau nodes on the unit step, the first node is the start of the step
+static const double H[8] = {
+	0.0, 0.0562625605369221464656521910318, 0.180240691736892364987579942780, 0.352624717113169637373907769648,
+	0.547153626330555383001448554766, 0.734210177215410531523210605558, 0.885320946839095768090359771030,
+	0.977520613561287501891174488626
+};
+
+// Differences of the node spacings, h[j] - h[k] for k < j, which the divided differences g are divided by
+static const double RR[28] = {
+	0.0562625605369221464656522, 0.1802406917368923649875799, 0.1239781311999702185219278,
+	0.3526247171131696373739078, 0.2963621565762474909082556, 0.1723840253762772723863278,
+	0.5471536263305553830014486, 0.4908910657936332365357964, 0.3669129345936630180138686,
+	0.1945289092173857456275408, 0.7342101772154105315232106, 0.6779476166784883850575584,
+	0.5539694854785181665356307, 0.3815854601022409140493028, 0.1870565508848551485217621,
+	0.8853209468390957680903598, 0.8290583863021736216247076, 0.7050802551022034031027798,
+	0.5326962297259261521164520, 0.3381673205085403865889112, 0.1511107696236852365671492,
+	0.9775206135612875018911745, 0.9212580530243653554255223, 0.7972799218243951369035945,
+	0.6248958964481179064172667, 0.4303669872307321408567259, 0.2433104363458770908521259,
+	0.0921996667221917338008147
+};
+
+// Coefficients that carry a change of g over to the coefficients b
+static const double C[21] = {
+	-0.0562625605369221464656522, 0.0101408028300636299864818, -0.2365032522738145114532321,
+	-0.0035758977292516175949345, 0.0935376952594620658957485, -0.5891279693869841488271399,
+	0.0019565654099472210769006, -0.0547553868890686864408084, 0.4158812000823068616886219,
+	-1.1362815957175395318285885, -0.0014365302363708915424460, 0.0421585277212687077072973,
+	-0.3600995965020568122897665, 1.2501507118406910258505441, -1.8704917729329500633517991,
+	0.0012717903090268677492943, -0.0387603579159067703699046, 0.3609622434528459832253398,
+	-1.4668842084004269643701553, 2.9061362593084293014237913, -2.7558127197720458314421588
+};
+
+// Coefficients that give g from b
+static const double D[21] = {
+	0.0562625605369221464656522, 0.0031654757181708292499905, 0.2365032522738145114532321,
+	0.0001780977692217433881125, 0.0457929855060279188954539, 0.5891279693869841488271399,
+	0.0000100202365223291272096, 0.0084318571535257015445000, 0.2535340690545692665214616,
+	1.1362815957175395318285885, 0.0000005637641639318207610, 0.0015297840025004658189490,
+	0.0978342365324440053653648, 0.8752546646840910912297246, 1.8704917729329500633517991,
+	0.0000000317188154017613665, 0.0002762930909826476593130, 0.0360285539837364596003871,
+	0.5767330002770787313544596, 2.2485887607691597933926895, 2.7558127197720458314421588
+};
+
+// Coordinates integrated by the Gauss-Radau step: x, y and z of the bodies and of the test particles, numbered one
+// after the other
+struct RadauCoordinates {
+	double *x[6], *v[6], *a[6];
+	size_t count[6];
+	size_t total;
+};
+
+static RadauCoordinates radauCoordinates(Simulation &simulation) {
+
+	RadauCoordinates c;
+	BodyStore *stores[2] = {&simulation.Bodies, &simulation.Particles};
+	c.total = 0;
+	for (int s = 0; s < 2; s++) {
+		BodyStore &b = *stores[s];
+		size_t n = b.size();
+		double *x[3] = {n ? &b.x[0] : NULL, n ? &b.y[0] : NULL, n ? &b.z[0] : NULL};
+		double *v[3] = {n ? &b.vx[0] : NULL, n ? &b.vy[0] : NULL, n ? &b.vz[0] : NULL};
+		double *a[3] = {n ? &b.ax[0] : NULL, n ? &b.ay[0] : NULL, n ? &b.az[0] : NULL};
+		for (int d = 0; d < 3; d++) {
+			c.x[3 * s + d] = x[d];
+			c.v[3 * s + d] = v[d];
+			c.a[3 * s + d] = a[d];
+			c.count[3 * s + d] = n;
+			c.total += n;
+		}
+	}
+	return c;
+}
+
+// Copy the coordinates into an array, or the array back into the coordinates
+static void gather(double *const *from, const size_t *count, std::vector<double> &to) {
+
+	for (size_t c = 0, k = 0; c < 6; c++)
+		for (size_t i = 0; i < count[c]; i++, k++)
+			to[k] = from[c][i];
+}
+
+static void scatter(const std::vector<double> &from, double *const *to, const size_t *count) {
+
+	for (size_t c = 0, k = 0; c < 6; c++)
+		for (size_t i = 0; i < count[c]; i++, k++)
+			to[c][i] = from[k];
+}
+
+/*
+ * Extrapolates the series of the last accepted substep to a substep ratio times as long (Everhart 1985, equation 13),
+ * and adds the correction that the last prediction needed. Predictions over more than 20 substep lengths are worthless,
+ * so the coefficients restart from zero instead
+ */
+static void predictCoefficients(double ratio, size_t count, const std::vector<double> *bLast, const std::vector<double> *eLast,
+	std::vector<double> *b, std::vector<double> *e) {
+
+	if (ratio > 20.0) {
+		for (int j = 0; j < 7; j++) {
+			b[j].assign(count, 0.0);
+			e[j].assign(count, 0.0);
+		}
+		return;
+	}
+
+	double q1 = ratio, q2 = q1 * q1, q3 = q1 * q2, q4 = q2 * q2, q5 = q2 * q3, q6 = q3 * q3, q7 = q3 * q4;
+	for (size_t k = 0; k < count; k++) {
+		double b0 = bLast[0][k], b1 = bLast[1][k], b2 = bLast[2][k], b3 = bLast[3][k];
+		double b4 = bLast[4][k], b5 = bLast[5][k], b6 = bLast[6][k];
+		e[0][k] = q1 * (b6 * 7.0 + b5 * 6.0 + b4 * 5.0 + b3 * 4.0 + b2 * 3.0 + b1 * 2.0 + b0);
+		e[1][k] = q2 * (b6 * 21.0 + b5 * 15.0 + b4 * 10.0 + b3 * 6.0 + b2 * 3.0 + b1);
+		e[2][k] = q3 * (b6 * 35.0 + b5 * 20.0 + b4 * 10.0 + b3 * 4.0 + b2);
+		e[3][k] = q4 * (b6 * 35.0 + b5 * 15.0 + b4 * 5.0 + b3);
+		e[4][k] = q5 * (b6 * 21.0 + b5 * 6.0 + b4);
+		e[5][k] = q6 * (b6 * 7.0 + b5);
+		e[6][k] = q7 * b6;
+		for (int j = 0; j < 7; j++)
+			b[j][k] = e[j][k] + (bLast[j][k] - eLast[j][k]);
+	}
+}
+
+void GaussRadauState::resize(size_t count) {
+
+	std::vector<double> *arrays[6] = {&x0, &v0, &a0, &at, &csx, &csv};
+	for (int j = 0; j < 6; j++)
+		arrays[j]->assign(count, 0.0);
+	for (int j = 0; j < 7; j++) {
+		b[j].assign(count, 0.0);
+		g[j].assign(count, 0.0);
+		e[j].assign(count, 0.0);
+		br[j].assign(count, 0.0);
+		er[j].assign(count, 0.0);
+	}
+	lastStep = 0.0;
+}
+
+/*
+ * IAS15 (Rein & Spiegel 2015). The acceleration over a substep is a polynomial in time whose coefficients b are fitted
+ * at the seven Gauss-Radau nodes by a predictor-corrector iteration, which stops when the last correction is at round-off.
+ * The size of the last coefficient b6 against the accelerations measures the error of the substep: a substep is redone
+ * shorter when the error estimate asks for less than a quarter of its length, and the next substep grows with the
+ * seventh root of Epsilon over the error. Positions and velocities are summed with compensation, so the round-off does
+ * not grow with the number of substeps. The last substep is shortened to end exactly at the end of dt
+ */
+void gaussRadauStep(Simulation &simulation, double dt) {
+
+	GaussRadauState &s = simulation.Radau;
+	RadauCoordinates c = radauCoordinates(simulation);
+	size_t n = c.total;
+	if (n == 0 || dt == 0.0)
+		return;
+
+	// A new set of coordinates restarts the predictions, coordinates changed from outside lose their carry
+	if (s.x0.size() != n)
+		s.resize(n);
+	for (size_t d = 0, k = 0; d < 6; d++)
+		for (size_t i = 0; i < c.count[d]; i++, k++) {
+			if (s.x0[k] != c.x[d][i])
+				s.csx[k] = 0.0;
+			if (s.v0[k] != c.v[d][i])
+				s.csv[k] = 0.0;
+		}
+	gather(c.x, c.count, s.x0);
+	gather(c.v, c.count, s.v0);
+
+	// The substep continues from the last call unless the direction of time changed
+	if (s.Step == 0.0 || (s.Step > 0.0) != (dt > 0.0))
+		s.Step = dt;
+
+	simulation.prepareAccelerations();
+	gather(c.a, c.count, s.a0);
+
+	double done = 0.0;
+	std::vector<double> &x0 = s.x0, &v0 = s.v0, &a0 = s.a0, &at = s.at;
+	std::vector<double> *b = s.b, *g = s.g;
+	for (;;) {
+		bool last = fabs(s.Step) >= fabs(dt - done);
+		double h = last ? dt - done : s.Step;
+
+		// Divided differences from the predicted coefficients
+		for (size_t k = 0; k < n; k++) {
+			g[0][k] = b[6][k] * D[15] + b[5][k] * D[10] + b[4][k] * D[6] + b[3][k] * D[3] + b[2][k] * D[1] + b[1][k] * D[0] + b[0][k];
+			g[1][k] = b[6][k] * D[16] + b[5][k] * D[11] + b[4][k] * D[7] + b[3][k] * D[4] + b[2][k] * D[2] + b[1][k];
+			g[2][k] = b[6][k] * D[17] + b[5][k] * D[12] + b[4][k] * D[8] + b[3][k] * D[5] + b[2][k];
+			g[3][k] = b[6][k] * D[18] + b[5][k] * D[13] + b[4][k] * D[9] + b[3][k];
+			g[4][k] = b[6][k] * D[19] + b[5][k] * D[14] + b[4][k];
+			g[5][k] = b[6][k] * D[20] + b[5][k];
+			g[6][k] = b[6][k];
+		}
+
+		// Predictor-corrector iteration over the nodes, until the correction of b6 stops shrinking or is at round-off
+		double correction = HUGE_VAL, lastCorrection = 0.0;
+		for (int iteration = 0; iteration < RADAU_ITERATIONS; iteration++) {
+			if (correction < 1.0e-16 || (iteration > 2 && lastCorrection <= correction))
+				break;
+			lastCorrection = correction;
+			s.Iterations++;
+
+			for (int node = 1; node < 8; node++) {
+				double t[9];
+				t[0] = h * H[node];
+				t[1] = t[0] * t[0] / 2.0;
+				t[2] = t[1] * H[node] / 3.0;
+				t[3] = t[2] * H[node] / 2.0;
+				t[4] = 3.0 * t[3] * H[node] / 5.0;
+				t[5] = 2.0 * t[4] * H[node] / 3.0;
+				t[6] = 5.0 * t[5] * H[node] / 7.0;
+				t[7] = 3.0 * t[6] * H[node] / 4.0;
+				t[8] = 7.0 * t[7] * H[node] / 9.0;
+
+				for (size_t d = 0, k = 0; d < 6; d++)
+					for (size_t i = 0; i < c.count[d]; i++, k++)
+						c.x[d][i] = -s.csx[k] + (t[8] * b[6][k] + t[7] * b[5][k] + t[6] * b[4][k] + t[5] * b[3][k] + t[4] * b[2][k]
+							+ t[3] * b[1][k] + t[2] * b[0][k] + t[1] * a0[k] + t[0] * v0[k]) + x0[k];
+				simulation.computeAccelerations();
+				s.ForceEvaluations++;
+				gather(c.a, c.count, at);
+
+				double maxA = 0.0, maxChange = 0.0;
+				for (size_t k = 0; k < n; k++) {
+					double gk = at[k] - a0[k];
+					double old;
+					switch (node) {
+					case 1:
+						old = g[0][k];
+						g[0][k] = gk / RR[0];
+						b[0][k] += g[0][k] - old;
+						break;
+					case 2:
+						old = g[1][k];
+						g[1][k] = (gk / RR[1] - g[0][k]) / RR[2];
+						old = g[1][k] - old;
+						b[0][k] += old * C[0];
+						b[1][k] += old;
+						break;
+					case 3:
+						old = g[2][k];
+						g[2][k] = ((gk / RR[3] - g[0][k]) / RR[4] - g[1][k]) / RR[5];
+						old = g[2][k] - old;
+						b[0][k] += old * C[1];
+						b[1][k] += old * C[2];
+						b[2][k] += old;
+						break;
+					case 4:
+						old = g[3][k];
+						g[3][k] = (((gk / RR[6] - g[0][k]) / RR[7] - g[1][k]) / RR[8] - g[2][k]) / RR[9];
+						old = g[3][k] - old;
+						b[0][k] += old * C[3];
+						b[1][k] += old * C[4];
+						b[2][k] += old * C[5];
+						b[3][k] += old;
+						break;
+					case 5:
+						old = g[4][k];
+						g[4][k] = ((((gk / RR[10] - g[0][k]) / RR[11] - g[1][k]) / RR[12] - g[2][k]) / RR[13] - g[3][k]) / RR[14];
+						old = g[4][k] - old;
+						b[0][k] += old * C[6];
+						b[1][k] += old * C[7];
+						b[2][k] += old * C[8];
+						b[3][k] += old * C[9];
+						b[4][k] += old;
+						break;
+					case 6:
+						old = g[5][k];
+						g[5][k] = (((((gk / RR[15] - g[0][k]) / RR[16] - g[1][k]) / RR[17] - g[2][k]) / RR[18] - g[3][k]) / RR[19]
+							- g[4][k]) / RR[20];
+						old = g[5][k] - old;
+						b[0][k] += old * C[10];
+						b[1][k] += old * C[11];
+						b[2][k] += old * C[12];
+						b[3][k] += old * C[13];
+						b[4][k] += old * C[14];
+						b[5][k] += old;
+						break;
+					default:
+						old = g[6][k];
+						g[6][k] = ((((((gk / RR[21] - g[0][k]) / RR[22] - g[1][k]) / RR[23] - g[2][k]) / RR[24] - g[3][k]) / RR[25]
+							- g[4][k]) / RR[26] - g[5][k]) / RR[27];
+						old = g[6][k] - old;
+						b[0][k] += old * C[15];
+						b[1][k] += old * C[16];
+						b[2][k] += old * C[17];
+						b[3][k] += old * C[18];
+						b[4][k] += old * C[19];
+						b[5][k] += old * C[20];
+						b[6][k] += old;
+						maxA = fmax(maxA, fabs(at[k]));
+						maxChange = fmax(maxChange, fabs(old));
+						break;
+					}
+				}
+				if (node == 7)
+					correction = maxA > 0.0 ? maxChange / maxA : 0.0;
+			}
+		}
+
+		// Error estimate from the last coefficient over the accelerations at the last node
+		double maxA = 0.0, maxB6 = 0.0;
+		bool finite = true;
+		for (size_t k = 0; k < n; k++) {
+			maxA = fmax(maxA, fabs(at[k]));
+			maxB6 = fmax(maxB6, fabs(b[6][k]));
+			finite = finite && fabs(at[k]) < HUGE_VAL && fabs(b[6][k]) < HUGE_VAL;
+		}
+		double error = maxA > 0.0 ? maxB6 / maxA : 0.0;
+		double next;
+		// A series that diverged says nothing about the error, the substep is retried at an eighth of its length
+		if (!finite)
+			next = h * RADAU_SAFETY / 2.0;
+		else if (s.Epsilon > 0.0 && error > 0.0)
+			next = pow(s.Epsilon / error, 1.0 / 7.0) * h;
+		else
+			next = h / RADAU_SAFETY;
+		if (!(fabs(next) >= s.MinStep))
+			next = h > 0.0 ? s.MinStep : -s.MinStep;
+
+		if (fabs(next / h) < RADAU_SAFETY && fabs(h) > s.MinStep) {
+			// Rejected, back to the start of the substep with a prediction for the shorter substep
+			s.Rejected++;
+			scatter(x0, c.x, c.count);
+			scatter(a0, c.a, c.count);
+			s.Step = next;
+			if (s.lastStep != 0.0)
+				predictCoefficients(next / s.lastStep, n, s.br, s.er, s.b, s.e);
+			else
+				for (int j = 0; j < 7; j++)
+					b[j].assign(n, 0.0);
+			continue;
+		}
+		if (fabs(next / h) > 1.0 / RADAU_SAFETY)
+			next = h / RADAU_SAFETY;
+		// A substep shortened to end at dt does not hold back the next one
+		if (last && fabs(next) > fabs(h))
+			next = fabs(next) < fabs(s.Step) ? next : s.Step;
+
+		// Accepted, the series at the end of the substep
+		for (size_t k = 0; k < n; k++) {
+			double dx = h * (v0[k] + h * (((((((b[6][k] * 7.0 / 9.0 + b[5][k]) * 3.0 / 4.0 + b[4][k]) * 5.0 / 7.0 + b[3][k]) * 2.0 / 3.0
+				+ b[2][k]) * 3.0 / 5.0 + b[1][k]) / 2.0 + b[0][k]) / 3.0 + a0[k]) / 2.0);
+			double dv = h * (((((((b[6][k] * 7.0 / 8.0 + b[5][k]) * 6.0 / 7.0 + b[4][k]) * 5.0 / 6.0 + b[3][k]) * 4.0 / 5.0
+				+ b[2][k]) * 3.0 / 4.0 + b[1][k]) * 2.0 / 3.0 + b[0][k]) / 2.0 + a0[k]);
+
+			double y = dx - s.csx[k];
+			double sum = x0[k] + y;
+			s.csx[k] = (sum - x0[k]) - y;
+			x0[k] = sum;
+
+			y = dv - s.csv[k];
+			sum = v0[k] + y;
+			s.csv[k] = (sum - v0[k]) - y;
+			v0[k] = sum;
+		}
+		scatter(x0, c.x, c.count);
+		scatter(v0, c.v, c.count);
+		simulation.computeAccelerations();
+		s.ForceEvaluations++;
+		gather(c.a, c.count, a0);
+
+		s.Accepted++;
+		done += h;
+		s.lastStep = h;
+		s.Step = next;
+		for (int j = 0; j < 7; j++) {
+			s.br[j] = b[j];
+			s.er[j] = s.e[j];
+		}
+		predictCoefficients(next / h, n, s.br, s.er, s.b, s.e);
+		if (last)
+			break;
+	}
+}
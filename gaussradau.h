@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef GAUSSRADAU_H
+#define GAUSSRADAU_H
+
+#include <vector>
+
+class Simulation;
+
+// Default Gauss-Radau values. A step is accepted when the last term of its series is below Epsilon relative to the
+// accelerations, and the next step is at most 1 / RADAU_SAFETY times longer or it is rejected below RADAU_SAFETY times
+// as long. The predictor-corrector stops after RADAU_ITERATIONS iterations
+const double RADAU_EPSILON = 1.0e-9;
+const double RADAU_SAFETY = 0.25;
+const int RADAU_ITERATIONS = 12;
+
+// State of the adaptive Gauss-Radau integrator. The substep carries over from one call to the next, so a sequence of
+// short steps does not restart the step size control every time
+class GaussRadauState {
+public:
+	// Accuracy parameter of the step size control. Below about 1e-10 the error estimate drowns in round-off and the
+	// substeps shrink without end
+	double Epsilon;
+	// Shortest substep, 0 for none. Substeps at this length are accepted whatever their error
+	double MinStep;
+	// Substep that the next step tries first, 0 before the first step
+	double Step;
+
+	// Statistics since the last reset. Accepted and rejected substeps
+	unsigned long long Accepted, Rejected;
+	// Force evaluations and predictor-corrector iterations, over accepted and rejected substeps
+	unsigned long long ForceEvaluations, Iterations;
+
+	GaussRadauState() : Epsilon(RADAU_EPSILON), MinStep(0.0), Step(0.0), Accepted(0), Rejected(0), ForceEvaluations(0), Iterations(0), lastStep(0.0) { }
+
+	// Clear the statistics
+	void resetStatistics()
+	{
+		Accepted = Rejected = ForceEvaluations = Iterations = 0;
+	}
+
+private:
+	friend void gaussRadauStep(Simulation &simulation, double dt);
+
+	// Length of the last accepted substep, 0 when the predicted coefficients below are not valid
+	double lastStep;
+	// Position, velocity and acceleration of every coordinate at the start of the substep, the acceleration at the
+	// current node, and the carries of the compensated position and velocity sums
+	std::vector<double> x0, v0, a0, at, csx, csv;
+	// Series coefficients b of the acceleration and their divided differences g, the coefficients e predicted for this
+	// substep, and b and e of the last accepted substep
+	std::vector<double> b[7], g[7], e[7], br[7], er[7];
+
+	// Size the arrays to the number of coordinates and forget the predicted coefficients
+	void resize(size_t count);
+};
+
+#endif
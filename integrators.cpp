@@ -0,0 +1,252 @@
+#include <math.h>
+#include "integrators.h"
+#include "forcelaw.h"
+#include "kepler.h"
+#include "strictfp.h"
+
+/*
+ * The stored accelerations include the pull of body 0 under the softening model and force law of the simulation, which the Kepler
+ * drift already accounts for, so exactly that pull is subtracted again. Body 0 takes the opposite momentum, which keeps the heliocentric velocities of the others unchanged
+ */
+void wisdomHolmanKick(Simulation &simulation, double dt) {
+
+	BodyStore &b = simulation.Bodies;
+	size_t n = b.size();
+	if (n < 2 || b.m[0] <= 0.0) {
+		simulation.kick(dt);
+		return;
+	}
+
+	ForceParameters<double> parameters(simulation.Softening, simulation.ScreeningLength);
+	double gm = simulation.G * b.m[0];
+	double px = 0.0, py = 0.0, pz = 0.0;
+
+	for (size_t i = 1; i < n; i++) {
+		double dx = b.x[0] - b.x[i];
+		double dy = b.y[0] - b.y[i];
+		double dz = b.z[0] - b.z[i];
+		double f = gm * softenedInverseCube(simulation.SofteningModel, dx * dx + dy * dy + dz * dz, parameters, simulation.ForceLaw);
+		double dvx = dt * (b.ax[i] - f * dx);
+		double dvy = dt * (b.ay[i] - f * dy);
+		double dvz = dt * (b.az[i] - f * dz);
+		b.vx[i] += dvx;
+		b.vy[i] += dvy;
+		b.vz[i] += dvz;
+		px += b.m[i] * dvx;
+		py += b.m[i] * dvy;
+		pz += b.m[i] * dvz;
+	}
+
+	b.vx[0] -= px / b.m[0];
+	b.vy[0] -= py / b.m[0];
+	b.vz[0] -= pz / b.m[0];
+
+	// Test particles carry no momentum, so body 0 takes none from them
+	BodyStore &p = simulation.Particles;
+	for (size_t i = 0; i < p.size(); i++) {
+		double dx = b.x[0] - p.x[i];
+		double dy = b.y[0] - p.y[i];
+		double dz = b.z[0] - p.z[i];
+		double f = gm * softenedInverseCube(simulation.SofteningModel, dx * dx + dy * dy + dz * dz, parameters, simulation.ForceLaw);
+		p.vx[i] += dt * (p.ax[i] - f * dx);
+		p.vy[i] += dt * (p.ay[i] - f * dy);
+		p.vz[i] += dt * (p.az[i] - f * dz);
+	}
+}
+
+/*
+ * Democratic heliocentric coordinates: positions relative to body 0 and velocities relative to the center of mass.
+ * Body 0 stands in for the center of mass while the others are converted
+ */
+void wisdomHolmanDrift(Simulation &simulation, double dt) {
+
+	BodyStore &b = simulation.Bodies;
+	size_t n = b.size();
+	double m0 = n > 0 ? b.m[0] : 0.0;
+	if (n < 2 || m0 <= 0.0) {
+		simulation.drift(dt);
+		return;
+	}
+
+	// Center of mass
+	double mass = 0.0, cx = 0.0, cy = 0.0, cz = 0.0, cvx = 0.0, cvy = 0.0, cvz = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		mass += b.m[i];
+		cx += b.m[i] * b.x[i]; cy += b.m[i] * b.y[i]; cz += b.m[i] * b.z[i];
+		cvx += b.m[i] * b.vx[i]; cvy += b.m[i] * b.vy[i]; cvz += b.m[i] * b.vz[i];
+	}
+	cx /= mass; cy /= mass; cz /= mass;
+	cvx /= mass; cvy /= mass; cvz /= mass;
+
+	// To democratic heliocentric coordinates, with the momentum of the others
+	double px = 0.0, py = 0.0, pz = 0.0;
+	for (size_t i = 1; i < n; i++) {
+		b.x[i] -= b.x[0]; b.y[i] -= b.y[0]; b.z[i] -= b.z[0];
+		b.vx[i] -= cvx; b.vy[i] -= cvy; b.vz[i] -= cvz;
+		px += b.m[i] * b.vx[i]; py += b.m[i] * b.vy[i]; pz += b.m[i] * b.vz[i];
+	}
+	BodyStore &p = simulation.Particles;
+	size_t particles = p.size();
+	for (size_t i = 0; i < particles; i++) {
+		p.x[i] -= b.x[0]; p.y[i] -= b.y[0]; p.z[i] -= b.z[0];
+		p.vx[i] -= cvx; p.vy[i] -= cvy; p.vz[i] -= cvz;
+	}
+
+	// Half jump, Kepler drift and the second half jump. The test particles jump with the momentum of the bodies
+	double h = 0.5 * dt / m0;
+	for (size_t i = 1; i < n; i++) {
+		b.x[i] += h * px; b.y[i] += h * py; b.z[i] += h * pz;
+	}
+	for (size_t i = 0; i < particles; i++) {
+		p.x[i] += h * px; p.y[i] += h * py; p.z[i] += h * pz;
+	}
+
+	double mu = simulation.G * m0;
+	for (size_t i = 1; i < n; i++)
+		keplerDrift(mu, dt, b.x[i], b.y[i], b.z[i], b.vx[i], b.vy[i], b.vz[i]);
+	for (size_t i = 0; i < particles; i++)
+		keplerDrift(mu, dt, p.x[i], p.y[i], p.z[i], p.vx[i], p.vy[i], p.vz[i]);
+
+	px = py = pz = 0.0;
+	for (size_t i = 1; i < n; i++) {
+		px += b.m[i] * b.vx[i]; py += b.m[i] * b.vy[i]; pz += b.m[i] * b.vz[i];
+	}
+	for (size_t i = 1; i < n; i++) {
+		b.x[i] += h * px; b.y[i] += h * py; b.z[i] += h * pz;
+	}
+	for (size_t i = 0; i < particles; i++) {
+		p.x[i] += h * px; p.y[i] += h * py; p.z[i] += h * pz;
+	}
+
+	// Back to barycentric coordinates, with the center of mass moved along
+	cx += dt * cvx; cy += dt * cvy; cz += dt * cvz;
+	double qx = 0.0, qy = 0.0, qz = 0.0;
+	for (size_t i = 1; i < n; i++) {
+		qx += b.m[i] * b.x[i]; qy += b.m[i] * b.y[i]; qz += b.m[i] * b.z[i];
+	}
+	b.x[0] = cx - qx / mass;
+	b.y[0] = cy - qy / mass;
+	b.z[0] = cz - qz / mass;
+	b.vx[0] = cvx - px / m0;
+	b.vy[0] = cvy - py / m0;
+	b.vz[0] = cvz - pz / m0;
+	for (size_t i = 1; i < n; i++) {
+		b.x[i] += b.x[0]; b.y[i] += b.y[0]; b.z[i] += b.z[0];
+		b.vx[i] += cvx; b.vy[i] += cvy; b.vz[i] += cvz;
+	}
+	for (size_t i = 0; i < particles; i++) {
+		p.x[i] += b.x[0]; p.y[i] += b.y[0]; p.z[i] += b.z[0];
+		p.vx[i] += cvx; p.vy[i] += cvy; p.vz[i] += cvz;
+	}
+
+	simulation.invalidateAccelerations();
+}
+
+/*
+ * Time within the step counts in ticks of dt / 2^maxLevel, so a body on level l starts and finishes its steps on multiples
+ * of 2^(maxLevel - l) ticks. A body gets its opening half kick when a step starts and its closing half kick after the
+ * drift that finishes it. The new level follows the Aarseth-style criterion dt_i = Eta |a| / |da/dt| with the rate of
+ * change of the acceleration over the finished step. A body moves to a deeper level at once, but to the next coarser
+ * level only when the coarser steps are synchronized with it
+ */
+void blockLeapfrogStep(Simulation &simulation, double dt) {
+
+	BodyStore &b = simulation.Bodies;
+	BlockTimesteps &blocks = simulation.Blocks;
+	size_t n = b.size();
+	if (n == 0) {
+		simulation.drift(dt);
+		return;
+	}
+
+	int maxLevel = blocks.MaxLevel < 0 ? 0 : (blocks.MaxLevel > 62 ? 62 : blocks.MaxLevel);
+	if (blocks.LevelSteps.size() != (size_t)maxLevel + 1)
+		blocks.resetStatistics();
+
+	simulation.prepareAccelerations();
+
+	// New bodies start on the deepest level and move up once the rate of change of their acceleration is known
+	if (blocks.Level.size() != n) {
+		blocks.Level.assign(n, maxLevel);
+		blocks.LastAx.assign(b.ax.begin(), b.ax.end());
+		blocks.LastAy.assign(b.ay.begin(), b.ay.end());
+		blocks.LastAz.assign(b.az.begin(), b.az.end());
+	}
+	for (size_t i = 0; i < n; i++)
+		if (blocks.Level[i] > maxLevel)
+			blocks.Level[i] = maxLevel;
+
+	const unsigned long long total = 1ULL << maxLevel;
+	const double tick = dt / (double)total;
+	std::vector<size_t> active;
+	active.reserve(n);
+
+	// Test particles take the base step, they drift with every substep and are evaluated once all bodies are synchronized
+	simulation.kickParticles(0.5 * dt);
+
+	unsigned long long t = 0;
+	while (t < total) {
+		int deepest = 0;
+		for (size_t i = 0; i < n; i++) {
+			int level = blocks.Level[i];
+			if (level > deepest)
+				deepest = level;
+
+			// Opening half kick of the bodies that start a step
+			unsigned long long span = 1ULL << (maxLevel - level);
+			if (t % span == 0) {
+				double h = 0.5 * tick * (double)span;
+				b.vx[i] += h * b.ax[i];
+				b.vy[i] += h * b.ay[i];
+				b.vz[i] += h * b.az[i];
+			}
+		}
+
+		unsigned long long stride = 1ULL << (maxLevel - deepest);
+		simulation.drift(tick * (double)stride);
+		t += stride;
+		blocks.Substeps++;
+
+		active.clear();
+		for (size_t i = 0; i < n; i++)
+			if (t % (1ULL << (maxLevel - blocks.Level[i])) == 0)
+				active.push_back(i);
+		simulation.computeActiveAccelerations(active);
+		blocks.ForceEvaluations += active.size();
+
+		for (size_t k = 0; k < active.size(); k++) {
+			size_t i = active[k];
+			int level = blocks.Level[i];
+			unsigned long long span = 1ULL << (maxLevel - level);
+			double h = tick * (double)span;
+
+			// Closing half kick
+			b.vx[i] += 0.5 * h * b.ax[i];
+			b.vy[i] += 0.5 * h * b.ay[i];
+			b.vz[i] += 0.5 * h * b.az[i];
+			blocks.LevelSteps[level]++;
+
+			double dax = b.ax[i] - blocks.LastAx[i];
+			double day = b.ay[i] - blocks.LastAy[i];
+			double daz = b.az[i] - blocks.LastAz[i];
+			double change = sqrt(dax * dax + day * day + daz * daz);
+			double accel = sqrt(b.ax[i] * b.ax[i] + b.ay[i] * b.ay[i] + b.az[i] * b.az[i]);
+			blocks.LastAx[i] = b.ax[i];
+			blocks.LastAy[i] = b.ay[i];
+			blocks.LastAz[i] = b.az[i];
+
+			// Deepest level whose step still fits the wanted step, at most one level coarser than now
+			double wanted = change > 0.0 ? blocks.Eta * h * accel / change : dt;
+			int next = 0;
+			while (next < maxLevel && dt / (double)(1ULL << next) > wanted)
+				next++;
+			if (next < level && (level == 0 || t % (span << 1) != 0))
+				next = level;
+			else if (next < level)
+				next = level - 1;
+			blocks.Level[i] = next;
+		}
+	}
+
+	simulation.kickParticles(0.5 * dt);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef INTEGRATORS_H
+#define INTEGRATORS_H
+
+#include "simulation.h"
+
+// Weights of the fourth order Yoshida composition, w1 = 1 / (2 - 2^(1/3)) and w0 = 1 - 2 w1
+const double YOSHIDA_W1 = 1.3512071919596578;
+const double YOSHIDA_W0 = -1.7024143839193153;
+
+// Integrator policies. Each provides a static step(), so Simulation::run() is specialized for the policy at compile time
+// and the step loop has no virtual calls
+
+// Kick-drift-kick leapfrog. The accelerations at the end of a step are kept for the first kick of the next step,
+// so each step costs a single force evaluation
+struct Leapfrog {
+	static void step(Simulation &simulation, double dt)
+	{
+		simulation.prepareAccelerations();
+		simulation.kick(0.5 * dt);
+		simulation.drift(dt);
+		simulation.computeAccelerations();
+		simulation.kick(0.5 * dt);
+	}
+};
+
+// Fourth order composition of three leapfrog steps (Yoshida 1990), three force evaluations per step
+struct Yoshida4 {
+	static void step(Simulation &simulation, double dt)
+	{
+		Leapfrog::step(simulation, YOSHIDA_W1 * dt);
+		Leapfrog::step(simulation, YOSHIDA_W0 * dt);
+		Leapfrog::step(simulation, YOSHIDA_W1 * dt);
+	}
+};
+
+// Interaction kick of the Wisdom-Holman map: the acceleration of every body except the one from body 0, applied so that the
+// total momentum does not change
+void wisdomHolmanKick(Simulation &simulation, double dt);
+
+// Kepler drift of every body around body 0 in democratic heliocentric coordinates, between two half steps of the
+// drift of body 0 caused by the momentum of the others
+void wisdomHolmanDrift(Simulation &simulation, double dt);
+
+// Wisdom-Holman mixed variable symplectic map (Wisdom & Holman 1991, Duncan, Levison & Lee 1998). The orbits around the
+// dominant body 0 are solved exactly, so the step only has to resolve the much weaker mutual perturbations
+struct WisdomHolman {
+	static void step(Simulation &simulation, double dt)
+	{
+		simulation.prepareAccelerations();
+		wisdomHolmanKick(simulation, 0.5 * dt);
+		wisdomHolmanDrift(simulation, dt);
+		simulation.computeAccelerations();
+		wisdomHolmanKick(simulation, 0.5 * dt);
+	}
+};
+
+// One step of the block time step leapfrog, split into the substeps of the bodies on the deepest level
+void blockLeapfrogStep(Simulation &simulation, double dt);
+
+// Kick-drift-kick leapfrog with hierarchical power-of-two time steps (Aarseth 1985, Springel 2005). A body on level l
+// takes steps of dt / 2^l, all bodies drift together, and only the bodies that finish a step in a substep are evaluated,
+// so a few fast inner orbits do not set the step of the whole system
+struct BlockLeapfrog {
+	static void step(Simulation &simulation, double dt)
+	{
+		blockLeapfrogStep(simulation, dt);
+	}
+};
+
+// One step of the Gauss-Radau integrator, covered by as many adaptive substeps as its accuracy needs
+void gaussRadauStep(Simulation &simulation, double dt);
+
+// Adaptive 15th order Gauss-Radau integrator (Everhart 1985, IAS15 of Rein & Spiegel 2015). Not symplectic, but its
+// error stays at machine precision, and its substeps shrink at pericenter and grow again on the way out, so eccentric
+// orbits cost far fewer force evaluations than with a fixed step
+struct GaussRadau {
+	static void step(Simulation &simulation, double dt)
+	{
+		gaussRadauStep(simulation, dt);
+	}
+};
+
+#endif
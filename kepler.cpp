@@ -0,0 +1,103 @@
+#include <math.h>
+#include "kepler.h"
+#include "strictfp.h"
+
+/*
+ * Series expansions close to z = 0, where the closed forms lose their precision to cancellation
+ */
+void stumpff(double z, double &c2, double &c3) {
+
+	if (z > 1.0e-2) {
+		double s = sqrt(z);
+		c2 = (1.0 - cos(s)) / z;
+		c3 = (s - sin(s)) / (z * s);
+	}
+	else if (z < -1.0e-2) {
+		double s = sqrt(-z);
+		c2 = (cosh(s) - 1.0) / -z;
+		c3 = (sinh(s) - s) / (-z * s);
+	}
+	else {
+		c2 = 1.0 / 2.0 - z * (1.0 / 24.0 - z * (1.0 / 720.0 - z * (1.0 / 40320.0 - z / 3628800.0)));
+		c3 = 1.0 / 6.0 - z * (1.0 / 120.0 - z * (1.0 / 5040.0 - z * (1.0 / 362880.0 - z / 39916800.0)));
+	}
+}
+
+/*
+ * Closed orbits start from the mean motion, which is exact for circular orbits. Open orbits start from the logarithmic
+ * estimate of Vallado (Fundamentals of Astrodynamics, algorithm 8), which follows the exponential growth of the anomaly
+ * at large times, and fall back to straight motion where it does not apply
+ */
+double universalGuess(double sqrtMu, double dt, double r0, double sigma, double alpha) {
+
+	if (alpha > 0.0)
+		return sqrtMu * dt * alpha;
+
+	if (alpha < 0.0 && dt != 0.0) {
+		double a = 1.0 / alpha;
+		double s = dt > 0.0 ? 1.0 : -1.0;
+		double ratio = -2.0 * sqrtMu * alpha * dt / (sigma + s * sqrt(-a) * (1.0 - r0 * alpha));
+		if (ratio > 1.0 && ratio < HUGE_VAL)
+			return s * sqrt(-a) * log(ratio);
+	}
+	return sqrtMu * dt / r0;
+}
+
+/*
+ * Universal variable formulation (Vallado, Fundamentals of Astrodynamics). Kepler's equation in the universal anomaly chi
+ * is solved with the Laguerre-Conway iteration, which converges from the first guess for elliptic and hyperbolic orbits
+ * alike, and the new state follows from the Lagrange f and g functions
+ */
+void keplerDrift(double mu, double dt, double &x, double &y, double &z, double &vx, double &vy, double &vz) {
+
+	double r0 = sqrt(x * x + y * y + z * z);
+	if (r0 == 0.0 || mu <= 0.0 || dt == 0.0) {
+		x += dt * vx;
+		y += dt * vy;
+		z += dt * vz;
+		return;
+	}
+
+	double v2 = vx * vx + vy * vy + vz * vz;
+	double sqrtMu = sqrt(mu);
+	double sigma = (x * vx + y * vy + z * vz) / sqrtMu;
+	// Reciprocal of the semi-major axis, negative for hyperbolic orbits
+	double alpha = 2.0 / r0 - v2 / mu;
+
+	double chi = universalGuess(sqrtMu, dt, r0, sigma, alpha);
+
+	double c2 = 0.5, c3 = 1.0 / 6.0;
+	for (int i = 0; i < KEPLER_ITERATIONS; i++) {
+		double psi = alpha * chi * chi;
+		stumpff(psi, c2, c3);
+		double chi2 = chi * chi;
+		double f = sigma * chi2 * c2 + (1.0 - alpha * r0) * chi2 * chi * c3 + r0 * chi - sqrtMu * dt;
+		double df = sigma * chi * (1.0 - psi * c3) + (1.0 - alpha * r0) * chi2 * c2 + r0;
+		double ddf = sigma * (1.0 - psi * c2) + (1.0 - alpha * r0) * chi * (1.0 - psi * c3);
+
+		// Laguerre-Conway step with n = 5
+		double root = sqrt(fabs(16.0 * df * df - 20.0 * f * ddf));
+		double delta = 5.0 * f / (df + (df >= 0.0 ? root : -root));
+		chi -= delta;
+		if (fabs(delta) <= KEPLER_TOLERANCE * fabs(chi))
+			break;
+	}
+
+	// Lagrange coefficients at the converged anomaly
+	double chi2 = chi * chi;
+	double psi = alpha * chi2;
+	stumpff(psi, c2, c3);
+	double r = sigma * chi * (1.0 - psi * c3) + (1.0 - alpha * r0) * chi2 * c2 + r0;
+	double f = 1.0 - chi2 / r0 * c2;
+	double g = dt - chi2 * chi / sqrtMu * c3;
+	double df = sqrtMu / (r * r0) * chi * (psi * c3 - 1.0);
+	double dg = 1.0 - chi2 / r * c2;
+
+	double px = x, py = y, pz = z;
+	x = f * px + g * vx;
+	y = f * py + g * vy;
+	z = f * pz + g * vz;
+	vx = df * px + dg * vx;
+	vy = df * py + dg * vy;
+	vz = df * pz + dg * vz;
+}
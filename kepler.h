@@ -0,0 +1,25 @@
+#pragma once
+
+#ifndef KEPLER_H
+#define KEPLER_H
+
+// Circle constant, math.h only defines M_PI on some compilers
+const double PI = 3.14159265358979323846;
+
+// Largest number of iterations for Kepler's equation, and the relative change of the anomaly at which it has converged.
+// The iteration converges cubically, so the anomaly after a step of 1e-12 is already exact to rounding
+const int KEPLER_ITERATIONS = 50;
+const double KEPLER_TOLERANCE = 1.0e-12;
+
+// Stumpff functions c2(z) = (1 - cos(sqrt z)) / z and c3(z) = (sqrt z - sin(sqrt z)) / sqrt(z)^3, continued to z <= 0
+void stumpff(double z, double &c2, double &c3);
+
+// First guess of the universal anomaly after the time dt, from sqrt(mu), the distance r0, sigma = r0.v0 / sqrt(mu) and
+// alpha = 1 / semi-major axis
+double universalGuess(double sqrtMu, double dt, double r0, double sigma, double alpha);
+
+// Advance a body on a two-body orbit around a fixed center with gravitational parameter mu = G * M by the time dt.
+// Position and velocity are relative to the center and are updated in place. Works for any eccentricity
+void keplerDrift(double mu, double dt, double &x, double &y, double &z, double &vx, double &vy, double &vz);
+
+#endif
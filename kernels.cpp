@@ -0,0 +1,674 @@
+#include <math.h>
+#include "kernels.h"
+
+#if defined(KERNEL_AVX512) || defined(KERNEL_AVX2)
+#include <immintrin.h>
+#endif
+
+const char *kernelName() {
+
+#if defined(KERNEL_AVX512)
+	return "AVX-512";
+#elif defined(KERNEL_AVX2)
+	return "AVX2";
+#else
+	return "scalar";
+#endif
+}
+
+// The scalar, exact and compensated kernels must not have their multiplications and additions contracted into fused
+// multiply-adds, which compilers may do differently per instruction set
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+void pairwiseAccelerationsScalar(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az) {
+
+	for (size_t i = 0; i < targets; i++) {
+		double xi = tx[i], yi = ty[i], zi = tz[i];
+		double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+		for (size_t j = 0; j < sources; j++) {
+			double dx = sx[j] - xi;
+			double dy = sy[j] - yi;
+			double dz = sz[j] - zi;
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 == 0.0)
+				continue;
+			double invR = 1.0 / sqrt(r2 + eps2);
+			double f = sm[j] * invR * invR * invR;
+			sumX += f * dx;
+			sumY += f * dy;
+			sumZ += f * dz;
+		}
+		ax[i] += sumX;
+		ay[i] += sumY;
+		az[i] += sumZ;
+	}
+}
+
+/*
+ * Same operations as pairwiseAccelerationsScalar, the potential is summed alongside
+ */
+void pairwiseAccelerationsPotentialScalar(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *potential) {
+
+	for (size_t i = 0; i < targets; i++) {
+		double xi = tx[i], yi = ty[i], zi = tz[i];
+		double sumX = 0.0, sumY = 0.0, sumZ = 0.0, sumP = 0.0;
+		for (size_t j = 0; j < sources; j++) {
+			double dx = sx[j] - xi;
+			double dy = sy[j] - yi;
+			double dz = sz[j] - zi;
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 == 0.0)
+				continue;
+			double invR = 1.0 / sqrt(r2 + eps2);
+			double f = sm[j] * invR * invR * invR;
+			sumX += f * dx;
+			sumY += f * dy;
+			sumZ += f * dz;
+			sumP -= sm[j] * invR;
+		}
+		ax[i] += sumX;
+		ay[i] += sumY;
+		az[i] += sumZ;
+		potential[i] += sumP;
+	}
+}
+
+/*
+ * Knuth's two-sum: t is the rounded sum and (s - (t - z)) + (x - z) exactly what the rounding lost
+ */
+static inline void twoSum(double &sum, double &error, double x) {
+
+	double t = sum + x;
+	double z = t - sum;
+	error += (sum - (t - z)) + (x - z);
+	sum = t;
+}
+
+static void pairwiseAccelerationsCompensatedScalar(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *ex, double *ey, double *ez) {
+
+	for (size_t i = 0; i < targets; i++) {
+		double sumX = ax[i], sumY = ay[i], sumZ = az[i];
+		double errX = ex[i], errY = ey[i], errZ = ez[i];
+		for (size_t j = 0; j < sources; j++) {
+			double dx = sx[j] - tx[i];
+			double dy = sy[j] - ty[i];
+			double dz = sz[j] - tz[i];
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 == 0.0)
+				continue;
+			double invR = 1.0 / sqrt(r2 + eps2);
+			double f = sm[j] * invR * invR * invR;
+			twoSum(sumX, errX, f * dx);
+			twoSum(sumY, errY, f * dy);
+			twoSum(sumZ, errZ, f * dz);
+		}
+		ax[i] = sumX; ay[i] = sumY; az[i] = sumZ;
+		ex[i] = errX; ey[i] = errY; ez[i] = errZ;
+	}
+}
+
+#if defined(KERNEL_AVX512)
+
+/*
+ * Eight targets per register, with the operations of the scalar kernel in the same order
+ */
+void pairwiseAccelerationsExact(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az) {
+
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d one = _mm512_set1_pd(1.0);
+	const __m512d soft = _mm512_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 8 <= targets; i += 8) {
+		__m512d xi = _mm512_loadu_pd(tx + i);
+		__m512d yi = _mm512_loadu_pd(ty + i);
+		__m512d zi = _mm512_loadu_pd(tz + i);
+		__m512d sumX = zero, sumY = zero, sumZ = zero;
+
+		for (size_t j = 0; j < sources; j++) {
+			__m512d dx = _mm512_sub_pd(_mm512_set1_pd(sx[j]), xi);
+			__m512d dy = _mm512_sub_pd(_mm512_set1_pd(sy[j]), yi);
+			__m512d dz = _mm512_sub_pd(_mm512_set1_pd(sz[j]), zi);
+			__m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+			__mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_UQ);
+			__m512d invR = _mm512_div_pd(one, _mm512_sqrt_pd(_mm512_add_pd(r2, soft)));
+			__m512d f = _mm512_maskz_mul_pd(valid, _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(sm[j]), invR), invR), invR);
+			sumX = _mm512_add_pd(sumX, _mm512_mul_pd(f, dx));
+			sumY = _mm512_add_pd(sumY, _mm512_mul_pd(f, dy));
+			sumZ = _mm512_add_pd(sumZ, _mm512_mul_pd(f, dz));
+		}
+
+		_mm512_storeu_pd(ax + i, _mm512_add_pd(_mm512_loadu_pd(ax + i), sumX));
+		_mm512_storeu_pd(ay + i, _mm512_add_pd(_mm512_loadu_pd(ay + i), sumY));
+		_mm512_storeu_pd(az + i, _mm512_add_pd(_mm512_loadu_pd(az + i), sumZ));
+	}
+
+	pairwiseAccelerationsScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2, ax + i, ay + i, az + i);
+}
+
+/*
+ * Two-sum of a register of contributions, see twoSum
+ */
+static inline void twoSum512(__m512d &sum, __m512d &error, __m512d x) {
+
+	__m512d t = _mm512_add_pd(sum, x);
+	__m512d z = _mm512_sub_pd(t, sum);
+	error = _mm512_add_pd(error, _mm512_add_pd(_mm512_sub_pd(sum, _mm512_sub_pd(t, z)), _mm512_sub_pd(x, z)));
+	sum = t;
+}
+
+void pairwiseAccelerationsCompensated(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *ex, double *ey, double *ez) {
+
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d one = _mm512_set1_pd(1.0);
+	const __m512d soft = _mm512_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 8 <= targets; i += 8) {
+		__m512d xi = _mm512_loadu_pd(tx + i);
+		__m512d yi = _mm512_loadu_pd(ty + i);
+		__m512d zi = _mm512_loadu_pd(tz + i);
+		__m512d sumX = _mm512_loadu_pd(ax + i), sumY = _mm512_loadu_pd(ay + i), sumZ = _mm512_loadu_pd(az + i);
+		__m512d errX = _mm512_loadu_pd(ex + i), errY = _mm512_loadu_pd(ey + i), errZ = _mm512_loadu_pd(ez + i);
+
+		for (size_t j = 0; j < sources; j++) {
+			__m512d dx = _mm512_sub_pd(_mm512_set1_pd(sx[j]), xi);
+			__m512d dy = _mm512_sub_pd(_mm512_set1_pd(sy[j]), yi);
+			__m512d dz = _mm512_sub_pd(_mm512_set1_pd(sz[j]), zi);
+			__m512d r2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz));
+			__mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_UQ);
+			__m512d invR = _mm512_div_pd(one, _mm512_sqrt_pd(_mm512_add_pd(r2, soft)));
+			__m512d f = _mm512_maskz_mul_pd(valid, _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(sm[j]), invR), invR), invR);
+			twoSum512(sumX, errX, _mm512_mul_pd(f, dx));
+			twoSum512(sumY, errY, _mm512_mul_pd(f, dy));
+			twoSum512(sumZ, errZ, _mm512_mul_pd(f, dz));
+		}
+
+		_mm512_storeu_pd(ax + i, sumX); _mm512_storeu_pd(ay + i, sumY); _mm512_storeu_pd(az + i, sumZ);
+		_mm512_storeu_pd(ex + i, errX); _mm512_storeu_pd(ey + i, errY); _mm512_storeu_pd(ez + i, errZ);
+	}
+
+	pairwiseAccelerationsCompensatedScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2,
+		ax + i, ay + i, az + i, ex + i, ey + i, ez + i);
+}
+
+#elif defined(KERNEL_AVX2)
+
+/*
+ * Four targets per register, with the operations of the scalar kernel in the same order
+ */
+void pairwiseAccelerationsExact(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az) {
+
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d soft = _mm256_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 4 <= targets; i += 4) {
+		__m256d xi = _mm256_loadu_pd(tx + i);
+		__m256d yi = _mm256_loadu_pd(ty + i);
+		__m256d zi = _mm256_loadu_pd(tz + i);
+		__m256d sumX = zero, sumY = zero, sumZ = zero;
+
+		for (size_t j = 0; j < sources; j++) {
+			__m256d dx = _mm256_sub_pd(_mm256_broadcast_sd(sx + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_broadcast_sd(sy + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_broadcast_sd(sz + j), zi);
+			__m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			__m256d valid = _mm256_cmp_pd(r2, zero, _CMP_NEQ_UQ);
+			__m256d invR = _mm256_div_pd(one, _mm256_sqrt_pd(_mm256_add_pd(r2, soft)));
+			__m256d f = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_broadcast_sd(sm + j), invR), invR), invR);
+			f = _mm256_and_pd(f, valid);
+			sumX = _mm256_add_pd(sumX, _mm256_mul_pd(f, dx));
+			sumY = _mm256_add_pd(sumY, _mm256_mul_pd(f, dy));
+			sumZ = _mm256_add_pd(sumZ, _mm256_mul_pd(f, dz));
+		}
+
+		_mm256_storeu_pd(ax + i, _mm256_add_pd(_mm256_loadu_pd(ax + i), sumX));
+		_mm256_storeu_pd(ay + i, _mm256_add_pd(_mm256_loadu_pd(ay + i), sumY));
+		_mm256_storeu_pd(az + i, _mm256_add_pd(_mm256_loadu_pd(az + i), sumZ));
+	}
+
+	pairwiseAccelerationsScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2, ax + i, ay + i, az + i);
+}
+
+/*
+ * Two-sum of a register of contributions, see twoSum
+ */
+static inline void twoSum256(__m256d &sum, __m256d &error, __m256d x) {
+
+	__m256d t = _mm256_add_pd(sum, x);
+	__m256d z = _mm256_sub_pd(t, sum);
+	error = _mm256_add_pd(error, _mm256_add_pd(_mm256_sub_pd(sum, _mm256_sub_pd(t, z)), _mm256_sub_pd(x, z)));
+	sum = t;
+}
+
+void pairwiseAccelerationsCompensated(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *ex, double *ey, double *ez) {
+
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d soft = _mm256_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 4 <= targets; i += 4) {
+		__m256d xi = _mm256_loadu_pd(tx + i);
+		__m256d yi = _mm256_loadu_pd(ty + i);
+		__m256d zi = _mm256_loadu_pd(tz + i);
+		__m256d sumX = _mm256_loadu_pd(ax + i), sumY = _mm256_loadu_pd(ay + i), sumZ = _mm256_loadu_pd(az + i);
+		__m256d errX = _mm256_loadu_pd(ex + i), errY = _mm256_loadu_pd(ey + i), errZ = _mm256_loadu_pd(ez + i);
+
+		for (size_t j = 0; j < sources; j++) {
+			__m256d dx = _mm256_sub_pd(_mm256_broadcast_sd(sx + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_broadcast_sd(sy + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_broadcast_sd(sz + j), zi);
+			__m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			__m256d valid = _mm256_cmp_pd(r2, zero, _CMP_NEQ_UQ);
+			__m256d invR = _mm256_div_pd(one, _mm256_sqrt_pd(_mm256_add_pd(r2, soft)));
+			__m256d f = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_broadcast_sd(sm + j), invR), invR), invR);
+			f = _mm256_and_pd(f, valid);
+			twoSum256(sumX, errX, _mm256_mul_pd(f, dx));
+			twoSum256(sumY, errY, _mm256_mul_pd(f, dy));
+			twoSum256(sumZ, errZ, _mm256_mul_pd(f, dz));
+		}
+
+		_mm256_storeu_pd(ax + i, sumX); _mm256_storeu_pd(ay + i, sumY); _mm256_storeu_pd(az + i, sumZ);
+		_mm256_storeu_pd(ex + i, errX); _mm256_storeu_pd(ey + i, errY); _mm256_storeu_pd(ez + i, errZ);
+	}
+
+	pairwiseAccelerationsCompensatedScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2,
+		ax + i, ay + i, az + i, ex + i, ey + i, ez + i);
+}
+
+#else
+
+void pairwiseAccelerationsExact(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az) {
+
+	pairwiseAccelerationsScalar(tx, ty, tz, targets, sx, sy, sz, sm, sources, eps2, ax, ay, az);
+}
+
+
+void pairwiseAccelerationsCompensated(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *ex, double *ey, double *ez) {
+
+	pairwiseAccelerationsCompensatedScalar(tx, ty, tz, targets, sx, sy, sz, sm, sources, eps2, ax, ay, az, ex, ey, ez);
+}
+
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+/*
+ * Every pair is visited once and pulls both ways
+ */
+void ensembleAccelerationsScalar(size_t bodies, size_t stride, size_t count, const double *m, const double *x, const double *y,
+	const double *z, double eps2, double *ax, double *ay, double *az) {
+
+	for (size_t b = 0; b < bodies; b++)
+		for (size_t e = 0; e < count; e++)
+			ax[b * stride + e] = ay[b * stride + e] = az[b * stride + e] = 0.0;
+
+	for (size_t i = 0; i < bodies; i++)
+		for (size_t j = i + 1; j < bodies; j++) {
+			size_t oi = i * stride, oj = j * stride;
+			for (size_t e = 0; e < count; e++) {
+				double dx = x[oj + e] - x[oi + e];
+				double dy = y[oj + e] - y[oi + e];
+				double dz = z[oj + e] - z[oi + e];
+				double r2 = dx * dx + dy * dy + dz * dz;
+				if (r2 == 0.0)
+					continue;
+				double invR = 1.0 / sqrt(r2 + eps2);
+				double f = invR * invR * invR;
+				double fi = m[oj + e] * f, fj = m[oi + e] * f;
+				ax[oi + e] += fi * dx; ay[oi + e] += fi * dy; az[oi + e] += fi * dz;
+				ax[oj + e] -= fj * dx; ay[oj + e] -= fj * dy; az[oj + e] -= fj * dz;
+			}
+		}
+}
+
+#if defined(KERNEL_AVX512)
+
+/*
+ * 14-bit hardware estimate of 1/sqrt(r2), refined by two Newton-Raphson steps y = y (1.5 - 0.5 r2 y^2) to about 52 bits
+ */
+static inline __m512d rsqrt(__m512d r2) {
+
+	const __m512d half = _mm512_set1_pd(0.5);
+	const __m512d threeHalves = _mm512_set1_pd(1.5);
+	__m512d h = _mm512_mul_pd(half, r2);
+	__m512d y = _mm512_rsqrt14_pd(r2);
+	y = _mm512_mul_pd(y, _mm512_fnmadd_pd(h, _mm512_mul_pd(y, y), threeHalves));
+	y = _mm512_mul_pd(y, _mm512_fnmadd_pd(h, _mm512_mul_pd(y, y), threeHalves));
+	return y;
+}
+
+/*
+ * Eight targets per register, every source broadcast against them
+ */
+void pairwiseAccelerations(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az) {
+
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d soft = _mm512_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 8 <= targets; i += 8) {
+		__m512d xi = _mm512_loadu_pd(tx + i);
+		__m512d yi = _mm512_loadu_pd(ty + i);
+		__m512d zi = _mm512_loadu_pd(tz + i);
+		__m512d sumX = zero, sumY = zero, sumZ = zero;
+
+		for (size_t j = 0; j < sources; j++) {
+			__m512d dx = _mm512_sub_pd(_mm512_set1_pd(sx[j]), xi);
+			__m512d dy = _mm512_sub_pd(_mm512_set1_pd(sy[j]), yi);
+			__m512d dz = _mm512_sub_pd(_mm512_set1_pd(sz[j]), zi);
+			__m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+			__mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+			__m512d invR = rsqrt(_mm512_add_pd(r2, soft));
+			__m512d f = _mm512_maskz_mul_pd(valid, _mm512_set1_pd(sm[j]), _mm512_mul_pd(invR, _mm512_mul_pd(invR, invR)));
+			sumX = _mm512_fmadd_pd(f, dx, sumX);
+			sumY = _mm512_fmadd_pd(f, dy, sumY);
+			sumZ = _mm512_fmadd_pd(f, dz, sumZ);
+		}
+
+		_mm512_storeu_pd(ax + i, _mm512_add_pd(_mm512_loadu_pd(ax + i), sumX));
+		_mm512_storeu_pd(ay + i, _mm512_add_pd(_mm512_loadu_pd(ay + i), sumY));
+		_mm512_storeu_pd(az + i, _mm512_add_pd(_mm512_loadu_pd(az + i), sumZ));
+	}
+
+	pairwiseAccelerationsScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2, ax + i, ay + i, az + i);
+}
+
+/*
+ * The loop of pairwiseAccelerations with a fourth sum for the potential
+ */
+void pairwiseAccelerationsPotential(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *potential) {
+
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d soft = _mm512_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 8 <= targets; i += 8) {
+		__m512d xi = _mm512_loadu_pd(tx + i);
+		__m512d yi = _mm512_loadu_pd(ty + i);
+		__m512d zi = _mm512_loadu_pd(tz + i);
+		__m512d sumX = zero, sumY = zero, sumZ = zero, sumP = zero;
+
+		for (size_t j = 0; j < sources; j++) {
+			__m512d dx = _mm512_sub_pd(_mm512_set1_pd(sx[j]), xi);
+			__m512d dy = _mm512_sub_pd(_mm512_set1_pd(sy[j]), yi);
+			__m512d dz = _mm512_sub_pd(_mm512_set1_pd(sz[j]), zi);
+			__m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+			__mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+			__m512d invR = rsqrt(_mm512_add_pd(r2, soft));
+			__m512d mj = _mm512_set1_pd(sm[j]);
+			__m512d f = _mm512_maskz_mul_pd(valid, mj, _mm512_mul_pd(invR, _mm512_mul_pd(invR, invR)));
+			sumX = _mm512_fmadd_pd(f, dx, sumX);
+			sumY = _mm512_fmadd_pd(f, dy, sumY);
+			sumZ = _mm512_fmadd_pd(f, dz, sumZ);
+			sumP = _mm512_mask3_fnmadd_pd(mj, invR, sumP, valid);
+		}
+
+		_mm512_storeu_pd(ax + i, _mm512_add_pd(_mm512_loadu_pd(ax + i), sumX));
+		_mm512_storeu_pd(ay + i, _mm512_add_pd(_mm512_loadu_pd(ay + i), sumY));
+		_mm512_storeu_pd(az + i, _mm512_add_pd(_mm512_loadu_pd(az + i), sumZ));
+		_mm512_storeu_pd(potential + i, _mm512_add_pd(_mm512_loadu_pd(potential + i), sumP));
+	}
+
+	pairwiseAccelerationsPotentialScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2, ax + i, ay + i, az + i,
+		potential + i);
+}
+
+/*
+ * Eight members per register. The accelerations of body i stay in registers while it meets the bodies after it
+ */
+void ensembleAccelerations(size_t bodies, size_t stride, size_t count, const double *m, const double *x, const double *y,
+	const double *z, double eps2, double *ax, double *ay, double *az) {
+
+	const __m512d zero = _mm512_setzero_pd();
+	const __m512d soft = _mm512_set1_pd(eps2);
+	size_t e = 0;
+
+	for (; e + 8 <= count; e += 8) {
+		for (size_t b = 0; b < bodies; b++) {
+			_mm512_storeu_pd(ax + b * stride + e, zero);
+			_mm512_storeu_pd(ay + b * stride + e, zero);
+			_mm512_storeu_pd(az + b * stride + e, zero);
+		}
+
+		for (size_t i = 0; i < bodies; i++) {
+			size_t oi = i * stride + e;
+			__m512d xi = _mm512_loadu_pd(x + oi), yi = _mm512_loadu_pd(y + oi), zi = _mm512_loadu_pd(z + oi);
+			__m512d mi = _mm512_loadu_pd(m + oi);
+			__m512d sumX = _mm512_loadu_pd(ax + oi), sumY = _mm512_loadu_pd(ay + oi), sumZ = _mm512_loadu_pd(az + oi);
+
+			for (size_t j = i + 1; j < bodies; j++) {
+				size_t oj = j * stride + e;
+				__m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + oj), xi);
+				__m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + oj), yi);
+				__m512d dz = _mm512_sub_pd(_mm512_loadu_pd(z + oj), zi);
+				__m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+				__mmask8 valid = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+				__m512d invR = rsqrt(_mm512_add_pd(r2, soft));
+				__m512d f = _mm512_maskz_mul_pd(valid, invR, _mm512_mul_pd(invR, invR));
+				__m512d fi = _mm512_mul_pd(_mm512_loadu_pd(m + oj), f);
+				__m512d fj = _mm512_mul_pd(mi, f);
+				sumX = _mm512_fmadd_pd(fi, dx, sumX);
+				sumY = _mm512_fmadd_pd(fi, dy, sumY);
+				sumZ = _mm512_fmadd_pd(fi, dz, sumZ);
+				_mm512_storeu_pd(ax + oj, _mm512_fnmadd_pd(fj, dx, _mm512_loadu_pd(ax + oj)));
+				_mm512_storeu_pd(ay + oj, _mm512_fnmadd_pd(fj, dy, _mm512_loadu_pd(ay + oj)));
+				_mm512_storeu_pd(az + oj, _mm512_fnmadd_pd(fj, dz, _mm512_loadu_pd(az + oj)));
+			}
+
+			_mm512_storeu_pd(ax + oi, sumX);
+			_mm512_storeu_pd(ay + oi, sumY);
+			_mm512_storeu_pd(az + oi, sumZ);
+		}
+	}
+
+	ensembleAccelerationsScalar(bodies, stride, count - e, m + e, x + e, y + e, z + e, eps2, ax + e, ay + e, az + e);
+}
+
+#elif defined(KERNEL_AVX2)
+
+/*
+ * 12-bit single precision estimate of 1/sqrt(r2), refined by two Newton-Raphson steps y = y (1.5 - 0.5 r2 y^2) to about 46 bits.
+ * r2 must lie within the single precision range
+ */
+static inline __m256d rsqrt(__m256d r2) {
+
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d threeHalves = _mm256_set1_pd(1.5);
+	__m256d h = _mm256_mul_pd(half, r2);
+	__m256d y = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+	y = _mm256_mul_pd(y, _mm256_sub_pd(threeHalves, _mm256_mul_pd(h, _mm256_mul_pd(y, y))));
+	y = _mm256_mul_pd(y, _mm256_sub_pd(threeHalves, _mm256_mul_pd(h, _mm256_mul_pd(y, y))));
+	return y;
+}
+
+/*
+ * Four targets per register, every source broadcast against them
+ */
+void pairwiseAccelerations(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az) {
+
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d soft = _mm256_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 4 <= targets; i += 4) {
+		__m256d xi = _mm256_loadu_pd(tx + i);
+		__m256d yi = _mm256_loadu_pd(ty + i);
+		__m256d zi = _mm256_loadu_pd(tz + i);
+		__m256d sumX = zero, sumY = zero, sumZ = zero;
+
+		for (size_t j = 0; j < sources; j++) {
+			__m256d dx = _mm256_sub_pd(_mm256_broadcast_sd(sx + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_broadcast_sd(sy + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_broadcast_sd(sz + j), zi);
+			__m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			__m256d valid = _mm256_cmp_pd(r2, zero, _CMP_GT_OQ);
+			__m256d invR = rsqrt(_mm256_add_pd(r2, soft));
+			__m256d f = _mm256_mul_pd(_mm256_broadcast_sd(sm + j), _mm256_mul_pd(invR, _mm256_mul_pd(invR, invR)));
+			f = _mm256_and_pd(f, valid);
+			sumX = _mm256_add_pd(sumX, _mm256_mul_pd(f, dx));
+			sumY = _mm256_add_pd(sumY, _mm256_mul_pd(f, dy));
+			sumZ = _mm256_add_pd(sumZ, _mm256_mul_pd(f, dz));
+		}
+
+		_mm256_storeu_pd(ax + i, _mm256_add_pd(_mm256_loadu_pd(ax + i), sumX));
+		_mm256_storeu_pd(ay + i, _mm256_add_pd(_mm256_loadu_pd(ay + i), sumY));
+		_mm256_storeu_pd(az + i, _mm256_add_pd(_mm256_loadu_pd(az + i), sumZ));
+	}
+
+	pairwiseAccelerationsScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2, ax + i, ay + i, az + i);
+}
+
+/*
+ * The loop of pairwiseAccelerations with a fourth sum for the potential
+ */
+void pairwiseAccelerationsPotential(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *potential) {
+
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d soft = _mm256_set1_pd(eps2);
+	size_t i = 0;
+
+	for (; i + 4 <= targets; i += 4) {
+		__m256d xi = _mm256_loadu_pd(tx + i);
+		__m256d yi = _mm256_loadu_pd(ty + i);
+		__m256d zi = _mm256_loadu_pd(tz + i);
+		__m256d sumX = zero, sumY = zero, sumZ = zero, sumP = zero;
+
+		for (size_t j = 0; j < sources; j++) {
+			__m256d dx = _mm256_sub_pd(_mm256_broadcast_sd(sx + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_broadcast_sd(sy + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_broadcast_sd(sz + j), zi);
+			__m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			__m256d valid = _mm256_cmp_pd(r2, zero, _CMP_GT_OQ);
+			__m256d invR = rsqrt(_mm256_add_pd(r2, soft));
+			__m256d mj = _mm256_broadcast_sd(sm + j);
+			__m256d f = _mm256_mul_pd(mj, _mm256_mul_pd(invR, _mm256_mul_pd(invR, invR)));
+			f = _mm256_and_pd(f, valid);
+			sumX = _mm256_add_pd(sumX, _mm256_mul_pd(f, dx));
+			sumY = _mm256_add_pd(sumY, _mm256_mul_pd(f, dy));
+			sumZ = _mm256_add_pd(sumZ, _mm256_mul_pd(f, dz));
+			sumP = _mm256_sub_pd(sumP, _mm256_and_pd(_mm256_mul_pd(mj, invR), valid));
+		}
+
+		_mm256_storeu_pd(ax + i, _mm256_add_pd(_mm256_loadu_pd(ax + i), sumX));
+		_mm256_storeu_pd(ay + i, _mm256_add_pd(_mm256_loadu_pd(ay + i), sumY));
+		_mm256_storeu_pd(az + i, _mm256_add_pd(_mm256_loadu_pd(az + i), sumZ));
+		_mm256_storeu_pd(potential + i, _mm256_add_pd(_mm256_loadu_pd(potential + i), sumP));
+	}
+
+	pairwiseAccelerationsPotentialScalar(tx + i, ty + i, tz + i, targets - i, sx, sy, sz, sm, sources, eps2, ax + i, ay + i, az + i,
+		potential + i);
+}
+
+/*
+ * Four members per register. The accelerations of body i stay in registers while it meets the bodies after it
+ */
+void ensembleAccelerations(size_t bodies, size_t stride, size_t count, const double *m, const double *x, const double *y,
+	const double *z, double eps2, double *ax, double *ay, double *az) {
+
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d soft = _mm256_set1_pd(eps2);
+	size_t e = 0;
+
+	for (; e + 4 <= count; e += 4) {
+		for (size_t b = 0; b < bodies; b++) {
+			_mm256_storeu_pd(ax + b * stride + e, zero);
+			_mm256_storeu_pd(ay + b * stride + e, zero);
+			_mm256_storeu_pd(az + b * stride + e, zero);
+		}
+
+		for (size_t i = 0; i < bodies; i++) {
+			size_t oi = i * stride + e;
+			__m256d xi = _mm256_loadu_pd(x + oi), yi = _mm256_loadu_pd(y + oi), zi = _mm256_loadu_pd(z + oi);
+			__m256d mi = _mm256_loadu_pd(m + oi);
+			__m256d sumX = _mm256_loadu_pd(ax + oi), sumY = _mm256_loadu_pd(ay + oi), sumZ = _mm256_loadu_pd(az + oi);
+
+			for (size_t j = i + 1; j < bodies; j++) {
+				size_t oj = j * stride + e;
+				__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + oj), xi);
+				__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + oj), yi);
+				__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + oj), zi);
+				__m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+				__m256d valid = _mm256_cmp_pd(r2, zero, _CMP_GT_OQ);
+				__m256d invR = rsqrt(_mm256_add_pd(r2, soft));
+				__m256d f = _mm256_and_pd(_mm256_mul_pd(invR, _mm256_mul_pd(invR, invR)), valid);
+				__m256d fi = _mm256_mul_pd(_mm256_loadu_pd(m + oj), f);
+				__m256d fj = _mm256_mul_pd(mi, f);
+				sumX = _mm256_add_pd(sumX, _mm256_mul_pd(fi, dx));
+				sumY = _mm256_add_pd(sumY, _mm256_mul_pd(fi, dy));
+				sumZ = _mm256_add_pd(sumZ, _mm256_mul_pd(fi, dz));
+				_mm256_storeu_pd(ax + oj, _mm256_sub_pd(_mm256_loadu_pd(ax + oj), _mm256_mul_pd(fj, dx)));
+				_mm256_storeu_pd(ay + oj, _mm256_sub_pd(_mm256_loadu_pd(ay + oj), _mm256_mul_pd(fj, dy)));
+				_mm256_storeu_pd(az + oj, _mm256_sub_pd(_mm256_loadu_pd(az + oj), _mm256_mul_pd(fj, dz)));
+			}
+
+			_mm256_storeu_pd(ax + oi, sumX);
+			_mm256_storeu_pd(ay + oi, sumY);
+			_mm256_storeu_pd(az + oi, sumZ);
+		}
+	}
+
+	ensembleAccelerationsScalar(bodies, stride, count - e, m + e, x + e, y + e, z + e, eps2, ax + e, ay + e, az + e);
+}
+
+#else
+
+void pairwiseAccelerations(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az) {
+
+	pairwiseAccelerationsScalar(tx, ty, tz, targets, sx, sy, sz, sm, sources, eps2, ax, ay, az);
+}
+
+void pairwiseAccelerationsPotential(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *potential) {
+
+	pairwiseAccelerationsPotentialScalar(tx, ty, tz, targets, sx, sy, sz, sm, sources, eps2, ax, ay, az, potential);
+}
+
+void ensembleAccelerations(size_t bodies, size_t stride, size_t count, const double *m, const double *x, const double *y,
+	const double *z, double eps2, double *ax, double *ay, double *az) {
+
+	ensembleAccelerationsScalar(bodies, stride, count, m, x, y, z, eps2, ax, ay, az);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+
+// Widest instruction set the pairwise kernel is compiled for (/arch:AVX2 or /arch:AVX512, -mavx2 or -mavx512f)
+#if defined(__AVX512F__)
+#define KERNEL_AVX512
+#define KERNEL_WIDTH 8
+#elif defined(__AVX2__)
+#define KERNEL_AVX2
+#define KERNEL_WIDTH 4
+#else
+#define KERNEL_WIDTH 1
+#endif
+
+// Name of the instruction set used by pairwiseAccelerations
+const char *kernelName();
+
+// Add the acceleration (without G) of every source on every target. Sources at the exact position of a target are skipped,
+// so the targets may be part of the sources
+void pairwiseAccelerations(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az);
+
+// Signature shared by the pairwise kernels
+typedef void (*PairwiseKernel)(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az);
+
+// Version of pairwiseAccelerations that also adds the potential (without G), -sum m / sqrt(r^2 + eps^2) over the sources,
+// to every target. The accelerations get the same bits as from pairwiseAccelerations, the potential costs one more
+// multiply-add per pair
+void pairwiseAccelerationsPotential(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *potential);
+
+// Signature shared by the pairwise kernels with potential
+typedef void (*PairwisePotentialKernel)(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *potential);
+
+// Bitwise reproducible version of pairwiseAccelerations. Uses correctly rounded square roots and divisions, no fused
+// multiply-add and the operation order of the scalar kernel in every lane, so it gives the same bits as
+// pairwiseAccelerationsScalar for any instruction set
+void pairwiseAccelerationsExact(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az);
+
+// Version of pairwiseAccelerationsExact with compensated sums. Every contribution is added with an error-free two-sum and
+// the rounding errors are collected in ex, ey and ez, so the sum continues across calls and the accurate result is
+// a + e. Lanes and scalar tail give the same bits, like the exact kernel
+void pairwiseAccelerationsCompensated(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *ex, double *ey, double *ez);
+
+// Accelerations (without G) in a batch of independent systems of the same bodies, stored as [body][member]: the value of
+// body b in member e is at b * stride + e. The bodies of a member pull only on each other, and the vector lanes run over
+// members, so one register advances as many members at once. Evaluates count members from the given pointers on and
+// overwrites their accelerations
+void ensembleAccelerations(size_t bodies, size_t stride, size_t count, const double *m, const double *x, const double *y,
+	const double *z, double eps2, double *ax, double *ay, double *az);
+
+// Scalar version of ensembleAccelerations, used for the members left over by the vector loop
+void ensembleAccelerationsScalar(size_t bodies, size_t stride, size_t count, const double *m, const double *x, const double *y,
+	const double *z, double eps2, double *ax, double *ay, double *az);
+
+// Scalar version of pairwiseAccelerations, used for the targets left over by the vector loop and when no vector instruction set is available
+void pairwiseAccelerationsScalar(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az);
+
+// Scalar version of pairwiseAccelerationsPotential
+void pairwiseAccelerationsPotentialScalar(const double *tx, const double *ty, const double *tz, size_t targets,
+	const double *sx, const double *sy, const double *sz, const double *sm, size_t sources,
+	double eps2, double *ax, double *ay, double *az, double *potential);
+
+#endif
@@ -0,0 +1,103 @@
+#pragma once
+
+#ifndef LANES_H
+#define LANES_H
+
+#include <math.h>
+#include <stddef.h>
+#include "kernels.h"
+
+#if defined(KERNEL_AVX512) || defined(KERNEL_AVX2)
+#include <immintrin.h>
+#endif
+
+// Lane types of the batched solvers. Each provides the same operations on one double or on a vector register, so a solver
+// is written once and instantiated for the vector width and for the scalar tail. I holds one 64-bit array index per lane
+
+// One lane at a time
+struct ScalarLanes {
+	typedef double V;
+	typedef long long I;
+	static const size_t WIDTH = 1;
+	static V load(const double *p) { return *p; }
+	static void store(double *p, V a) { *p = a; }
+	static V set(double a) { return a; }
+	static V add(V a, V b) { return a + b; }
+	static V sub(V a, V b) { return a - b; }
+	static V mul(V a, V b) { return a * b; }
+	static V div(V a, V b) { return a / b; }
+	static V sqrt(V a) { return ::sqrt(a); }
+	static V abs(V a) { return fabs(a); }
+	static V floor(V a) { return ::floor(a); }
+	// a where c is positive, b elsewhere
+	static V selectPositive(V c, V a, V b) { return c > 0.0 ? a : b; }
+	// a with the sign of s
+	static V signOf(V a, V s) { return s >= 0.0 ? a : -a; }
+	// True when any lane is positive
+	static bool anyPositive(V a) { return a > 0.0; }
+	static I loadIndex(const long long *p) { return *p; }
+	static I addIndex(I a, I b) { return a + b; }
+	// p[index + k] in the lanes where k is below count, 0 elsewhere
+	static V gather(const double *p, I index, long long k, I count) { return k < count ? p[index + k] : 0.0; }
+};
+
+#if defined(KERNEL_AVX512)
+
+// Eight lanes per register
+struct VectorLanes {
+	typedef __m512d V;
+	typedef __m512i I;
+	static const size_t WIDTH = 8;
+	static V load(const double *p) { return _mm512_loadu_pd(p); }
+	static void store(double *p, V a) { _mm512_storeu_pd(p, a); }
+	static V set(double a) { return _mm512_set1_pd(a); }
+	static V add(V a, V b) { return _mm512_add_pd(a, b); }
+	static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+	static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+	static V div(V a, V b) { return _mm512_div_pd(a, b); }
+	static V sqrt(V a) { return _mm512_sqrt_pd(a); }
+	static V abs(V a) { return _mm512_abs_pd(a); }
+	static V floor(V a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+	static V selectPositive(V c, V a, V b) { return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(c, _mm512_setzero_pd(), _CMP_GT_OQ), b, a); }
+	static V signOf(V a, V s) { return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(s, _mm512_setzero_pd(), _CMP_GE_OQ), _mm512_sub_pd(_mm512_setzero_pd(), a), a); }
+	static bool anyPositive(V a) { return _mm512_cmp_pd_mask(a, _mm512_setzero_pd(), _CMP_GT_OQ) != 0; }
+	static I loadIndex(const long long *p) { return _mm512_loadu_si512(p); }
+	static I addIndex(I a, I b) { return _mm512_add_epi64(a, b); }
+	static V gather(const double *p, I index, long long k, I count) {
+		__m512i kk = _mm512_set1_epi64(k);
+		return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), _mm512_cmpgt_epi64_mask(count, kk), _mm512_add_epi64(index, kk), p, 8);
+	}
+};
+
+#elif defined(KERNEL_AVX2)
+
+// Four lanes per register
+struct VectorLanes {
+	typedef __m256d V;
+	typedef __m256i I;
+	static const size_t WIDTH = 4;
+	static V load(const double *p) { return _mm256_loadu_pd(p); }
+	static void store(double *p, V a) { _mm256_storeu_pd(p, a); }
+	static V set(double a) { return _mm256_set1_pd(a); }
+	static V add(V a, V b) { return _mm256_add_pd(a, b); }
+	static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+	static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+	static V div(V a, V b) { return _mm256_div_pd(a, b); }
+	static V sqrt(V a) { return _mm256_sqrt_pd(a); }
+	static V abs(V a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+	static V floor(V a) { return _mm256_floor_pd(a); }
+	static V selectPositive(V c, V a, V b) { return _mm256_blendv_pd(b, a, _mm256_cmp_pd(c, _mm256_setzero_pd(), _CMP_GT_OQ)); }
+	static V signOf(V a, V s) { return _mm256_blendv_pd(_mm256_sub_pd(_mm256_setzero_pd(), a), a, _mm256_cmp_pd(s, _mm256_setzero_pd(), _CMP_GE_OQ)); }
+	static bool anyPositive(V a) { return _mm256_movemask_pd(_mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_GT_OQ)) != 0; }
+	static I loadIndex(const long long *p) { return _mm256_loadu_si256((const __m256i *)p); }
+	static I addIndex(I a, I b) { return _mm256_add_epi64(a, b); }
+	static V gather(const double *p, I index, long long k, I count) {
+		__m256i kk = _mm256_set1_epi64x(k);
+		return _mm256_mask_i64gather_pd(_mm256_setzero_pd(), p, _mm256_add_epi64(index, kk),
+			_mm256_castsi256_pd(_mm256_cmpgt_epi64(count, kk)), 8);
+	}
+};
+
+#endif
+
+#endif
@@ -7,9 +7,15 @@
 #include <glm/ext.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
+#include <algorithm>
 #include <time.h>
+#include <math.h>
 #include "camera.h"
 #include "shader.h"
+#include "simulation.h"
+#include "simthread.h"
+#include "prediction.h"
+#include "benchmark.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -42,6 +48,15 @@
 const unsigned int DEFAULT_WIDTH = 1024;
 const unsigned int DEFAULT_HEIGHT = 768;
 
+// Simulated time the left arrow key rewinds
+const double REWIND_TIME = 10.0;
+// Factor of a press of the up and down arrow keys on the warp, and seconds between two updates of the window title
+const double WARP_FACTOR = 10.0;
+const float TITLE_INTERVAL = 0.5f;
+
+// Color of the predicted paths
+const glm::vec3 PREDICTION_COLOR(0.3f, 0.6f, 1.0f);
+
 // Light properties (4 valued vectors due to std140 see OpenGL 4.5 reference)
 GLfloat lightProperties[]{
 	// Position
@@ -107,8 +122,12 @@ std::vector<std::string> cm_textures {
 };
 unsigned int cubemapTexture, skyboxVAO, skyboxVBO;
 
+// Vertex buffer of the predicted paths and the prediction it holds
+unsigned int predictionVAO, predictionVBO;
+unsigned long long predictionUploaded = 0;
+
 // Shaders
-Shader shader, skyboxShader, textureShader;
+Shader shader, skyboxShader, textureShader, lineShader;
 
 // Skybox vertices
 float skyboxVertices[] = {
@@ -165,6 +184,7 @@ bool firstMouse = true;
 // Timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+float lastTitle = 0.0f;
 
 // Names
 GLuint programName;
@@ -177,23 +197,45 @@ GLuint satVertexBuf, satUVbuffer;
 GLushort *indexData;
 int numIndices;
 
-// Struct for planet dimensions
+// Struct for planet dimensions (mass in simulation units, G = 1)
 typedef struct {
-	float distance, orbitSpeed, size, rotationSpeed;
+	float distance, mass, size, rotationSpeed;
 } planet;
 
 planet planets[numObj] = {
-	{0.0f,  0.0f,  2.0f, 0.3f },		// Sun
-	{10.0f, 0.2f,  0.7f, 0.2f },		// Mercury
-	{15.0f, 0.18f, 1.0f, 0.1f },		// Venus
-	{20.0f, 0.14f, 1.0f, 0.3f },		// Earth
-	{30.0f, 0.12f, 0.8f, 0.28f},		// Mars
-	{35.0f, 0.10f, 1.7f, 0.8f },		// Jupiter
-	{40.0f, 0.08f, 1.6f, 0.6f },		// Saturn
-	{45.0f, 0.06f, 1.2f, 0.3f },		// Uranus
-	{50.0f, 0.04f, 1.2f, 0.3f }			// Neptune
+	{0.0f,  40.0f,     2.0f, 0.3f },		// Sun
+	{10.0f, 6.6e-6f,   0.7f, 0.2f },		// Mercury
+	{15.0f, 9.8e-5f,   1.0f, 0.1f },		// Venus
+	{20.0f, 1.2e-4f,   1.0f, 0.3f },		// Earth
+	{30.0f, 1.3e-5f,   0.8f, 0.28f},		// Mars
+	{35.0f, 3.8e-2f,   1.7f, 0.8f },		// Jupiter
+	{40.0f, 1.14e-2f,  1.6f, 0.6f },		// Saturn
+	{45.0f, 1.75e-3f,  1.2f, 0.3f },		// Uranus
+	{50.0f, 2.06e-3f,  1.2f, 0.3f }			// Neptune
 };
 
+// Simulation and the threads used for its force evaluation
+Simulation simulation;
+ThreadPool pool;
+// Thread that steps the simulation while the window is open
+SimulationThread simulationThread(simulation);
+// Predicted paths of the planets selected with the number keys
+OrbitPredictor predictor;
+std::vector<size_t> predicted;
+
+/*
+ * Create the simulated bodies from the planet table. The sun is body 0 and every
+ * planet starts on a circular orbit around it
+ */
+void initSimulation() {
+
+	simulation.Pool = &pool;
+	simulation.addBody(planets[0].mass, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+	for (int i = 1; i < numObj; i++)
+		simulation.addOrbitingBody(0, planets[i].mass, planets[i].distance);
+	simulation.zeroMomentum();
+}
+
 /*
  * Load a 2D texture from file
  */
@@ -400,6 +442,7 @@ int initGL() {
 	shader.init("shaders/default33.vert", "shaders/default33.frag");
 	skyboxShader.init("shaders/cubemap.vert", "shaders/cubemap.frag");
 	textureShader.init("shaders/texture.vert", "shaders/texture.frag");
+	lineShader.init("shaders/line.vert", "shaders/line.frag");
 
 	skyboxShader.use();
 	skyboxShader.setInt("skybox", 0);
@@ -417,6 +460,15 @@ int initGL() {
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 
+	// Setup the predicted paths, filled when a prediction arrives
+	glGenVertexArrays(1, &predictionVAO);
+	glGenBuffers(1, &predictionVBO);
+	glBindVertexArray(predictionVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, predictionVBO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+	glBindVertexArray(0);
+
 	// Load planet textures
 	for (int i = 0; i < numObj; i++) {
 		textureName[i] = loadTexture(textures[i]);
@@ -467,8 +519,8 @@ void drawGLScene() {
 
 	glm::mat4 model;
 
-	// Change the view matrix
-	glm::mat4 view = camera.GetViewMatrix();
+	// Change the view matrix. Everything is drawn relative to the camera (floating origin), so the view only rotates
+	glm::mat4 view = camera.GetRelativeViewMatrix();
 	glUniformMatrix4fv(viewMatrixPos, 1, GL_FALSE, &view[0][0]);
 
 	// Change the projection matrix
@@ -484,7 +536,7 @@ void drawGLScene() {
 	// Draw skybox
 	glDepthFunc(GL_LEQUAL);
 	skyboxShader.use();
-	view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
+	view = camera.GetRelativeViewMatrix();
 	skyboxShader.setMat4("view", view);
 	skyboxShader.setMat4("proj", proj);
 	glBindVertexArray(skyboxVAO);
@@ -497,17 +549,27 @@ void drawGLScene() {
 	// Enable depth buffer testing
 	glEnable(GL_DEPTH_TEST);
 
-	view = camera.GetViewMatrix();
+	view = camera.GetRelativeViewMatrix();
 	glUniformMatrix4fv(viewMatrixPos, 1, GL_FALSE, &view[0][0]);
 
+	// Light and camera in camera-relative coordinates, like the planets. The camera sits at the origin
+	glm::vec3 light = camera.GetRelativePosition(lightPosition[0], lightPosition[1], lightPosition[2]);
+	glUniform3fv(lightPositionPos, 1, &light[0]);
+	glUniform3f(cameraPositionPos, 0.0f, 0.0f, 0.0f);
+
+	// Latest state published by the simulation thread
+	const SimulationState &state = simulationThread.latest();
+
 	// Draw planets
 	for (int i = 0; i < numObj; i++) {
 
+		// Offset from the camera in double precision, rounded to float only afterwards
+		glm::vec3 position = camera.GetRelativePosition(state.x[i], state.y[i], state.z[i]);
+
 		model = glm::mat4(1.0);
+		model = glm::translate(model, position);																							// Set position
+		model = glm::rotate(model, (float)state.Time * planets[i].rotationSpeed, glm::vec3(0.0f, 1.0f, 0.0f));							// Set rotation
 		model = glm::scale(model, glm::vec3(planets[i].size, planets[i].size, planets[i].size));											// Set size
-		model = glm::rotate(model, (float)glfwGetTime() * planets[i].orbitSpeed, glm::vec3(0.0f, 10.0f, 0.0f));								// Set orbit
-		model = glm::translate(model, glm::vec3(planets[i].distance, 0.0f, -planets[i].distance));											// Set distance
-		model = glm::rotate(model, (float)glfwGetTime() * planets[i].rotationSpeed, glm::vec3(0.0f, planets[i].rotationSpeed, 0.0f));		// Set rotation
 		glUniformMatrix4fv(modelMatrixPos, 1, GL_FALSE, &model[0][0]);
 
 		
@@ -525,13 +587,30 @@ void drawGLScene() {
 	}
 
 	// Set the remaining uniforms
-	glUniform3fv(lightPositionPos, 1, lightPosition);
 	glUniform3f(lightAmbientPos, lightAmbient[0], lightAmbient[1], lightAmbient[2]);
 	glUniform3fv(lightDiffusePos, 1, lightDiffuse);
 	glUniform3fv(lightSpecularPos, 1, lightSpecular);
 	glUniform4fv(materialShininessColorPos, 1, materialShininessColor);
 	glUniform1f(materialShininessPos, materialShininess);
-	glUniform3fv(cameraPositionPos, 1, cameraPosition);
+
+	// Draw the predicted paths. The vertices are only uploaded when the predictor published new ones
+	const Prediction &prediction = predictor.latest();
+	glBindVertexArray(predictionVAO);
+	if (prediction.Generation != predictionUploaded) {
+		glBindBuffer(GL_ARRAY_BUFFER, predictionVBO);
+		glBufferData(GL_ARRAY_BUFFER, prediction.Vertices.size() * sizeof(float), prediction.Vertices.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		predictionUploaded = prediction.Generation;
+	}
+	lineShader.use();
+	lineShader.setMat4("view", view);
+	lineShader.setMat4("proj", proj);
+	lineShader.setVec3("color", PREDICTION_COLOR);
+	for (size_t k = 0; k < prediction.Bodies.size(); k++) {
+		model = glm::translate(glm::mat4(1.0), camera.GetRelativePosition(prediction.OriginX[k], prediction.OriginY[k], prediction.OriginZ[k]));
+		lineShader.setMat4("model", model);
+		glDrawArrays(GL_LINE_STRIP, prediction.First[k], prediction.Count[k]);
+	}
 
 	// Disable vertex array and texture
 	glBindVertexArray(0);
@@ -572,6 +651,23 @@ static void glfwErrorCallback(int error, const char* description) {
 static void glfwKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GLFW_TRUE);
+	if (key == GLFW_KEY_LEFT && (action == GLFW_PRESS || action == GLFW_REPEAT))
+		simulationThread.seek(simulationThread.latest().Time - REWIND_TIME);
+	if (key == GLFW_KEY_UP && action == GLFW_PRESS)
+		simulationThread.setWarp(simulationThread.warp() * WARP_FACTOR);
+	if (key == GLFW_KEY_DOWN && action == GLFW_PRESS)
+		simulationThread.setWarp(simulationThread.warp() / WARP_FACTOR);
+
+	// The number keys switch the predicted path of a planet on and off
+	if (key >= GLFW_KEY_1 && key <= GLFW_KEY_8 && action == GLFW_PRESS) {
+		size_t body = key - GLFW_KEY_0;
+		std::vector<size_t>::iterator found = std::find(predicted.begin(), predicted.end(), body);
+		if (found == predicted.end())
+			predicted.push_back(body);
+		else
+			predicted.erase(found);
+		predictor.select(predicted);
+	}
 }
 
 /*
@@ -618,10 +714,169 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
 	camera.ProcessMouseMovement(xoffset, yoffset);
 }
 
+/*
+ * Run the simulation without a window for the given number of steps and report the throughput
+ */
+void runHeadless(unsigned long long steps) {
+
+	double energy = simulation.totalEnergy();
+	clock_t start = clock();
+	for (unsigned long long i = 0; i < steps; i++)
+		simulation.step(simulation.MaxStep);
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("Steps: %llu\n", steps);
+	printf("Simulated time: %g\n", simulation.Time);
+	printf("Wall time: %g s (%g steps/s)\n", seconds, seconds > 0.0 ? steps / seconds : 0.0);
+	printf("Relative energy error: %g\n", fabs((simulation.totalEnergy() - energy) / energy));
+}
+
 /*
  * Program entry function
  */
-int main() {
+int main(int argc, char *argv[]) {
+
+	// Create the simulated bodies
+	initSimulation();
+
+	// Run without a window when requested
+	if (argc > 2 && strcmp(argv[1], "--headless") == 0) {
+		runHeadless(strtoull(argv[2], NULL, 10));
+		exit(EXIT_SUCCESS);
+	}
+
+	// Compare the gravity solvers up to the given number of bodies
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+		benchmarkSolvers(argc > 2 ? strtoull(argv[2], NULL, 10) : 1 << 20);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Report the fast multipole accuracy of every expansion order against direct summation
+	if (argc > 1 && strcmp(argv[1], "--fmm") == 0) {
+		benchmarkFmm(argc > 2 ? strtoull(argv[2], NULL, 10) : 20000, argc > 3 ? atof(argv[3]) : 1.0e-6);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Compare the scalar and vector pairwise kernels
+	if (argc > 1 && strcmp(argv[1], "--kernels") == 0) {
+		benchmarkKernels(argc > 2 ? strtoull(argv[2], NULL, 10) : 8192);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Strong scaling of the force evaluation over threads
+	if (argc > 1 && strcmp(argv[1], "--scaling") == 0) {
+		benchmarkScaling(argc > 2 ? strtoull(argv[2], NULL, 10) : 65536, argc > 3 ? atoi(argv[3]) : 0);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Energy error and cost of the integrators on the solar system
+	if (argc > 1 && strcmp(argv[1], "--integrators") == 0) {
+		benchmarkIntegrators(simulation, argc > 2 ? atof(argv[2]) : 400.0, argc > 3 ? atof(argv[3]) : 1.0e-7);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Levels and cost of the block time steps on the solar system
+	if (argc > 1 && strcmp(argv[1], "--blocks") == 0) {
+		benchmarkBlocks(simulation, argc > 2 ? atof(argv[2]) : 400.0, argc > 3 ? atof(argv[3]) : 1.0);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Cost of a belt of test particles around the solar system
+	if (argc > 1 && strcmp(argv[1], "--particles") == 0) {
+		benchmarkParticles(simulation, argc > 2 ? (size_t)atol(argv[2]) : (size_t)1 << 22, argc > 3 ? atoi(argv[3]) : 10);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Throughput of the batched Kepler solver on a random orbit catalog
+	if (argc > 1 && strcmp(argv[1], "--kepler") == 0) {
+		benchmarkKepler(argc > 2 ? (size_t)atol(argv[2]) : 1000000, argc > 3 ? (unsigned)atoi(argv[3]) : 0);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Cost of the collision searches on debris disks
+	if (argc > 1 && strcmp(argv[1], "--collisions") == 0) {
+		benchmarkCollisions(argc > 2 ? (size_t)atol(argv[2]) : (size_t)1 << 20);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Reproducibility and cost of the deterministic mode across thread counts
+	if (argc > 1 && strcmp(argv[1], "--determinism") == 0) {
+		benchmarkDeterminism(argc > 2 ? (size_t)atol(argv[2]) : 16384, argc > 3 ? atoi(argv[3]) : 10, argc > 4 ? (unsigned)atoi(argv[4]) : 0);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Energy drift against cost of the summation modes on the solar system
+	if (argc > 1 && strcmp(argv[1], "--summation") == 0) {
+		benchmarkSummation(simulation, argc > 2 ? atof(argv[2]) : 4000.0, argc > 3 ? atof(argv[3]) : 0.01, argc > 4 ? atof(argv[4]) : 1.0e-14);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Close comet encounter with and without regularization
+	if (argc > 1 && strcmp(argv[1], "--regularization") == 0) {
+		benchmarkRegularization(simulation, argc > 2 ? atof(argv[2]) : 1.0e-5, argc > 3 ? atof(argv[3]) : 1.0);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Force evaluations of the adaptive Gauss-Radau integrator against leapfrog on an eccentric comet
+	if (argc > 1 && strcmp(argv[1], "--gauss-radau") == 0) {
+		benchmarkGaussRadau(simulation, argc > 2 ? atof(argv[2]) : 0.99, argc > 3 ? atoi(argv[3]) : 2);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Moons of Jupiter and Saturn as plain bodies and in subsystems of their own
+	if (argc > 1 && strcmp(argv[1], "--moons") == 0) {
+		benchmarkMoons(simulation, argc > 2 ? (size_t)atol(argv[2]) : 8, argc > 3 ? atof(argv[3]) : 10.0, argc > 4 ? atof(argv[4]) : 0.01);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Perturbed copies of the solar system as one batched ensemble and as separate simulations
+	if (argc > 1 && strcmp(argv[1], "--ensemble") == 0) {
+		benchmarkEnsemble(simulation, argc > 2 ? (size_t)atol(argv[2]) : 4096, argc > 3 ? atoi(argv[3]) : 1000, argc > 4 ? atof(argv[4]) : 0.01);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Random cluster split into spatial domains over cooperating processes
+	if (argc > 1 && strcmp(argv[1], "--domains") == 0) {
+		benchmarkDomains(argc > 2 ? (size_t)atol(argv[2]) : 16384, argc > 3 ? (unsigned)atoi(argv[3]) : 0, argc > 4 ? atoi(argv[4]) : 20);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Rewinding and scrubbing through the recorded history of the solar system
+	if (argc > 1 && strcmp(argv[1], "--snapshots") == 0) {
+		benchmarkSnapshots(simulation, argc > 2 ? atof(argv[2]) : 1000.0, argc > 3 ? atoi(argv[3]) : 100);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Warp reached by the simulation thread on the solar system
+	if (argc > 1 && strcmp(argv[1], "--time-warp") == 0) {
+		benchmarkTimeWarp(simulation, argc > 2 ? atof(argv[2]) : 1.0);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Every precision, softening model and force law of the pair interaction template
+	if (argc > 1 && strcmp(argv[1], "--interactions") == 0) {
+		benchmarkInteractions(argc > 2 ? (size_t)atol(argv[2]) : 4096);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Cost of sampling the conserved quantities with the force evaluation
+	if (argc > 1 && strcmp(argv[1], "--diagnostics") == 0) {
+		benchmarkDiagnostics(argc > 2 ? (size_t)atol(argv[2]) : 8192, argc > 3 ? atoi(argv[3]) : 20, argc > 4 ? atoi(argv[4]) : 0);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Latency and accuracy of the predicted paths on the solar system
+	if (argc > 1 && strcmp(argv[1], "--prediction") == 0) {
+		benchmarkPrediction(simulation, argc > 2 ? atof(argv[2]) : PREDICTION_ORBITS);
+		exit(EXIT_SUCCESS);
+	}
+
+	// Lookup rate of the Chebyshev ephemeris, on a fitted fixture unless a DE file is given
+	if (argc > 1 && strcmp(argv[1], "--ephemeris") == 0) {
+		benchmarkEphemeris(argc > 2 && strcmp(argv[2], "-") != 0 ? argv[2] : NULL, argc > 3 ? (size_t)atol(argv[3]) : 1200000,
+			argc > 4 ? (unsigned)atoi(argv[4]) : 0);
+		exit(EXIT_SUCCESS);
+	}
 
 	// Set error callback
 	glfwSetErrorCallback(glfwErrorCallback);
@@ -691,6 +946,11 @@ int main() {
 	// Initialize OpenGL view
 	resizeGL(DEFAULT_WIDTH, DEFAULT_HEIGHT);
 
+	// Step the simulation on its own thread from here on, and predict paths on another
+	simulationThread.Predictor = &predictor;
+	predictor.start();
+	simulationThread.start();
+
 	// Run a loop until the window is closed
 	while (!glfwWindowShouldClose(window)) {
 
@@ -699,6 +959,15 @@ int main() {
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
+		// Requested and reached warp, and the simulated time dropped when the warp did not fit
+		if (currentFrame - lastTitle >= TITLE_INTERVAL) {
+			char title[128];
+			snprintf(title, sizeof(title), "Solar system - warp %gx, reached %.3gx, step %.3g, lag %.3g", simulationThread.warp(),
+				(double)simulationThread.Achieved, (double)simulationThread.Step, (double)simulationThread.Lag);
+			glfwSetWindowTitle(window, title);
+			lastTitle = currentFrame;
+		}
+
 		// Input
 		processInput(window);
 
@@ -712,6 +981,10 @@ int main() {
 		glfwPollEvents();
 
 	}
+
+	// Stop the simulation and prediction threads
+	simulationThread.stop();
+	predictor.stop();
 	
 	// De-allocate resources
 	glDeleteVertexArrays(1, &skyboxVAO);
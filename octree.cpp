@@ -0,0 +1,279 @@
+#include <math.h>
+#include "octree.h"
+
+Octree::Octree(int leafSize) : LeafSize(leafSize) { }
+
+/*
+ * Build the tree top-down. The root is the smallest cube that holds every body, and cells are split
+ * until they hold at most LeafSize bodies or reach MAX_DEPTH
+ */
+void Octree::build(const BodyStore &bodies) {
+
+	int n = (int)bodies.size();
+	Nodes.clear();
+	Index.resize(n);
+	scratch.resize(n);
+	for (int i = 0; i < n; i++)
+		Index[i] = i;
+
+	// Bounding cube
+	double minX = 0.0, minY = 0.0, minZ = 0.0, maxX = 0.0, maxY = 0.0, maxZ = 0.0;
+	if (n > 0) {
+		minX = maxX = bodies.x[0];
+		minY = maxY = bodies.y[0];
+		minZ = maxZ = bodies.z[0];
+	}
+	for (int i = 1; i < n; i++) {
+		minX = fmin(minX, bodies.x[i]); maxX = fmax(maxX, bodies.x[i]);
+		minY = fmin(minY, bodies.y[i]); maxY = fmax(maxY, bodies.y[i]);
+		minZ = fmin(minZ, bodies.z[i]); maxZ = fmax(maxZ, bodies.z[i]);
+	}
+	double halfSize = 0.5 * fmax(maxX - minX, fmax(maxY - minY, maxZ - minZ));
+	halfSize = halfSize * (1.0 + 1.0e-9) + 1.0e-12;
+
+	OctreeNode root;
+	root.cx = 0.5 * (minX + maxX);
+	root.cy = 0.5 * (minY + maxY);
+	root.cz = 0.5 * (minZ + maxZ);
+	root.halfSize = halfSize;
+	root.firstChild = 0;
+	root.childCount = 0;
+	root.begin = 0;
+	root.end = n;
+	Nodes.push_back(root);
+
+	split(bodies, 0, 0);
+}
+
+void Octree::split(const BodyStore &bodies, int node, int depth) {
+
+	OctreeNode cell = Nodes[node];
+
+	if (cell.end - cell.begin > LeafSize && depth < MAX_DEPTH) {
+
+		// Count the bodies in each octant
+		int count[8] = { 0 };
+		for (int i = cell.begin; i < cell.end; i++) {
+			int b = Index[i];
+			int octant = (bodies.x[b] >= cell.cx ? 1 : 0) | (bodies.y[b] >= cell.cy ? 2 : 0) | (bodies.z[b] >= cell.cz ? 4 : 0);
+			count[octant]++;
+		}
+
+		// Counting sort of the range by octant
+		int start[8];
+		start[0] = cell.begin;
+		for (int o = 1; o < 8; o++)
+			start[o] = start[o - 1] + count[o - 1];
+		int fill[8];
+		for (int o = 0; o < 8; o++)
+			fill[o] = start[o];
+		for (int i = cell.begin; i < cell.end; i++) {
+			int b = Index[i];
+			int octant = (bodies.x[b] >= cell.cx ? 1 : 0) | (bodies.y[b] >= cell.cy ? 2 : 0) | (bodies.z[b] >= cell.cz ? 4 : 0);
+			scratch[fill[octant]++] = b;
+		}
+		for (int i = cell.begin; i < cell.end; i++)
+			Index[i] = scratch[i];
+
+		// Create the non-empty children next to each other
+		double h = 0.5 * cell.halfSize;
+		int firstChild = (int)Nodes.size();
+		int childCount = 0;
+		for (int o = 0; o < 8; o++) {
+			if (count[o] == 0)
+				continue;
+			OctreeNode child;
+			child.cx = cell.cx + ((o & 1) ? h : -h);
+			child.cy = cell.cy + ((o & 2) ? h : -h);
+			child.cz = cell.cz + ((o & 4) ? h : -h);
+			child.halfSize = h;
+			child.firstChild = 0;
+			child.childCount = 0;
+			child.begin = start[o];
+			child.end = start[o] + count[o];
+			Nodes.push_back(child);
+			childCount++;
+		}
+		Nodes[node].firstChild = firstChild;
+		Nodes[node].childCount = childCount;
+
+		for (int c = 0; c < childCount; c++)
+			split(bodies, firstChild + c, depth + 1);
+	}
+
+	// Mass moments, from the children or directly from the bodies of a leaf
+	double mass = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+	if (Nodes[node].childCount > 0) {
+		for (int c = 0; c < Nodes[node].childCount; c++) {
+			const OctreeNode &child = Nodes[Nodes[node].firstChild + c];
+			mass += child.mass;
+			mx += child.mass * child.mx;
+			my += child.mass * child.my;
+			mz += child.mass * child.mz;
+		}
+	}
+	else {
+		for (int i = cell.begin; i < cell.end; i++) {
+			int b = Index[i];
+			mass += bodies.m[b];
+			mx += bodies.m[b] * bodies.x[b];
+			my += bodies.m[b] * bodies.y[b];
+			mz += bodies.m[b] * bodies.z[b];
+		}
+	}
+
+	OctreeNode &result = Nodes[node];
+	result.mass = mass;
+	if (mass > 0.0) {
+		result.mx = mx / mass;
+		result.my = my / mass;
+		result.mz = mz / mass;
+	}
+	else {
+		result.mx = result.cx;
+		result.my = result.cy;
+		result.mz = result.cz;
+	}
+	double dx = result.mx - result.cx, dy = result.my - result.cy, dz = result.mz - result.cz;
+	result.offset = sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+/*
+ * Bodies are walked in tree order, so consecutive bodies open nearly the same cells. Blocks of LeafSize * 64 bodies are
+ * separate tasks for the thread pool
+ */
+void Octree::computeAccelerations(const BodyStore &bodies, double G, double theta, double softening, double *ax, double *ay, double *az, ThreadPool *pool,
+	Softening_Model model, double *potential, Force_Law law, double range) const {
+
+	int n = (int)bodies.size();
+	double eps2 = softening * softening;
+	int block = LeafSize * 64;
+	int blocks = (n + block - 1) / block;
+
+	std::function<void(size_t)> task = [&](size_t b) {
+		int end = ((int)b + 1) * block < n ? ((int)b + 1) * block : n;
+		for (int k = (int)b * block; k < end; k++) {
+			int i = Index[k];
+			accelerationAt(bodies, bodies.x[i], bodies.y[i], bodies.z[i], i, G, theta, eps2, ax[i], ay[i], az[i], model, potential ? &potential[i] : NULL,
+				law, range);
+		}
+	};
+
+	if (pool)
+		pool->run(blocks, task);
+	else
+		for (int b = 0; b < blocks; b++)
+			task(b);
+}
+
+void Octree::accelerationAt(const BodyStore &bodies, double x, double y, double z, int self, double G, double theta, double eps2, double &ax, double &ay, double &az,
+	Softening_Model model, double *potential, Force_Law law, double range) const {
+
+	ForceParameters<double> p(sqrt(eps2), range);
+	if (law == SCREENED_LAW)
+		walkModel<ScreenedLaw>(bodies, x, y, z, self, theta, p, ax, ay, az, model, potential);
+	else
+		walkModel<NewtonLaw>(bodies, x, y, z, self, theta, p, ax, ay, az, model, potential);
+	if (potential)
+		*potential *= G;
+	ax *= G;
+	ay *= G;
+	az *= G;
+}
+
+/*
+ * The walk without potential is a separate instantiation, so the force evaluations between diagnostics do not pay for it
+ */
+template <typename Law>
+void Octree::walkModel(const BodyStore &bodies, double x, double y, double z, int self, double theta, const ForceParameters<double> &p, double &ax, double &ay, double &az,
+	Softening_Model model, double *potential) const {
+
+	double phi = 0.0;
+	if (potential) {
+		switch (model) {
+		case NO_SOFTENING: walk<NoSoftening, Law, true>(bodies, x, y, z, self, theta, p, ax, ay, az, phi); break;
+		case SPLINE_SOFTENING: walk<SplineSoftening, Law, true>(bodies, x, y, z, self, theta, p, ax, ay, az, phi); break;
+		default: walk<PlummerSoftening, Law, true>(bodies, x, y, z, self, theta, p, ax, ay, az, phi); break;
+		}
+		*potential = phi;
+	}
+	else {
+		switch (model) {
+		case NO_SOFTENING: walk<NoSoftening, Law, false>(bodies, x, y, z, self, theta, p, ax, ay, az, phi); break;
+		case SPLINE_SOFTENING: walk<SplineSoftening, Law, false>(bodies, x, y, z, self, theta, p, ax, ay, az, phi); break;
+		default: walk<PlummerSoftening, Law, false>(bodies, x, y, z, self, theta, p, ax, ay, az, phi); break;
+		}
+	}
+}
+
+/*
+ * The policies are resolved at compile time, so the loops carry no test of the softening model or the force law. A far
+ * cell is screened at the distance of its center of mass
+ */
+template <typename Softening, typename Law, bool Potential>
+void Octree::walk(const BodyStore &bodies, double x, double y, double z, int self, double theta, const ForceParameters<double> &p, double &ax, double &ay, double &az,
+	double &phi) const {
+
+	double sumX = 0.0, sumY = 0.0, sumZ = 0.0, sumP = 0.0;
+	double invTheta = 1.0 / theta;
+
+	if (Nodes.empty()) {
+		ax = ay = az = phi = 0.0;
+		return;
+	}
+
+	// Depth-first traversal with an explicit stack
+	int stack[8 * MAX_DEPTH + 8];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		const OctreeNode &cell = Nodes[stack[--top]];
+
+		double dx = cell.mx - x;
+		double dy = cell.my - y;
+		double dz = cell.mz - z;
+		double r2 = dx * dx + dy * dy + dz * dz;
+		double open = 2.0 * cell.halfSize * invTheta + cell.offset;
+
+		if (cell.childCount > 0 && r2 <= open * open) {
+			for (int c = 0; c < cell.childCount; c++)
+				stack[top++] = cell.firstChild + c;
+		}
+		else if (cell.childCount > 0) {
+			// Far enough away to use the center of mass
+			double term = 0.0;
+			double f = cell.mass * Law::scale(r2, p) * (Potential ? Softening::both(r2, p, term) : Softening::inverseCube(r2, p));
+			sumX += f * dx;
+			sumY += f * dy;
+			sumZ += f * dz;
+			if (Potential)
+				sumP += cell.mass * Law::potentialScale(r2, p) * term;
+		}
+		else {
+			// Leaf, sum the bodies directly. Coincident bodies are skipped with a select, like in the kernels
+			for (int i = cell.begin; i < cell.end; i++) {
+				int b = Index[i];
+				if (b == self)
+					continue;
+				double bx = bodies.x[b] - x;
+				double by = bodies.y[b] - y;
+				double bz = bodies.z[b] - z;
+				double r2 = bx * bx + by * by + bz * bz;
+				double term = 0.0;
+				double f = bodies.m[b] * Law::scale(r2, p) * (Potential ? Softening::both(r2, p, term) : Softening::inverseCube(r2, p));
+				f = r2 > 0.0 ? f : 0.0;
+				sumX += f * bx;
+				sumY += f * by;
+				sumZ += f * bz;
+				if (Potential)
+					sumP += r2 > 0.0 ? bodies.m[b] * Law::potentialScale(r2, p) * term : 0.0;
+			}
+		}
+	}
+
+	ax = sumX;
+	ay = sumY;
+	az = sumZ;
+	phi = sumP;
+}
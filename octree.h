@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <stddef.h>
+#include <vector>
+#include "bodies.h"
+#include "forcelaw.h"
+#include "threadpool.h"
+
+// Default octree values
+const double THETA = 0.5;
+const int LEAF_SIZE = 8;
+const int MAX_DEPTH = 48;
+
+// Cell of the octree. Children are stored next to each other, and the bodies of a cell are a contiguous range of Octree::Index
+struct OctreeNode {
+	// Geometric center and half the side length
+	double cx, cy, cz, halfSize;
+	// Total mass, center of mass and distance from the center of mass to the geometric center
+	double mass, mx, my, mz, offset;
+	// Index of the first child and number of children (0 for leaves)
+	int firstChild, childCount;
+	// Range of bodies in Octree::Index
+	int begin, end;
+};
+
+// Octree over the bodies, used for Barnes-Hut force evaluation
+class Octree
+{
+public:
+	// Cells, with the root at index 0
+	std::vector<OctreeNode> Nodes;
+	// Body indices in tree order
+	std::vector<int> Index;
+	// Largest number of bodies in a leaf
+	int LeafSize;
+
+	// Constructor
+	Octree(int leafSize = LEAF_SIZE);
+
+	// Build the tree and the mass moments of every cell from the current positions
+	void build(const BodyStore &bodies);
+
+	// Barnes-Hut accelerations of every body. A cell is approximated by its center of mass when the body is further away than size / theta plus the offset of the center of mass.
+	// The potential of every body is stored as well when potential is not NULL. range is the screening length of SCREENED_LAW
+	void computeAccelerations(const BodyStore &bodies, double G, double theta, double softening, double *ax, double *ay, double *az, ThreadPool *pool = NULL,
+		Softening_Model model = PLUMMER_SOFTENING, double *potential = NULL, Force_Law law = NEWTON_LAW, double range = 0.0) const;
+
+	// Barnes-Hut acceleration at a point, skipping the body with the given index (-1 for none), and the potential there when potential is not NULL
+	void accelerationAt(const BodyStore &bodies, double x, double y, double z, int self, double G, double theta, double eps2, double &ax, double &ay, double &az,
+		Softening_Model model = PLUMMER_SOFTENING, double *potential = NULL, Force_Law law = NEWTON_LAW, double range = 0.0) const;
+
+private:
+	// Scratch space for sorting bodies into octants
+	std::vector<int> scratch;
+
+	// Tree walk of accelerationAt for one force law, with the softening policy chosen at run time
+	template <typename Law>
+	void walkModel(const BodyStore &bodies, double x, double y, double z, int self, double theta, const ForceParameters<double> &p, double &ax, double &ay, double &az,
+		Softening_Model model, double *potential) const;
+	// Tree walk of accelerationAt for one softening policy and force law, without G, summing the potential into phi when Potential is set
+	template <typename Softening, typename Law, bool Potential>
+	void walk(const BodyStore &bodies, double x, double y, double z, int self, double theta, const ForceParameters<double> &p, double &ax, double &ay, double &az,
+		double &phi) const;
+	// Recursively split a cell into octants and compute its mass moments
+	void split(const BodyStore &bodies, int node, int depth);
+};
+
+#endif
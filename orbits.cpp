@@ -0,0 +1,199 @@
+#include <math.h>
+#include "orbits.h"
+#include "kepler.h"
+#include "kernels.h"
+#include "lanes.h"
+
+// Largest number of quarterings of the Stumpff argument, enough for any argument that does not overflow cosh
+const int STUMPFF_QUARTERINGS = 40;
+
+/*
+ * Every lane divides its argument by 4 until it is small, the series give c0 to c3 there, and the duplication formulas
+ * c0(4z) = 2 c0^2 - 1, c1(4z) = c0 c1, c2(4z) = c1^2 / 2, c3(4z) = (c2 + c0 c3) / 4 bring them back. Each duplication
+ * multiplies the rounding error, so lanes only take as many as they need. Only arithmetic and no branches per lane, so it
+ * runs on whole registers, unlike cos and cosh
+ */
+template <typename L>
+static inline void stumpffLanes(typename L::V z, typename L::V &c2, typename L::V &c3) {
+
+	typedef typename L::V V;
+	V count = L::set(0.0);
+	int quarterings = 0;
+	for (;;) {
+		V excess = L::sub(L::abs(z), L::set(0.1));
+		if (!L::anyPositive(excess) || quarterings == STUMPFF_QUARTERINGS)
+			break;
+		z = L::selectPositive(excess, L::mul(z, L::set(0.25)), z);
+		count = L::selectPositive(excess, L::add(count, L::set(1.0)), count);
+		quarterings++;
+	}
+
+	V c0 = L::sub(L::set(1.0), L::mul(z, L::sub(L::set(1.0 / 2.0), L::mul(z, L::sub(L::set(1.0 / 24.0), L::mul(z, L::sub(L::set(1.0 / 720.0),
+		L::mul(z, L::sub(L::set(1.0 / 40320.0), L::mul(z, L::set(1.0 / 3628800.0)))))))))));
+	V c1 = L::sub(L::set(1.0), L::mul(z, L::sub(L::set(1.0 / 6.0), L::mul(z, L::sub(L::set(1.0 / 120.0), L::mul(z, L::sub(L::set(1.0 / 5040.0),
+		L::mul(z, L::sub(L::set(1.0 / 362880.0), L::mul(z, L::set(1.0 / 39916800.0)))))))))));
+	c2 = L::sub(L::set(1.0 / 2.0), L::mul(z, L::sub(L::set(1.0 / 24.0), L::mul(z, L::sub(L::set(1.0 / 720.0), L::mul(z, L::sub(L::set(1.0 / 40320.0),
+		L::mul(z, L::sub(L::set(1.0 / 3628800.0), L::mul(z, L::set(1.0 / 479001600.0)))))))))));
+	c3 = L::sub(L::set(1.0 / 6.0), L::mul(z, L::sub(L::set(1.0 / 120.0), L::mul(z, L::sub(L::set(1.0 / 5040.0), L::mul(z, L::sub(L::set(1.0 / 362880.0),
+		L::mul(z, L::sub(L::set(1.0 / 39916800.0), L::mul(z, L::set(1.0 / 6227020800.0)))))))))));
+
+	for (int k = 0; k < quarterings; k++) {
+		// Positive in the lanes that still have a quartering to undo
+		V undo = L::sub(count, L::set(k + 0.5));
+		V n3 = L::mul(L::set(0.25), L::add(c2, L::mul(c0, c3)));
+		V n2 = L::mul(L::set(0.5), L::mul(c1, c1));
+		V n1 = L::mul(c0, c1);
+		V n0 = L::sub(L::mul(L::set(2.0), L::mul(c0, c0)), L::set(1.0));
+		c3 = L::selectPositive(undo, n3, c3);
+		c2 = L::selectPositive(undo, n2, c2);
+		c1 = L::selectPositive(undo, n1, c1);
+		c0 = L::selectPositive(undo, n0, c0);
+	}
+}
+
+OrbitCatalog::OrbitCatalog() { }
+
+void OrbitCatalog::clear() {
+
+	BodyArray *arrays[] = { &mu, &epoch, &x0, &y0, &z0, &vx0, &vy0, &vz0, &sqrtMu, &r0, &sigma, &alpha, &period, &invPeriod };
+	for (size_t k = 0; k < sizeof(arrays) / sizeof(arrays[0]); k++)
+		arrays[k]->clear();
+}
+
+size_t OrbitCatalog::addState(double gm, double t, double x, double y, double z, double vx, double vy, double vz) {
+
+	double r = sqrt(x * x + y * y + z * z);
+	double v2 = vx * vx + vy * vy + vz * vz;
+	double a = 2.0 / r - v2 / gm;
+
+	mu.push_back(gm);
+	epoch.push_back(t);
+	x0.push_back(x); y0.push_back(y); z0.push_back(z);
+	vx0.push_back(vx); vy0.push_back(vy); vz0.push_back(vz);
+	sqrtMu.push_back(sqrt(gm));
+	r0.push_back(r);
+	sigma.push_back((x * vx + y * vy + z * vz) / sqrt(gm));
+	alpha.push_back(a);
+	period.push_back(a > 0.0 ? 2.0 * PI / (sqrt(gm) * a * sqrt(a)) : 0.0);
+	invPeriod.push_back(a > 0.0 ? sqrt(gm) * a * sqrt(a) / (2.0 * PI) : 0.0);
+	return mu.size() - 1;
+}
+
+/*
+ * The orbit is stored with its periapsis as the epoch, where the state follows directly from the elements. The perifocal
+ * frame is rotated by the node, inclination and argument, with ecliptic (X, Y, Z) mapped to (x, -z, y)
+ */
+size_t OrbitCatalog::addElements(double gm, double q, double e, double inclination, double node, double argument, double periapsisTime) {
+
+	double speed = sqrt(gm * (1.0 + e) / q);
+	double cosO = cos(node), sinO = sin(node);
+	double cosW = cos(argument), sinW = sin(argument);
+	double cosI = cos(inclination), sinI = sin(inclination);
+
+	// Unit vectors towards periapsis and along the velocity at periapsis
+	double px = cosO * cosW - sinO * sinW * cosI;
+	double py = sinO * cosW + cosO * sinW * cosI;
+	double pz = sinW * sinI;
+	double qx = -cosO * sinW - sinO * cosW * cosI;
+	double qy = -sinO * sinW + cosO * cosW * cosI;
+	double qz = cosW * sinI;
+
+	return addState(gm, periapsisTime, q * px, q * pz, -q * py, speed * qx, speed * qz, -speed * qy);
+}
+
+void OrbitCatalog::stateAt(size_t i, double t, double &x, double &y, double &z, double &vx, double &vy, double &vz) const {
+
+	x = x0[i]; y = y0[i]; z = z0[i];
+	vx = vx0[i]; vy = vy0[i]; vz = vz0[i];
+	keplerDrift(mu[i], t - epoch[i], x, y, z, vx, vy, vz);
+}
+
+void OrbitCatalog::positionsAt(double t, double *x, double *y, double *z, ThreadPool *pool) const {
+
+	size_t n = size();
+	size_t blocks = (n + ORBIT_BLOCK - 1) / ORBIT_BLOCK;
+	auto task = [&](size_t b) {
+		size_t end = (b + 1) * ORBIT_BLOCK < n ? (b + 1) * ORBIT_BLOCK : n;
+		positionsBlock(b * ORBIT_BLOCK, end, t, x, y, z);
+	};
+
+	if (pool && blocks > 1)
+		pool->run(blocks, task);
+	else
+		for (size_t b = 0; b < blocks; b++)
+			task(b);
+}
+
+/*
+ * Same universal variable solution as keplerDrift(), for a register of orbits at once. Closed orbits are first moved back
+ * by whole periods, so the anomaly stays within one revolution and the iteration converges in a few steps for every lane.
+ * The iteration runs until every lane has converged
+ */
+template <typename L>
+static void positionsLanes(const double *epoch, const double *x0, const double *y0, const double *z0,
+	const double *vx0, const double *vy0, const double *vz0, const double *sqrtMu, const double *r0, const double *sigma,
+	const double *alpha, const double *period, const double *invPeriod, double t, double *x, double *y, double *z) {
+
+	typedef typename L::V V;
+	const V one = L::set(1.0);
+
+	V dt = L::sub(L::set(t), L::load(epoch));
+	dt = L::sub(dt, L::mul(L::floor(L::mul(dt, L::load(invPeriod))), L::load(period)));
+
+	V sm = L::load(sqrtMu);
+	V r = L::load(r0);
+	V sg = L::load(sigma);
+	V al = L::load(alpha);
+	V beta = L::sub(one, L::mul(al, r));
+	V smDt = L::mul(sm, dt);
+
+	// First guess from the mean motion, replaced by the scalar estimate in the lanes of open orbits
+	V chi = L::mul(smDt, al);
+	if (L::anyPositive(L::sub(L::set(0.0), al))) {
+		double lanes[L::WIDTH];
+		L::store(lanes, chi);
+		for (size_t k = 0; k < L::WIDTH; k++)
+			if (!(alpha[k] > 0.0))
+				lanes[k] = universalGuess(sqrtMu[k], t - epoch[k], r0[k], sigma[k], alpha[k]);
+		chi = L::load(lanes);
+	}
+	V c2, c3;
+
+	for (int i = 0; i < KEPLER_ITERATIONS; i++) {
+		V chi2 = L::mul(chi, chi);
+		V psi = L::mul(al, chi2);
+		stumpffLanes<L>(psi, c2, c3);
+		V f = L::sub(L::add(L::add(L::mul(L::mul(sg, chi2), c2), L::mul(L::mul(beta, L::mul(chi2, chi)), c3)), L::mul(r, chi)), smDt);
+		V df = L::add(L::add(L::mul(L::mul(sg, chi), L::sub(one, L::mul(psi, c3))), L::mul(L::mul(beta, chi2), c2)), r);
+		V ddf = L::add(L::mul(sg, L::sub(one, L::mul(psi, c2))), L::mul(L::mul(beta, chi), L::sub(one, L::mul(psi, c3))));
+
+		// Laguerre-Conway step with n = 5
+		V root = L::sqrt(L::abs(L::sub(L::mul(L::set(16.0), L::mul(df, df)), L::mul(L::set(20.0), L::mul(f, ddf)))));
+		V delta = L::div(L::mul(L::set(5.0), f), L::add(df, L::signOf(root, df)));
+		chi = L::sub(chi, delta);
+		if (!L::anyPositive(L::sub(L::abs(delta), L::mul(L::set(KEPLER_TOLERANCE), L::abs(chi)))))
+			break;
+	}
+
+	V chi2 = L::mul(chi, chi);
+	stumpffLanes<L>(L::mul(al, chi2), c2, c3);
+	V f = L::sub(one, L::mul(L::div(chi2, r), c2));
+	V g = L::sub(dt, L::mul(L::div(L::mul(chi2, chi), sm), c3));
+
+	L::store(x, L::add(L::mul(f, L::load(x0)), L::mul(g, L::load(vx0))));
+	L::store(y, L::add(L::mul(f, L::load(y0)), L::mul(g, L::load(vy0))));
+	L::store(z, L::add(L::mul(f, L::load(z0)), L::mul(g, L::load(vz0))));
+}
+
+void OrbitCatalog::positionsBlock(size_t begin, size_t end, double t, double *x, double *y, double *z) const {
+
+	size_t i = begin;
+#if defined(KERNEL_AVX512) || defined(KERNEL_AVX2)
+	for (; i + VectorLanes::WIDTH <= end; i += VectorLanes::WIDTH)
+		positionsLanes<VectorLanes>(&epoch[i], &x0[i], &y0[i], &z0[i], &vx0[i], &vy0[i], &vz0[i], &sqrtMu[i], &r0[i],
+			&sigma[i], &alpha[i], &period[i], &invPeriod[i], t, x + i, y + i, z + i);
+#endif
+	for (; i < end; i++)
+		positionsLanes<ScalarLanes>(&epoch[i], &x0[i], &y0[i], &z0[i], &vx0[i], &vy0[i], &vz0[i], &sqrtMu[i], &r0[i],
+			&sigma[i], &alpha[i], &period[i], &invPeriod[i], t, x + i, y + i, z + i);
+}
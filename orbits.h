@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef ORBITS_H
+#define ORBITS_H
+
+#include <stddef.h>
+#include "bodies.h"
+#include "threadpool.h"
+
+// Orbits per task when positions are evaluated on the thread pool
+const size_t ORBIT_BLOCK = 4096;
+
+// Catalog of bodies on fixed two-body orbits around their central body ("on rails"). Positions follow analytically at any
+// time from the state at an epoch, without stepping, so the catalog can be scrubbed to any time at constant cost
+class OrbitCatalog
+{
+public:
+	OrbitCatalog();
+
+	// Number of orbits
+	size_t size() const { return mu.size(); }
+
+	// Remove every orbit
+	void clear();
+
+	// Add an orbit from the position and velocity relative to the central body at the epoch, mu = G * M of the central
+	// body. Return its index
+	size_t addState(double mu, double epoch, double x, double y, double z, double vx, double vy, double vz);
+
+	// Add an orbit from its periapsis distance, eccentricity (any conic), inclination, longitude of the ascending node,
+	// argument of periapsis (radians) and time of periapsis passage. The reference plane is the xz-plane and orbits with
+	// zero inclination run counter-clockwise seen from +y, like Simulation::addOrbitingBody(). Return its index
+	size_t addElements(double mu, double periapsis, double eccentricity, double inclination, double node, double argument, double periapsisTime);
+
+	// Position of every orbit at time t relative to its central body, with the batched vector solver
+	void positionsAt(double t, double *x, double *y, double *z, ThreadPool *pool = NULL) const;
+
+	// Position and velocity of one orbit at time t with the scalar solver
+	void stateAt(size_t i, double t, double &x, double &y, double &z, double &vx, double &vy, double &vz) const;
+
+private:
+	// Gravitational parameter, epoch and the state at the epoch
+	BodyArray mu, epoch, x0, y0, z0, vx0, vy0, vz0;
+	// Quantities of Kepler's equation that do not change with time: sqrt(mu), distance, r.v / sqrt(mu), 1 / semi-major axis,
+	// and the period with its reciprocal (both 0 for open orbits)
+	BodyArray sqrtMu, r0, sigma, alpha, period, invPeriod;
+
+	// Positions of the orbits from begin to end
+	void positionsBlock(size_t begin, size_t end, double t, double *x, double *y, double *z) const;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include <math.h>
+#include <algorithm>
+#include "prediction.h"
+#include "kepler.h"
+
+/*
+ * Period of the osculating two-body orbit around the heaviest other body. An open orbit takes the period of a circular
+ * orbit at its current distance, the time scale on which its path bends
+ */
+static double orbitPeriod(const BodyStore &b, size_t body, double G) {
+
+	size_t central = body == 0 ? 1 : 0;
+	for (size_t i = 0; i < b.size(); i++)
+		if (i != body && b.m[i] > b.m[central])
+			central = i;
+
+	double mu = G * (b.m[central] + b.m[body]);
+	double dx = b.x[body] - b.x[central], dy = b.y[body] - b.y[central], dz = b.z[body] - b.z[central];
+	double dvx = b.vx[body] - b.vx[central], dvy = b.vy[body] - b.vy[central], dvz = b.vz[body] - b.vz[central];
+	double r = sqrt(dx * dx + dy * dy + dz * dz);
+	double alpha = 2.0 / r - (dvx * dvx + dvy * dvy + dvz * dvz) / mu;
+	double a = alpha > 0.0 ? 1.0 / alpha : r;
+	return 2.0 * PI * sqrt(a * a * a / mu);
+}
+
+OrbitPredictor::OrbitPredictor(unsigned threads) : Orbits(PREDICTION_ORBITS), StepsPerOrbit(PREDICTION_STEPS), PointsPerOrbit(PREDICTION_POINTS),
+	Completed(0), Cancelled(0), running(false), pool(threads), hasPending(false), selectionChanged(false), snapshotTime(0.0), snapshotEnd(0.0),
+	snapshotBodies(0), generation(0) { }
+
+OrbitPredictor::~OrbitPredictor() {
+
+	stop();
+}
+
+void OrbitPredictor::start() {
+
+	if (running)
+		return;
+	running = true;
+	thread = std::thread(&OrbitPredictor::loop, this);
+}
+
+void OrbitPredictor::stop() {
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		running = false;
+	}
+	wake.notify_one();
+	if (thread.joinable())
+		thread.join();
+}
+
+void OrbitPredictor::select(const std::vector<size_t> &bodies) {
+
+	std::lock_guard<std::mutex> guard(lock);
+	selection = bodies;
+	selectionChanged = true;
+}
+
+/*
+ * The staleness test runs after every tick of the simulation thread, so it only compares a few numbers. The copy of the
+ * simulation is made when a snapshot is due, and replaces a snapshot the worker has not taken yet
+ */
+void OrbitPredictor::offer(const Simulation &simulation) {
+
+	std::lock_guard<std::mutex> guard(lock);
+	size_t n = simulation.Bodies.size();
+	if (!selectionChanged && (selection.empty() || (n == snapshotBodies && simulation.Time >= snapshotTime
+		&& simulation.Time <= snapshotTime + PREDICTION_REFRESH * (snapshotEnd - snapshotTime))))
+		return;
+
+	pendingBodies.clear();
+	for (size_t k = 0; k < selection.size(); k++)
+		if (selection[k] < n)
+			pendingBodies.push_back(selection[k]);
+	pending = simulation;
+	hasPending = true;
+	selectionChanged = false;
+
+	std::vector<double> periods;
+	double dt;
+	unsigned long long steps;
+	plan(pending, pendingBodies, periods, dt, steps);
+	snapshotTime = simulation.Time;
+	snapshotEnd = simulation.Time + steps * dt;
+	snapshotBodies = n;
+
+	generation++;
+	wake.notify_one();
+}
+
+/*
+ * The step follows the fastest selected body and the length the slowest one, so every body gets its orbits at
+ * StepsPerOrbit or more steps per orbit
+ */
+void OrbitPredictor::plan(const Simulation &simulation, const std::vector<size_t> &bodies, std::vector<double> &periods, double &dt,
+	unsigned long long &steps) const {
+
+	periods.resize(bodies.size());
+	double shortest = HUGE_VAL, longest = 0.0;
+	for (size_t k = 0; k < bodies.size(); k++) {
+		periods[k] = orbitPeriod(simulation.Bodies, bodies[k], simulation.G);
+		shortest = std::min(shortest, periods[k]);
+		longest = std::max(longest, periods[k]);
+	}
+	if (bodies.empty() || !(longest > 0.0 && longest < HUGE_VAL)) {
+		dt = 0.0;
+		steps = 0;
+		return;
+	}
+	dt = shortest / StepsPerOrbit;
+	steps = std::min((unsigned long long)ceil(Orbits * longest / dt), PREDICTION_MAX_STEPS);
+}
+
+/*
+ * Snapshots that arrive while a prediction runs cancel it, the worker then starts over from the newest
+ */
+void OrbitPredictor::loop() {
+
+	Simulation snapshot;
+	std::vector<size_t> bodies;
+
+	while (true) {
+		unsigned long long number;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [this]() { return hasPending || !running; });
+			if (!running)
+				return;
+			snapshot = pending;
+			bodies = pendingBodies;
+			number = generation;
+			hasPending = false;
+		}
+
+		Prediction &prediction = results.write();
+		if (predict(snapshot, bodies, number, prediction)) {
+			results.publish();
+			Completed++;
+		}
+		else
+			Cancelled++;
+	}
+}
+
+/*
+ * The snapshot runs on plain leapfrog without the extras of the simulation: no test particles, collisions,
+ * regularization, compensation or samples. Every body gets a vertex every few steps until it has completed its orbits
+ */
+bool OrbitPredictor::predict(Simulation &simulation, const std::vector<size_t> &bodies, unsigned long long number, Prediction &prediction) {
+
+	std::vector<double> periods;
+	double dt;
+	unsigned long long steps;
+	plan(simulation, bodies, periods, dt, steps);
+
+	simulation.Pool = &pool;
+	simulation.Integrator = LEAPFROG;
+	simulation.Particles.clear();
+	simulation.Collisions = NO_COLLISIONS;
+	simulation.RegularizationRadius = 0.0;
+	simulation.Deterministic = false;
+	simulation.Summation = PLAIN_SUMMATION;
+	simulation.DiagnosticInterval = 0;
+	simulation.invalidateAccelerations();
+
+	size_t count = bodies.size();
+	const BodyStore &b = simulation.Bodies;
+	prediction.Generation = number;
+	prediction.Time = simulation.Time;
+	prediction.Steps = simulation.Steps;
+	prediction.Bodies = bodies;
+	prediction.OriginX.resize(count);
+	prediction.OriginY.resize(count);
+	prediction.OriginZ.resize(count);
+	prediction.Interval.resize(count);
+	prediction.First.resize(count);
+	prediction.Count.resize(count);
+
+	// Steps between two vertices and the last step of every body
+	std::vector<unsigned long long> every(count), last(count);
+	int vertices = 0;
+	for (size_t k = 0; k < count; k++) {
+		every[k] = std::max(1ULL, (unsigned long long)(periods[k] / (PointsPerOrbit * dt)));
+		last[k] = std::min(steps, (unsigned long long)ceil(Orbits * periods[k] / dt));
+		prediction.OriginX[k] = b.x[bodies[k]];
+		prediction.OriginY[k] = b.y[bodies[k]];
+		prediction.OriginZ[k] = b.z[bodies[k]];
+		prediction.Interval[k] = every[k] * dt;
+		prediction.First[k] = vertices;
+		prediction.Count[k] = (int)(last[k] / every[k]) + 1;
+		vertices += prediction.Count[k];
+	}
+	prediction.Vertices.resize(3 * (size_t)vertices);
+
+	for (unsigned long long step = 0; step <= steps; step++) {
+		if (step > 0)
+			simulation.step(dt);
+		for (size_t k = 0; k < count; k++) {
+			if (step % every[k] != 0 || step > last[k])
+				continue;
+			size_t v = 3 * (prediction.First[k] + step / every[k]);
+			prediction.Vertices[v] = (float)(b.x[bodies[k]] - prediction.OriginX[k]);
+			prediction.Vertices[v + 1] = (float)(b.y[bodies[k]] - prediction.OriginY[k]);
+			prediction.Vertices[v + 2] = (float)(b.z[bodies[k]] - prediction.OriginZ[k]);
+		}
+		if (step % PREDICTION_CHECK == 0 && (generation != number || !running))
+			return false;
+	}
+	return true;
+}
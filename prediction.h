@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef PREDICTION_H
+#define PREDICTION_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "simulation.h"
+#include "threadpool.h"
+#include "triplebuffer.h"
+
+// Default prediction values. Orbits ahead of every selected body, leapfrog steps per orbit of the fastest of them and
+// vertices per orbit of every polyline. The steps are far longer than the simulation's, a preview needs the shape of
+// the path, not its phase to machine precision
+const double PREDICTION_ORBITS = 2.0;
+const int PREDICTION_STEPS = 200;
+const int PREDICTION_POINTS = 128;
+// Longest prediction in steps, so open orbits and far apart periods end somewhere
+const unsigned long long PREDICTION_MAX_STEPS = 100000;
+// Steps between two checks whether the prediction was cancelled
+const int PREDICTION_CHECK = 64;
+// Share of the predicted time the simulation may run on before the prediction is renewed
+const double PREDICTION_REFRESH = 0.25;
+
+// Predicted paths of the selected bodies, ready to upload as one vertex buffer. The vertices are float offsets from an
+// origin kept in double precision, so the paths are drawn relative to the camera like the bodies
+struct Prediction {
+	// Number of the snapshot the prediction was made from (0 before the first), its simulated time and steps
+	unsigned long long Generation;
+	double Time;
+	unsigned long long Steps;
+	// Predicted bodies, the origin of their polylines (their position at Time) and the simulated time between two vertices
+	std::vector<size_t> Bodies;
+	std::vector<double> OriginX, OriginY, OriginZ, Interval;
+	// Vertices of every polyline as x, y, z triples. Polyline k is Count[k] vertices from vertex First[k] on
+	std::vector<float> Vertices;
+	std::vector<int> First, Count;
+
+	Prediction() : Generation(0), Time(0.0), Steps(0) { }
+};
+
+// Background service that integrates snapshots of a simulation ahead and publishes the predicted paths of the selected
+// bodies. The thread stepping the simulation offers it every state it publishes, and a snapshot is only taken when the
+// prediction is stale: the selection changed, bodies merged, time went backwards after a seek, or the simulation used up
+// PREDICTION_REFRESH of the predicted time. A new snapshot cancels the prediction in progress. The renderer reads the
+// latest complete prediction without waiting, like the states of SimulationThread
+class OrbitPredictor
+{
+public:
+	// Constructor, threads for the force evaluation of the snapshots (0 for every hardware thread)
+	OrbitPredictor(unsigned threads = 1);
+	~OrbitPredictor();
+
+	// Start and stop the worker thread
+	void start();
+	void stop();
+
+	// Bodies to predict, none when empty. Taken into account by the next offer()
+	void select(const std::vector<size_t> &bodies);
+
+	// Take a snapshot of the simulation if the last prediction is stale. Call from the thread that steps the simulation
+	void offer(const Simulation &simulation);
+
+	// Latest complete prediction, without blocking. Call from one thread only
+	const Prediction &latest() { return results.read(); }
+
+	// Orbits ahead, steps per orbit and vertices per orbit
+	double Orbits;
+	int StepsPerOrbit, PointsPerOrbit;
+	// Predictions published and cancelled so far
+	std::atomic<unsigned long long> Completed, Cancelled;
+
+private:
+	std::thread thread;
+	std::atomic<bool> running;
+	// Force evaluation threads of the worker
+	ThreadPool pool;
+	// Snapshot waiting for the worker, the selection of the renderer and the bookkeeping of offer(), all guarded by lock
+	std::mutex lock;
+	std::condition_variable wake;
+	Simulation pending;
+	std::vector<size_t> pendingBodies;
+	bool hasPending;
+	std::vector<size_t> selection;
+	bool selectionChanged;
+	// Start and end time and number of bodies of the last snapshot
+	double snapshotTime, snapshotEnd;
+	size_t snapshotBodies;
+	// Number of the newest snapshot. The worker abandons a prediction once a newer snapshot exists
+	std::atomic<unsigned long long> generation;
+	TripleBuffer<Prediction> results;
+
+	// Loop of the worker thread
+	void loop();
+	// Integrate a snapshot ahead and fill the prediction. Returns false when a newer snapshot cancelled it
+	bool predict(Simulation &simulation, const std::vector<size_t> &bodies, unsigned long long number, Prediction &prediction);
+	// Orbital period of every body, the common step and the number of steps of a prediction
+	void plan(const Simulation &simulation, const std::vector<size_t> &bodies, std::vector<double> &periods, double &dt, unsigned long long &steps) const;
+
+	OrbitPredictor(const OrbitPredictor &);
+	OrbitPredictor &operator=(const OrbitPredictor &);
+};
+
+#endif
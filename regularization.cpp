@@ -0,0 +1,141 @@
+#include <math.h>
+#include "regularization.h"
+#include "kepler.h"
+
+/*
+ * Position x = L(u) u of the KS vector u, with the standard KS matrix
+ *     |u1 -u2 -u3  u4|
+ * L = |u2  u1 -u4 -u3|
+ *     |u3  u4  u1  u2|
+ *     |u4 -u3  u2 -u1|
+ * of which only the first three rows map to space
+ */
+static void ksPosition(const double u[4], double &x, double &y, double &z) {
+
+	x = u[0] * u[0] - u[1] * u[1] - u[2] * u[2] + u[3] * u[3];
+	y = 2.0 * (u[0] * u[1] - u[2] * u[3]);
+	z = 2.0 * (u[0] * u[2] + u[1] * u[3]);
+}
+
+/*
+ * Velocity v = 2 L(u) u' / r from the derivative by fictitious time
+ */
+static void ksVelocity(const double u[4], const double du[4], double r, double &vx, double &vy, double &vz) {
+
+	double s = 2.0 / r;
+	vx = s * (u[0] * du[0] - u[1] * du[1] - u[2] * du[2] + u[3] * du[3]);
+	vy = s * (u[1] * du[0] + u[0] * du[1] - u[3] * du[2] - u[2] * du[3]);
+	vz = s * (u[2] * du[0] + u[3] * du[1] + u[0] * du[2] + u[1] * du[3]);
+}
+
+/*
+ * One of the four-vectors that map to the position, chosen by the sign of x so the square root does not cancel, and
+ * u' = L^T(u) v / 2, which makes the bilinear relation hold
+ */
+static void ksFromCartesian(double x, double y, double z, double vx, double vy, double vz, double r, double u[4], double du[4]) {
+
+	if (x >= 0.0) {
+		u[0] = sqrt(0.5 * (r + x));
+		u[1] = y / (2.0 * u[0]);
+		u[2] = z / (2.0 * u[0]);
+		u[3] = 0.0;
+	}
+	else {
+		u[1] = sqrt(0.5 * (r - x));
+		u[0] = y / (2.0 * u[1]);
+		u[3] = z / (2.0 * u[1]);
+		u[2] = 0.0;
+	}
+
+	du[0] = 0.5 * (u[0] * vx + u[1] * vy + u[2] * vz);
+	du[1] = 0.5 * (-u[1] * vx + u[0] * vy + u[3] * vz);
+	du[2] = 0.5 * (-u[2] * vx - u[3] * vy + u[0] * vz);
+	du[3] = 0.5 * (u[3] * vx - u[2] * vy + u[1] * vz);
+}
+
+/*
+ * Physical time after the fictitious time tau, t = integral of |u|^2. With u = u0 c0(w tau^2) + u0' tau c1(w tau^2) and
+ * w = -h / 2 the integral is r0 tau + 2 (u0.u0') tau^2 c2 + (4 |u0'|^2 - mu) tau^3 c3 in Stumpff functions of 4 w tau^2,
+ * the universal Kepler equation. Grouped this way the terms do not cancel on long hyperbolic arcs. Also returns the
+ * derivative r = |u(tau)|^2
+ */
+static double ksTime(double tau, double w, double r0, double udu, double k3, double &r) {
+
+	double y = 4.0 * w * tau * tau;
+	double c2, c3;
+	stumpff(y, c2, c3);
+	double c1 = 1.0 - y * c3;
+
+	r = r0 + 2.0 * udu * tau * c1 + k3 * tau * tau * c2;
+	return r0 * tau + 2.0 * udu * tau * tau * c2 + k3 * tau * tau * tau * c3;
+}
+
+/*
+ * With dt = r dtau the unperturbed Kepler problem becomes u'' = (h / 2) u, h = (2 |u'|^2 - mu) / r the energy per unit
+ * reduced mass (Stiefel and Scheifele, Linear and Regular Celestial Mechanics). The fictitious time of the step solves
+ * t(tau) = dt, which increases monotonically, with Newton steps kept inside a bracket by bisection
+ */
+void ksDrift(double mu, double dt, double &x, double &y, double &z, double &vx, double &vy, double &vz) {
+
+	double r0 = sqrt(x * x + y * y + z * z);
+	if (r0 == 0.0 || mu <= 0.0 || dt == 0.0) {
+		x += dt * vx;
+		y += dt * vy;
+		z += dt * vz;
+		return;
+	}
+
+	double u0[4], du0[4];
+	ksFromCartesian(x, y, z, vx, vy, vz, r0, u0, du0);
+	double udu = u0[0] * du0[0] + u0[1] * du0[1] + u0[2] * du0[2] + u0[3] * du0[3];
+	double dudu = du0[0] * du0[0] + du0[1] * du0[1] + du0[2] * du0[2] + du0[3] * du0[3];
+	double w = -0.5 * (2.0 * dudu - mu) / r0;
+	double k3 = 4.0 * dudu - mu;
+
+	// The regularized equations run forward in tau, a backward step runs the reversed orbit forward
+	double sign = dt > 0.0 ? 1.0 : -1.0;
+	udu *= sign;
+	double target = fabs(dt);
+
+	// The fictitious time is the universal anomaly over sqrt(mu), so the first guess of the universal Kepler solver applies.
+	// The bracket grows from there until t(tau) >= target at its upper end
+	double sqrtMu = sqrt(mu);
+	double tau = universalGuess(sqrtMu, target, r0, 2.0 * udu / sqrtMu, 4.0 * w / mu) / sqrtMu;
+	double r, lower = 0.0, upper = tau > 0.0 ? tau : target / r0;
+	while (ksTime(upper, w, r0, udu, k3, r) < target && upper < HUGE_VAL) {
+		lower = upper;
+		upper *= 2.0;
+	}
+	if (!(tau >= lower && tau <= upper))
+		tau = 0.5 * (lower + upper);
+	for (int i = 0; i < KS_ITERATIONS; i++) {
+		double f = ksTime(tau, w, r0, udu, k3, r) - target;
+		if (f < 0.0)
+			lower = tau;
+		else
+			upper = tau;
+		double next = tau - f / r;
+		if (!(next >= lower && next <= upper))
+			next = 0.5 * (lower + upper);
+		double delta = next - tau;
+		tau = next;
+		if (fabs(delta) <= KS_TOLERANCE * tau)
+			break;
+	}
+
+	// u(tau) = u0 c0 + u0' tau c1 and u'(tau) = -w u0 tau c1 + u0' c0, with the Stumpff functions of w tau^2
+	double c2, c3;
+	double q = w * tau * tau;
+	stumpff(q, c2, c3);
+	double c0 = 1.0 - q * c2, s = tau * (1.0 - q * c3);
+	double u[4], du[4];
+	for (int k = 0; k < 4; k++) {
+		double dk = sign * du0[k];
+		u[k] = u0[k] * c0 + dk * s;
+		du[k] = sign * (-w * u0[k] * s + dk * c0);
+	}
+
+	r = u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3];
+	ksPosition(u, x, y, z);
+	ksVelocity(u, du, r, vx, vy, vz);
+}
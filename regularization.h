@@ -0,0 +1,15 @@
+#pragma once
+
+#ifndef REGULARIZATION_H
+#define REGULARIZATION_H
+
+// Largest number of iterations for the fictitious time of a step, and the relative change at which it has converged
+const int KS_ITERATIONS = 60;
+const double KS_TOLERANCE = 1.0e-14;
+
+// Advance a two-body relative orbit with gravitational parameter mu = G * (m1 + m2) by the time dt in Kustaanheimo-Stiefel
+// coordinates. Position and velocity are relative and updated in place. The motion is a harmonic oscillator in the
+// regularized coordinates, so even a collision orbit passes through r = 0 without a singularity
+void ksDrift(double mu, double dt, double &x, double &y, double &z, double &vx, double &vy, double &vz);
+
+#endif
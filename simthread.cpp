@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <chrono>
+#include "simthread.h"
+
+SimulationThread::SimulationThread(Simulation &simulation, double rate) : Rate(rate), Achieved(0.0), Lag(0.0), Step(1.0 / rate),
+	Predictor(NULL), simulation(simulation), running(false), seeking(false), seekTime(0.0), requestedWarp(WARP_MIN) { }
+
+SimulationThread::~SimulationThread() {
+
+	stop();
+}
+
+void SimulationThread::start() {
+
+	if (running)
+		return;
+
+	// The renderer has a state to draw before the first step completes
+	History.record(simulation, 0.0);
+	publish();
+	running = true;
+	thread = std::thread(&SimulationThread::loop, this);
+}
+
+void SimulationThread::seek(double time) {
+
+	seekTime = time;
+	seeking = true;
+}
+
+void SimulationThread::setWarp(double warp) {
+
+	requestedWarp = std::min(std::max(warp, WARP_MIN), WARP_MAX);
+}
+
+void SimulationThread::stop() {
+
+	running = false;
+	if (thread.joinable())
+		thread.join();
+}
+
+/*
+ * Every tick the controller turns the wall time since the last one into steps. Only the last state of a tick is
+ * published, the renderer would not see the others, but every step is recorded
+ */
+void SimulationThread::loop() {
+
+	typedef std::chrono::steady_clock Clock;
+	TimeWarp controller(1.0 / Rate);
+	Clock::duration tick = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(controller.Tick));
+	Clock::time_point last = Clock::now();
+	Clock::time_point next = last + tick;
+
+	while (running) {
+		std::this_thread::sleep_until(next);
+
+		// Restart the schedule from the restored state, the time passed meanwhile is not owed. The old future is dropped,
+		// since the next steps need not land on the recorded times
+		if (seeking.exchange(false)) {
+			double time = std::max((double)seekTime, History.earliest());
+			History.restore(time, simulation);
+			History.discardAfter(time);
+			publish();
+			last = Clock::now();
+			next = last + tick;
+			continue;
+		}
+
+		Clock::time_point now = Clock::now();
+		controller.setWarp(requestedWarp);
+		unsigned long long count;
+		double dt;
+		controller.plan(std::chrono::duration<double>(now - last).count(), count, dt);
+		last = now;
+
+		for (unsigned long long i = 0; i < count && running; i++) {
+			simulation.step(dt);
+			History.record(simulation, dt);
+		}
+		if (count > 0)
+			publish();
+		controller.taken(std::chrono::duration<double>(Clock::now() - now).count());
+
+		Achieved = controller.Achieved;
+		Lag = controller.Lag;
+		Step = dt;
+
+		next += tick;
+		if (next < Clock::now())
+			next = Clock::now();
+	}
+}
+
+void SimulationThread::publish() {
+
+	SimulationState &state = states.write();
+	const BodyStore &b = simulation.Bodies;
+	state.Time = simulation.Time;
+	state.Steps = simulation.Steps;
+	state.x.assign(b.x.begin(), b.x.end());
+	state.y.assign(b.y.begin(), b.y.end());
+	state.z.assign(b.z.begin(), b.z.end());
+	states.publish();
+	if (Predictor)
+		Predictor->offer(simulation);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifndef SIMTHREAD_H
+#define SIMTHREAD_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "prediction.h"
+#include "simulation.h"
+#include "snapshots.h"
+#include "timewarp.h"
+#include "triplebuffer.h"
+
+// Copy of the body positions after a completed step, as handed to the renderer
+struct SimulationState {
+	// Simulated time and number of steps taken
+	double Time;
+	unsigned long long Steps;
+	// Body positions
+	std::vector<double> x, y, z;
+
+	SimulationState() : Time(0.0), Steps(0) { }
+};
+
+// Runs a simulation on its own thread and publishes the completed states through a triple buffer, so the renderer never
+// waits for a step and a slow frame does not change the steps taken. Simulated time runs at a warp of the wall time, and
+// a TimeWarp decides the steps of every tick
+class SimulationThread
+{
+public:
+	// Constructor, the base step of the simulation is 1 / rate, so at warp 1 it takes rate steps per second
+	SimulationThread(Simulation &simulation, double rate = 1.0 / MAX_STEP);
+	~SimulationThread();
+
+	// Start and stop the thread. The simulation must not be touched by other threads while it runs
+	void start();
+	void stop();
+
+	// Most recent completed state, without blocking. Call from one thread only
+	const SimulationState &latest() { return states.read(); }
+
+	// Go back to the recorded state at the given time, or the earliest one kept. Takes effect before the next step
+	void seek(double time);
+
+	// Change the requested warp, between WARP_MIN and WARP_MAX. Takes effect in the next tick
+	void setWarp(double warp);
+	double warp() const { return requestedWarp; }
+
+	// Steps per second of wall time at warp 1
+	double Rate;
+	// Warp reached, simulated time dropped because the steps did not fit into the budget, and the current step
+	std::atomic<double> Achieved, Lag, Step;
+	// States recorded after every step, only touched by the thread while it runs
+	SnapshotRing History;
+	// Predictor offered every published state, NULL for none. Set before start()
+	OrbitPredictor *Predictor;
+
+private:
+	Simulation &simulation;
+	TripleBuffer<SimulationState> states;
+	std::thread thread;
+	std::atomic<bool> running;
+	// Pending seek and its target time
+	std::atomic<bool> seeking;
+	std::atomic<double> seekTime;
+	// Warp requested by the renderer
+	std::atomic<double> requestedWarp;
+
+	// Step loop of the thread
+	void loop();
+	// Copy the current state into the triple buffer, and offer it to the predictor
+	void publish();
+
+	SimulationThread(const SimulationThread &);
+	SimulationThread &operator=(const SimulationThread &);
+};
+
+#endif
@@ -0,0 +1,986 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "simulation.h"
+#include "integrators.h"
+#include "kepler.h"
+#include "regularization.h"
+#include "strictfp.h"
+
+// Offset basis and prime of the 64-bit FNV-1a hash
+const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+const unsigned long long FNV_PRIME = 1099511628211ULL;
+
+// Partial sums per block of a sample: kinetic and potential energy, momentum and angular momentum
+const size_t DIAGNOSTIC_SUMS = 8;
+
+/*
+ * Kahan summation step: the carry holds the low-order part that the previous additions to the sum lost
+ */
+static inline void compensatedAdd(double &sum, double &carry, double value) {
+
+	double y = value - carry;
+	double t = sum + y;
+	carry = (t - sum) - y;
+	sum = t;
+}
+
+/*
+ * FNV-1a step over the bit pattern of every value of an array
+ */
+static unsigned long long hashValues(unsigned long long hash, const double *values, size_t count) {
+
+	for (size_t i = 0; i < count; i++) {
+		unsigned long long bits;
+		memcpy(&bits, &values[i], sizeof(bits));
+		hash = (hash ^ bits) * FNV_PRIME;
+	}
+	return hash;
+}
+
+Simulation::Simulation(double g, double softening, double maxStep)
+	: G(g), Softening(softening), SofteningModel(PLUMMER_SOFTENING), ForceLaw(NEWTON_LAW), ScreeningLength(0.0), MaxStep(maxStep), Solver(DIRECT_SUM), Theta(THETA), Order(FMM_ORDER), Integrator(LEAPFROG), Time(0.0), Steps(0), Pool(NULL), Collisions(NO_COLLISIONS), Merges(0), Deterministic(false), StateHash(0), Summation(PLAIN_SUMMATION), RegularizationRadius(0.0), RegularizedSteps(0), DiagnosticInterval(0), DiagnosticSamples(0), accelerationsValid(false), samplePotential(false), potentialValid(false) { }
+
+size_t Simulation::addBody(double mass, double x, double y, double z, double vx, double vy, double vz, double radius) {
+
+	accelerationsValid = false;
+	return Bodies.add(mass, x, y, z, vx, vy, vz, radius);
+}
+
+size_t Simulation::addParticle(double x, double y, double z, double vx, double vy, double vz) {
+
+	accelerationsValid = false;
+	return Particles.add(0.0, x, y, z, vx, vy, vz);
+}
+
+/*
+ * Place a body at the given distance along the x-axis from the central body, moving with
+ * circular velocity in the xz-plane (counter-clockwise seen from +y)
+ */
+size_t Simulation::addOrbitingBody(size_t central, double mass, double distance, double radius) {
+
+	double speed = sqrt(G * (Bodies.m[central] + mass) / distance);
+	return addBody(mass,
+		Bodies.x[central] + distance, Bodies.y[central], Bodies.z[central],
+		Bodies.vx[central], Bodies.vy[central], Bodies.vz[central] - speed, radius);
+}
+
+size_t Simulation::addSubsystem(size_t parent) {
+
+	Subsystem subsystem;
+	subsystem.Parent = parent;
+	subsystem.Members = Simulation(G, Softening, MaxStep);
+	subsystem.Members.Integrator = WISDOM_HOLMAN;
+	subsystem.Members.SofteningModel = SofteningModel;
+	subsystem.Members.ForceLaw = ForceLaw;
+	subsystem.Members.ScreeningLength = ScreeningLength;
+	subsystem.Members.addBody(Bodies.m[parent], 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, Bodies.r[parent]);
+	Subsystems.push_back(subsystem);
+	return Subsystems.size() - 1;
+}
+
+/*
+ * The parent body keeps its position and velocity, the members move so that their center of mass stays at the origin
+ * of their frame
+ */
+size_t Simulation::addMoon(size_t subsystem, double mass, double distance, double radius) {
+
+	Subsystem &s = Subsystems[subsystem];
+	BodyStore &m = s.Members.Bodies;
+	size_t moon = s.Members.addOrbitingBody(0, mass, distance, radius);
+
+	double total = 0.0, cx = 0.0, cy = 0.0, cz = 0.0, cvx = 0.0, cvy = 0.0, cvz = 0.0;
+	for (size_t j = 0; j < m.size(); j++) {
+		total += m.m[j];
+		cx += m.m[j] * m.x[j]; cy += m.m[j] * m.y[j]; cz += m.m[j] * m.z[j];
+		cvx += m.m[j] * m.vx[j]; cvy += m.m[j] * m.vy[j]; cvz += m.m[j] * m.vz[j];
+	}
+	BodyStore *stores[2] = { &m, &s.Members.Particles };
+	for (int k = 0; k < 2; k++) {
+		BodyStore &b = *stores[k];
+		for (size_t j = 0; j < b.size(); j++) {
+			b.x[j] -= cx / total; b.y[j] -= cy / total; b.z[j] -= cz / total;
+			b.vx[j] -= cvx / total; b.vy[j] -= cvy / total; b.vz[j] -= cvz / total;
+		}
+	}
+
+	Bodies.m[s.Parent] += mass;
+	double period = 2.0 * PI * sqrt(distance * distance * distance / (G * (m.m[0] + mass)));
+	s.Members.MaxStep = fmin(s.Members.MaxStep, period / MOON_ORBIT_STEPS);
+	accelerationsValid = false;
+	return moon;
+}
+
+/*
+ * Bodies keep their order, so body 0 stays the central body of the Wisdom-Holman map. The block time step state
+ * follows the bodies, a merged body keeps the level of the body it replaced. A subsystem whose parent was merged into
+ * another body is dissolved, the merged body already carries its mass and momentum
+ */
+void Simulation::resolveCollisions() {
+
+	Detector.findContacts(Bodies, Collisions, contacts, Pool);
+	if (contacts.empty())
+		return;
+
+	size_t n = Bodies.size();
+	Merges += mergeContacts(Bodies, contacts, kept);
+	if (Blocks.Level.size() == n) {
+		for (size_t k = 0; k < kept.size(); k++) {
+			Blocks.Level[k] = Blocks.Level[kept[k]];
+			Blocks.LastAx[k] = Blocks.LastAx[kept[k]];
+			Blocks.LastAy[k] = Blocks.LastAy[kept[k]];
+			Blocks.LastAz[k] = Blocks.LastAz[kept[k]];
+		}
+		Blocks.Level.resize(kept.size());
+		Blocks.LastAx.resize(kept.size());
+		Blocks.LastAy.resize(kept.size());
+		Blocks.LastAz.resize(kept.size());
+	}
+	if (compensation.size() == n) {
+		for (size_t k = 0; k < kept.size(); k++)
+			compensation.move(k, kept[k]);
+		compensation.resize(kept.size());
+	}
+	for (size_t s = 0; s < Subsystems.size(); ) {
+		size_t k = std::find(kept.begin(), kept.end(), Subsystems[s].Parent) - kept.begin();
+		if (k < kept.size()) {
+			Subsystems[s].Parent = k;
+			s++;
+		}
+		else
+			Subsystems.erase(Subsystems.begin() + s);
+	}
+	accelerationsValid = false;
+}
+
+void Simulation::zeroMomentum() {
+
+	double mass = 0.0, px = 0.0, py = 0.0, pz = 0.0;
+	for (size_t i = 0; i < Bodies.size(); i++) {
+		mass += Bodies.m[i];
+		px += Bodies.m[i] * Bodies.vx[i];
+		py += Bodies.m[i] * Bodies.vy[i];
+		pz += Bodies.m[i] * Bodies.vz[i];
+	}
+	if (mass <= 0.0)
+		return;
+
+	for (size_t i = 0; i < Bodies.size(); i++) {
+		Bodies.vx[i] -= px / mass;
+		Bodies.vy[i] -= py / mass;
+		Bodies.vz[i] -= pz / mass;
+	}
+}
+
+void Simulation::advance(double duration) {
+
+	if (duration <= 0.0)
+		return;
+
+	// Equal steps that cover the duration without exceeding the maximum step
+	unsigned long long count = (unsigned long long)ceil(duration / MaxStep);
+	double dt = duration / count;
+
+	switch (Integrator) {
+	case YOSHIDA4: run<Yoshida4>(count, dt); break;
+	case WISDOM_HOLMAN: run<WisdomHolman>(count, dt); break;
+	case BLOCK_LEAPFROG: run<BlockLeapfrog>(count, dt); break;
+	case GAUSS_RADAU: run<GaussRadau>(count, dt); break;
+	default: run<Leapfrog>(count, dt); break;
+	}
+}
+
+void Simulation::step(double dt) {
+
+	switch (Integrator) {
+	case YOSHIDA4: run<Yoshida4>(1, dt); break;
+	case WISDOM_HOLMAN: run<WisdomHolman>(1, dt); break;
+	case BLOCK_LEAPFROG: run<BlockLeapfrog>(1, dt); break;
+	case GAUSS_RADAU: run<GaussRadau>(1, dt); break;
+	default: run<Leapfrog>(1, dt); break;
+	}
+}
+
+/*
+ * The integrator is chosen once per call, so the step loop calls the policy directly. The force evaluations of a step that
+ * ends with a sample store the potential as well, and the last of them is at the final positions for every integrator
+ * but the block time steps
+ */
+template <typename Policy>
+void Simulation::run(unsigned long long count, double dt) {
+
+	for (unsigned long long i = 0; i < count; i++) {
+		bool sample = DiagnosticInterval > 0 && (Steps + 1) % DiagnosticInterval == 0;
+		samplePotential = sample;
+		if (RegularizationRadius > 0.0 || !Pairs.empty())
+			findPairs();
+		if (!Subsystems.empty())
+			kickSubsystems(0.5 * dt);
+		Policy::step(*this, dt);
+		if (!Subsystems.empty()) {
+			advanceSubsystems(dt);
+			kickSubsystems(0.5 * dt);
+		}
+		Time += dt;
+		Steps++;
+		if (Collisions != NO_COLLISIONS)
+			resolveCollisions();
+		if (Deterministic)
+			StateHash = StateHash * FNV_PRIME ^ stateHash();
+		if (sample)
+			diagnostics();
+	}
+}
+
+void Simulation::prepareAccelerations() {
+
+	if (!accelerationsValid)
+		computeAccelerations();
+}
+
+void Simulation::kick(double dt) {
+
+	size_t n = Bodies.size();
+	if (Summation != PLAIN_SUMMATION) {
+		prepareCompensation();
+		BodyStore &c = compensation;
+		for (size_t i = 0; i < n; i++) {
+			compensatedAdd(Bodies.vx[i], c.vx[i], dt * Bodies.ax[i]);
+			compensatedAdd(Bodies.vy[i], c.vy[i], dt * Bodies.ay[i]);
+			compensatedAdd(Bodies.vz[i], c.vz[i], dt * Bodies.az[i]);
+		}
+		kickParticles(dt);
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		Bodies.vx[i] += dt * Bodies.ax[i];
+		Bodies.vy[i] += dt * Bodies.ay[i];
+		Bodies.vz[i] += dt * Bodies.az[i];
+	}
+	kickParticles(dt);
+}
+
+void Simulation::kickParticles(double dt) {
+
+	BodyStore &p = Particles;
+	runBlocks(p.size(), PARTICLE_BLOCK, [&p, dt](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			p.vx[i] += dt * p.ax[i];
+			p.vy[i] += dt * p.ay[i];
+			p.vz[i] += dt * p.az[i];
+		}
+	});
+}
+
+void Simulation::drift(double dt) {
+
+	size_t n = Bodies.size();
+	if (Summation != PLAIN_SUMMATION) {
+		prepareCompensation();
+		BodyStore &c = compensation;
+		for (size_t i = 0; i < n; i++) {
+			compensatedAdd(Bodies.x[i], c.x[i], dt * Bodies.vx[i]);
+			compensatedAdd(Bodies.y[i], c.y[i], dt * Bodies.vy[i]);
+			compensatedAdd(Bodies.z[i], c.z[i], dt * Bodies.vz[i]);
+		}
+	}
+	else
+		for (size_t i = 0; i < n; i++) {
+			Bodies.x[i] += dt * Bodies.vx[i];
+			Bodies.y[i] += dt * Bodies.vy[i];
+			Bodies.z[i] += dt * Bodies.vz[i];
+		}
+	if (!Pairs.empty())
+		driftPairs(dt);
+
+	BodyStore &p = Particles;
+	runBlocks(p.size(), PARTICLE_BLOCK, [&p, dt](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			p.x[i] += dt * p.vx[i];
+			p.y[i] += dt * p.vy[i];
+			p.z[i] += dt * p.vz[i];
+		}
+	});
+	accelerationsValid = false;
+}
+
+void Simulation::prepareCompensation() {
+
+	if (compensation.size() != Bodies.size())
+		compensation.resize(Bodies.size());
+}
+
+/*
+ * Squared distance between the bodies of a pair
+ */
+static inline double separation2(const BodyStore &b, const Contact &pair) {
+
+	double dx = b.x[pair.b] - b.x[pair.a];
+	double dy = b.y[pair.b] - b.y[pair.a];
+	double dz = b.z[pair.b] - b.z[pair.a];
+	return dx * dx + dy * dy + dz * dz;
+}
+
+/*
+ * Every body joins at most one pair, the closest candidates first. Of a tight triple only the closest pair is
+ * regularized, the third body pulls on it through the kicks. The stored accelerations leave out the mutual pull of the
+ * pairs, which their two-body orbit accounts for instead, so a pair that forms or breaks up only moves its own pull in
+ * or out of them and no new force evaluation is needed
+ */
+void Simulation::findPairs() {
+
+	size_t n = Bodies.size();
+	previousPartner.swap(partner);
+	partner.resize(n);
+	for (size_t i = 0; i < n; i++)
+		partner[i] = i;
+	std::vector<Contact> previous;
+	previous.swap(Pairs);
+
+	if (RegularizationRadius > 0.0 && (Integrator == LEAPFROG || Integrator == YOSHIDA4) && n > 1) {
+		pairBodies.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			pairBodies.x[i] = Bodies.x[i];
+			pairBodies.y[i] = Bodies.y[i];
+			pairBodies.z[i] = Bodies.z[i];
+			pairBodies.r[i] = 0.5 * RegularizationRadius;
+		}
+		pairSearch.findContacts(pairBodies, SPATIAL_HASH, contacts, Pool);
+
+		const BodyStore &b = Bodies;
+		std::sort(contacts.begin(), contacts.end(), [&b](const Contact &p, const Contact &q) {
+			double dp = separation2(b, p), dq = separation2(b, q);
+			return dp < dq || (dp == dq && (p.a < q.a || (p.a == q.a && p.b < q.b)));
+		});
+		for (size_t k = 0; k < contacts.size(); k++) {
+			const Contact &c = contacts[k];
+			if (partner[c.a] == c.a && partner[c.b] == c.b && Bodies.m[c.a] + Bodies.m[c.b] > 0.0) {
+				partner[c.a] = c.b;
+				partner[c.b] = c.a;
+				Pairs.push_back(c);
+			}
+		}
+		std::sort(Pairs.begin(), Pairs.end(), [](const Contact &p, const Contact &q) { return p.a < q.a; });
+		contacts.clear();
+	}
+	RegularizedSteps += Pairs.size();
+
+	if (!accelerationsValid)
+		return;
+	if (previousPartner.size() != n) {
+		accelerationsValid = false;
+		return;
+	}
+	for (size_t k = 0; k < previous.size(); k++)
+		if (partner[previous[k].a] != previous[k].b)
+			addPairAcceleration(previous[k], 1.0);
+	for (size_t k = 0; k < Pairs.size(); k++)
+		if (previousPartner[Pairs[k].a] != Pairs[k].b)
+			addPairAcceleration(Pairs[k], -1.0);
+}
+
+void Simulation::addPairAcceleration(const Contact &pair, double sign) {
+
+	size_t a = pair.a, b = pair.b;
+	double dx = Bodies.x[b] - Bodies.x[a];
+	double dy = Bodies.y[b] - Bodies.y[a];
+	double dz = Bodies.z[b] - Bodies.z[a];
+	double f = sign * G * softenedInverseCube(SofteningModel, dx * dx + dy * dy + dz * dz, ForceParameters<double>(Softening, ScreeningLength), ForceLaw);
+	Bodies.ax[a] += Bodies.m[b] * f * dx;
+	Bodies.ay[a] += Bodies.m[b] * f * dy;
+	Bodies.az[a] += Bodies.m[b] * f * dz;
+	Bodies.ax[b] -= Bodies.m[a] * f * dx;
+	Bodies.ay[b] -= Bodies.m[a] * f * dy;
+	Bodies.az[b] -= Bodies.m[a] * f * dz;
+}
+
+/*
+ * Runs after the straight drift of all bodies, which already moved the center of mass of every pair correctly. The
+ * relative state at the start of the step follows from undoing the straight drift, the velocities are still unchanged.
+ * The two-body orbit is unsoftened, regularization takes the place of the softening for a pair
+ */
+void Simulation::driftPairs(double dt) {
+
+	BodyStore &b = Bodies;
+	for (size_t k = 0; k < Pairs.size(); k++) {
+		size_t i = Pairs[k].a, j = Pairs[k].b;
+		double mass = b.m[i] + b.m[j];
+		double wi = b.m[i] / mass, wj = b.m[j] / mass;
+
+		double cx = wi * b.x[i] + wj * b.x[j], cy = wi * b.y[i] + wj * b.y[j], cz = wi * b.z[i] + wj * b.z[j];
+		double cvx = wi * b.vx[i] + wj * b.vx[j], cvy = wi * b.vy[i] + wj * b.vy[j], cvz = wi * b.vz[i] + wj * b.vz[j];
+		double vx = b.vx[j] - b.vx[i], vy = b.vy[j] - b.vy[i], vz = b.vz[j] - b.vz[i];
+		double x = b.x[j] - b.x[i] - dt * vx, y = b.y[j] - b.y[i] - dt * vy, z = b.z[j] - b.z[i] - dt * vz;
+
+		ksDrift(G * mass, dt, x, y, z, vx, vy, vz);
+
+		b.x[i] = cx - wj * x; b.y[i] = cy - wj * y; b.z[i] = cz - wj * z;
+		b.x[j] = cx + wi * x; b.y[j] = cy + wi * y; b.z[j] = cz + wi * z;
+		b.vx[i] = cvx - wj * vx; b.vy[i] = cvy - wj * vy; b.vz[i] = cvz - wj * vz;
+		b.vx[j] = cvx + wi * vx; b.vy[j] = cvy + wi * vy; b.vz[j] = cvz + wi * vz;
+		if (compensation.size() == b.size()) {
+			BodyStore &c = compensation;
+			c.x[i] = c.y[i] = c.z[i] = c.vx[i] = c.vy[i] = c.vz[i] = 0.0;
+			c.x[j] = c.y[j] = c.z[j] = c.vx[j] = c.vy[j] = c.vz[j] = 0.0;
+		}
+	}
+}
+
+/*
+ * The tidal acceleration of a member at r from the center of mass is T r, with the tidal tensor
+ * T = sum G m (-2 f'(d^2) d d^T - f(d^2) I) over the other bodies at d = x - center, where f is the factor of the pull
+ * m f d under the softening model and force law and f' its derivative in d^2, 3 d d^T / s^5 - I / s^3 with s^2 = d^2 + softening^2
+ * for a Plummer sphere. That is the first order of the pull difference in r / d, so a tidal kick costs one product per member. The members are centered on
+ * their center of mass, so the kicks add no momentum and the outer bodies feel no reaction at this order
+ */
+void Simulation::tidalTensor(size_t parent, double *t) const {
+
+	ForceParameters<double> p(Softening, ScreeningLength);
+	for (int a = 0; a < 6; a++)
+		t[a] = 0.0;
+	for (size_t k = 0; k < Bodies.size(); k++) {
+		if (k == parent)
+			continue;
+		double dx = Bodies.x[k] - Bodies.x[parent], dy = Bodies.y[k] - Bodies.y[parent], dz = Bodies.z[k] - Bodies.z[parent];
+		double r2 = dx * dx + dy * dy + dz * dz;
+		double invS3 = G * Bodies.m[k] * softenedInverseCube(SofteningModel, r2, p, ForceLaw);
+		double f = -2.0 * G * Bodies.m[k] * softenedInverseCubeSlope(SofteningModel, r2, p, ForceLaw);
+		t[0] += f * dx * dx - invS3;
+		t[1] += f * dx * dy;
+		t[2] += f * dx * dz;
+		t[3] += f * dy * dy - invS3;
+		t[4] += f * dy * dz;
+		t[5] += f * dz * dz - invS3;
+	}
+}
+
+void Simulation::kickSubsystems(double dt) {
+
+	for (size_t s = 0; s < Subsystems.size(); s++) {
+		double t[6];
+		tidalTensor(Subsystems[s].Parent, t);
+		BodyStore *stores[2] = { &Subsystems[s].Members.Bodies, &Subsystems[s].Members.Particles };
+		for (int k = 0; k < 2; k++) {
+			BodyStore &m = *stores[k];
+			for (size_t j = 0; j < m.size(); j++) {
+				m.vx[j] += dt * (t[0] * m.x[j] + t[1] * m.y[j] + t[2] * m.z[j]);
+				m.vy[j] += dt * (t[1] * m.x[j] + t[3] * m.y[j] + t[4] * m.z[j]);
+				m.vz[j] += dt * (t[2] * m.x[j] + t[4] * m.y[j] + t[5] * m.z[j]);
+			}
+		}
+	}
+}
+
+/*
+ * Subsystems do not interact within the step, so each runs as one task. Their own force evaluation stays on the task's thread
+ */
+void Simulation::advanceSubsystems(double dt) {
+
+	auto advanceSubsystem = [this, dt](size_t s) {
+		Simulation &members = Subsystems[s].Members;
+		unsigned long long count = (unsigned long long)ceil(fabs(dt) / members.MaxStep);
+		for (unsigned long long i = 0; i < count; i++)
+			members.step(dt / count);
+	};
+	if (Pool != NULL && Subsystems.size() > 1)
+		Pool->run(Subsystems.size(), advanceSubsystem);
+	else
+		for (size_t s = 0; s < Subsystems.size(); s++)
+			advanceSubsystem(s);
+}
+
+void Simulation::invalidateAccelerations() {
+
+	accelerationsValid = false;
+}
+
+void Simulation::computeAccelerations() {
+
+	computeParticleAccelerations();
+	// The tree walk and the plain direct sum store the potential on the way when a sample asks for it
+	potentialValid = samplePotential && (Solver == BARNES_HUT || (Solver == DIRECT_SUM && !Deterministic && Summation != COMPENSATED_ALL));
+	if (potentialValid)
+		potential.resize(Bodies.size());
+	if (Bodies.size() == 0) {
+		accelerationsValid = true;
+		return;
+	}
+
+	if (Solver == BARNES_HUT) {
+		tree.build(Bodies);
+		tree.computeAccelerations(Bodies, G, Theta, Softening, &Bodies.ax[0], &Bodies.ay[0], &Bodies.az[0], Pool, SofteningModel,
+			potentialValid ? &potential[0] : NULL, ForceLaw, ScreeningLength);
+	}
+	else if (Solver == FAST_MULTIPOLE) {
+		multipole.setOrder(Order);
+		multipole.computeAccelerations(Bodies, G, Softening, &Bodies.ax[0], &Bodies.ay[0], &Bodies.az[0], Pool);
+	}
+	else
+		computeDirect();
+
+	for (size_t k = 0; k < Pairs.size(); k++)
+		addPairAcceleration(Pairs[k], -1.0);
+	accelerationsValid = true;
+}
+
+/*
+ * Direct O(N^2) summation. The tiled vector kernel visits every ordered pair, and every tile of targets is a separate task
+ * for the thread pool. Without vector instructions and threads the scalar loop uses Newton's third law, so every pair
+ * is visited once, unless another softening model than Plummer's or another law than Newton's needs its kernel. Deterministic mode stays on the
+ * tiles, where the sum of each target runs through the sources in the same order on any number of threads, and so do
+ * compensated force sums, which need the sum of each target in one place
+ */
+void Simulation::computeDirect() {
+
+	size_t n = Bodies.size();
+	double eps2 = Softening * Softening;
+	size_t tiles = (n + TILE_SIZE - 1) / TILE_SIZE;
+
+	if (Summation == COMPENSATED_ALL)
+		prepareCompensation();
+	if (Deterministic || Summation == COMPENSATED_ALL || KERNEL_WIDTH > 1 || SofteningModel != PLUMMER_SOFTENING || ForceLaw != NEWTON_LAW || (Pool && Pool->size() > 1 && tiles > 1)) {
+		if (Pool)
+			Pool->run(tiles, [this](size_t tile) { computeTile(tile); });
+		else
+			for (size_t tile = 0; tile < tiles; tile++)
+				computeTile(tile);
+		return;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		Bodies.ax[i] = 0.0;
+		Bodies.ay[i] = 0.0;
+		Bodies.az[i] = 0.0;
+		if (potentialValid)
+			potential[i] = 0.0;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		double xi = Bodies.x[i], yi = Bodies.y[i], zi = Bodies.z[i];
+		double axi = 0.0, ayi = 0.0, azi = 0.0, phi = 0.0;
+		for (size_t j = i + 1; j < n; j++) {
+			double dx = Bodies.x[j] - xi;
+			double dy = Bodies.y[j] - yi;
+			double dz = Bodies.z[j] - zi;
+			double r2 = dx * dx + dy * dy + dz * dz + eps2;
+			double invR = 1.0 / sqrt(r2);
+			double invR3 = G * invR * invR * invR;
+			axi += Bodies.m[j] * invR3 * dx;
+			ayi += Bodies.m[j] * invR3 * dy;
+			azi += Bodies.m[j] * invR3 * dz;
+			Bodies.ax[j] -= Bodies.m[i] * invR3 * dx;
+			Bodies.ay[j] -= Bodies.m[i] * invR3 * dy;
+			Bodies.az[j] -= Bodies.m[i] * invR3 * dz;
+			if (potentialValid) {
+				phi -= G * Bodies.m[j] * invR;
+				potential[j] -= G * Bodies.m[i] * invR;
+			}
+		}
+		Bodies.ax[i] += axi;
+		Bodies.ay[i] += ayi;
+		Bodies.az[i] += azi;
+		if (potentialValid)
+			potential[i] += phi;
+	}
+}
+
+/*
+ * Plummer softening under Newton's law keeps the hand-vectorized kernels and deterministic mode its exact ones, every
+ * other combination uses its instantiation of the policy template. The kernels with potential give the accelerations the
+ * same bits as the ones without, so a sampled step moves the bodies exactly like any other
+ */
+void Simulation::interact(const double *tx, const double *ty, const double *tz, size_t targets, size_t source, size_t sources,
+	double *ax, double *ay, double *az, double *potential) const {
+
+	const double *sx = &Bodies.x[source], *sy = &Bodies.y[source], *sz = &Bodies.z[source], *sm = &Bodies.m[source];
+	if (Deterministic || (SofteningModel == PLUMMER_SOFTENING && ForceLaw == NEWTON_LAW)) {
+		double eps2 = Softening * Softening;
+		if (potential)
+			(Deterministic ? pairwiseAccelerationsPotentialScalar : pairwiseAccelerationsPotential)(tx, ty, tz, targets,
+				sx, sy, sz, sm, sources, eps2, ax, ay, az, potential);
+		else
+			(Deterministic ? pairwiseAccelerationsExact : pairwiseAccelerations)(tx, ty, tz, targets,
+				sx, sy, sz, sm, sources, eps2, ax, ay, az);
+	}
+	else
+		softenedKernel(SofteningModel, ForceLaw)(tx, ty, tz, targets, sx, sy, sz, sm, sources,
+			ForceParameters<double>(Softening, ScreeningLength), ax, ay, az, potential);
+}
+
+void Simulation::computeTile(size_t tile) {
+
+	size_t n = Bodies.size();
+	size_t begin = tile * TILE_SIZE;
+	size_t end = begin + TILE_SIZE < n ? begin + TILE_SIZE : n;
+	double eps2 = Softening * Softening;
+
+	for (size_t i = begin; i < end; i++) {
+		Bodies.ax[i] = 0.0;
+		Bodies.ay[i] = 0.0;
+		Bodies.az[i] = 0.0;
+	}
+
+	// The compensated sum runs on over all tiles of sources and adds the collected rounding errors at the end
+	if (Summation == COMPENSATED_ALL) {
+		BodyStore &c = compensation;
+		for (size_t i = begin; i < end; i++) {
+			c.ax[i] = 0.0;
+			c.ay[i] = 0.0;
+			c.az[i] = 0.0;
+		}
+		for (size_t source = 0; source < n; source += TILE_SIZE) {
+			size_t count = source + TILE_SIZE < n ? TILE_SIZE : n - source;
+			pairwiseAccelerationsCompensated(&Bodies.x[begin], &Bodies.y[begin], &Bodies.z[begin], end - begin,
+				&Bodies.x[source], &Bodies.y[source], &Bodies.z[source], &Bodies.m[source], count,
+				eps2, &Bodies.ax[begin], &Bodies.ay[begin], &Bodies.az[begin], &c.ax[begin], &c.ay[begin], &c.az[begin]);
+		}
+		for (size_t i = begin; i < end; i++) {
+			Bodies.ax[i] += c.ax[i];
+			Bodies.ay[i] += c.ay[i];
+			Bodies.az[i] += c.az[i];
+		}
+	}
+	else if (potentialValid) {
+		for (size_t i = begin; i < end; i++)
+			potential[i] = 0.0;
+		for (size_t source = 0; source < n; source += TILE_SIZE) {
+			size_t count = source + TILE_SIZE < n ? TILE_SIZE : n - source;
+			interact(&Bodies.x[begin], &Bodies.y[begin], &Bodies.z[begin], end - begin, source, count,
+				&Bodies.ax[begin], &Bodies.ay[begin], &Bodies.az[begin], &potential[begin]);
+		}
+		for (size_t i = begin; i < end; i++)
+			potential[i] *= G;
+	}
+	else {
+		for (size_t source = 0; source < n; source += TILE_SIZE) {
+			size_t count = source + TILE_SIZE < n ? TILE_SIZE : n - source;
+			interact(&Bodies.x[begin], &Bodies.y[begin], &Bodies.z[begin], end - begin, source, count,
+				&Bodies.ax[begin], &Bodies.ay[begin], &Bodies.az[begin]);
+		}
+	}
+
+	for (size_t i = begin; i < end; i++) {
+		Bodies.ax[i] *= G;
+		Bodies.ay[i] *= G;
+		Bodies.az[i] *= G;
+	}
+}
+
+/*
+ * The stored accelerations only match the positions again once every body has been evaluated. The fast multipole solver
+ * has no cheaper path for a subset of targets, so it evaluates every body
+ */
+void Simulation::computeActiveAccelerations(const std::vector<size_t> &active) {
+
+	size_t n = Bodies.size();
+	size_t count = active.size();
+	if (count == n || Solver == FAST_MULTIPOLE) {
+		computeAccelerations();
+		return;
+	}
+	accelerationsValid = false;
+	potentialValid = false;
+	if (count == 0)
+		return;
+
+	if (Solver == BARNES_HUT) {
+		tree.build(Bodies);
+		double eps2 = Softening * Softening;
+		size_t block = tree.LeafSize * 64;
+		size_t blocks = (count + block - 1) / block;
+		auto task = [&](size_t b) {
+			size_t end = (b + 1) * block < count ? (b + 1) * block : count;
+			for (size_t k = b * block; k < end; k++) {
+				size_t i = active[k];
+				tree.accelerationAt(Bodies, Bodies.x[i], Bodies.y[i], Bodies.z[i], (int)i, G, Theta, eps2, Bodies.ax[i], Bodies.ay[i], Bodies.az[i],
+					SofteningModel, NULL, ForceLaw, ScreeningLength);
+			}
+		};
+		if (Pool)
+			Pool->run(blocks, task);
+		else
+			for (size_t b = 0; b < blocks; b++)
+				task(b);
+		return;
+	}
+
+	// Gather the active bodies, so the vector kernel reads contiguous targets
+	activeX.resize(count);
+	activeY.resize(count);
+	activeZ.resize(count);
+	activeAx.resize(count);
+	activeAy.resize(count);
+	activeAz.resize(count);
+	for (size_t k = 0; k < count; k++) {
+		activeX[k] = Bodies.x[active[k]];
+		activeY[k] = Bodies.y[active[k]];
+		activeZ[k] = Bodies.z[active[k]];
+	}
+
+	size_t tiles = (count + TILE_SIZE - 1) / TILE_SIZE;
+	if (Pool)
+		Pool->run(tiles, [this](size_t tile) { computeActiveTile(tile); });
+	else
+		for (size_t tile = 0; tile < tiles; tile++)
+			computeActiveTile(tile);
+
+	for (size_t k = 0; k < count; k++) {
+		Bodies.ax[active[k]] = activeAx[k];
+		Bodies.ay[active[k]] = activeAy[k];
+		Bodies.az[active[k]] = activeAz[k];
+	}
+}
+
+void Simulation::computeActiveTile(size_t tile) {
+
+	size_t n = Bodies.size();
+	size_t count = activeX.size();
+	size_t begin = tile * TILE_SIZE;
+	size_t end = begin + TILE_SIZE < count ? begin + TILE_SIZE : count;
+
+	for (size_t k = begin; k < end; k++) {
+		activeAx[k] = 0.0;
+		activeAy[k] = 0.0;
+		activeAz[k] = 0.0;
+	}
+
+	for (size_t source = 0; source < n; source += TILE_SIZE) {
+		size_t sources = source + TILE_SIZE < n ? TILE_SIZE : n - source;
+		interact(&activeX[begin], &activeY[begin], &activeZ[begin], end - begin, source, sources,
+			&activeAx[begin], &activeAy[begin], &activeAz[begin]);
+	}
+
+	for (size_t k = begin; k < end; k++) {
+		activeAx[k] *= G;
+		activeAy[k] *= G;
+		activeAz[k] *= G;
+	}
+}
+
+/*
+ * Test particles never act as sources, so the cost is linear in their number. The tiles of particles run as tasks on the
+ * thread pool through the same vector kernel as the direct sum
+ */
+void Simulation::computeParticleAccelerations() {
+
+	size_t tiles = (Particles.size() + TILE_SIZE - 1) / TILE_SIZE;
+	if (Pool)
+		Pool->run(tiles, [this](size_t tile) { computeParticleTile(tile); });
+	else
+		for (size_t tile = 0; tile < tiles; tile++)
+			computeParticleTile(tile);
+}
+
+void Simulation::computeParticleTile(size_t tile) {
+
+	size_t n = Bodies.size();
+	size_t count = Particles.size();
+	size_t begin = tile * TILE_SIZE;
+	size_t end = begin + TILE_SIZE < count ? begin + TILE_SIZE : count;
+	BodyStore &p = Particles;
+
+	for (size_t i = begin; i < end; i++) {
+		p.ax[i] = 0.0;
+		p.ay[i] = 0.0;
+		p.az[i] = 0.0;
+	}
+
+	for (size_t source = 0; source < n; source += TILE_SIZE) {
+		size_t sources = source + TILE_SIZE < n ? TILE_SIZE : n - source;
+		interact(&p.x[begin], &p.y[begin], &p.z[begin], end - begin, source, sources, &p.ax[begin], &p.ay[begin], &p.az[begin]);
+	}
+
+	for (size_t i = begin; i < end; i++) {
+		p.ax[i] *= G;
+		p.ay[i] *= G;
+		p.az[i] *= G;
+	}
+}
+
+void Simulation::runBlocks(size_t count, size_t block, const std::function<void(size_t, size_t)> &task) {
+
+	size_t blocks = (count + block - 1) / block;
+	auto range = [&](size_t b) { task(b * block, (b + 1) * block < count ? (b + 1) * block : count); };
+	if (Pool && blocks > 1)
+		Pool->run(blocks, range);
+	else
+		for (size_t b = 0; b < blocks; b++)
+			range(b);
+}
+
+double Simulation::totalEnergy() const {
+
+	size_t n = Bodies.size();
+	ForceParameters<double> p(Softening, ScreeningLength);
+	double kinetic = 0.0, potential = 0.0;
+
+	for (size_t i = 0; i < n; i++) {
+		double v2 = Bodies.vx[i] * Bodies.vx[i] + Bodies.vy[i] * Bodies.vy[i] + Bodies.vz[i] * Bodies.vz[i];
+		kinetic += 0.5 * Bodies.m[i] * v2;
+		for (size_t j = i + 1; j < n; j++) {
+			double dx = Bodies.x[j] - Bodies.x[i];
+			double dy = Bodies.y[j] - Bodies.y[i];
+			double dz = Bodies.z[j] - Bodies.z[i];
+			potential += G * Bodies.m[i] * Bodies.m[j] * softenedPotential(SofteningModel, dx * dx + dy * dy + dz * dz, p, ForceLaw);
+		}
+	}
+
+	return kinetic + potential + subsystemEnergy();
+}
+
+/*
+ * Energy of the members in their frame, and their tidal potential -1/2 sum m r^T T r
+ */
+double Simulation::subsystemEnergy() const {
+
+	double internal = 0.0;
+	for (size_t s = 0; s < Subsystems.size(); s++) {
+		double t[6];
+		tidalTensor(Subsystems[s].Parent, t);
+		const BodyStore &m = Subsystems[s].Members.Bodies;
+		internal += Subsystems[s].Members.totalEnergy();
+		for (size_t j = 0; j < m.size(); j++)
+			internal -= 0.5 * m.m[j] * (t[0] * m.x[j] * m.x[j] + t[3] * m.y[j] * m.y[j] + t[5] * m.z[j] * m.z[j]
+				+ 2.0 * (t[1] * m.x[j] * m.y[j] + t[2] * m.x[j] * m.z[j] + t[4] * m.y[j] * m.z[j]));
+	}
+	return internal;
+}
+
+/*
+ * Every block of bodies sums into its own slot and the slots are added in block order, so the sample does not depend
+ * on the number of threads. The members of a subsystem move about their center of mass, so they add angular momentum
+ * but no momentum
+ */
+Diagnostics Simulation::diagnostics() {
+
+	size_t n = Bodies.size();
+	Diagnostics d;
+	d.Time = Time;
+	d.Steps = Steps;
+	d.Fused = potentialValid && accelerationsValid && potential.size() == n;
+	if (!d.Fused)
+		computePotentials();
+	samplePotential = false;
+
+	size_t blocks = (n + DIAGNOSTIC_BLOCK - 1) / DIAGNOSTIC_BLOCK;
+	diagnosticSums.assign(blocks * DIAGNOSTIC_SUMS, 0.0);
+	runBlocks(n, DIAGNOSTIC_BLOCK, [this](size_t begin, size_t end) {
+		const BodyStore &b = Bodies;
+		double *sum = &diagnosticSums[begin / DIAGNOSTIC_BLOCK * DIAGNOSTIC_SUMS];
+		for (size_t i = begin; i < end; i++) {
+			double px = b.m[i] * b.vx[i], py = b.m[i] * b.vy[i], pz = b.m[i] * b.vz[i];
+			sum[0] += 0.5 * (px * b.vx[i] + py * b.vy[i] + pz * b.vz[i]);
+			sum[1] += 0.5 * b.m[i] * potential[i];
+			sum[2] += px;
+			sum[3] += py;
+			sum[4] += pz;
+			sum[5] += b.y[i] * pz - b.z[i] * py;
+			sum[6] += b.z[i] * px - b.x[i] * pz;
+			sum[7] += b.x[i] * py - b.y[i] * px;
+		}
+	});
+
+	for (size_t block = 0; block < blocks; block++) {
+		const double *sum = &diagnosticSums[block * DIAGNOSTIC_SUMS];
+		d.Kinetic += sum[0];
+		d.Potential += sum[1];
+		for (int k = 0; k < 3; k++) {
+			d.Momentum[k] += sum[2 + k];
+			d.AngularMomentum[k] += sum[5 + k];
+		}
+	}
+
+	for (size_t s = 0; s < Subsystems.size(); s++) {
+		const BodyStore &m = Subsystems[s].Members.Bodies;
+		for (size_t j = 0; j < m.size(); j++) {
+			d.AngularMomentum[0] += m.m[j] * (m.y[j] * m.vz[j] - m.z[j] * m.vy[j]);
+			d.AngularMomentum[1] += m.m[j] * (m.z[j] * m.vx[j] - m.x[j] * m.vz[j]);
+			d.AngularMomentum[2] += m.m[j] * (m.x[j] * m.vy[j] - m.y[j] * m.vx[j]);
+		}
+	}
+	d.Energy = d.Kinetic + d.Potential + subsystemEnergy();
+
+	LastDiagnostics = d;
+	if (DiagnosticSamples++ == 0)
+		InitialDiagnostics = d;
+	return d;
+}
+
+/*
+ * Fallback of the samples that the last force evaluation could not serve. The fast multipole solver has no potential of
+ * its own, so it takes the potential from the tree, in O(N log N). The direct sum runs its tiles through a kernel with
+ * potential, the scalar one in deterministic mode so the sample has the same bits on any instruction set. The
+ * accelerations of the pass go to the scratch arrays of the active bodies, the stored ones are left as they are
+ */
+void Simulation::computePotentials() {
+
+	size_t n = Bodies.size();
+	potential.resize(n);
+	activeAx.resize(n);
+	activeAy.resize(n);
+	activeAz.resize(n);
+	if (n > 0 && Solver != DIRECT_SUM) {
+		tree.build(Bodies);
+		tree.computeAccelerations(Bodies, G, Theta, Softening, &activeAx[0], &activeAy[0], &activeAz[0], Pool, SofteningModel, &potential[0],
+			ForceLaw, ScreeningLength);
+	}
+	else if (n > 0) {
+		size_t tiles = (n + TILE_SIZE - 1) / TILE_SIZE;
+		if (Pool)
+			Pool->run(tiles, [this](size_t tile) { computePotentialTile(tile); });
+		else
+			for (size_t tile = 0; tile < tiles; tile++)
+				computePotentialTile(tile);
+	}
+	potentialValid = true;
+}
+
+void Simulation::computePotentialTile(size_t tile) {
+
+	size_t n = Bodies.size();
+	size_t begin = tile * TILE_SIZE;
+	size_t end = begin + TILE_SIZE < n ? begin + TILE_SIZE : n;
+
+	for (size_t i = begin; i < end; i++) {
+		activeAx[i] = 0.0;
+		activeAy[i] = 0.0;
+		activeAz[i] = 0.0;
+		potential[i] = 0.0;
+	}
+
+	for (size_t source = 0; source < n; source += TILE_SIZE) {
+		size_t count = source + TILE_SIZE < n ? TILE_SIZE : n - source;
+		interact(&Bodies.x[begin], &Bodies.y[begin], &Bodies.z[begin], end - begin, source, count,
+			&activeAx[begin], &activeAy[begin], &activeAz[begin], &potential[begin]);
+	}
+
+	for (size_t i = begin; i < end; i++)
+		potential[i] *= G;
+}
+
+/*
+ * Whole 64-bit words are hashed rather than single bytes, so the hash costs one multiplication per value. The
+ * accelerations are left out, they follow from the positions
+ */
+unsigned long long Simulation::stateHash() const {
+
+	const BodyStore *stores[] = { &Bodies, &Particles };
+	unsigned long long hash = hashValues(FNV_OFFSET, &Time, 1);
+	for (int s = 0; s < 2; s++) {
+		const BodyStore &b = *stores[s];
+		size_t n = b.size();
+		if (n == 0)
+			continue;
+		hash = hashValues(hash, &b.m[0], n);
+		hash = hashValues(hash, &b.x[0], n);
+		hash = hashValues(hash, &b.y[0], n);
+		hash = hashValues(hash, &b.z[0], n);
+		hash = hashValues(hash, &b.vx[0], n);
+		hash = hashValues(hash, &b.vy[0], n);
+		hash = hashValues(hash, &b.vz[0], n);
+	}
+	for (size_t s = 0; s < Subsystems.size(); s++)
+		hash = hash * FNV_PRIME ^ Subsystems[s].Members.stateHash();
+	return hash;
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stddef.h>
+#include <functional>
+#include "bodies.h"
+#include "blocksteps.h"
+#include "gaussradau.h"
+#include "octree.h"
+#include "fmm.h"
+#include "forcelaw.h"
+#include "collisions.h"
+#include "diagnostics.h"
+#include "kernels.h"
+#include "threadpool.h"
+
+// Default simulation values
+const double GRAVITY = 1.0;
+const double SOFTENING = 1.0e-3;
+const double MAX_STEP = 1.0 / 240.0;
+
+// Bodies per tile of the direct summation. The positions and masses of a tile of sources take 16 KB, so they stay in the L1 cache
+const size_t TILE_SIZE = 512;
+
+// Test particles per task of the particle kick and drift loops
+const size_t PARTICLE_BLOCK = 16384;
+
+// Substeps per orbit of the innermost moon of a subsystem
+const double MOON_ORBIT_STEPS = 20.0;
+
+// Available gravity solvers
+enum Force_Solver {
+	DIRECT_SUM,
+	BARNES_HUT,
+	FAST_MULTIPOLE
+};
+
+// Available integrators
+enum Integrator_Type {
+	// Kick-drift-kick leapfrog, second order, one force evaluation per step
+	LEAPFROG,
+	// Fourth order Yoshida composition of three leapfrog steps
+	YOSHIDA4,
+	// Wisdom-Holman mixed variable map in democratic heliocentric coordinates around body 0
+	WISDOM_HOLMAN,
+	// Kick-drift-kick leapfrog with power-of-two block steps per body, only the bodies that finish a step are evaluated
+	BLOCK_LEAPFROG,
+	// Adaptive 15th order Gauss-Radau (IAS15), substeps of its own length keep the error at machine precision
+	GAUSS_RADAU
+};
+
+// Round-off compensation of long runs
+enum Summation_Mode {
+	// Plain floating point sums
+	PLAIN_SUMMATION,
+	// Kahan-compensated position and velocity updates in drift() and kick()
+	COMPENSATED_STATE,
+	// Compensated state updates, and direct-sum force accumulation with error-free two-sums
+	COMPENSATED_ALL
+};
+
+struct Subsystem;
+
+// Headless N-body simulation. Holds the body state and integrates it under mutual gravity, without any dependency on a window or OpenGL context
+class Simulation
+{
+public:
+	// Body state
+	BodyStore Bodies;
+	// Massless test particles, pulled by the bodies but pulling neither the bodies nor each other
+	BodyStore Particles;
+	// Gravitational constant
+	double G;
+	// Softening length
+	double Softening;
+	// Softening model of the direct sum, the Barnes-Hut tree and the test particles (PLUMMER_SOFTENING by default). The
+	// deterministic and compensated kernels and the fast multipole solver always soften like a Plummer sphere
+	Softening_Model SofteningModel;
+	// Force law of the same solvers (NEWTON_LAW by default) and the screening length of SCREENED_LAW, 0 for none. The
+	// deterministic and compensated kernels and the fast multipole solver always follow Newton's law
+	Force_Law ForceLaw;
+	double ScreeningLength;
+	// Longest step taken by advance()
+	double MaxStep;
+	// Gravity solver and the Barnes-Hut opening angle
+	Force_Solver Solver;
+	double Theta;
+	// Expansion order of the fast multipole solver
+	int Order;
+	// Integrator used by step() and advance()
+	Integrator_Type Integrator;
+	// Simulated time and number of steps taken
+	double Time;
+	unsigned long long Steps;
+	// Threads used for force evaluation (NULL runs on the calling thread only)
+	ThreadPool *Pool;
+	// Levels and statistics of the block time steps
+	BlockTimesteps Blocks;
+	// Substep, accuracy and statistics of the Gauss-Radau integrator
+	GaussRadauState Radau;
+	// Collision search run after every step (NO_COLLISIONS by default), and the bodies removed by merging so far
+	Collision_Detector Collisions;
+	CollisionDetector Detector;
+	unsigned long long Merges;
+	// Bitwise reproducible mode, off by default. The direct sum always runs tiled through the exact kernel, so the result
+	// depends neither on the number of threads nor on the vector instruction set
+	bool Deterministic;
+	// Hash chained over the state after every step taken in deterministic mode. Two runs from the same state took
+	// identical steps when their hashes match
+	unsigned long long StateHash;
+	// Round-off compensation of the state updates and force sums (PLAIN_SUMMATION by default)
+	Summation_Mode Summation;
+	// Bodies closer than this are paired up before every leapfrog or Yoshida step, and every pair moves as a two-body
+	// orbit in Kustaanheimo-Stiefel coordinates while the rest keeps the normal step (0 disables)
+	double RegularizationRadius;
+	// Pairs regularized in the last step, and the pair steps taken in regularized coordinates so far
+	std::vector<Contact> Pairs;
+	unsigned long long RegularizedSteps;
+	// Planets whose moons move in a frame of their own, see Subsystem
+	std::vector<Subsystem> Subsystems;
+	// Steps between samples of the conserved quantities (0, the default, takes none). The force evaluations of a sampled
+	// step store the potential of every body with the accelerations, for the direct sum and Barnes-Hut, so the sample adds
+	// only a pass over the bodies. The deterministic and compensated direct sums, the fast multipole solver and block
+	// time steps need a potential pass of their own, over the tree for the multipole solver
+	unsigned long long DiagnosticInterval;
+	// First and latest sample
+	Diagnostics InitialDiagnostics, LastDiagnostics;
+	// Samples taken so far
+	unsigned long long DiagnosticSamples;
+
+	// Constructor
+	Simulation(double g = GRAVITY, double softening = SOFTENING, double maxStep = MAX_STEP);
+
+	// Add a body and return its index
+	size_t addBody(double mass, double x, double y, double z, double vx, double vy, double vz, double radius = 0.0);
+
+	// Add a test particle and return its index
+	size_t addParticle(double x, double y, double z, double vx, double vy, double vz);
+
+	// Add a body on a circular orbit in the xz-plane around the central body and return its index
+	size_t addOrbitingBody(size_t central, double mass, double distance, double radius = 0.0);
+
+	// Give a body a subsystem of moons and return the index of the subsystem. The body becomes member 0 of the subsystem,
+	// and from then on stands for the whole subsystem in this simulation
+	size_t addSubsystem(size_t parent);
+
+	// Add a moon on a circular orbit in the xz-plane around member 0 of a subsystem and return its index among the members.
+	// The members are shifted so the parent body stays at their center of mass, and their substep is shortened to
+	// MOON_ORBIT_STEPS per orbit of the moon
+	size_t addMoon(size_t subsystem, double mass, double distance, double radius = 0.0);
+
+	// Merge the bodies that overlap, with the selected collision search
+	void resolveCollisions();
+
+	// Shift velocities so that the total momentum is zero
+	void zeroMomentum();
+
+	// Advance the simulation by the given duration, split into steps no longer than MaxStep
+	void advance(double duration);
+
+	// Advance the simulation by a single step of the selected integrator
+	void step(double dt);
+
+	// Total kinetic plus potential energy, the members of the subsystems included
+	double totalEnergy() const;
+
+	// Sample the conserved quantities now, reusing the potential of the last force evaluation when it still matches the
+	// positions. Also updates LastDiagnostics, and InitialDiagnostics for the first sample
+	Diagnostics diagnostics();
+
+	// 64-bit FNV-1a hash of the bit patterns of the time, the bodies and the test particles, chained with the hashes of
+	// the subsystems
+	unsigned long long stateHash() const;
+
+	// Evaluate the gravitational acceleration of every body with the selected solver, and of every test particle
+	void computeAccelerations();
+
+	// Evaluate the acceleration of every test particle from the bodies, O(particles x bodies)
+	void computeParticleAccelerations();
+
+	// Evaluate the acceleration of the listed bodies only, from all bodies. The other accelerations are left unchanged
+	void computeActiveAccelerations(const std::vector<size_t> &active);
+
+	// Building blocks of the integrators
+	// Evaluate the accelerations unless they already match the positions
+	void prepareAccelerations();
+	// Change velocities by dt times the stored accelerations, test particles included
+	void kick(double dt);
+	// Change the velocities of the test particles only
+	void kickParticles(double dt);
+	// Change positions by dt times the velocities, test particles included
+	void drift(double dt);
+	// Mark the stored accelerations as outdated after the positions were changed directly
+	void invalidateAccelerations();
+
+private:
+	// True when the stored accelerations match the current positions
+	bool accelerationsValid;
+	// Tree used by the Barnes-Hut solver
+	Octree tree;
+	// Fast multipole solver
+	Fmm multipole;
+	// Round-off carried by the compensated sums, x to vz for the state updates and ax to az for the force sums
+	BodyStore compensation;
+	// Search for close pairs, on bodies with half the regularization radius
+	CollisionDetector pairSearch;
+	BodyStore pairBodies;
+	// Partner of every body in the current pairs, or the body itself
+	std::vector<size_t> partner, previousPartner;
+	// Contacts of the last collision search and the old indices of the bodies left after merging
+	std::vector<Contact> contacts;
+	std::vector<size_t> kept;
+	// Potential of every body, stored by the force evaluations while samplePotential is set. potentialValid tells that the
+	// last evaluation stored it for all bodies
+	BodyArray potential;
+	bool samplePotential, potentialValid;
+	// Partial sums of the conserved quantities, DIAGNOSTIC_SUMS per block of bodies
+	std::vector<double> diagnosticSums;
+
+	// Take count steps of the integrator policy
+	template <typename Policy>
+	void run(unsigned long long count, double dt);
+
+	// Direct O(N^2) summation
+	void computeDirect();
+	// Size the compensation terms to the bodies, new bodies start without carry
+	void prepareCompensation();
+	// Pair up the closest bodies within the regularization radius, and move the mutual pull of pairs that start or end in
+	// or out of the stored accelerations
+	void findPairs();
+	// Add sign times the softened mutual pull of a pair to their accelerations
+	void addPairAcceleration(const Contact &pair, double sign);
+	// Move every pair by its two-body orbit over dt in regularized coordinates, and its center of mass in a straight line
+	void driftPairs(double dt);
+	// Tidal tensor of the other bodies at a parent body, the symmetric matrix as xx, xy, xz, yy, yz, zz
+	void tidalTensor(size_t parent, double *t) const;
+	// Kick the members of every subsystem with the tidal pull of the other bodies, their pull on the member less their
+	// pull on the center of mass
+	void kickSubsystems(double dt);
+	// Advance the members of every subsystem by dt in substeps no longer than their MaxStep, on the thread pool when there is one
+	void advanceSubsystems(double dt);
+	// Add the acceleration (without G) of the bodies from source on the targets, and their potential (without G) when
+	// potential is not NULL, through the kernel of the current mode, softening model and force law
+	void interact(const double *tx, const double *ty, const double *tz, size_t targets, size_t source, size_t sources,
+		double *ax, double *ay, double *az, double *potential = NULL) const;
+	// Store the potential of every body without using the stored accelerations
+	void computePotentials();
+	// Potential of every body on one tile of targets
+	void computePotentialTile(size_t tile);
+	// Energy of the members of the subsystems in their frames, with their tidal potential
+	double subsystemEnergy() const;
+	// Direct summation on one tile of target bodies, one tile of sources at a time
+	void computeTile(size_t tile);
+	// Gathered positions and accelerations of the active bodies
+	BodyArray activeX, activeY, activeZ, activeAx, activeAy, activeAz;
+	// Direct summation on one tile of the gathered active bodies
+	void computeActiveTile(size_t tile);
+	// Pull of every body on one tile of test particles
+	void computeParticleTile(size_t tile);
+	// Call task(begin, end) for blocks of the given size covering count items, on the thread pool when there is one
+	void runBlocks(size_t count, size_t block, const std::function<void(size_t, size_t)> &task);
+};
+
+// A planet and its moons, moving in their own Jacobi frame: the members are kept relative to their center of mass, and
+// the simulation they belong to sees only their total mass at the center of mass, as the parent body. The members have
+// their own integrator and substep (Wisdom-Holman around the planet by default), so fast moons do not shorten the step
+// of the outer system, and the tidal pull of the outer bodies couples the two at the outer step. The tide is taken to
+// first order in the size of the subsystem, so other bodies should stay well outside it. Test particles added to the
+// members, a ring for example, move with the moons
+struct Subsystem {
+	// Body of the outer simulation that carries the mass, position and velocity of the subsystem
+	size_t Parent;
+	// Planet (body 0) and moons, relative to the center of mass
+	Simulation Members;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include <string.h>
+#include "snapshots.h"
+
+/*
+ * Constant, linear or quadratic extrapolation, depending on how many snapshots are known
+ */
+static inline double predict(const std::vector<double> *recent, int known, size_t i) {
+
+	if (known >= 3)
+		return 3.0 * recent[0][i] - 3.0 * recent[1][i] + recent[2][i];
+	if (known == 2)
+		return 2.0 * recent[0][i] - recent[1][i];
+	return recent[0][i];
+}
+
+static inline unsigned long long changeOf(double value, double prediction) {
+
+	unsigned long long a, b;
+	memcpy(&a, &value, sizeof(a));
+	memcpy(&b, &prediction, sizeof(b));
+	return a ^ b;
+}
+
+static inline int significantBytes(unsigned long long change) {
+
+	int length = 0;
+	for (; change != 0; change >>= 8)
+		length++;
+	return length;
+}
+
+/*
+ * Values go in pairs: one byte holds the number of significant bytes of both, then follow their low bytes. The XOR of
+ * the bit patterns keeps the encoding lossless
+ */
+static void encodeSnapshot(std::vector<unsigned char> &data, const std::vector<double> &values, const std::vector<double> *recent, int known) {
+
+	for (size_t i = 0; i < values.size(); i += 2) {
+		unsigned long long change[2] = { changeOf(values[i], predict(recent, known, i)), 0 };
+		if (i + 1 < values.size())
+			change[1] = changeOf(values[i + 1], predict(recent, known, i + 1));
+		int length[2] = { significantBytes(change[0]), significantBytes(change[1]) };
+		data.push_back((unsigned char)(length[0] | length[1] << 4));
+		for (int v = 0; v < 2; v++)
+			for (int k = 0; k < length[v]; k++)
+				data.push_back((unsigned char)(change[v] >> (8 * k)));
+	}
+}
+
+static const unsigned char *decodeSnapshot(const unsigned char *data, std::vector<double> &values, const std::vector<double> *recent, int known) {
+
+	for (size_t i = 0; i < values.size(); i += 2) {
+		int length[2] = { *data & 15, *data >> 4 };
+		data++;
+		for (int v = 0; v < 2 && i + v < values.size(); v++) {
+			unsigned long long change = 0;
+			for (int k = 0; k < length[v]; k++)
+				change |= (unsigned long long)*data++ << (8 * k);
+			double prediction = predict(recent, known, i + v);
+			unsigned long long bits;
+			memcpy(&bits, &prediction, sizeof(bits));
+			bits ^= change;
+			memcpy(&values[i + v], &bits, sizeof(bits));
+		}
+	}
+	return data;
+}
+
+// Bookkeeping bytes of every snapshot after a keyframe: time, step and offset
+static const size_t DELTA_OVERHEAD = 2 * sizeof(double) + sizeof(size_t);
+
+SnapshotRing::SnapshotRing(int keyframeInterval, size_t budget) : KeyframeInterval(keyframeInterval), Budget(budget), known(0), used(0) { }
+
+double SnapshotRing::earliest() const {
+
+	return groups.empty() ? 0.0 : groups.front().Times.front();
+}
+
+double SnapshotRing::latest() const {
+
+	return groups.empty() ? 0.0 : groups.back().Times.back();
+}
+
+size_t SnapshotRing::size() const {
+
+	size_t count = 0;
+	for (size_t g = 0; g < groups.size(); g++)
+		count += groups[g].Times.size();
+	return count;
+}
+
+void SnapshotRing::clear() {
+
+	groups.clear();
+	known = 0;
+	used = 0;
+}
+
+size_t SnapshotRing::keyframeBytes(const Simulation &simulation) {
+
+	// Eleven arrays of the bodies, about as much again for the scratch space of the solvers
+	return sizeof(Simulation) + 2 * 11 * sizeof(double) * (simulation.Bodies.size() + simulation.Particles.size());
+}
+
+void SnapshotRing::gather(const Simulation &simulation, std::vector<double> &values) {
+
+	const BodyStore *stores[] = { &simulation.Bodies, &simulation.Particles };
+	values.clear();
+	for (int s = 0; s < 2; s++) {
+		const BodyStore &b = *stores[s];
+		const BodyArray *arrays[] = { &b.x, &b.y, &b.z, &b.vx, &b.vy, &b.vz };
+		for (int k = 0; k < 6; k++)
+			values.insert(values.end(), arrays[k]->begin(), arrays[k]->end());
+	}
+}
+
+/*
+ * A new keyframe starts when the group is full or the number of bodies changed, since a delta needs the same values
+ * as the snapshots before it. The oldest groups go once the budget is exceeded, the newest one always stays
+ */
+void SnapshotRing::record(const Simulation &simulation, double step) {
+
+	truncate(simulation.Time);
+
+	std::vector<double> values;
+	gather(simulation, values);
+
+	bool keyframe = groups.empty() || (int)groups.back().Times.size() >= KeyframeInterval || values.size() != recent[0].size();
+	if (keyframe) {
+		groups.push_back(SnapshotGroup());
+		SnapshotGroup &group = groups.back();
+		group.Keyframe = simulation;
+		group.Keyframe.Pool = NULL;
+		group.Times.push_back(simulation.Time);
+		used += keyframeBytes(simulation);
+		known = 0;
+	}
+	else {
+		SnapshotGroup &group = groups.back();
+		size_t start = group.Data.size();
+		group.Offsets.push_back(start);
+		group.Times.push_back(simulation.Time);
+		group.Steps.push_back(step);
+		encodeSnapshot(group.Data, values, recent, known);
+		used += group.Data.size() - start + DELTA_OVERHEAD;
+	}
+
+	recent[2].swap(recent[1]);
+	recent[1].swap(recent[0]);
+	recent[0].swap(values);
+	known = known < 3 ? known + 1 : 3;
+
+	while (used > Budget && groups.size() > 1) {
+		const SnapshotGroup &oldest = groups.front();
+		used -= keyframeBytes(oldest.Keyframe) + oldest.Data.size() + oldest.Steps.size() * DELTA_OVERHEAD;
+		groups.pop_front();
+	}
+}
+
+void SnapshotRing::discardAfter(double time) {
+
+	size_t g, index;
+	if (!find(time, g, index))
+		return;
+	if (index + 1 < groups[g].Times.size())
+		truncate(groups[g].Times[index + 1]);
+	else if (g + 1 < groups.size())
+		truncate(groups[g + 1].Times.front());
+}
+
+/*
+ * A later keyframe can replace a whole group, a time inside the last group cuts it after the snapshot before
+ */
+void SnapshotRing::truncate(double time) {
+
+	if (groups.empty() || time > latest())
+		return;
+
+	while (!groups.empty() && groups.back().Times.front() >= time) {
+		const SnapshotGroup &last = groups.back();
+		used -= keyframeBytes(last.Keyframe) + last.Data.size() + last.Steps.size() * DELTA_OVERHEAD;
+		groups.pop_back();
+	}
+	if (groups.empty()) {
+		known = 0;
+		return;
+	}
+
+	SnapshotGroup &group = groups.back();
+	size_t keep = group.Times.size();
+	while (group.Times[keep - 1] >= time)
+		keep--;
+	size_t end = keep < group.Times.size() ? group.Offsets[keep - 1] : group.Data.size();
+	used -= group.Data.size() - end + (group.Times.size() - keep) * DELTA_OVERHEAD;
+	group.Data.resize(end);
+	group.Times.resize(keep);
+	group.Steps.resize(keep - 1);
+	group.Offsets.resize(keep - 1);
+	decode(group, keep - 1, recent, known);
+}
+
+void SnapshotRing::decode(const SnapshotGroup &group, size_t index, std::vector<double> *recent, int &known) {
+
+	gather(group.Keyframe, recent[0]);
+	known = 1;
+	std::vector<double> values(recent[0].size());
+	for (size_t s = 1; s <= index; s++) {
+		decodeSnapshot(&group.Data[group.Offsets[s - 1]], values, recent, known);
+		recent[2].swap(recent[1]);
+		recent[1].swap(recent[0]);
+		recent[0].swap(values);
+		values.resize(recent[0].size());
+		known = known < 3 ? known + 1 : 3;
+	}
+}
+
+bool SnapshotRing::find(double time, size_t &group, size_t &index) const {
+
+	if (groups.empty() || time < earliest())
+		return false;
+
+	group = groups.size() - 1;
+	while (groups[group].Times.front() > time)
+		group--;
+	const std::vector<double> &times = groups[group].Times;
+	index = times.size() - 1;
+	while (times[index] > time)
+		index--;
+	return true;
+}
+
+/*
+ * The recorded steps are replayed with the integrator of the keyframe, so a deterministic simulation arrives at the
+ * recorded state bit for bit
+ */
+bool SnapshotRing::restore(double time, Simulation &simulation) const {
+
+	size_t g, index;
+	if (!find(time, g, index))
+		return false;
+
+	const SnapshotGroup &group = groups[g];
+	ThreadPool *pool = simulation.Pool;
+	simulation = group.Keyframe;
+	simulation.Pool = pool;
+	for (size_t s = 0; s < index; s++)
+		simulation.step(group.Steps[s]);
+	return true;
+}
+
+/*
+ * The Hermite cubic matches position and velocity at both snapshots, which is close to the orbit for snapshots a step
+ * apart. A time between two groups interpolates to the keyframe of the later one
+ */
+bool SnapshotRing::interpolate(double time, std::vector<double> &x, std::vector<double> &y, std::vector<double> &z) const {
+
+	size_t g, index;
+	if (!find(time, g, index) || time > latest())
+		return false;
+
+	// Snapshots before and after the time
+	std::vector<double> states[3], after;
+	int count;
+	const SnapshotGroup &group = groups[g];
+	double t0 = group.Times[index], t1 = t0;
+	if (index + 1 < group.Times.size()) {
+		decode(group, index + 1, states, count);
+		t1 = group.Times[index + 1];
+		after.swap(states[0]);
+		states[0].swap(states[1]);
+	}
+	else {
+		decode(group, index, states, count);
+		if (g + 1 < groups.size()) {
+			t1 = groups[g + 1].Times.front();
+			gather(groups[g + 1].Keyframe, after);
+		}
+	}
+	const std::vector<double> &a = states[0], &b = after;
+
+	size_t n = group.Keyframe.Bodies.size();
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+	std::vector<double> *positions[] = { &x, &y, &z };
+	double h = t1 - t0;
+	if (h <= 0.0 || b.size() != a.size() || time == t0) {
+		for (int k = 0; k < 3; k++)
+			for (size_t i = 0; i < n; i++)
+				(*positions[k])[i] = a[k * n + i];
+		return true;
+	}
+
+	double s = (time - t0) / h;
+	double h00 = (1.0 + 2.0 * s) * (1.0 - s) * (1.0 - s), h10 = s * (1.0 - s) * (1.0 - s);
+	double h01 = s * s * (3.0 - 2.0 * s), h11 = s * s * (s - 1.0);
+	for (int k = 0; k < 3; k++)
+		for (size_t i = 0; i < n; i++) {
+			size_t p = k * n + i, v = (k + 3) * n + i;
+			(*positions[k])[i] = h00 * a[p] + h10 * h * a[v] + h01 * b[p] + h11 * h * b[v];
+		}
+	return true;
+}
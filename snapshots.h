@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef SNAPSHOTS_H
+#define SNAPSHOTS_H
+
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include "simulation.h"
+
+// Recorded snapshots per keyframe, the most steps a restore has to re-integrate
+const int SNAPSHOT_KEYFRAME = 64;
+// Memory the snapshots may take before the oldest keyframes are dropped (bytes)
+const size_t SNAPSHOT_BUDGET = 64 << 20;
+
+// Keyframe and the compressed snapshots recorded after it
+struct SnapshotGroup {
+	// Full copy of the simulation at the keyframe
+	Simulation Keyframe;
+	// Time of every snapshot, the keyframe first
+	std::vector<double> Times;
+	// Step that led to every snapshot after the keyframe
+	std::vector<double> Steps;
+	// Start of every snapshot after the keyframe in Data
+	std::vector<size_t> Offsets;
+	// Positions and velocities of the bodies and test particles of every snapshot after the keyframe, as the XOR of their
+	// bit patterns with a prediction from the snapshots before, without the leading zero bytes
+	std::vector<unsigned char> Data;
+};
+
+// Bounded history of a simulation for rewinding and scrubbing. Every K-th snapshot is a full keyframe, the ones in between
+// only store how each value differs from its quadratic extrapolation from the snapshots before. A step is short against
+// an orbit, so the prediction and the value share sign, exponent and the leading mantissa bits
+class SnapshotRing
+{
+public:
+	// Constructor
+	SnapshotRing(int keyframeInterval = SNAPSHOT_KEYFRAME, size_t budget = SNAPSHOT_BUDGET);
+
+	// Snapshots per keyframe
+	int KeyframeInterval;
+	// Memory budget in bytes
+	size_t Budget;
+
+	// Record the current state and the step that led to it. Call after every step, restore() replays the recorded steps.
+	// Snapshots at or after the time of the simulation are dropped first. A step longer than the recorded ones would
+	// leave old snapshots before that time, so call discardAfter() when continuing from a restored state
+	void record(const Simulation &simulation, double step);
+
+	// Drop every snapshot after the last one at or before the time, so recording continues from the state restore()
+	// gives for that time
+	void discardAfter(double time);
+
+	// Remove every snapshot
+	void clear();
+
+	// Time span covered and approximate memory used
+	bool empty() const { return groups.empty(); }
+	double earliest() const;
+	double latest() const;
+	size_t bytes() const { return used; }
+	// Number of snapshots
+	size_t size() const;
+
+	// Replace the simulation by the recorded state at the last snapshot at or before the time: a copy of the keyframe
+	// before it, re-integrated with the recorded steps. Keeps the thread pool of the simulation. Returns false when the
+	// time is before the earliest snapshot
+	bool restore(double time, Simulation &simulation) const;
+
+	// Body positions at any time within the recorded span, by cubic Hermite interpolation between the positions and
+	// velocities of the two snapshots around it. Nothing is integrated. Returns false outside the span
+	bool interpolate(double time, std::vector<double> &x, std::vector<double> &y, std::vector<double> &z) const;
+
+private:
+	std::deque<SnapshotGroup> groups;
+	// Values of the last three recorded snapshots of the newest group, the latest first, and how many of them are known.
+	// The next snapshot is encoded against their extrapolation
+	std::vector<double> recent[3];
+	int known;
+	size_t used;
+
+	// Memory of a keyframe, estimated from its bodies
+	static size_t keyframeBytes(const Simulation &simulation);
+	// Positions and velocities of the bodies and test particles of a simulation, array by array
+	static void gather(const Simulation &simulation, std::vector<double> &values);
+	// Values of snapshot index of a group (0 being the keyframe) into recent[0], and of the snapshots before it
+	static void decode(const SnapshotGroup &group, size_t index, std::vector<double> *recent, int &known);
+	// Find the group and index of the last snapshot at or before the time
+	bool find(double time, size_t &group, size_t &index) const;
+	// Drop the snapshots at or after the time
+	void truncate(double time);
+};
+
+#endif
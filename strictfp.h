@@ -0,0 +1,17 @@
+#pragma once
+
+#ifndef STRICTFP_H
+#define STRICTFP_H
+
+// Keep the compiler from contracting a multiplication and an addition into a fused multiply-add in the rest of the
+// translation unit. Whether it does otherwise depends on the compiler and the instruction set, which would make the
+// deterministic mode give different bits on different machines. MSVC only contracts with /fp:contract or /fp:fast
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#endif
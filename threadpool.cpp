@@ -0,0 +1,138 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned threads) : job(NULL), remaining(0), generation(0), stopping(false) {
+
+	start(threads);
+}
+
+ThreadPool::~ThreadPool() {
+
+	stop();
+}
+
+void ThreadPool::resize(unsigned threads) {
+
+	stop();
+	start(threads);
+}
+
+void ThreadPool::start(unsigned threads) {
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+
+	stopping = false;
+	for (unsigned i = 0; i < threads; i++)
+		queues.push_back(new TaskQueue());
+
+	// Queue 0 belongs to the thread that calls run()
+	for (unsigned i = 1; i < threads; i++)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+void ThreadPool::stop() {
+
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+
+	for (size_t i = 0; i < queues.size(); i++)
+		delete queues[i];
+	queues.clear();
+}
+
+/*
+ * Every queue starts with a contiguous block of tasks, so neighbouring tasks run on the same thread unless they are stolen
+ */
+void ThreadPool::run(size_t count, const std::function<void(size_t)> &task) {
+
+	if (count == 0)
+		return;
+	if (queues.size() == 1 || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			task(i);
+		return;
+	}
+
+	job = &task;
+	remaining = count;
+
+	size_t threads = queues.size();
+	for (size_t q = 0; q < threads; q++) {
+		std::lock_guard<std::mutex> guard(queues[q]->lock);
+		for (size_t i = q * count / threads; i < (q + 1) * count / threads; i++)
+			queues[q]->tasks.push_back(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		generation++;
+	}
+	wake.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this]() { return remaining == 0; });
+}
+
+void ThreadPool::workerLoop(unsigned id) {
+
+	unsigned long long seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+		work(id);
+	}
+}
+
+void ThreadPool::work(unsigned id) {
+
+	size_t task;
+	while (take(id, task)) {
+		(*job)(task);
+		if (--remaining == 0) {
+			std::lock_guard<std::mutex> guard(mutex);
+			done.notify_all();
+		}
+	}
+}
+
+bool ThreadPool::take(unsigned id, size_t &task) {
+
+	{
+		TaskQueue &own = *queues[id];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty()) {
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	// Steal the oldest task of the next queue that has one
+	size_t threads = queues.size();
+	for (size_t i = 1; i < threads; i++) {
+		TaskQueue &victim = *queues[(id + i) % threads];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Task queue of one thread. The owner takes tasks from the back, other threads steal from the front
+struct TaskQueue {
+	std::mutex lock;
+	std::deque<size_t> tasks;
+};
+
+// Pool of worker threads with one task queue each. Idle threads steal tasks from the queues of busy threads,
+// so uneven tasks still keep every thread busy
+class ThreadPool
+{
+public:
+	// Constructor, 0 threads uses one per hardware thread. The calling thread counts as one of them
+	ThreadPool(unsigned threads = 0);
+	~ThreadPool();
+
+	// Number of threads taking part in run(), including the caller
+	unsigned size() const { return (unsigned)queues.size(); }
+
+	// Change the number of threads
+	void resize(unsigned threads);
+
+	// Call task(i) for every i below count and return when all calls have finished. The calling thread takes part
+	void run(size_t count, const std::function<void(size_t)> &task);
+
+private:
+	std::vector<std::thread> workers;
+	std::vector<TaskQueue *> queues;
+	// Task function of the current run and the number of tasks not yet finished
+	const std::function<void(size_t)> *job;
+	std::atomic<size_t> remaining;
+	// Wakes the workers for a new run and the caller when the run has finished
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	unsigned long long generation;
+	bool stopping;
+
+	void start(unsigned threads);
+	void stop();
+	// Loop of worker thread id
+	void workerLoop(unsigned id);
+	// Run tasks from queue id, then steal from the others until every queue is empty
+	void work(unsigned id);
+	// Take a task from the back of queue id or the front of another queue
+	bool take(unsigned id, size_t &task);
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
+
+#endif
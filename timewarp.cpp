@@ -0,0 +1,53 @@
+#include <math.h>
+#include "timewarp.h"
+
+TimeWarp::TimeWarp(double step) : Warp(WARP_MIN), Step(step), LargestStep(step * WARP_STEP_GROWTH), Tick(1.0 / WARP_TICK_RATE),
+	Budget(WARP_BUDGET), StepCost(0.0), Achieved(0.0), Lag(0.0), debt(0.0), wanted(0.0), elapsed(0.0), size(step), count(0) { }
+
+void TimeWarp::setWarp(double warp) {
+
+	Warp = fmin(fmax(warp, WARP_MIN), WARP_MAX);
+}
+
+/*
+ * The steps that fit are counted from at most one tick of wall time, so a stall of the thread does not turn into a
+ * burst that stalls it again. Until the cost of a step is known a single step measures it
+ */
+void TimeWarp::plan(double seconds, unsigned long long &steps, double &dt) {
+
+	elapsed = seconds;
+	wanted = Warp * seconds + debt;
+	double affordable = StepCost > 0.0 ? floor(Budget * fmin(seconds, Tick) / StepCost) : 1.0;
+	affordable = fmax(affordable, 1.0);
+
+	size = Step;
+	if (wanted > affordable * Step)
+		size = fmin(LargestStep, wanted / affordable);
+	count = (unsigned long long)fmin(floor(wanted / size), affordable);
+
+	steps = count;
+	dt = size;
+}
+
+/*
+ * Less than a step left over is owed to the next tick, anything more means the steps did not fit and is dropped. The
+ * tick that measured the first step only took that one step, so its rest is owed as well instead of counting as lag the
+ * machine never had
+ */
+void TimeWarp::taken(double seconds) {
+
+	bool measuring = StepCost == 0.0;
+	if (count > 0)
+		StepCost = StepCost > 0.0 ? StepCost + WARP_SMOOTHING * (seconds / count - StepCost) : seconds / count;
+
+	double rest = wanted - count * size;
+	if (rest < size || measuring)
+		debt = rest;
+	else {
+		Lag += rest;
+		debt = 0.0;
+	}
+
+	if (elapsed > 0.0)
+		Achieved += WARP_SMOOTHING * (count * size / elapsed - Achieved);
+}
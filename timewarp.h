@@ -0,0 +1,56 @@
+#pragma once
+
+#ifndef TIMEWARP_H
+#define TIMEWARP_H
+
+// Slowest and fastest warp, simulated time per wall-clock time
+const double WARP_MIN = 1.0;
+const double WARP_MAX = 1.0e7;
+// Planning ticks per second of wall time
+const double WARP_TICK_RATE = 120.0;
+// Fraction of a tick the steps may take, the rest of the core is left to the renderer
+const double WARP_BUDGET = 0.5;
+// Largest step as a multiple of the base step, the accuracy given up before the warp is capped
+const double WARP_STEP_GROWTH = 16.0;
+// Weight of the newest tick in the averages of the step cost and the warp reached
+const double WARP_SMOOTHING = 0.1;
+
+// Decides how many steps of which size to take in every tick of wall time, so that simulated time runs at the requested
+// warp. The steps keep to the base step while they fit into the budget, then grow up to the largest step. Beyond that
+// the warp is capped: the time that did not fit is dropped and counted as lag rather than owed, so a warp the machine
+// cannot reach never builds up a backlog
+class TimeWarp
+{
+public:
+	// Constructor, step is the base step of the simulation
+	TimeWarp(double step);
+
+	// Requested warp, clamped to WARP_MIN and WARP_MAX by setWarp()
+	double Warp;
+	// Base and largest step
+	double Step, LargestStep;
+	// Wall seconds of a tick, and the fraction of it the steps may take
+	double Tick, Budget;
+	// Average wall seconds per step, 0 before the first measurement
+	double StepCost;
+	// Average warp reached, and the simulated time dropped because it did not fit into the budget
+	double Achieved, Lag;
+
+	// Change the requested warp
+	void setWarp(double warp);
+
+	// Number and size of the steps for the given wall seconds since the last tick
+	void plan(double elapsed, unsigned long long &count, double &dt);
+
+	// Report the wall seconds that the planned steps took
+	void taken(double seconds);
+
+private:
+	// Simulated time owed to the schedule, less than one step or the rest of the tick that measured the first step, and
+	// the plan of the current tick
+	double debt;
+	double wanted, elapsed, size;
+	unsigned long long count;
+};
+
+#endif
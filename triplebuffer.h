@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Lock-free single producer, single consumer triple buffer. The writer fills its back slot and swaps it with the middle
+// slot, the reader swaps its front slot with the middle slot when that holds a newer value. Neither side ever waits,
+// and the reader always sees the most recently published complete value
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : back(0), middle(1), front(2) { }
+
+	// Slot the writer fills before publish()
+	T &write() { return slots[back]; }
+
+	// Hand the written slot to the reader
+	void publish()
+	{
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Most recently published value. Stays valid and unchanged until the next call
+	const T &read()
+	{
+		if (middle.load(std::memory_order_relaxed) & FRESH)
+			front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return slots[front];
+	}
+
+private:
+	// The middle index carries a flag that is set while it holds a value the reader has not taken yet
+	static const unsigned INDEX = 3;
+	static const unsigned FRESH = 4;
+
+	T slots[3];
+	unsigned back;
+	std::atomic<unsigned> middle;
+	unsigned front;
+
+	TripleBuffer(const TripleBuffer &);
+	TripleBuffer &operator=(const TripleBuffer &);
+};
+
+#endif